@@ -0,0 +1,390 @@
+#pragma once
+
+//Command line runner for the benchmarks.
+//Each bench is a function which measures all of its variants once for a given number of threads
+// and reports the results through bench_report. The runner calls it for every thread count and repeat
+// and prints one record per variant as text, CSV or JSON so that runs can be compared.
+//
+// --bench=name[,name...]   "all" runs everything, without --bench the benches are listed
+// --threads=N or A..B      default 1..hardware threads
+// --seconds=S              wall time of a single measurement, default 1
+// --repeats=R              default 1
+// --item-size=B            for benches that support it, the rest report the size they use. Default 8
+// --format=text|csv|json   default text
+// --sample-every=N         latency benches time every Nth operation, default 1 (all of them)
+//
+//On linux: g++ -std=c++17 -O2 main.cpp -o blog_pools -lpthread && ./blog_pools --bench=all --format=csv
+
+#include "_test_chase_lev_queue.h"
+
+#include <string.h>
+#include <math.h>
+
+enum {BENCH_RUNNER_MAX_THREADS = 64}; //the benches use fixed size thread arrays of this size
+
+typedef enum Bench_Format {
+    BENCH_FORMAT_TEXT,
+    BENCH_FORMAT_CSV,
+    BENCH_FORMAT_JSON,
+} Bench_Format;
+
+typedef struct Bench_Options {
+    const char* benches; //comma separated names or NULL
+    isize min_threads;
+    isize max_threads;
+    double seconds;
+    isize repeats;
+    isize item_size;
+    isize sample_every;
+    Bench_Format format;
+} Bench_Options;
+
+typedef struct Bench_Runner {
+    Bench_Options options;
+    const char* bench; //currently running
+    isize threads;
+    isize repeat;
+    isize records_count;
+} Bench_Runner;
+
+typedef void (*Bench_Func)(Bench_Runner* runner, isize threads);
+
+typedef struct Bench_Entry {
+    const char* name;
+    Bench_Func func;
+    isize min_threads; //thread counts below this are skipped
+    const char* description;
+} Bench_Entry;
+
+//HDR style histogram of latencies. A value lands in a bucket given by its highest set bit
+// and the BENCH_HIST_SUB_BITS bits below it so each bucket is at most 1/32 of its values wide
+// no matter the magnitude. Each thread records into its own and they get merged at the end.
+enum {
+    BENCH_HIST_SUB_BITS = 5,
+    BENCH_HIST_SUB_COUNT = 1 << BENCH_HIST_SUB_BITS,
+    BENCH_HIST_BUCKETS = (65 - BENCH_HIST_SUB_BITS) * BENCH_HIST_SUB_COUNT,
+};
+
+typedef struct Bench_Hist {
+    uint64_t count;
+    uint64_t max;
+    uint64_t counts[BENCH_HIST_BUCKETS];
+} Bench_Hist;
+
+CL_QUEUE_API_INLINE void bench_hist_record(Bench_Hist* hist, uint64_t value);
+CL_QUEUE_API void bench_hist_merge(Bench_Hist* into, const Bench_Hist* from);
+//Upper bound of the bucket holding the value below which percentile % of the values lie. 
+// Never more than the max value recorded.
+CL_QUEUE_API uint64_t bench_hist_percentile(const Bench_Hist* hist, double percentile);
+
+//Prints a single result of the currently running bench. item_size is the size actually used.
+void bench_report(Bench_Runner* runner, const char* variant, isize item_size, double ops_per_sec);
+//Same as bench_report but also prints p50/p99/p99.9/max of hist. ns_per_unit converts the recorded values to ns.
+void bench_report_latency(Bench_Runner* runner, const char* variant, isize item_size, double ops_per_sec, const Bench_Hist* hist, double ns_per_unit);
+//Returns false and prints why if argv is not valid
+bool bench_options_parse(Bench_Options* options, int argc, char** argv);
+//Parses argv, runs the selected benches and returns the exit code for main
+int bench_runner_main(const Bench_Entry* entries, isize entries_count, int argc, char** argv);
+
+#if defined(_MSC_VER)
+    #include <intrin.h>
+    static int32_t _bench_hist_highest_bit(uint64_t num)
+    {
+        unsigned long out = 0;
+        _BitScanReverse64(&out, (unsigned long long) num);
+        return (int32_t) out;
+    }
+#elif defined(__GNUC__) || defined(__clang__)
+    static int32_t _bench_hist_highest_bit(uint64_t num)
+    {
+        return 63 - __builtin_clzll((unsigned long long) num);
+    }
+#else
+    #error unsupported compiler!
+#endif
+
+CL_QUEUE_API_INLINE isize _bench_hist_index(uint64_t value)
+{
+    //values below BENCH_HIST_SUB_COUNT get a bucket each, 
+    // above that every power of two is split into BENCH_HIST_SUB_COUNT buckets
+    if(value < BENCH_HIST_SUB_COUNT)
+        return (isize) value;
+
+    int32_t shift = _bench_hist_highest_bit(value) - BENCH_HIST_SUB_BITS;
+    uint64_t top = value >> shift; //in [SUB_COUNT, 2*SUB_COUNT)
+    return (isize) (shift + 1)*BENCH_HIST_SUB_COUNT + (isize) (top - BENCH_HIST_SUB_COUNT);
+}
+
+CL_QUEUE_API_INLINE uint64_t _bench_hist_bucket_max(isize index)
+{
+    if(index < BENCH_HIST_SUB_COUNT)
+        return (uint64_t) index;
+
+    int32_t shift = (int32_t) (index/BENCH_HIST_SUB_COUNT - 1);
+    uint64_t top = (uint64_t) (index % BENCH_HIST_SUB_COUNT + BENCH_HIST_SUB_COUNT);
+    return ((top + 1) << shift) - 1;
+}
+
+CL_QUEUE_API_INLINE void bench_hist_record(Bench_Hist* hist, uint64_t value)
+{
+    hist->counts[_bench_hist_index(value)] += 1;
+    hist->count += 1;
+    if(hist->max < value)
+        hist->max = value;
+}
+
+CL_QUEUE_API void bench_hist_merge(Bench_Hist* into, const Bench_Hist* from)
+{
+    for(isize i = 0; i < BENCH_HIST_BUCKETS; i++)
+        into->counts[i] += from->counts[i];
+    into->count += from->count;
+    if(into->max < from->max)
+        into->max = from->max;
+}
+
+CL_QUEUE_API uint64_t bench_hist_percentile(const Bench_Hist* hist, double percentile)
+{
+    if(hist->count == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t) ceil(percentile/100*(double) hist->count);
+    if(rank < 1)
+        rank = 1;
+
+    uint64_t seen = 0;
+    for(isize i = 0; i < BENCH_HIST_BUCKETS; i++)
+    {
+        seen += hist->counts[i];
+        if(seen >= rank)
+        {
+            uint64_t bucket_max = _bench_hist_bucket_max(i);
+            return bucket_max < hist->max ? bucket_max : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+static void _bench_report(Bench_Runner* runner, const char* variant, isize item_size, double ops_per_sec, const Bench_Hist* hist, double ns_per_unit)
+{
+    //percentiles in ns, left empty (or out) for throughput only records
+    double p[4] = {0};
+    if(hist)
+    {
+        p[0] = (double) bench_hist_percentile(hist, 50)*ns_per_unit;
+        p[1] = (double) bench_hist_percentile(hist, 99)*ns_per_unit;
+        p[2] = (double) bench_hist_percentile(hist, 99.9)*ns_per_unit;
+        p[3] = (double) hist->max*ns_per_unit;
+    }
+
+    Bench_Format format = runner->options.format;
+    if(format == BENCH_FORMAT_CSV)
+    {
+        if(runner->records_count == 0)
+            printf("bench,variant,threads,item_size,repeat,seconds,ops_per_sec,p50_ns,p99_ns,p999_ns,max_ns\n");
+        printf("%s,%s,%lli,%lli,%lli,%.3lf,%.0lf", runner->bench, variant, runner->threads, item_size, runner->repeat, runner->options.seconds, ops_per_sec);
+        if(hist)
+            printf(",%.1lf,%.1lf,%.1lf,%.1lf\n", p[0], p[1], p[2], p[3]);
+        else
+            printf(",,,,\n");
+    }
+    else if(format == BENCH_FORMAT_JSON)
+    {
+        printf("%s\n  {\"bench\":\"%s\",\"variant\":\"%s\",\"threads\":%lli,\"item_size\":%lli,\"repeat\":%lli,\"seconds\":%.3lf,\"ops_per_sec\":%.0lf",
+            runner->records_count == 0 ? "[" : ",", runner->bench, variant, runner->threads, item_size, runner->repeat, runner->options.seconds, ops_per_sec);
+        if(hist)
+            printf(",\"p50_ns\":%.1lf,\"p99_ns\":%.1lf,\"p999_ns\":%.1lf,\"max_ns\":%.1lf", p[0], p[1], p[2], p[3]);
+        printf("}");
+    }
+    else
+    {
+        printf("%-16s %-24s threads:%2lli item:%4lli repeat:%2lli %9.2lf M/s", runner->bench, variant, runner->threads, item_size, runner->repeat, ops_per_sec*1e-6);
+        if(hist)
+            printf(" p50:%7.1lf p99:%8.1lf p99.9:%9.1lf max:%10.1lf ns", p[0], p[1], p[2], p[3]);
+        printf("\n");
+    }
+
+    runner->records_count += 1;
+    fflush(stdout);
+}
+
+void bench_report(Bench_Runner* runner, const char* variant, isize item_size, double ops_per_sec)
+{
+    _bench_report(runner, variant, item_size, ops_per_sec, NULL, 0);
+}
+
+void bench_report_latency(Bench_Runner* runner, const char* variant, isize item_size, double ops_per_sec, const Bench_Hist* hist, double ns_per_unit)
+{
+    _bench_report(runner, variant, item_size, ops_per_sec, hist, ns_per_unit);
+}
+
+static bool _bench_parse_int(const char* str, isize* out)
+{
+    char* end = NULL;
+    long long val = strtoll(str, &end, 10);
+    *out = (isize) val;
+    return end != str && *end == '\0';
+}
+
+static const char* _bench_option_value(const char* arg, const char* name)
+{
+    size_t len = strlen(name);
+    if(strncmp(arg, name, len) == 0 && arg[len] == '=')
+        return arg + len + 1;
+    return NULL;
+}
+
+bool bench_options_parse(Bench_Options* options, int argc, char** argv)
+{
+    #ifdef __cplusplus
+    isize hardware_threads = (isize) std::thread::hardware_concurrency();
+    #else
+    isize hardware_threads = 1;
+    #endif
+    options->benches = NULL;
+    options->min_threads = 1;
+    options->max_threads = hardware_threads > 0 ? hardware_threads : 1;
+    options->seconds = 1;
+    options->repeats = 1;
+    options->item_size = 8;
+    options->sample_every = 1;
+    options->format = BENCH_FORMAT_TEXT;
+
+    for(int i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        const char* value = NULL;
+        bool ok = true;
+        if((value = _bench_option_value(arg, "--bench")) != NULL)
+            options->benches = value;
+        else if((value = _bench_option_value(arg, "--threads")) != NULL)
+        {
+            const char* dots = strstr(value, "..");
+            if(dots == NULL)
+            {
+                ok = _bench_parse_int(value, &options->min_threads);
+                options->max_threads = options->min_threads;
+            }
+            else
+            {
+                char first[32] = {0};
+                size_t first_len = (size_t) (dots - value);
+                ok = first_len < sizeof first;
+                if(ok)
+                {
+                    memcpy(first, value, first_len);
+                    ok = _bench_parse_int(first, &options->min_threads) && _bench_parse_int(dots + 2, &options->max_threads);
+                }
+            }
+            ok = ok && 1 <= options->min_threads && options->min_threads <= options->max_threads;
+        }
+        else if((value = _bench_option_value(arg, "--seconds")) != NULL)
+        {
+            char* end = NULL;
+            options->seconds = strtod(value, &end);
+            ok = end != value && *end == '\0' && options->seconds > 0;
+        }
+        else if((value = _bench_option_value(arg, "--repeats")) != NULL)
+            ok = _bench_parse_int(value, &options->repeats) && options->repeats > 0;
+        else if((value = _bench_option_value(arg, "--item-size")) != NULL)
+            ok = _bench_parse_int(value, &options->item_size) && options->item_size > 0;
+        else if((value = _bench_option_value(arg, "--sample-every")) != NULL)
+            ok = _bench_parse_int(value, &options->sample_every) && options->sample_every > 0;
+        else if((value = _bench_option_value(arg, "--format")) != NULL)
+        {
+            if(strcmp(value, "text") == 0)
+                options->format = BENCH_FORMAT_TEXT;
+            else if(strcmp(value, "csv") == 0)
+                options->format = BENCH_FORMAT_CSV;
+            else if(strcmp(value, "json") == 0)
+                options->format = BENCH_FORMAT_JSON;
+            else
+                ok = false;
+        }
+        else
+            ok = false;
+
+        if(ok == false)
+        {
+            fprintf(stderr, "invalid argument: %s\n", arg);
+            return false;
+        }
+    }
+
+    if(options->max_threads > BENCH_RUNNER_MAX_THREADS)
+        options->max_threads = BENCH_RUNNER_MAX_THREADS;
+    if(options->min_threads > options->max_threads)
+        options->min_threads = options->max_threads;
+    return true;
+}
+
+//true if name is one of the comma separated names in list
+static bool _bench_is_selected(const char* list, const char* name)
+{
+    size_t len = strlen(name);
+    for(const char* at = list; *at; )
+    {
+        const char* comma = strchr(at, ',');
+        size_t item_len = comma ? (size_t) (comma - at) : strlen(at);
+        if((item_len == len && strncmp(at, name, len) == 0) || (item_len == 3 && strncmp(at, "all", 3) == 0))
+            return true;
+        if(comma == NULL)
+            break;
+        at = comma + 1;
+    }
+    return false;
+}
+
+int bench_runner_main(const Bench_Entry* entries, isize entries_count, int argc, char** argv)
+{
+    Bench_Runner runner = {0};
+    if(bench_options_parse(&runner.options, argc, argv) == false)
+        return 1;
+
+    if(runner.options.benches == NULL)
+    {
+        printf("usage: %s --bench=name[,name...]|all [--threads=N|A..B] [--seconds=S] [--repeats=R] [--item-size=B] [--sample-every=N] [--format=text|csv|json]\n", argv[0]);
+        for(isize i = 0; i < entries_count; i++)
+            printf("  %-20s %s\n", entries[i].name, entries[i].description);
+        return 0;
+    }
+
+    for(const char* at = runner.options.benches; *at; )
+    {
+        const char* comma = strchr(at, ',');
+        size_t len = comma ? (size_t) (comma - at) : strlen(at);
+        bool found = len == 3 && strncmp(at, "all", 3) == 0;
+        for(isize i = 0; i < entries_count && found == false; i++)
+            found = strlen(entries[i].name) == len && strncmp(at, entries[i].name, len) == 0;
+
+        if(found == false)
+        {
+            fprintf(stderr, "unknown bench: %.*s\n", (int) len, at);
+            return 1;
+        }
+        if(comma == NULL)
+            break;
+        at = comma + 1;
+    }
+
+    for(isize i = 0; i < entries_count; i++)
+    {
+        if(_bench_is_selected(runner.options.benches, entries[i].name) == false)
+            continue;
+
+        runner.bench = entries[i].name;
+        isize min_threads = runner.options.min_threads;
+        if(min_threads < entries[i].min_threads)
+            min_threads = entries[i].min_threads;
+        for(isize threads = min_threads; threads <= runner.options.max_threads; threads++)
+            for(isize repeat = 0; repeat < runner.options.repeats; repeat++)
+            {
+                runner.threads = threads;
+                runner.repeat = repeat;
+                entries[i].func(&runner, threads);
+            }
+    }
+
+    if(runner.options.format == BENCH_FORMAT_JSON)
+        printf(runner.records_count ? "\n]\n" : "[]\n");
+    return 0;
+}
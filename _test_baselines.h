@@ -0,0 +1,575 @@
+#pragma once
+
+//Reference pools LC_Pool is compared against, run through the same scenarios as bench_lc_pool:
+// - std::mutex + std::deque
+// - spin lock (test and test and set) + std::deque
+// - Vyukov bounded MPMC ring (sequence number per cell)
+// - Michael-Scott queue with nodes freed through hazard pointers
+//All of them are a single shared structure so the "self" and "others" pops of LC_Pool are
+// the same pop here. The deques pop from the back (like the owner of a CL_Queue), the rest are FIFO.
+//The ring is sized like the queues of LC_Pool are reserved in run_bench_lc_pool and fails pushes
+// once full. The rest grow without bounds so N push 1 pop can take a lot of memory on many cores.
+
+#include "hazard_ptr.h"
+#include "sync_stacks.h"
+#include "_test_pools.h"
+
+#include <mutex>
+#include <deque>
+
+typedef enum Bench_Baseline_Kind {
+    BENCH_BASELINE_LC_POOL, //not a baseline but its convenient to run it through the same function
+    BENCH_BASELINE_MUTEX_DEQUE,
+    BENCH_BASELINE_SPIN_DEQUE,
+    BENCH_BASELINE_VYUKOV_RING,
+    BENCH_BASELINE_MS_QUEUE,
+    BENCH_BASELINE_KIND_COUNT,
+} Bench_Baseline_Kind;
+
+typedef enum Bench_Baseline_Scenario {
+    BENCH_BASELINE_PING_PONG,
+    BENCH_BASELINE_50_50,
+    BENCH_BASELINE_1_PUSH_N_POP,
+    BENCH_BASELINE_N_PUSH_1_POP,
+    BENCH_BASELINE_SCENARIO_COUNT,
+} Bench_Baseline_Scenario;
+
+static const char* bench_baseline_kind_names[BENCH_BASELINE_KIND_COUNT] = {"lc_pool", "mutex_deque", "spin_deque", "vyukov_ring", "ms_queue"};
+static const char* bench_baseline_scenario_names[BENCH_BASELINE_SCENARIO_COUNT] = {"ping/pong", "50/50", "1 push N pop", "N push 1 pop"};
+
+enum {BENCH_BASELINE_CAPACITY = 1024*1024*2};
+
+typedef struct Bench_Ring_Cell {
+    CL_QUEUE_ATOMIC(uint64_t) sequence;
+    isize value;
+} Bench_Ring_Cell;
+
+typedef struct Bench_Ring {
+    alignas(64)
+    CL_QUEUE_ATOMIC(uint64_t) push_pos;
+    alignas(64)
+    CL_QUEUE_ATOMIC(uint64_t) pop_pos;
+    alignas(64)
+    Bench_Ring_Cell* cells;
+    uint64_t mask;
+} Bench_Ring;
+
+typedef struct Bench_MS_Node {
+    CL_QUEUE_ATOMIC(void*) next;
+    isize value;
+} Bench_MS_Node;
+
+typedef struct Bench_MS_Queue {
+    alignas(64)
+    CL_QUEUE_ATOMIC(void*) head; //Bench_MS_Node*, always points to a dummy
+    alignas(64)
+    CL_QUEUE_ATOMIC(void*) tail;
+    Hazard_Domain hazards;
+} Bench_MS_Queue;
+
+typedef struct Bench_Baseline {
+    Bench_Baseline_Kind kind;
+    alignas(64)
+    std::mutex mutex;
+    CL_QUEUE_ATOMIC(uint32_t) spin_lock;
+    std::deque<isize> deque;
+    Bench_Ring ring;
+    Bench_MS_Queue ms_queue;
+} Bench_Baseline;
+
+static void bench_baseline_init(Bench_Baseline* pool, Bench_Baseline_Kind kind, isize capacity)
+{
+    pool->kind = kind;
+    atomic_store(&pool->spin_lock, 0);
+
+    uint64_t ring_capacity = 1;
+    while(ring_capacity < (uint64_t) capacity)
+        ring_capacity *= 2;
+    pool->ring.mask = ring_capacity - 1;
+    pool->ring.cells = (Bench_Ring_Cell*) calloc((size_t) ring_capacity, sizeof(Bench_Ring_Cell));
+    for(uint64_t i = 0; i < ring_capacity; i++)
+        atomic_store_explicit(&pool->ring.cells[i].sequence, i, memory_order_relaxed);
+    atomic_store(&pool->ring.push_pos, (uint64_t) 0);
+    atomic_store(&pool->ring.pop_pos, (uint64_t) 0);
+
+    Bench_MS_Node* dummy = (Bench_MS_Node*) calloc(1, sizeof(Bench_MS_Node));
+    atomic_store(&pool->ms_queue.head, (void*) dummy);
+    atomic_store(&pool->ms_queue.tail, (void*) dummy);
+    hazard_domain_init(&pool->ms_queue.hazards);
+}
+
+static void bench_baseline_deinit(Bench_Baseline* pool)
+{
+    free(pool->ring.cells);
+    for(Bench_MS_Node* node = (Bench_MS_Node*) atomic_load(&pool->ms_queue.head); node; )
+    {
+        Bench_MS_Node* next = (Bench_MS_Node*) atomic_load(&node->next);
+        free(node);
+        node = next;
+    }
+    hazard_domain_deinit(&pool->ms_queue.hazards);
+    pool->deque.clear();
+}
+
+CL_QUEUE_API_INLINE void bench_spin_lock(CL_QUEUE_ATOMIC(uint32_t)* lock)
+{
+    while(atomic_exchange_explicit(lock, 1, memory_order_acquire) != 0)
+        while(atomic_load_explicit(lock, memory_order_relaxed) != 0)
+            _sync_pause();
+}
+
+CL_QUEUE_API_INLINE void bench_spin_unlock(CL_QUEUE_ATOMIC(uint32_t)* lock)
+{
+    atomic_store_explicit(lock, 0, memory_order_release);
+}
+
+//Cell i is free for the push at position pos when its sequence is pos
+// and full for the pop at pos when its pos + 1. The pop sets it to pos + capacity.
+CL_QUEUE_API_INLINE bool bench_ring_push(Bench_Ring* ring, isize value)
+{
+    uint64_t pos = atomic_load_explicit(&ring->push_pos, memory_order_relaxed);
+    Bench_Ring_Cell* cell = NULL;
+    for(;;) {
+        cell = &ring->cells[pos & ring->mask];
+        uint64_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        int64_t diff = (int64_t) (sequence - pos);
+        if(diff == 0) {
+            if(atomic_compare_exchange_weak_explicit(&ring->push_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if(diff < 0)
+            return false;
+        else
+            pos = atomic_load_explicit(&ring->push_pos, memory_order_relaxed);
+    }
+
+    cell->value = value;
+    atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+    return true;
+}
+
+CL_QUEUE_API_INLINE bool bench_ring_pop(Bench_Ring* ring, isize* value)
+{
+    uint64_t pos = atomic_load_explicit(&ring->pop_pos, memory_order_relaxed);
+    Bench_Ring_Cell* cell = NULL;
+    for(;;) {
+        cell = &ring->cells[pos & ring->mask];
+        uint64_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        int64_t diff = (int64_t) (sequence - (pos + 1));
+        if(diff == 0) {
+            if(atomic_compare_exchange_weak_explicit(&ring->pop_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+                break;
+        }
+        else if(diff < 0)
+            return false;
+        else
+            pos = atomic_load_explicit(&ring->pop_pos, memory_order_relaxed);
+    }
+
+    *value = cell->value;
+    atomic_store_explicit(&cell->sequence, pos + ring->mask + 1, memory_order_release);
+    return true;
+}
+
+static void bench_ms_node_free(void* node)
+{
+    free(node);
+}
+
+CL_QUEUE_API_INLINE void bench_ms_queue_push(Bench_MS_Queue* queue, Hazard_Thread* hazard, isize value)
+{
+    Bench_MS_Node* node = (Bench_MS_Node*) malloc(sizeof(Bench_MS_Node));
+    atomic_store_explicit(&node->next, (void*) NULL, memory_order_relaxed);
+    node->value = value;
+
+    for(;;) {
+        Bench_MS_Node* tail = (Bench_MS_Node*) hazard_protect(hazard, 0, &queue->tail);
+        void* next = atomic_load_explicit(&tail->next, memory_order_acquire);
+        if(tail != atomic_load_explicit(&queue->tail, memory_order_acquire))
+            continue;
+
+        void* expected = (void*) tail;
+        if(next == NULL)
+        {
+            if(atomic_compare_exchange_weak_explicit(&tail->next, &next, (void*) node, memory_order_release, memory_order_relaxed))
+            {
+                atomic_compare_exchange_strong_explicit(&queue->tail, &expected, (void*) node, memory_order_release, memory_order_relaxed);
+                break;
+            }
+        }
+        else
+            //help the push which linked next but did not move the tail yet
+            atomic_compare_exchange_strong_explicit(&queue->tail, &expected, next, memory_order_release, memory_order_relaxed);
+    }
+    hazard_clear(hazard, 0);
+}
+
+CL_QUEUE_API_INLINE bool bench_ms_queue_pop(Bench_MS_Queue* queue, Hazard_Thread* hazard, isize* value)
+{
+    bool popped = false;
+    for(;;) {
+        Bench_MS_Node* head = (Bench_MS_Node*) hazard_protect(hazard, 0, &queue->head);
+        void* tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+        Bench_MS_Node* next = (Bench_MS_Node*) atomic_load_explicit(&head->next, memory_order_acquire);
+        //next is reachable (and so not freed) for as long as head is still the head
+        hazard_set(hazard, 1, next);
+        if(head != atomic_load_explicit(&queue->head, memory_order_acquire))
+            continue;
+        if(next == NULL)
+            break;
+
+        void* expected = (void*) head;
+        if((void*) head == tail)
+            atomic_compare_exchange_strong_explicit(&queue->tail, &expected, (void*) next, memory_order_release, memory_order_relaxed);
+        else
+        {
+            isize read = next->value;
+            if(atomic_compare_exchange_strong(&queue->head, &expected, (void*) next))
+            {
+                //next is the new dummy, the old one is unreachable
+                hazard_retire(&queue->hazards, hazard, head, bench_ms_node_free);
+                *value = read;
+                popped = true;
+                break;
+            }
+        }
+    }
+    hazard_clear(hazard, 0);
+    hazard_clear(hazard, 1);
+    return popped;
+}
+
+//hazard is only used by the MS queue and may be NULL for the rest
+CL_QUEUE_API_INLINE bool bench_baseline_push(Bench_Baseline* pool, Hazard_Thread* hazard, isize value)
+{
+    switch(pool->kind)
+    {
+        case BENCH_BASELINE_MUTEX_DEQUE: {
+            std::lock_guard<std::mutex> guard(pool->mutex);
+            pool->deque.push_back(value);
+            return true;
+        }
+        case BENCH_BASELINE_SPIN_DEQUE: {
+            bench_spin_lock(&pool->spin_lock);
+            pool->deque.push_back(value);
+            bench_spin_unlock(&pool->spin_lock);
+            return true;
+        }
+        case BENCH_BASELINE_VYUKOV_RING:
+            return bench_ring_push(&pool->ring, value);
+        default:
+            bench_ms_queue_push(&pool->ms_queue, hazard, value);
+            return true;
+    }
+}
+
+CL_QUEUE_API_INLINE bool bench_baseline_pop(Bench_Baseline* pool, Hazard_Thread* hazard, isize* value)
+{
+    switch(pool->kind)
+    {
+        case BENCH_BASELINE_MUTEX_DEQUE: {
+            std::lock_guard<std::mutex> guard(pool->mutex);
+            if(pool->deque.empty())
+                return false;
+            *value = pool->deque.back();
+            pool->deque.pop_back();
+            return true;
+        }
+        case BENCH_BASELINE_SPIN_DEQUE: {
+            bool popped = false;
+            bench_spin_lock(&pool->spin_lock);
+            if(pool->deque.empty() == false)
+            {
+                *value = pool->deque.back();
+                pool->deque.pop_back();
+                popped = true;
+            }
+            bench_spin_unlock(&pool->spin_lock);
+            return popped;
+        }
+        case BENCH_BASELINE_VYUKOV_RING:
+            return bench_ring_pop(&pool->ring, value);
+        default:
+            return bench_ms_queue_pop(&pool->ms_queue, hazard, value);
+    }
+}
+
+typedef struct Bench_Baseline_Thread {
+    CL_QUEUE_ATOMIC(isize)* started;
+    CL_QUEUE_ATOMIC(isize)* finished;
+    CL_QUEUE_ATOMIC(isize)* run_test;
+    Bench_Baseline* pool_a;
+    Bench_Baseline* pool_b;
+    Bench_Baseline_Scenario scenario;
+    bool is_push;
+    isize index;
+    uint64_t iters;
+    uint64_t ops;
+} Bench_Baseline_Thread;
+
+//Same loops as bench_lc_pool_ping_pong_thread_func, bench_lc_pool_50_50_thread_func
+// and bench_lc_pool_asymetric_thread_func
+static void bench_baseline_thread_func(void* arg)
+{
+    Bench_Baseline_Thread* thread = (Bench_Baseline_Thread*) arg;
+    Bench_Baseline* pool_a = thread->pool_a;
+    Bench_Baseline* pool_b = thread->pool_b;
+    Hazard_Thread* hazard_a = hazard_thread_acquire(&pool_a->ms_queue.hazards);
+    Hazard_Thread* hazard_b = hazard_thread_acquire(&pool_b->ms_queue.hazards);
+    atomic_fetch_add(thread->started, 1);
+
+    //wait to run
+    while(*thread->run_test == 0);
+
+    uint64_t iters = 0;
+    uint64_t ops = 0;
+    isize item = 0;
+    if(thread->scenario == BENCH_BASELINE_PING_PONG)
+    {
+        Bench_Baseline* from = thread->is_push ? pool_a : pool_b;
+        Bench_Baseline* to = thread->is_push ? pool_b : pool_a;
+        Hazard_Thread* from_hazard = thread->is_push ? hazard_a : hazard_b;
+        Hazard_Thread* to_hazard = thread->is_push ? hazard_b : hazard_a;
+        for(; atomic_load_explicit(thread->run_test, memory_order_relaxed) == 1; iters += 2) {
+            ops += bench_baseline_pop(from, from_hazard, &item);
+            ops += bench_baseline_push(to, to_hazard, item);
+        }
+    }
+    else if(thread->scenario == BENCH_BASELINE_50_50)
+    {
+        uint64_t random_mask = 0xE0349F24ABC58B2F;
+        for(; atomic_load_explicit(thread->run_test, memory_order_relaxed) == 1; iters += 1)
+        {
+            uint64_t bit_i = ((uint64_t) thread->index + iters) % 64;
+            if(random_mask & ((uint64_t) 1 << bit_i))
+                ops += bench_baseline_push(pool_a, hazard_a, item);
+            else
+                ops += bench_baseline_pop(pool_a, hazard_a, &item);
+        }
+    }
+    else if(thread->is_push)
+    {
+        for(; atomic_load_explicit(thread->run_test, memory_order_relaxed) == 1;)
+            bench_baseline_push(pool_a, hazard_a, item);
+    }
+    else
+    {
+        for(; atomic_load_explicit(thread->run_test, memory_order_relaxed) == 1; iters += 1)
+        {
+            ops += bench_baseline_pop(pool_a, hazard_a, &item);
+            for(int i = 0; i < 30; i++)
+                _sync_pause();
+        }
+    }
+
+    thread->iters = iters;
+    thread->ops = ops;
+    hazard_thread_release(&pool_a->ms_queue.hazards, hazard_a);
+    hazard_thread_release(&pool_b->ms_queue.hazards, hazard_b);
+    atomic_fetch_add(thread->finished, 1);
+}
+
+//the first a_count threads push (or ping), the rest pop (or pong)
+static isize bench_baseline_a_count(Bench_Baseline_Scenario scenario, isize threads_count)
+{
+    switch(scenario)
+    {
+        case BENCH_BASELINE_1_PUSH_N_POP: return 1;
+        case BENCH_BASELINE_N_PUSH_1_POP: return threads_count - 1;
+        default:                          return threads_count/2;
+    }
+}
+
+static Bench_Pool_Result bench_baseline_single(Bench_Baseline_Kind kind, Bench_Baseline_Scenario scenario, isize threads_count, double time)
+{
+    isize a_count = bench_baseline_a_count(scenario, threads_count);
+    isize b_count = threads_count - a_count;
+    if(kind == BENCH_BASELINE_LC_POOL)
+    {
+        void (*funcs[BENCH_BASELINE_SCENARIO_COUNT])(void*) = {bench_lc_pool_ping_pong_thread_func, bench_lc_pool_50_50_thread_func, bench_lc_pool_asymetric_thread_func, bench_lc_pool_asymetric_thread_func};
+        return bench_lc_pool_single(0, false, BENCH_BASELINE_CAPACITY, a_count, b_count, time, funcs[scenario]);
+    }
+
+    //contains std::mutex and std::deque so cannot be zero initialized
+    Bench_Baseline* pool_a = new Bench_Baseline;
+    Bench_Baseline* pool_b = new Bench_Baseline;
+    bench_baseline_init(pool_a, kind, BENCH_BASELINE_CAPACITY);
+    bench_baseline_init(pool_b, kind, BENCH_BASELINE_CAPACITY);
+
+    CL_QUEUE_ATOMIC(isize) started = 0;
+    CL_QUEUE_ATOMIC(isize) finished = 0;
+    CL_QUEUE_ATOMIC(isize) run_test = 0;
+    Bench_Baseline_Thread threads[TEST_MAX_THREADS] = {0};
+    for(isize i = 0; i < threads_count; i++)
+    {
+        threads[i].started = &started;
+        threads[i].finished = &finished;
+        threads[i].run_test = &run_test;
+        threads[i].pool_a = pool_a;
+        threads[i].pool_b = pool_b;
+        threads[i].scenario = scenario;
+        threads[i].is_push = i < a_count;
+        threads[i].index = i;
+        test_cl_launch_thread(bench_baseline_thread_func, &threads[i]);
+    }
+
+    Bench_Pool_Result result = {0};
+    {
+        while(started != threads_count);
+        run_test = 1;
+        int64_t before = test_cl_clock_ns();
+        test_cl_sleep_thread(time);
+        run_test = 2;
+        int64_t after = test_cl_clock_ns();
+        while(finished != threads_count);
+        result.time = (double)(after - before)*1e-9;
+    }
+
+    result.a_count = a_count;
+    result.b_count = b_count;
+    result.repeats = 1;
+    for(isize i = 0; i < threads_count; i++)
+    {
+        result.tries += threads[i].iters;
+        result.ops += threads[i].ops;
+    }
+
+    bench_baseline_deinit(pool_a);
+    bench_baseline_deinit(pool_b);
+    delete pool_a;
+    delete pool_b;
+    return result;
+}
+
+//Prints a table per scenario with a column per implementation
+void bench_baselines(double time, isize max_threads)
+{
+    if(max_threads > TEST_MAX_THREADS)
+        max_threads = TEST_MAX_THREADS;
+
+    for(isize scenario = 0; scenario < BENCH_BASELINE_SCENARIO_COUNT; scenario++)
+    {
+        printf("%-14s threads", bench_baseline_scenario_names[scenario]);
+        for(isize kind = 0; kind < BENCH_BASELINE_KIND_COUNT; kind++)
+            printf(" %12s", bench_baseline_kind_names[kind]);
+        printf(" (millions/s)\n");
+
+        for(isize threads = 2; threads <= max_threads; threads++)
+        {
+            printf("%-14s %7lli", "", threads);
+            for(isize kind = 0; kind < BENCH_BASELINE_KIND_COUNT; kind++)
+            {
+                Bench_Pool_Result res = bench_baseline_single((Bench_Baseline_Kind) kind, (Bench_Baseline_Scenario) scenario, threads, time);
+                printf(" %12.2lf", (double) res.ops/(res.time*1e6));
+            }
+            printf("\n");
+        }
+    }
+}
+
+typedef struct Test_Baseline_Thread {
+    CL_QUEUE_ATOMIC(isize)* started;
+    CL_QUEUE_ATOMIC(isize)* run_test;
+    Bench_Baseline* pool;
+    isize index;
+    isize pushed_sum;
+    isize popped_sum;
+    isize pushed_count;
+    isize popped_count;
+} Test_Baseline_Thread;
+
+static void test_baseline_thread_func(void* arg)
+{
+    Test_Baseline_Thread* thread = (Test_Baseline_Thread*) arg;
+    Hazard_Thread* hazard = hazard_thread_acquire(&thread->pool->ms_queue.hazards);
+    atomic_fetch_add(thread->started, 1);
+    while(*thread->run_test == 0);
+
+    uint64_t random = (uint64_t) thread->index*0x9E3779B97F4A7C15 + 1;
+    for(isize iter = 0; atomic_load_explicit(thread->run_test, memory_order_relaxed) == 1; iter++)
+    {
+        random = random*6364136223846793005 + 1442695040888963407;
+        isize item = 0;
+        if((random >> 40) % 2)
+        {
+            item = thread->index*((isize) 1 << 40) + iter + 1;
+            if(bench_baseline_push(thread->pool, hazard, item))
+            {
+                thread->pushed_sum += item;
+                thread->pushed_count += 1;
+            }
+        }
+        else if(bench_baseline_pop(thread->pool, hazard, &item))
+        {
+            TEST(item != 0);
+            thread->popped_sum += item;
+            thread->popped_count += 1;
+        }
+    }
+
+    hazard_thread_release(&thread->pool->ms_queue.hazards, hazard);
+    atomic_fetch_add(thread->started, -1);
+}
+
+//Every pushed item is popped exactly once: sums of pushed and popped (plus what is left) match
+void test_baseline_concurrent(Bench_Baseline_Kind kind, double time, isize threads_count, isize capacity)
+{
+    Bench_Baseline* pool = new Bench_Baseline;
+    bench_baseline_init(pool, kind, capacity);
+
+    CL_QUEUE_ATOMIC(isize) started = 0;
+    CL_QUEUE_ATOMIC(isize) run_test = 0;
+    Test_Baseline_Thread threads[TEST_MAX_THREADS] = {0};
+    for(isize i = 0; i < threads_count; i++)
+    {
+        threads[i].started = &started;
+        threads[i].run_test = &run_test;
+        threads[i].pool = pool;
+        threads[i].index = i;
+        test_cl_launch_thread(test_baseline_thread_func, &threads[i]);
+    }
+
+    while(started != threads_count);
+    run_test = 1;
+    test_cl_sleep_thread(time);
+    run_test = 2;
+    while(started != 0);
+
+    isize pushed_sum = 0;
+    isize popped_sum = 0;
+    isize pushed_count = 0;
+    isize popped_count = 0;
+    for(isize i = 0; i < threads_count; i++)
+    {
+        pushed_sum += threads[i].pushed_sum;
+        popped_sum += threads[i].popped_sum;
+        pushed_count += threads[i].pushed_count;
+        popped_count += threads[i].popped_count;
+    }
+
+    Hazard_Thread* hazard = hazard_thread_acquire(&pool->ms_queue.hazards);
+    for(isize item = 0; bench_baseline_pop(pool, hazard, &item); )
+    {
+        popped_sum += item;
+        popped_count += 1;
+    }
+    hazard_thread_release(&pool->ms_queue.hazards, hazard);
+
+    TEST(pushed_count == popped_count);
+    TEST(pushed_sum == popped_sum);
+
+    bench_baseline_deinit(pool);
+    delete pool;
+}
+
+void test_baselines(double time, isize max_threads)
+{
+    if(max_threads > TEST_MAX_THREADS)
+        max_threads = TEST_MAX_THREADS;
+
+    //small ring so that it gets full often
+    isize capacities[BENCH_BASELINE_KIND_COUNT] = {0, 1 << 20, 1 << 20, 16, 1 << 20};
+    for(isize kind = BENCH_BASELINE_MUTEX_DEQUE; kind < BENCH_BASELINE_KIND_COUNT; kind++)
+        for(isize i = 1; i <= max_threads; i++)
+            test_baseline_concurrent((Bench_Baseline_Kind) kind, time/(max_threads*(BENCH_BASELINE_KIND_COUNT - 1)), i, capacities[kind]);
+}
@@ -102,8 +102,23 @@ typedef struct Test_CL_Thread {
 static int  test_cl_isize_comp_func(const void* a, const void* b);
 static void test_cl_launch_thread(void (*func)(void*), void* context);
 static void test_cl_buffer_push(Test_CL_Buffer* buffer, isize* val, isize count);
+static bool test_cl_pin_thread(isize cpu);
+static double test_cl_process_cpu_seconds();
+static int64_t test_cl_available_memory();
 int64_t test_cl_clock_ns();
 
+//Benches check their deadline only once per this many iterations so that reading the clock
+// does not show up in the numbers
+enum {TEST_CL_DEADLINE_EVERY = 64};
+
+//Cheap clock for deadline checks and timing single operations. rdtsc on x86 with an invariant TSC 
+// (constant rate, synchronized across cores) which costs a few ns, test_cl_clock_ns otherwise.
+static int64_t test_cl_ticks();
+//Calibrated against test_cl_clock_ns on first use (takes about 20ms)
+static double test_cl_ticks_per_sec();
+//test_cl_ticks() value seconds from now
+static int64_t test_cl_ticks_after(double seconds);
+
 static void test_chase_lev_producer_consumers_thread_func(void *arg)
 {
     Test_CL_Thread* thread = (Test_CL_Thread*) arg;
@@ -155,8 +170,8 @@ static void test_chase_lev_producer_consumers(isize reserve_size, isize consumer
         while(started != consumer_count);
         run_test = 1;
 
-        isize deadline = clock() + (isize)(time*CLOCKS_PER_SEC);
-        while(clock() < deadline)
+        int64_t deadline = test_cl_clock_ns() + (int64_t)(time*1e9);
+        while(test_cl_clock_ns() < deadline)
         {
             cl_queue_push(&queue, &produced_counter, sizeof(isize));
             produced_counter += 1;
@@ -268,10 +283,11 @@ static void bench_chase_lev_thread_func(void *arg)
     //wait to run
     while(*thread->run_test == 0); 
     
+    //in test_cl_ticks
     isize deadline = atomic_load_explicit(thread->deadline, memory_order_relaxed);
     //CL_QUEUE_ATOMIC(isize) dummy = 0;
     //run for as long as we can
-    while(test_cl_clock_ns() < deadline)
+    for(isize iter = 0; iter % TEST_CL_DEADLINE_EVERY != 0 || test_cl_ticks() < deadline; iter++)
     {
         isize val = 0;
         thread->ops += cl_queue_pop(thread->queue, &val, sizeof(isize));
@@ -327,11 +343,11 @@ static Bench_CL_Result bench_chase_lev_single(isize reserve_size, isize consumer
     {
         while(started != consumer_count);
 
-        isize local_deadline = test_cl_clock_ns() + (isize)(time * 1000*1000*1000);
+        isize local_deadline = test_cl_ticks_after(time);
         deadline = local_deadline; 
         run_test = 1;
 
-        for(; test_cl_clock_ns() < local_deadline; push_ops++)
+        for(; push_ops % TEST_CL_DEADLINE_EVERY != 0 || test_cl_ticks() < local_deadline; push_ops++)
             cl_queue_push(&queue, &push_ops, sizeof(isize));
 
         run_test = 2;
@@ -432,10 +448,11 @@ static int test_cl_isize_comp_func(const void* a, const void* b)
          std::thread(func, context).detach();
     }
     #include <chrono>
+    //steady so that deadlines dont jump when the system time gets adjusted
     int64_t test_cl_clock_ns()
     {
         using namespace std::chrono;
-        return duration_cast<nanoseconds>(system_clock::now().time_since_epoch()).count();
+        return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
     }
 
     static void test_cl_sleep_thread(double seconds_val)
@@ -485,3 +502,149 @@ static int test_cl_isize_comp_func(const void* a, const void* b)
         assert(error == 0);
     }
 #endif
+
+#if defined(_WIN32) || defined(_WIN64)
+    #include <Windows.h>
+    //pins the calling thread to the given cpu. Returns false if not supported
+    static bool test_cl_pin_thread(isize cpu)
+    {
+        return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR) 1 << cpu) != 0;
+    }
+
+    //cpu time used by all threads of this process
+    static double test_cl_process_cpu_seconds()
+    {
+        FILETIME creation, exit, kernel, user;
+        GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user);
+        uint64_t kernel_100ns = ((uint64_t) kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+        uint64_t user_100ns = ((uint64_t) user.dwHighDateTime << 32) | user.dwLowDateTime;
+        return (double) (kernel_100ns + user_100ns) / 1e7;
+    }
+
+    //physical memory free right now in bytes
+    static int64_t test_cl_available_memory()
+    {
+        MEMORYSTATUSEX status = {0};
+        status.dwLength = sizeof status;
+        if(GlobalMemoryStatusEx(&status) == false)
+            return INT64_MAX;
+        return (int64_t) status.ullAvailPhys;
+    }
+#elif defined(__linux__)
+    #include <pthread.h>
+    #include <sched.h>
+    static bool test_cl_pin_thread(isize cpu)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET((int) cpu, &set);
+        return pthread_setaffinity_np(pthread_self(), sizeof set, &set) == 0;
+    }
+
+    #include <sys/resource.h>
+    static double test_cl_process_cpu_seconds()
+    {
+        struct rusage usage = {0};
+        getrusage(RUSAGE_SELF, &usage);
+        return (double) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) 
+            + (double) (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec)/1e6;
+    }
+
+    #include <unistd.h>
+    static int64_t test_cl_available_memory()
+    {
+        long pages = sysconf(_SC_AVPHYS_PAGES);
+        long page_size = sysconf(_SC_PAGESIZE);
+        if(pages < 0 || page_size < 0)
+            return INT64_MAX;
+        return (int64_t) pages * page_size;
+    }
+#else
+    static bool test_cl_pin_thread(isize cpu)
+    {
+        (void) cpu;
+        return false;
+    }
+
+    static double test_cl_process_cpu_seconds()
+    {
+        return (double) clock() / CLOCKS_PER_SEC;
+    }
+
+    static int64_t test_cl_available_memory()
+    {
+        return INT64_MAX;
+    }
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    #include <intrin.h>
+    #define TEST_CL_HAS_RDTSC
+    static bool _test_cl_cpu_invariant_tsc()
+    {
+        int info[4] = {0};
+        __cpuid(info, 0x80000000);
+        if((unsigned) info[0] < 0x80000007)
+            return false;
+        __cpuid(info, 0x80000007);
+        return (info[3] >> 8) & 1;
+    }
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    #include <x86intrin.h>
+    #include <cpuid.h>
+    #define TEST_CL_HAS_RDTSC
+    static bool _test_cl_cpu_invariant_tsc()
+    {
+        unsigned a = 0, b = 0, c = 0, d = 0;
+        if(__get_cpuid(0x80000007, &a, &b, &c, &d) == 0)
+            return false;
+        return (d >> 8) & 1;
+    }
+#endif
+
+//0 not checked yet, 1 rdtsc, 2 fallback
+static CL_QUEUE_ATOMIC(int32_t) _test_cl_ticks_source = 0;
+static CL_QUEUE_ATOMIC(int64_t) _test_cl_ticks_per_sec = 0;
+
+static int64_t test_cl_ticks()
+{
+    #ifdef TEST_CL_HAS_RDTSC
+        int32_t source = atomic_load_explicit(&_test_cl_ticks_source, memory_order_relaxed);
+        if(source == 0)
+        {
+            source = _test_cl_cpu_invariant_tsc() ? 1 : 2;
+            atomic_store_explicit(&_test_cl_ticks_source, source, memory_order_relaxed);
+        }
+        if(source == 1)
+            return (int64_t) __rdtsc();
+    #endif
+    return test_cl_clock_ns();
+}
+
+static double test_cl_ticks_per_sec()
+{
+    int64_t per_sec = atomic_load_explicit(&_test_cl_ticks_per_sec, memory_order_relaxed);
+    if(per_sec == 0)
+    {
+        test_cl_ticks();
+        if(atomic_load_explicit(&_test_cl_ticks_source, memory_order_relaxed) != 1)
+            per_sec = 1000*1000*1000;
+        else
+        {
+            int64_t ns_before = test_cl_clock_ns();
+            int64_t ticks_before = test_cl_ticks();
+            int64_t ns_after = ns_before;
+            while(ns_after - ns_before < 20*1000*1000)
+                ns_after = test_cl_clock_ns();
+            int64_t ticks_after = test_cl_ticks();
+            per_sec = (int64_t) ((double) (ticks_after - ticks_before)*1e9/(double) (ns_after - ns_before));
+        }
+        atomic_store_explicit(&_test_cl_ticks_per_sec, per_sec, memory_order_relaxed);
+    }
+    return (double) per_sec;
+}
+
+static int64_t test_cl_ticks_after(double seconds)
+{
+    return test_cl_ticks() + (int64_t) (seconds*test_cl_ticks_per_sec());
+}
@@ -0,0 +1,479 @@
+#pragma once
+
+#include "lc_executor.h"
+
+#include "_test_chase_lev_queue.h"
+
+//Sums kept per worker so that the tasks dont fight over a single cache line.
+// The last one is for tasks run from outside (never happens but keeps the indexing simple).
+typedef struct Test_Executor_Sums {
+    struct {
+        alignas(64)
+        isize val;
+    } of_worker[LC_EXECUTOR_MAX_WORKERS + 1];
+} Test_Executor_Sums;
+
+static void test_executor_sums_add(Test_Executor_Sums* sums, LC_Executor* executor, isize val)
+{
+    isize index = lc_executor_worker_index(executor);
+    if(index == -1)
+        index = LC_EXECUTOR_MAX_WORKERS;
+    sums->of_worker[index].val += val;
+}
+
+static isize test_executor_sums_total(Test_Executor_Sums* sums)
+{
+    isize total = 0;
+    for(isize i = 0; i < LC_EXECUTOR_MAX_WORKERS + 1; i++)
+        total += sums->of_worker[i].val;
+    return total;
+}
+
+typedef struct Test_Executor_Context {
+    LC_Executor* executor;
+    Test_Executor_Sums* sums;
+    isize cutoff;
+} Test_Executor_Context;
+
+//Binary tree of tasks. Leaves add 1.
+typedef struct Test_Executor_Tree_Task {
+    Test_Executor_Context* context;
+    isize depth;
+} Test_Executor_Tree_Task;
+
+static void test_executor_tree_task(void* payload)
+{
+    Test_Executor_Tree_Task task = {0};
+    memcpy(&task, payload, sizeof task);
+    if(task.depth == 0)
+        test_executor_sums_add(task.context->sums, task.context->executor, 1);
+    else
+    {
+        Test_Executor_Tree_Task child = {task.context, task.depth - 1};
+        lc_executor_spawn(task.context->executor, test_executor_tree_task, &child, sizeof child);
+        lc_executor_spawn(task.context->executor, test_executor_tree_task, &child, sizeof child);
+    }
+}
+
+//Spawns count leaves at once so that the workers queue overflows into the injection queue
+typedef struct Test_Executor_Fan_Task {
+    Test_Executor_Context* context;
+    isize count;
+} Test_Executor_Fan_Task;
+
+static void test_executor_fan_task(void* payload)
+{
+    Test_Executor_Fan_Task task = {0};
+    memcpy(&task, payload, sizeof task);
+    Test_Executor_Tree_Task leaf = {task.context, 0};
+    for(isize i = 0; i < task.count; i++)
+        lc_executor_spawn(task.context->executor, test_executor_tree_task, &leaf, sizeof leaf);
+}
+
+typedef struct Test_Executor_For {
+    LC_Executor* executor;
+    CL_QUEUE_ATOMIC(uint8_t)* visited;
+    isize inner_count; //if non zero every iteration runs a nested parallel for of this size
+    CL_QUEUE_ATOMIC(isize) inner_total;
+} Test_Executor_For;
+
+static void test_executor_for_inner_body(isize from, isize to, void* context)
+{
+    Test_Executor_For* test = (Test_Executor_For*) context;
+    atomic_fetch_add(&test->inner_total, to - from);
+}
+
+static void test_executor_for_body(isize from, isize to, void* context)
+{
+    Test_Executor_For* test = (Test_Executor_For*) context;
+    TEST(from < to);
+    for(isize i = from; i < to; i++)
+    {
+        atomic_fetch_add(&test->visited[i], 1);
+        if(test->inner_count)
+            lc_executor_parallel_for(test->executor, 0, test->inner_count, 3, test_executor_for_inner_body, test);
+    }
+}
+
+//every iteration has to be visited exactly once, also when parallel fors are nested
+void test_lc_executor_for(LC_Executor* executor, isize count, isize grain, isize inner_count)
+{
+    Test_Executor_For test = {0};
+    test.executor = executor;
+    test.visited = (CL_QUEUE_ATOMIC(uint8_t)*) calloc(count + 1, sizeof(uint8_t));
+    test.inner_count = inner_count;
+
+    lc_executor_parallel_for(executor, 0, count, grain, test_executor_for_body, &test);
+    for(isize i = 0; i < count; i++)
+        TEST(test.visited[i] == 1);
+    TEST(test.inner_total == count*inner_count);
+
+    free((void*) test.visited);
+}
+
+void test_lc_executor(isize max_threads)
+{
+    for(isize workers = 1; workers < max_threads; workers++)
+    {
+        static Test_Executor_Sums sums = {0};
+        memset(&sums, 0, sizeof sums);
+
+        LC_Executor executor = {0};
+        lc_executor_init(&executor, workers);
+        Test_Executor_Context context = {&executor, &sums, 0};
+
+        //nothing spawned
+        lc_executor_wait_all(&executor);
+        TEST(test_executor_sums_total(&sums) == 0);
+
+        //spawn a few trees from outside and wait for them. Repeat to see that wait_all can be reused.
+        isize expected = 0;
+        for(isize round = 0; round < 5; round++)
+        {
+            for(isize depth = 0; depth < 12; depth += 3)
+            {
+                Test_Executor_Tree_Task root = {&context, depth};
+                lc_executor_spawn(&executor, test_executor_tree_task, &root, sizeof root);
+                expected += (isize) 1 << depth;
+            }
+
+            lc_executor_wait_all(&executor);
+            TEST(test_executor_sums_total(&sums) == expected);
+        }
+
+        //many more tasks than fit into the queue of a worker, both from a task and from outside
+        Test_Executor_Fan_Task fan = {&context, 10*LC_EXECUTOR_LOCAL_CAPACITY};
+        lc_executor_spawn(&executor, test_executor_fan_task, &fan, sizeof fan);
+        for(isize i = 0; i < 10*LC_EXECUTOR_LOCAL_CAPACITY; i++)
+        {
+            Test_Executor_Tree_Task leaf = {&context, 0};
+            lc_executor_spawn(&executor, test_executor_tree_task, &leaf, sizeof leaf);
+        }
+        lc_executor_wait_all(&executor);
+        expected += 20*LC_EXECUTOR_LOCAL_CAPACITY;
+        TEST(test_executor_sums_total(&sums) == expected);
+        for(isize i = 0; i < workers; i++)
+            TEST(cl_queue_capacity(&executor.pool.threads[i].queue) <= LC_EXECUTOR_LOCAL_CAPACITY);
+
+        //trees pushed to each worker
+        for(isize i = 0; i < workers; i++)
+        {
+            Test_Executor_Tree_Task root = {&context, 6};
+            lc_executor_spawn_to(&executor, i, test_executor_tree_task, &root, sizeof root);
+            expected += 64;
+        }
+        lc_executor_wait_all(&executor);
+        TEST(test_executor_sums_total(&sums) == expected);
+
+        test_lc_executor_for(&executor, 0, 1, 0);
+        test_lc_executor_for(&executor, 1, 1, 0);
+        test_lc_executor_for(&executor, 1000, 1, 0);
+        test_lc_executor_for(&executor, 100000, 7, 0);
+        test_lc_executor_for(&executor, 1000, 5, 100);
+
+        //deinit waits for everything as well
+        Test_Executor_Tree_Task root = {&context, 10};
+        lc_executor_spawn(&executor, test_executor_tree_task, &root, sizeof root);
+        lc_executor_deinit(&executor);
+        TEST(test_executor_sums_total(&sums) == expected + 1024);
+    }
+}
+
+//================ fork join benchmarks ================
+//fib: each task spawns fib(n-2) and continues with fib(n-1) until n drops below cutoff.
+static isize bench_fib_seq(isize n)
+{
+    return n < 2 ? n : bench_fib_seq(n - 1) + bench_fib_seq(n - 2);
+}
+
+typedef struct Bench_Fib_Task {
+    Test_Executor_Context* context;
+    isize n;
+} Bench_Fib_Task;
+
+static void bench_fib_task(void* payload)
+{
+    Bench_Fib_Task task = {0};
+    memcpy(&task, payload, sizeof task);
+    for(; task.n >= task.context->cutoff; task.n -= 1)
+    {
+        Bench_Fib_Task child = {task.context, task.n - 2};
+        lc_executor_spawn(task.context->executor, bench_fib_task, &child, sizeof child);
+    }
+
+    test_executor_sums_add(task.context->sums, task.context->executor, bench_fib_seq(task.n));
+}
+
+//nqueens: board rows are filled one by one, each free column of the next row is a new task
+// until the last cutoff rows which are counted sequentially.
+// cols, left and right are the bitmasks of attacked columns/diagonals of the next row.
+static isize bench_nqueens_seq(isize n, isize row, uint32_t cols, uint32_t left, uint32_t right)
+{
+    if(row == n)
+        return 1;
+
+    isize count = 0;
+    uint32_t all = ((uint32_t) 1 << n) - 1;
+    for(uint32_t free = all & ~(cols | left | right); free; free &= free - 1)
+    {
+        uint32_t bit = free & (0 - free);
+        count += bench_nqueens_seq(n, row + 1, cols | bit, (left | bit) << 1, (right | bit) >> 1);
+    }
+    return count;
+}
+
+typedef struct Bench_Nqueens_Task {
+    Test_Executor_Context* context;
+    uint32_t cols;
+    uint32_t left;
+    uint32_t right;
+    int16_t row;
+    int16_t n;
+} Bench_Nqueens_Task;
+
+static void bench_nqueens_task(void* payload)
+{
+    Bench_Nqueens_Task task = {0};
+    memcpy(&task, payload, sizeof task);
+    if(task.n - task.row <= task.context->cutoff)
+    {
+        isize count = bench_nqueens_seq(task.n, task.row, task.cols, task.left, task.right);
+        test_executor_sums_add(task.context->sums, task.context->executor, count);
+        return;
+    }
+
+    uint32_t all = ((uint32_t) 1 << task.n) - 1;
+    for(uint32_t free = all & ~(task.cols | task.left | task.right); free; free &= free - 1)
+    {
+        uint32_t bit = free & (0 - free);
+        Bench_Nqueens_Task child = {task.context,
+            task.cols | bit, (task.left | bit) << 1, (task.right | bit) >> 1,
+            (int16_t) (task.row + 1), task.n};
+        lc_executor_spawn(task.context->executor, bench_nqueens_task, &child, sizeof child);
+    }
+}
+
+//Unbalanced tree search (binomial variant, T3 like). The root has UTS_ROOT_CHILDREN children,
+// every other node has UTS_CHILDREN children with probability UTS_CHANCE and none otherwise.
+// Whether a node has children is decided by its hashed id so the tree is the same for every run
+// but its shape is impossible to predict. Counts the nodes.
+enum {BENCH_UTS_ROOT_CHILDREN = 2000, BENCH_UTS_CHILDREN = 8};
+#define BENCH_UTS_CHANCE 0.124875
+
+static uint64_t bench_uts_hash(uint64_t x)
+{
+    //splitmix64
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+static isize bench_uts_children(uint64_t id, bool is_root)
+{
+    if(is_root)
+        return BENCH_UTS_ROOT_CHILDREN;
+
+    double chance = (double) (bench_uts_hash(id) >> 11) / (double) ((uint64_t) 1 << 53);
+    return chance < BENCH_UTS_CHANCE ? BENCH_UTS_CHILDREN : 0;
+}
+
+static isize bench_uts_seq(uint64_t id, bool is_root)
+{
+    isize count = 1;
+    isize children = bench_uts_children(id, is_root);
+    for(isize i = 0; i < children; i++)
+        count += bench_uts_seq(bench_uts_hash(id*31 + (uint64_t) i + 1), false);
+    return count;
+}
+
+typedef struct Bench_Uts_Task {
+    Test_Executor_Context* context;
+    uint64_t id;
+    bool is_root;
+} Bench_Uts_Task;
+
+static void bench_uts_task(void* payload)
+{
+    Bench_Uts_Task task = {0};
+    memcpy(&task, payload, sizeof task);
+
+    isize children = bench_uts_children(task.id, task.is_root);
+    for(isize i = 0; i < children; i++)
+    {
+        Bench_Uts_Task child = {task.context, bench_uts_hash(task.id*31 + (uint64_t) i + 1), false};
+        lc_executor_spawn(task.context->executor, bench_uts_task, &child, sizeof child);
+    }
+    test_executor_sums_add(task.context->sums, task.context->executor, 1);
+}
+
+typedef enum Bench_Executor_Kind {
+    BENCH_EXECUTOR_FIB,
+    BENCH_EXECUTOR_NQUEENS,
+    BENCH_EXECUTOR_UTS,
+} Bench_Executor_Kind;
+
+//Runs the benchmark once on a fresh executor and returns the time it took in seconds (without starting the workers).
+static double bench_lc_executor_single(Bench_Executor_Kind kind, isize workers, isize size, isize cutoff, isize* result)
+{
+    static Test_Executor_Sums sums = {0};
+    memset(&sums, 0, sizeof sums);
+
+    LC_Executor executor = {0};
+    lc_executor_init(&executor, workers);
+    Test_Executor_Context context = {&executor, &sums, cutoff};
+
+    int64_t before = _lc_pool_clock_ns();
+    if(kind == BENCH_EXECUTOR_FIB)
+    {
+        Bench_Fib_Task root = {&context, size};
+        lc_executor_spawn(&executor, bench_fib_task, &root, sizeof root);
+    }
+    if(kind == BENCH_EXECUTOR_NQUEENS)
+    {
+        Bench_Nqueens_Task root = {&context, 0, 0, 0, 0, (int16_t) size};
+        lc_executor_spawn(&executor, bench_nqueens_task, &root, sizeof root);
+    }
+    if(kind == BENCH_EXECUTOR_UTS)
+    {
+        Bench_Uts_Task root = {&context, (uint64_t) size, true};
+        lc_executor_spawn(&executor, bench_uts_task, &root, sizeof root);
+    }
+    lc_executor_wait_all(&executor);
+    int64_t after = _lc_pool_clock_ns();
+
+    lc_executor_deinit(&executor);
+    *result = test_executor_sums_total(&sums);
+    return (double) (after - before)*1e-9;
+}
+
+static void bench_lc_executor_kind(const char* name, Bench_Executor_Kind kind, isize size, isize cutoff, isize max_threads, isize repeats)
+{
+    isize expected = 0;
+    int64_t before = _lc_pool_clock_ns();
+    if(kind == BENCH_EXECUTOR_FIB)
+        expected = bench_fib_seq(size);
+    if(kind == BENCH_EXECUTOR_NQUEENS)
+        expected = bench_nqueens_seq(size, 0, 0, 0, 0);
+    if(kind == BENCH_EXECUTOR_UTS)
+        expected = bench_uts_seq((uint64_t) size, true);
+    double sequential = (double) (_lc_pool_clock_ns() - before)*1e-9;
+    printf("%s(%lli) sequential: time:%7.3lf s result:%lli\n", name, size, sequential, expected);
+
+    double single = 0;
+    for(isize workers = 1; workers <= max_threads && workers <= LC_EXECUTOR_MAX_WORKERS; workers++)
+    {
+        //take the best of repeats
+        double best = 1e100;
+        for(isize i = 0; i < repeats; i++)
+        {
+            isize result = 0;
+            double time = bench_lc_executor_single(kind, workers, size, cutoff, &result);
+            TEST(result == expected);
+            if(best > time)
+                best = time;
+        }
+
+        if(workers == 1)
+            single = best;
+        printf("%s(%lli) workers:%2lli time:%7.3lf s speedup:%5.2lf (vs sequential %5.2lf)\n",
+            name, size, workers, best, single/best, sequential/best);
+    }
+}
+
+//Every iteration does cost units of work. Skewed loops put nearly all the work into the last 1% of iterations.
+typedef struct Bench_Executor_For {
+    isize count;
+    isize unit;
+    bool skewed;
+    CL_QUEUE_ATOMIC(uint64_t) checksum;
+} Bench_Executor_For;
+
+static void bench_executor_for_body(isize from, isize to, void* context)
+{
+    Bench_Executor_For* bench = (Bench_Executor_For*) context;
+    uint64_t x = 0;
+    for(isize i = from; i < to; i++)
+    {
+        isize cost = bench->unit;
+        if(bench->skewed && i >= bench->count - bench->count/100)
+            cost *= 100;
+
+        for(isize k = 0; k < cost; k++)
+            x = bench_uts_hash(x + (uint64_t) i);
+    }
+    atomic_fetch_add_explicit(&bench->checksum, x, memory_order_relaxed);
+}
+
+typedef struct Bench_Executor_Chunk_Task {
+    Bench_Executor_For* bench;
+    isize from;
+    isize to;
+} Bench_Executor_Chunk_Task;
+
+static void bench_executor_chunk_task(void* payload)
+{
+    Bench_Executor_Chunk_Task task = {0};
+    memcpy(&task, payload, sizeof task);
+    bench_executor_for_body(task.from, task.to, task.bench);
+}
+
+//chunks == 0 means lazy splitting through lc_executor_parallel_for, otherwise the range 
+// is statically cut into that many equal chunks up front.
+static double bench_lc_executor_for_single(LC_Executor* executor, Bench_Executor_For* bench, isize chunks, isize grain)
+{
+    int64_t before = _lc_pool_clock_ns();
+    if(chunks == 0)
+        lc_executor_parallel_for(executor, 0, bench->count, grain, bench_executor_for_body, bench);
+    else
+    {
+        for(isize i = 0; i < chunks; i++)
+        {
+            Bench_Executor_Chunk_Task task = {bench, bench->count*i/chunks, bench->count*(i + 1)/chunks};
+            lc_executor_spawn(executor, bench_executor_chunk_task, &task, sizeof task);
+        }
+        lc_executor_wait_all(executor);
+    }
+    return (double) (_lc_pool_clock_ns() - before)*1e-9;
+}
+
+void bench_lc_executor_for(isize max_threads, isize repeats)
+{
+    for(isize skewed = 0; skewed < 2; skewed++)
+    {
+        for(isize workers = 1; workers <= max_threads && workers <= LC_EXECUTOR_MAX_WORKERS; workers++)
+        {
+            LC_Executor executor = {0};
+            lc_executor_init(&executor, workers);
+            
+            Bench_Executor_For bench = {0};
+            bench.count = 1000*1000;
+            bench.unit = 20;
+            bench.skewed = skewed != 0;
+
+            //lazy, static one chunk per worker, static 8 chunks per worker
+            isize chunks[3] = {0, workers, 8*workers};
+            double best[3] = {1e100, 1e100, 1e100};
+            for(isize r = 0; r < repeats; r++)
+                for(isize k = 0; k < 3; k++)
+                {
+                    double time = bench_lc_executor_for_single(&executor, &bench, chunks[k], 64);
+                    if(best[k] > time)
+                        best[k] = time;
+                }
+
+            printf("parallel for %s: workers:%2lli lazy:%7.4lf s static:%7.4lf s static x8:%7.4lf s\n", 
+                skewed ? "skewed " : "uniform", workers, best[0], best[1], best[2]);
+            lc_executor_deinit(&executor);
+        }
+    }
+}
+
+void bench_lc_executor(isize max_threads)
+{
+    isize repeats = 3;
+    bench_lc_executor_kind("fib", BENCH_EXECUTOR_FIB, 40, 15, max_threads, repeats);
+    bench_lc_executor_kind("nqueens", BENCH_EXECUTOR_NQUEENS, 13, 5, max_threads, repeats);
+    bench_lc_executor_kind("uts", BENCH_EXECUTOR_UTS, 19, 0, max_threads, repeats);
+    bench_lc_executor_for(max_threads, repeats);
+}
@@ -0,0 +1,424 @@
+#pragma once
+
+#include "hazard_ptr.h"
+#include "_test_sync_stacks.h"
+#include "_test_link_pool.h"
+
+enum {
+    TEST_HAZARD_MAX_THREADS = 64,
+    TEST_HAZARD_ALIVE = 0x600D,
+    TEST_HAZARD_DEAD = 0xDEAD,
+};
+
+static CL_QUEUE_ATOMIC(isize) test_hazard_freed_count = 0;
+
+static void test_hazard_counting_free(void* ptr)
+{
+    atomic_fetch_add(&test_hazard_freed_count, 1);
+    free(ptr);
+}
+
+typedef struct Test_Hazard_Node {
+    CL_QUEUE_ATOMIC(isize) magic;
+    isize value;
+} Test_Hazard_Node;
+
+//Marks the node before freeing it so that a reader which was not protected fails even without asan
+static void test_hazard_poisoning_free(void* ptr)
+{
+    Test_Hazard_Node* node = (Test_Hazard_Node*) ptr;
+    atomic_store(&node->magic, (isize) TEST_HAZARD_DEAD);
+    free(node);
+}
+
+void test_hazard_ptr_sequential(isize count)
+{
+    Hazard_Domain domain = {0};
+    hazard_domain_init(&domain);
+    Hazard_Thread* thread = hazard_thread_acquire(&domain);
+    Hazard_Thread* other = hazard_thread_acquire(&domain);
+    TEST(thread != other);
+    atomic_store(&test_hazard_freed_count, 0);
+
+    //protected by a different record so it must survive every scan
+    void* kept = malloc(16);
+    hazard_set(other, 1, kept);
+    hazard_retire(&domain, thread, kept, test_hazard_counting_free);
+    for(isize i = 0; i < count; i++)
+        hazard_retire(&domain, thread, malloc(16), test_hazard_counting_free);
+
+    hazard_scan(&domain, thread);
+    TEST(test_hazard_freed_count == count);
+    TEST(thread->retired_count == 1);
+
+    hazard_clear(other, 1);
+    hazard_scan(&domain, thread);
+    TEST(test_hazard_freed_count == count + 1);
+    TEST(thread->retired_count == 0);
+
+    //released records get reused, together with what they still had retired
+    kept = malloc(16);
+    hazard_set(thread, 0, kept);
+    hazard_retire(&domain, other, kept, test_hazard_counting_free);
+    hazard_thread_release(&domain, other);
+    TEST(hazard_thread_acquire(&domain) == other);
+    TEST(other->retired_count == 1);
+
+    //deinit frees everything regardless of hazards
+    hazard_domain_deinit(&domain);
+    TEST(test_hazard_freed_count == count + 2);
+}
+
+typedef struct Test_Hazard_Thread {
+    CL_QUEUE_ATOMIC(isize)* started;
+    CL_QUEUE_ATOMIC(isize)* finished;
+    CL_QUEUE_ATOMIC(isize)* run_test;
+    CL_QUEUE_ATOMIC(void*)* current;
+    Hazard_Domain* domain;
+    isize reads;
+} Test_Hazard_Thread;
+
+static void test_hazard_reader_func(void* arg)
+{
+    Test_Hazard_Thread* thread = (Test_Hazard_Thread*) arg;
+    Hazard_Thread* hazard = hazard_thread_acquire(thread->domain);
+    atomic_fetch_add(thread->started, 1);
+
+    isize last_value = 0;
+    while(atomic_load_explicit(thread->run_test, memory_order_relaxed) == 1)
+    {
+        Test_Hazard_Node* node = (Test_Hazard_Node*) hazard_protect(hazard, 0, thread->current);
+        TEST(atomic_load_explicit(&node->magic, memory_order_relaxed) == TEST_HAZARD_ALIVE);
+        TEST(node->value >= last_value);
+        last_value = node->value;
+        hazard_clear(hazard, 0);
+        thread->reads += 1;
+    }
+
+    hazard_thread_release(thread->domain, hazard);
+    atomic_fetch_add(thread->finished, 1);
+}
+
+//One thread keeps replacing the current node and retiring the old one while the others read it
+void test_hazard_ptr_concurrent(double time, isize readers_count)
+{
+    Hazard_Domain domain = {0};
+    hazard_domain_init(&domain);
+    Hazard_Thread* writer = hazard_thread_acquire(&domain);
+
+    Test_Hazard_Node* first = (Test_Hazard_Node*) malloc(sizeof(Test_Hazard_Node));
+    atomic_store(&first->magic, (isize) TEST_HAZARD_ALIVE);
+    first->value = 0;
+    CL_QUEUE_ATOMIC(void*) current = first;
+
+    CL_QUEUE_ATOMIC(isize) started = 0;
+    CL_QUEUE_ATOMIC(isize) finished = 0;
+    CL_QUEUE_ATOMIC(isize) run_test = 1;
+    Test_Hazard_Thread threads[TEST_HAZARD_MAX_THREADS] = {0};
+    for(isize i = 0; i < readers_count; i++)
+    {
+        threads[i].started = &started;
+        threads[i].finished = &finished;
+        threads[i].run_test = &run_test;
+        threads[i].current = &current;
+        threads[i].domain = &domain;
+        test_cl_launch_thread(test_hazard_reader_func, &threads[i]);
+    }
+    while(started != readers_count);
+
+    int64_t deadline = test_cl_clock_ns() + (int64_t) (time*1e9);
+    for(isize i = 1; i % 256 != 0 || test_cl_clock_ns() < deadline; i++)
+    {
+        Test_Hazard_Node* node = (Test_Hazard_Node*) malloc(sizeof(Test_Hazard_Node));
+        atomic_store(&node->magic, (isize) TEST_HAZARD_ALIVE);
+        node->value = i;
+        void* old = atomic_exchange(&current, (void*) node);
+        hazard_retire(&domain, writer, old, test_hazard_poisoning_free);
+    }
+
+    run_test = 0;
+    while(finished != readers_count);
+
+    //no one reads anymore so a scan frees everything
+    hazard_scan(&domain, writer);
+    TEST(writer->retired_count == 0);
+    free(atomic_load(&current));
+    hazard_domain_deinit(&domain);
+}
+
+static bool test_hazard_stack_pop(Test_Sync_Stack* stack, Hazard_Domain* domain, Hazard_Thread* hazard, isize* item)
+{
+    if(stack->kind == TEST_SYNC_STACK_PACK)
+        return pack_stack_pop_hazard(&stack->pack, domain, hazard, item, sizeof *item);
+    else
+        return fat_stack_pop_hazard(&stack->fat, domain, hazard, item, sizeof *item);
+}
+
+typedef struct Test_Hazard_Stack_Thread {
+    CL_QUEUE_ATOMIC(isize)* started;
+    CL_QUEUE_ATOMIC(isize)* finished;
+    Test_Sync_Stack* stack;
+    Hazard_Domain* domain;
+
+    isize index;
+    int64_t deadline;
+    isize pushed_count;
+    Test_CL_Buffer popped;
+} Test_Hazard_Stack_Thread;
+
+static void test_hazard_stack_thread_func(void* arg)
+{
+    Test_Hazard_Stack_Thread* thread = (Test_Hazard_Stack_Thread*) arg;
+    Hazard_Thread* hazard = hazard_thread_acquire(thread->domain);
+    atomic_fetch_add(thread->started, 1);
+
+    for(isize iter = 0; iter % 256 != 0 || test_cl_clock_ns() < thread->deadline; iter++)
+    {
+        if(iter % 64 < 32)
+        {
+            test_sync_stack_push(thread->stack, thread->index << 40 | thread->pushed_count);
+            thread->pushed_count += 1;
+        }
+        else
+        {
+            isize item = 0;
+            if(test_hazard_stack_pop(thread->stack, thread->domain, hazard, &item))
+                test_cl_buffer_push(&thread->popped, &item, 1);
+        }
+    }
+
+    hazard_thread_release(thread->domain, hazard);
+    atomic_fetch_add(thread->finished, 1);
+}
+
+//Same as test_sync_stack_concurrent but popped slots get freed. Checks that every item gets popped exactly once.
+void test_hazard_stack_concurrent(double time, isize threads_count, Test_Sync_Stack_Kind kind)
+{
+    Test_Sync_Stack stack = {0};
+    test_sync_stack_init(&stack, kind, false);
+    Hazard_Domain domain = {0};
+    hazard_domain_init(&domain);
+
+    CL_QUEUE_ATOMIC(isize) started = 0;
+    CL_QUEUE_ATOMIC(isize) finished = 0;
+    Test_Hazard_Stack_Thread threads[TEST_HAZARD_MAX_THREADS] = {0};
+    int64_t deadline = test_cl_clock_ns() + (int64_t) (time*1e9);
+    for(isize i = 0; i < threads_count; i++)
+    {
+        threads[i].started = &started;
+        threads[i].finished = &finished;
+        threads[i].stack = &stack;
+        threads[i].domain = &domain;
+        threads[i].index = i;
+        threads[i].deadline = deadline;
+        test_cl_launch_thread(test_hazard_stack_thread_func, &threads[i]);
+    }
+
+    while(finished != threads_count);
+
+    Test_CL_Buffer buffer = {0};
+    for(isize i = 0; i < threads_count; i++)
+        test_cl_buffer_push(&buffer, threads[i].popped.data, threads[i].popped.count);
+
+    Hazard_Thread* hazard = hazard_thread_acquire(&domain);
+    isize rest = 0;
+    while(test_hazard_stack_pop(&stack, &domain, hazard, &rest))
+        test_cl_buffer_push(&buffer, &rest, 1);
+
+    qsort(buffer.data, buffer.count, sizeof(isize), test_cl_isize_comp_func);
+    isize at = 0;
+    for(isize i = 0; i < threads_count; i++)
+        for(isize k = 0; k < threads[i].pushed_count; k++, at++)
+            TEST(at < buffer.count && buffer.data[at] == (i << 40 | k));
+    TEST(at == buffer.count);
+
+    for(isize i = 0; i < threads_count; i++)
+        test_cl_buffer_deinit(&threads[i].popped);
+    test_cl_buffer_deinit(&buffer);
+    test_sync_stack_deinit(&stack);
+    hazard_domain_deinit(&domain);
+}
+
+void test_hazard_ptr(double time, isize max_threads)
+{
+    test_hazard_ptr_sequential(0);
+    test_hazard_ptr_sequential(1);
+    test_hazard_ptr_sequential(HAZARD_PTR_RETIRE_BATCH);
+    test_hazard_ptr_sequential(10000);
+
+    if(max_threads > TEST_HAZARD_MAX_THREADS)
+        max_threads = TEST_HAZARD_MAX_THREADS;
+
+    Test_Sync_Stack_Kind kinds[] = {TEST_SYNC_STACK_FAT, TEST_SYNC_STACK_FAT_LOCK, TEST_SYNC_STACK_PACK};
+    double part = time/max_threads/5;
+    for(isize i = 1; i <= max_threads; i++)
+    {
+        test_hazard_ptr_concurrent(part, i);
+        for(isize k = 0; k < 3; k++)
+            test_hazard_stack_concurrent(part, i, kinds[k]);
+        test_link_pool_linearizable(part, i, true);
+    }
+}
+
+typedef struct Bench_Hazard_List {
+    CL_QUEUE_ATOMIC(struct Bench_Hazard_List*) next;
+    isize value;
+} Bench_Hazard_List;
+
+//Walks the whole list hand over hand the way a lock free reader would, with or without publishing each node
+static isize bench_hazard_walk(CL_QUEUE_ATOMIC(Bench_Hazard_List*)* head, Hazard_Thread* hazard)
+{
+    isize sum = 0;
+    if(hazard == NULL)
+    {
+        for(Bench_Hazard_List* node = atomic_load_explicit(head, memory_order_acquire); node; node = atomic_load_explicit(&node->next, memory_order_acquire))
+            sum += node->value;
+        return sum;
+    }
+
+    isize slot = 0;
+    CL_QUEUE_ATOMIC(void*)* from = (CL_QUEUE_ATOMIC(void*)*) (void*) head;
+    for(Bench_Hazard_List* node; (node = (Bench_Hazard_List*) hazard_protect(hazard, slot, from)) != NULL; )
+    {
+        sum += node->value;
+        from = (CL_QUEUE_ATOMIC(void*)*) (void*) &node->next;
+        slot = 1 - slot;
+    }
+    hazard_clear(hazard, 0);
+    hazard_clear(hazard, 1);
+    return sum;
+}
+
+static double bench_hazard_walk_ns(CL_QUEUE_ATOMIC(Bench_Hazard_List*)* head, isize length, Hazard_Thread* hazard, double time)
+{
+    isize walks = 0;
+    volatile isize sink = 0;
+    int64_t before = test_cl_clock_ns();
+    int64_t after = before;
+    do {
+        for(isize i = 0; i < 16; i++, walks++)
+            sink += bench_hazard_walk(head, hazard);
+        after = test_cl_clock_ns();
+    } while((double) (after - before)*1e-9 < time);
+    (void) sink;
+
+    return (double) (after - before)/(double) (walks*length);
+}
+
+typedef struct Bench_Hazard_Stack_Thread {
+    CL_QUEUE_ATOMIC(isize)* started;
+    CL_QUEUE_ATOMIC(isize)* finished;
+    CL_QUEUE_ATOMIC(isize)* run_test;
+    Test_Sync_Stack* stack;
+    Hazard_Domain* domain; //NULL for plain pops
+    isize ops;
+} Bench_Hazard_Stack_Thread;
+
+static void bench_hazard_stack_func(void* arg)
+{
+    Bench_Hazard_Stack_Thread* thread = (Bench_Hazard_Stack_Thread*) arg;
+    Hazard_Thread* hazard = thread->domain ? hazard_thread_acquire(thread->domain) : NULL;
+    atomic_fetch_add(thread->started, 1);
+    while(*thread->run_test == 0);
+
+    isize item = 0;
+    while(*thread->run_test == 1)
+    {
+        test_sync_stack_push(thread->stack, item);
+        if(hazard)
+            thread->ops += test_hazard_stack_pop(thread->stack, thread->domain, hazard, &item);
+        else
+            thread->ops += test_sync_stack_pop(thread->stack, &item);
+    }
+
+    if(hazard)
+        hazard_thread_release(thread->domain, hazard);
+    atomic_fetch_add(thread->finished, 1);
+}
+
+static double bench_hazard_stack_single(isize threads_count, Test_Sync_Stack_Kind kind, bool use_hazards, double time)
+{
+    Test_Sync_Stack stack = {0};
+    test_sync_stack_init(&stack, kind, false);
+    Hazard_Domain domain = {0};
+    hazard_domain_init(&domain);
+
+    CL_QUEUE_ATOMIC(isize) started = 0;
+    CL_QUEUE_ATOMIC(isize) finished = 0;
+    CL_QUEUE_ATOMIC(isize) run_test = 0;
+    Bench_Hazard_Stack_Thread threads[TEST_HAZARD_MAX_THREADS] = {0};
+    for(isize i = 0; i < threads_count; i++)
+    {
+        threads[i].started = &started;
+        threads[i].finished = &finished;
+        threads[i].run_test = &run_test;
+        threads[i].stack = &stack;
+        threads[i].domain = use_hazards ? &domain : NULL;
+        test_cl_launch_thread(bench_hazard_stack_func, &threads[i]);
+    }
+
+    while(started != threads_count);
+    int64_t before = test_cl_clock_ns();
+    run_test = 1;
+    test_cl_sleep_thread(time);
+    run_test = 2;
+    int64_t after = test_cl_clock_ns();
+    while(finished != threads_count);
+
+    isize ops = 0;
+    for(isize i = 0; i < threads_count; i++)
+        ops += threads[i].ops;
+
+    test_sync_stack_deinit(&stack);
+    hazard_domain_deinit(&domain);
+    return (double) ops/((double) (after - before)*1e-9);
+}
+
+//Read side overhead: ns per node when walking a list with and without hazard pointers
+// (the difference is mostly the fence in hazard_set).
+//Then push+pop pairs per second on the stacks with slots recycled (plain pop) vs freed (hazard pop).
+void bench_hazard_ptr(double time, isize max_threads)
+{
+    Hazard_Domain domain = {0};
+    hazard_domain_init(&domain);
+    Hazard_Thread* hazard = hazard_thread_acquire(&domain);
+    for(isize length = 16; length <= 1 << 16; length *= 16)
+    {
+        CL_QUEUE_ATOMIC(Bench_Hazard_List*) head = NULL;
+        for(isize i = 0; i < length; i++)
+        {
+            Bench_Hazard_List* node = (Bench_Hazard_List*) malloc(sizeof(Bench_Hazard_List));
+            node->value = i;
+            atomic_store(&node->next, atomic_load(&head));
+            atomic_store(&head, node);
+        }
+
+        double plain = bench_hazard_walk_ns(&head, length, NULL, time/8);
+        double hazards = bench_hazard_walk_ns(&head, length, hazard, time/8);
+        printf("hazard walk nodes:%6lli plain:%6.2lf ns hazard:%6.2lf ns\n", length, plain, hazards);
+
+        for(Bench_Hazard_List* node = atomic_load(&head); node; )
+        {
+            Bench_Hazard_List* next = atomic_load(&node->next);
+            free(node);
+            node = next;
+        }
+    }
+    hazard_domain_deinit(&domain);
+
+    if(max_threads > TEST_HAZARD_MAX_THREADS)
+        max_threads = TEST_HAZARD_MAX_THREADS;
+
+    Test_Sync_Stack_Kind kinds[] = {TEST_SYNC_STACK_FAT, TEST_SYNC_STACK_PACK};
+    for(isize threads = 1; threads <= max_threads; threads++)
+    {
+        printf("hazard stacks threads:%2lli", threads);
+        for(isize k = 0; k < 2; k++)
+        {
+            double recycled = bench_hazard_stack_single(threads, kinds[k], false, time/4);
+            double freed = bench_hazard_stack_single(threads, kinds[k], true, time/4);
+            printf(" %s recycled/hazard:%7.2lf/%7.2lf M/s", test_sync_stack_kind_names[kinds[k]], recycled*1e-6, freed*1e-6);
+        }
+        printf("\n");
+    }
+}
@@ -0,0 +1,219 @@
+#pragma once
+
+#include "index_mem.h"
+
+#include "_test_chase_lev_queue.h"
+
+enum {
+    TEST_INDEX_MEM_MAX_THREADS = 64,
+    TEST_INDEX_MEM_BLOCK_SIZE = 16,
+};
+
+void test_index_mem_sequential(isize blocks)
+{
+    Index_Mem mem = {0};
+    TEST(index_mem_capacity(&mem) == 0);
+
+    isize* first = NULL;
+    for(isize b = 0; b < blocks; b++)
+    {
+        isize* block = (isize*) index_mem_unsafe_grow(&mem, TEST_INDEX_MEM_BLOCK_SIZE, sizeof(isize));
+        TEST(index_mem_capacity(&mem) == (b + 1)*TEST_INDEX_MEM_BLOCK_SIZE);
+        for(isize i = 0; i < TEST_INDEX_MEM_BLOCK_SIZE; i++)
+        {
+            TEST(block[i] == 0);
+            block[i] = b*TEST_INDEX_MEM_BLOCK_SIZE + i;
+        }
+
+        //items never move
+        if(first == NULL)
+            first = (isize*) index_mem_get(&mem, 0, TEST_INDEX_MEM_BLOCK_SIZE, sizeof(isize));
+        TEST(first == index_mem_get(&mem, 0, TEST_INDEX_MEM_BLOCK_SIZE, sizeof(isize)));
+    }
+
+    for(isize i = 0; i < index_mem_capacity(&mem); i++)
+        TEST(*(isize*) index_mem_get(&mem, i, TEST_INDEX_MEM_BLOCK_SIZE, sizeof(isize)) == i);
+
+    //tables got replaced while growing past 64 blocks. Reclaiming them must not change anything.
+    isize freed = index_mem_unsafe_reclaim(&mem);
+    TEST((freed > 0) == (blocks > 64));
+    TEST(index_mem_unsafe_reclaim(&mem) == 0);
+    for(isize i = 0; i < index_mem_capacity(&mem); i++)
+        TEST(*(isize*) index_mem_get(&mem, i, TEST_INDEX_MEM_BLOCK_SIZE, sizeof(isize)) == i);
+
+    index_mem_unsafe_deinit(&mem);
+    TEST(index_mem_capacity(&mem) == 0);
+}
+
+void test_index_mem_reserve(isize blocks)
+{
+    Index_Mem mem = {0};
+    index_mem_unsafe_reserve(&mem, blocks);
+    for(isize b = 0; b < blocks; b++)
+        index_mem_unsafe_grow(&mem, TEST_INDEX_MEM_BLOCK_SIZE, sizeof(isize));
+
+    //nothing was retired
+    TEST(index_mem_unsafe_reclaim(&mem) == 0);
+    index_mem_unsafe_deinit(&mem);
+}
+
+typedef struct Test_Index_Mem_Thread {
+    CL_QUEUE_ATOMIC(isize)* started;
+    CL_QUEUE_ATOMIC(isize)* finished;
+    CL_QUEUE_ATOMIC(isize)* run_test;
+    Index_Mem* mem;
+    isize index;
+    isize reads;
+} Test_Index_Mem_Thread;
+
+static void test_index_mem_reader_func(void* arg)
+{
+    Test_Index_Mem_Thread* thread = (Test_Index_Mem_Thread*) arg;
+    atomic_fetch_add(thread->started, 1);
+
+    uint64_t random = (uint64_t) thread->index*0x9E3779B97F4A7C15 + 1;
+    while(atomic_load_explicit(thread->run_test, memory_order_relaxed) == 1)
+    {
+        isize capacity = index_mem_capacity(thread->mem);
+        if(capacity == 0)
+            continue;
+
+        random = random*6364136223846793005 + 1442695040888963407;
+        isize index = (isize) ((random >> 16) % (uint64_t) capacity);
+        CL_QUEUE_ATOMIC(isize)* item = (CL_QUEUE_ATOMIC(isize)*) index_mem_get(thread->mem, index, TEST_INDEX_MEM_BLOCK_SIZE, sizeof(isize));
+        //the writer fills blocks after publishing them
+        isize value = atomic_load_explicit(item, memory_order_relaxed);
+        TEST(value == 0 || value == index + 1);
+        thread->reads += 1;
+    }
+
+    atomic_fetch_add(thread->finished, 1);
+}
+
+//One thread grows (replacing the table many times) while the others read random published items.
+void test_index_mem_concurrent(double time, isize readers_count, isize max_blocks)
+{
+    Index_Mem mem = {0};
+    CL_QUEUE_ATOMIC(isize) started = 0;
+    CL_QUEUE_ATOMIC(isize) finished = 0;
+    CL_QUEUE_ATOMIC(isize) run_test = 1;
+    Test_Index_Mem_Thread threads[TEST_INDEX_MEM_MAX_THREADS] = {0};
+    for(isize i = 0; i < readers_count; i++)
+    {
+        threads[i].started = &started;
+        threads[i].finished = &finished;
+        threads[i].run_test = &run_test;
+        threads[i].mem = &mem;
+        threads[i].index = i;
+        test_cl_launch_thread(test_index_mem_reader_func, &threads[i]);
+    }
+    while(started != readers_count);
+
+    int64_t deadline = test_cl_clock_ns() + (int64_t) (time*1e9);
+    for(isize b = 0; b < max_blocks && test_cl_clock_ns() < deadline; b++)
+    {
+        CL_QUEUE_ATOMIC(isize)* block = (CL_QUEUE_ATOMIC(isize)*) index_mem_unsafe_grow(&mem, TEST_INDEX_MEM_BLOCK_SIZE, sizeof(isize));
+        for(isize i = 0; i < TEST_INDEX_MEM_BLOCK_SIZE; i++)
+            atomic_store_explicit(&block[i], b*TEST_INDEX_MEM_BLOCK_SIZE + i + 1, memory_order_relaxed);
+    }
+
+    run_test = 0;
+    while(finished != readers_count);
+
+    //all readers are gone so the old tables can go
+    index_mem_unsafe_reclaim(&mem);
+    for(isize i = 0; i < index_mem_capacity(&mem); i++)
+        TEST(*(isize*) index_mem_get(&mem, i, TEST_INDEX_MEM_BLOCK_SIZE, sizeof(isize)) == i + 1);
+
+    index_mem_unsafe_deinit(&mem);
+}
+
+void test_index_mem(double time, isize max_threads)
+{
+    test_index_mem_sequential(0);
+    test_index_mem_sequential(1);
+    test_index_mem_sequential(64);
+    test_index_mem_sequential(65);
+    test_index_mem_sequential(10000);
+    test_index_mem_reserve(1);
+    test_index_mem_reserve(1000);
+
+    if(max_threads > TEST_INDEX_MEM_MAX_THREADS)
+        max_threads = TEST_INDEX_MEM_MAX_THREADS;
+    for(isize i = 1; i < max_threads; i++)
+        test_index_mem_concurrent(time/max_threads, i, 1 << 16);
+}
+
+enum {BENCH_INDEX_MEM_BLOCK_SIZE = 1 << 16};
+
+//Summing the items at random (or sequential) indices so that nothing gets optimized out
+static uint64_t bench_index_mem_run(Index_Mem* mem, const uint8_t* flat, isize count, bool random_access, isize iters)
+{
+    uint64_t sum = 0;
+    uint64_t random = 0x9E3779B97F4A7C15;
+    uint64_t mask = (uint64_t) count - 1;
+    for(isize i = 0; i < iters; i++)
+    {
+        uint64_t index = (uint64_t) i & mask;
+        if(random_access)
+        {
+            random ^= random << 13;
+            random ^= random >> 7;
+            random ^= random << 17;
+            index = random & mask;
+        }
+
+        if(flat)
+            sum += flat[index];
+        else
+            sum += *(uint8_t*) index_mem_get(mem, (isize) index, BENCH_INDEX_MEM_BLOCK_SIZE, 1);
+    }
+    return sum;
+}
+
+static double bench_index_mem_time_ns(Index_Mem* mem, const uint8_t* flat, isize count, bool random_access, double time)
+{
+    //run in rounds until time is up
+    isize iters = 1 << 20;
+    isize total_iters = 0;
+    int64_t before = test_cl_clock_ns();
+    int64_t after = before;
+    volatile uint64_t sink = 0;
+    do {
+        sink += bench_index_mem_run(mem, flat, count, random_access, iters);
+        total_iters += iters;
+        after = test_cl_clock_ns();
+    } while((double) (after - before)*1e-9 < time);
+    (void) sink;
+
+    return (double) (after - before)/(double) total_iters;
+}
+
+//Cost of a single lookup compared against a flat array for 1K to max_count byte sized items.
+// max_count of 1 << 30 needs 2GB of memory.
+void bench_index_mem(double time, isize max_count)
+{
+    for(isize count = 1 << 10; count <= max_count; count *= 4)
+    {
+        Index_Mem mem = {0};
+        uint8_t* flat = (uint8_t*) malloc((size_t) count);
+        for(isize i = 0; i < count; i++)
+            flat[i] = (uint8_t) i;
+        for(isize i = 0; i < count; i += BENCH_INDEX_MEM_BLOCK_SIZE)
+        {
+            uint8_t* block = (uint8_t*) index_mem_unsafe_grow(&mem, BENCH_INDEX_MEM_BLOCK_SIZE, 1);
+            for(isize k = 0; k < BENCH_INDEX_MEM_BLOCK_SIZE; k++)
+                block[k] = (uint8_t) (i + k);
+        }
+
+        double flat_seq = bench_index_mem_time_ns(NULL, flat, count, false, time/4);
+        double mem_seq = bench_index_mem_time_ns(&mem, NULL, count, false, time/4);
+        double flat_rand = bench_index_mem_time_ns(NULL, flat, count, true, time/4);
+        double mem_rand = bench_index_mem_time_ns(&mem, NULL, count, true, time/4);
+        printf("index mem items:%11lli sequential flat/index:%6.2lf/%6.2lf ns random flat/index:%6.2lf/%6.2lf ns\n",
+            count, flat_seq, mem_seq, flat_rand, mem_rand);
+
+        index_mem_unsafe_deinit(&mem);
+        free(flat);
+    }
+}
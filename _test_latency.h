@@ -0,0 +1,221 @@
+#pragma once
+
+//Latency of single operations (the other benches only measure throughput).
+//One owner thread pushes and pops back while the others steal. Lazy_Queue has no pop from
+// the back so its owner only pushes. Every sample_every-th operation is timed with test_cl_ticks
+// into a histogram of the thread doing it and the histograms are merged at the end.
+//The queues start empty and are never reserved so growing (_cl_queue_reserve, _lazy_queue_reserve)
+// happens during the measurement and shows up in the tail. Only successful pops are recorded.
+//The values include one timestamp read (see test_cl_ticks) so compare them against each other, not against zero.
+
+#include "lc_pool.h"
+#include "lazy_queue.h"
+#include "_bench_runner.h"
+
+typedef enum Bench_Latency_Kind {
+    BENCH_LATENCY_CL_QUEUE,
+    BENCH_LATENCY_LC_POOL,
+    BENCH_LATENCY_LAZY_QUEUE,
+} Bench_Latency_Kind;
+
+typedef enum Bench_Latency_Op {
+    BENCH_LATENCY_PUSH,
+    BENCH_LATENCY_POP_BACK,
+    BENCH_LATENCY_STEAL,
+    BENCH_LATENCY_OP_COUNT,
+} Bench_Latency_Op;
+
+enum {
+    BENCH_LATENCY_MAX_THREADS = 64,
+    BENCH_LATENCY_MAX_ITEMS = 1 << 22, //the owner stops pushing above this many items so memory stays bounded
+};
+
+typedef struct Bench_Latency_Thread {
+    CL_QUEUE_ATOMIC(isize)* started;
+    CL_QUEUE_ATOMIC(isize)* finished;
+    CL_QUEUE_ATOMIC(isize)* run_test;
+    Bench_Latency_Kind kind;
+    CL_Queue* cl_queue;
+    LC_Pool* lc_pool;
+    Lazy_Queue* lazy_queue;
+    int32_t handle;
+    bool is_owner;
+    isize sample_every;
+    int64_t deadline; //in test_cl_ticks, only used by the owner
+    isize ops[BENCH_LATENCY_OP_COUNT];
+    Bench_Hist* hists; //[BENCH_LATENCY_OP_COUNT]
+} Bench_Latency_Thread;
+
+typedef struct Bench_Latency_Result {
+    Bench_Hist hists[BENCH_LATENCY_OP_COUNT]; //in test_cl_ticks
+    double ops_per_sec[BENCH_LATENCY_OP_COUNT];
+} Bench_Latency_Result;
+
+CL_QUEUE_API_INLINE bool bench_latency_op(Bench_Latency_Thread* thread, Bench_Latency_Op op, isize* item)
+{
+    switch(thread->kind)
+    {
+        case BENCH_LATENCY_CL_QUEUE:
+            if(op == BENCH_LATENCY_PUSH)     return cl_queue_push(thread->cl_queue, item, sizeof *item);
+            if(op == BENCH_LATENCY_POP_BACK) return cl_queue_pop_back(thread->cl_queue, item, sizeof *item);
+            return cl_queue_pop(thread->cl_queue, item, sizeof *item);
+
+        case BENCH_LATENCY_LC_POOL:
+            if(op == BENCH_LATENCY_PUSH)     return lc_pool_push(thread->lc_pool, thread->handle, item, sizeof *item);
+            if(op == BENCH_LATENCY_POP_BACK) return lc_pool_pop_self(thread->lc_pool, thread->handle, item, sizeof *item);
+            return lc_pool_pop_others(thread->lc_pool, thread->handle, item, sizeof *item);
+
+        default:
+            ASSERT(op != BENCH_LATENCY_POP_BACK);
+            if(op == BENCH_LATENCY_PUSH)     return lazy_queue_st_push(thread->lazy_queue, item, sizeof *item);
+            return lazy_queue_pop(thread->lazy_queue, item, sizeof *item);
+    }
+}
+
+static isize bench_latency_count(Bench_Latency_Thread* thread)
+{
+    switch(thread->kind)
+    {
+        case BENCH_LATENCY_CL_QUEUE: return cl_queue_count(thread->cl_queue);
+        case BENCH_LATENCY_LC_POOL:  return cl_queue_count(&thread->lc_pool->threads[thread->handle].queue);
+        default:                     return lazy_queue_count(thread->lazy_queue);
+    }
+}
+
+CL_QUEUE_API_INLINE void bench_latency_timed_op(Bench_Latency_Thread* thread, Bench_Latency_Op op, isize* item, isize iter)
+{
+    bool sample = iter % thread->sample_every == 0;
+    int64_t before = sample ? test_cl_ticks() : 0;
+    if(bench_latency_op(thread, op, item))
+    {
+        if(sample)
+            bench_hist_record(&thread->hists[op], (uint64_t) (test_cl_ticks() - before));
+        thread->ops[op] += 1;
+    }
+}
+
+static void bench_latency_thread_func(void* arg)
+{
+    Bench_Latency_Thread* thread = (Bench_Latency_Thread*) arg;
+    atomic_fetch_add(thread->started, 1);
+    while(atomic_load_explicit(thread->run_test, memory_order_acquire) == 0); //deadline is set before
+
+    isize item = 0;
+    if(thread->is_owner)
+    {
+        //push, push, pop back so the queue keeps growing until its full
+        bool full = false;
+        for(isize iter = 0; ; iter++)
+        {
+            if(iter % TEST_CL_DEADLINE_EVERY == 0)
+            {
+                if(test_cl_ticks() >= thread->deadline)
+                    break;
+                full = bench_latency_count(thread) >= BENCH_LATENCY_MAX_ITEMS;
+            }
+
+            Bench_Latency_Op op = BENCH_LATENCY_PUSH;
+            if(thread->kind != BENCH_LATENCY_LAZY_QUEUE && (full || iter % 3 == 2))
+                op = BENCH_LATENCY_POP_BACK;
+            else if(full)
+                continue; //wait for the thieves
+
+            item += 1;
+            bench_latency_timed_op(thread, op, &item, iter);
+        }
+        atomic_store(thread->run_test, 2);
+    }
+    else
+    {
+        for(isize iter = 0; atomic_load_explicit(thread->run_test, memory_order_relaxed) == 1; iter++)
+            bench_latency_timed_op(thread, BENCH_LATENCY_STEAL, &item, iter);
+    }
+
+    atomic_fetch_add(thread->finished, 1);
+}
+
+//Thread 0 is the owner, the rest steal. Results are added to out.
+void bench_latency_single(Bench_Latency_Result* out, Bench_Latency_Kind kind, isize threads_count, double seconds, isize sample_every)
+{
+    CL_Queue cl_queue = {0};
+    LC_Pool lc_pool = {0};
+    Lazy_Queue lazy_queue = {0};
+    cl_queue_init(&cl_queue, sizeof(isize), -1);
+    lc_pool_init(&lc_pool, sizeof(isize), BENCH_LATENCY_MAX_THREADS);
+    lazy_queue_init(&lazy_queue, sizeof(isize), -1);
+
+    CL_QUEUE_ATOMIC(isize) started = 0;
+    CL_QUEUE_ATOMIC(isize) finished = 0;
+    CL_QUEUE_ATOMIC(isize) run_test = 0;
+    Bench_Latency_Thread threads[BENCH_LATENCY_MAX_THREADS] = {0};
+    for(isize i = 0; i < threads_count; i++)
+    {
+        threads[i].started = &started;
+        threads[i].finished = &finished;
+        threads[i].run_test = &run_test;
+        threads[i].kind = kind;
+        threads[i].cl_queue = &cl_queue;
+        threads[i].lc_pool = &lc_pool;
+        threads[i].lazy_queue = &lazy_queue;
+        threads[i].handle = lc_pool_thread_add(&lc_pool);
+        threads[i].is_owner = i == 0;
+        threads[i].sample_every = sample_every;
+        threads[i].hists = (Bench_Hist*) calloc(BENCH_LATENCY_OP_COUNT, sizeof(Bench_Hist));
+        test_cl_launch_thread(bench_latency_thread_func, &threads[i]);
+    }
+
+    while(started != threads_count);
+    int64_t before = test_cl_clock_ns();
+    threads[0].deadline = test_cl_ticks_after(seconds);
+    atomic_store(&run_test, 1);
+    while(finished != threads_count);
+    double elapsed = (double) (test_cl_clock_ns() - before)*1e-9;
+
+    for(isize i = 0; i < threads_count; i++)
+    {
+        for(isize op = 0; op < BENCH_LATENCY_OP_COUNT; op++)
+        {
+            bench_hist_merge(&out->hists[op], &threads[i].hists[op]);
+            out->ops_per_sec[op] += (double) threads[i].ops[op]/elapsed;
+        }
+        free(threads[i].hists);
+    }
+
+    lazy_queue_deinit(&lazy_queue);
+    lc_pool_deinit(&lc_pool);
+    cl_queue_deinit(&cl_queue);
+}
+
+void test_bench_hist()
+{
+    //every value below 2*SUB_COUNT is exact, above that the error is at most 1/SUB_COUNT
+    isize last_index = -1;
+    for(uint64_t value = 0; value < 1 << 20; value++)
+    {
+        isize index = _bench_hist_index(value);
+        TEST(index == last_index || index == last_index + 1);
+        TEST(value <= _bench_hist_bucket_max(index));
+        TEST(_bench_hist_bucket_max(index) - value <= value/BENCH_HIST_SUB_COUNT);
+        last_index = index;
+    }
+    TEST(_bench_hist_index(UINT64_MAX) == BENCH_HIST_BUCKETS - 1);
+    TEST(_bench_hist_bucket_max(BENCH_HIST_BUCKETS - 1) == UINT64_MAX);
+
+    Bench_Hist* a = (Bench_Hist*) calloc(1, sizeof(Bench_Hist));
+    Bench_Hist* b = (Bench_Hist*) calloc(1, sizeof(Bench_Hist));
+    TEST(bench_hist_percentile(a, 50) == 0);
+    for(uint64_t i = 1; i <= 1000; i++)
+        bench_hist_record(i <= 500 ? a : b, i);
+    bench_hist_record(b, 1000000);
+    bench_hist_merge(a, b);
+
+    TEST(a->count == 1001 && a->max == 1000000);
+    uint64_t p50 = bench_hist_percentile(a, 50);
+    uint64_t p99 = bench_hist_percentile(a, 99);
+    TEST(501 <= p50 && p50 <= 501 + 501/BENCH_HIST_SUB_COUNT);
+    TEST(991 <= p99 && p99 <= 991 + 991/BENCH_HIST_SUB_COUNT);
+    TEST(bench_hist_percentile(a, 100) == 1000000);
+    TEST(bench_hist_percentile(a, 0) == 1);
+    free(a);
+    free(b);
+}
@@ -0,0 +1,399 @@
+#pragma once
+
+#include "link_pool.h"
+#include "lc_pool.h"
+
+#include "_test_chase_lev_queue.h"
+
+enum {TEST_LINK_POOL_MAX_THREADS = 64};
+
+static isize test_link_pool_blocks_count(Link_Pool* pool, int32_t thread)
+{
+    isize count = 0;
+    for(Link_Pool_Block* block = atomic_load(&pool->threads[thread].head); block; block = atomic_load(&block->next))
+        count += 1;
+    for(Link_Pool_Block* block = pool->threads[thread].recycled_private; block; block = block->next_recycled)
+        count += 1;
+    for(Link_Pool_Block* block = atomic_load(&pool->threads[thread].recycled_public); block; block = block->next_recycled)
+        count += 1;
+    return count;
+}
+
+void test_link_pool_sequential(isize count)
+{
+    Link_Pool pool = {0};
+    link_pool_init(&pool, sizeof(isize), TEST_LINK_POOL_MAX_THREADS);
+
+    int32_t thread = link_pool_thread_add(&pool);
+    int32_t other = link_pool_thread_add(&pool);
+    isize dummy = 0;
+    TEST(link_pool_pop(&pool, thread, &dummy, sizeof(isize)) == false);
+    TEST(link_pool_pop(&pool, other, &dummy, sizeof(isize)) == false);
+
+    for(isize i = 0; i < count; i++)
+        link_pool_push(&pool, thread, &i, sizeof(isize));
+
+    //the owner takes the last one, others the first one
+    if(count > 0)
+    {
+        TEST(link_pool_pop(&pool, thread, &dummy, sizeof(isize)) && dummy == count - 1);
+        link_pool_push(&pool, thread, &dummy, sizeof(isize));
+        TEST(link_pool_pop(&pool, other, &dummy, sizeof(isize)) && dummy == 0);
+        link_pool_push(&pool, thread, &dummy, sizeof(isize));
+    }
+
+    //cycle some of them through the other thread
+    for(isize i = 0; i < count/2; i++)
+    {
+        TEST(link_pool_pop(&pool, i % 2 ? thread : other, &dummy, sizeof(isize)));
+        link_pool_push(&pool, other, &dummy, sizeof(isize));
+    }
+
+    Test_CL_Buffer buffer = {0};
+    for(isize i = 0; i < count; i++)
+    {
+        isize popped = 0;
+        TEST(link_pool_pop(&pool, i % 3 ? thread : other, &popped, sizeof(isize)));
+        test_cl_buffer_push(&buffer, &popped, 1);
+    }
+
+    TEST(link_pool_pop(&pool, thread, &dummy, sizeof(isize)) == false);
+    TEST(link_pool_pop(&pool, other, &dummy, sizeof(isize)) == false);
+
+    qsort(buffer.data, buffer.count, sizeof(isize), test_cl_isize_comp_func);
+    for(isize i = 0; i < count; i++)
+        TEST(buffer.data[i] == i);
+
+    test_cl_buffer_deinit(&buffer);
+    link_pool_deinit(&pool);
+}
+
+//One thread pushes, the other pops in batches. Each batch comes from a single block
+// so it has at most max_count items in the order they were pushed.
+void test_link_pool_pop_many(isize count, isize max_count)
+{
+    Link_Pool pool = {0};
+    link_pool_init(&pool, sizeof(isize), TEST_LINK_POOL_MAX_THREADS);
+
+    int32_t thread = link_pool_thread_add(&pool);
+    int32_t other = link_pool_thread_add(&pool);
+    for(isize i = 0; i < count; i++)
+        link_pool_push(&pool, thread, &i, sizeof(isize));
+
+    isize* batch = (isize*) malloc((size_t) max_count*sizeof(isize));
+    Test_CL_Buffer buffer = {0};
+    for(isize round = 0;; round++)
+    {
+        //the owner takes some from the end
+        isize popped = 0;
+        if(round % 4 == 3 && link_pool_pop(&pool, thread, batch, sizeof(isize)))
+            popped = 1;
+        else
+            popped = link_pool_pop_many(&pool, other, batch, max_count, sizeof(isize));
+
+        if(popped == 0)
+            break;
+
+        TEST(1 <= popped && popped <= max_count);
+        for(isize i = 1; i < popped; i++)
+            TEST(batch[i - 1] < batch[i] && batch[i - 1]/LINK_POOL_BLOCK_SIZE == batch[i]/LINK_POOL_BLOCK_SIZE);
+        test_cl_buffer_push(&buffer, batch, popped);
+    }
+
+    TEST(link_pool_pop(&pool, thread, batch, sizeof(isize)) == false);
+    TEST(buffer.count == count);
+    qsort(buffer.data, buffer.count, sizeof(isize), test_cl_isize_comp_func);
+    for(isize i = 0; i < count; i++)
+        TEST(buffer.data[i] == i);
+
+    free(batch);
+    test_cl_buffer_deinit(&buffer);
+    link_pool_deinit(&pool);
+}
+
+//Items pushed by one thread and popped by another go through the blocks one after another.
+// Emptied blocks have to get reused instead of allocating new ones.
+void test_link_pool_recycle(isize count)
+{
+    Link_Pool pool = {0};
+    link_pool_init(&pool, sizeof(isize), TEST_LINK_POOL_MAX_THREADS);
+
+    int32_t producer = link_pool_thread_add(&pool);
+    int32_t consumer = link_pool_thread_add(&pool);
+    isize in_flight = 3*LINK_POOL_BLOCK_SIZE + 5;
+    isize pushed = 0;
+    isize popped = 0;
+    for(; pushed < in_flight; pushed++)
+        link_pool_push(&pool, producer, &pushed, sizeof(isize));
+
+    for(; popped < count; popped++)
+    {
+        isize item = 0;
+        TEST(link_pool_pop(&pool, consumer, &item, sizeof(isize)));
+        TEST(item == popped);
+        link_pool_push(&pool, producer, &pushed, sizeof(isize));
+        pushed += 1;
+    }
+
+    //the items in flight span at most 5 blocks, +1 done block waiting in front of the head
+    TEST(test_link_pool_blocks_count(&pool, producer) <= in_flight/LINK_POOL_BLOCK_SIZE + 3);
+    TEST(test_link_pool_blocks_count(&pool, consumer) == 1);
+    link_pool_deinit(&pool);
+}
+
+typedef struct Test_Link_Pool_Thread {
+    CL_QUEUE_ATOMIC(isize)* started;
+    CL_QUEUE_ATOMIC(isize)* finished;
+    CL_QUEUE_ATOMIC(isize)* pushes_done;
+    CL_QUEUE_ATOMIC(isize)* pops_maybe;
+
+    Link_Pool* pool;
+    int32_t handle;
+    isize index;
+    int64_t deadline;
+    isize pushed_count;
+    Test_CL_Buffer popped;
+} Test_Link_Pool_Thread;
+
+static void test_link_pool_linearizable_thread_func(void *arg)
+{
+    Test_Link_Pool_Thread* thread = (Test_Link_Pool_Thread*) arg;
+    atomic_fetch_add(thread->started, 1);
+
+    uint64_t rng = (uint64_t) (thread->index + 1)*0x9E3779B97F4A7C15ull;
+    for(isize iter = 0; iter % 256 != 0 || test_cl_clock_ns() < thread->deadline; iter++)
+    {
+        //Bursts of pushes so that blocks fill up and get unlinked, otherwise mostly pops
+        uint64_t random = _lc_pool_xorshift64(&rng);
+        if(random % 4 == 0)
+        {
+            isize burst = (random >> 8) % 256 == 0 ? (isize) (random >> 32) % 200 : 1;
+            for(isize i = 0; i < burst; i++)
+            {
+                isize item = thread->index << 40 | thread->pushed_count;
+                link_pool_push(thread->pool, thread->handle, &item, sizeof item);
+                thread->pushed_count += 1;
+                atomic_fetch_add(thread->pushes_done, 1);
+            }
+        }
+        else
+        {
+            //some steal in batches. pops_maybe counts the items we might take.
+            isize items[8] = {0};
+            isize max_count = (random >> 16) % 8 == 0 ? 8 : 1;
+            isize pushes_before = atomic_load(thread->pushes_done);
+            atomic_fetch_add(thread->pops_maybe, max_count);
+
+            isize popped = 0;
+            if(max_count > 1)
+                popped = link_pool_pop_many(thread->pool, thread->handle, items, max_count, sizeof(isize));
+            else
+                popped = link_pool_pop(thread->pool, thread->handle, items, sizeof(isize));
+
+            if(popped > 0)
+            {
+                test_cl_buffer_push(&thread->popped, items, popped);
+                atomic_fetch_sub(thread->pops_maybe, max_count - popped);
+            }
+            else
+            {
+                //same as in test_lc_pool_linearizable
+                TEST(pushes_before <= atomic_load(thread->pops_maybe) - max_count);
+                atomic_fetch_sub(thread->pops_maybe, max_count);
+            }
+        }
+    }
+
+    atomic_fetch_add(thread->finished, 1);
+}
+
+//All threads randomly push and pop. Checks that no failed pop ever misses an item and that
+// all items get popped exactly once. With reclaim blocks get freed right away instead of kept for reuse.
+void test_link_pool_linearizable(double time, isize threads_count, bool reclaim)
+{
+    Link_Pool pool = {0};
+    link_pool_init(&pool, sizeof(isize), TEST_LINK_POOL_MAX_THREADS);
+    if(reclaim)
+        link_pool_enable_reclamation(&pool, 0);
+
+    CL_QUEUE_ATOMIC(isize) started = 0;
+    CL_QUEUE_ATOMIC(isize) finished = 0;
+    CL_QUEUE_ATOMIC(isize) pushes_done = 0;
+    CL_QUEUE_ATOMIC(isize) pops_maybe = 0;
+
+    Test_Link_Pool_Thread threads[TEST_LINK_POOL_MAX_THREADS] = {0};
+    int64_t deadline = test_cl_clock_ns() + (int64_t) (time*1e9);
+    for(isize i = 0; i < threads_count; i++)
+    {
+        threads[i].started = &started;
+        threads[i].finished = &finished;
+        threads[i].pushes_done = &pushes_done;
+        threads[i].pops_maybe = &pops_maybe;
+        threads[i].pool = &pool;
+        threads[i].handle = link_pool_thread_add(&pool);
+        threads[i].index = i;
+        threads[i].deadline = deadline;
+    }
+
+    for(isize i = 0; i < threads_count; i++)
+        test_cl_launch_thread(test_link_pool_linearizable_thread_func, &threads[i]);
+
+    while(finished != threads_count);
+
+    Test_CL_Buffer buffer = {0};
+    for(isize i = 0; i < threads_count; i++)
+        test_cl_buffer_push(&buffer, threads[i].popped.data, threads[i].popped.count);
+
+    isize rest = 0;
+    while(link_pool_pop(&pool, threads[0].handle, &rest, sizeof rest))
+        test_cl_buffer_push(&buffer, &rest, 1);
+
+    qsort(buffer.data, buffer.count, sizeof(isize), test_cl_isize_comp_func);
+    isize at = 0;
+    for(isize i = 0; i < threads_count; i++)
+        for(isize k = 0; k < threads[i].pushed_count; k++, at++)
+            TEST(at < buffer.count && buffer.data[at] == (i << 40 | k));
+    TEST(at == buffer.count);
+
+    for(isize i = 0; i < threads_count; i++)
+        test_cl_buffer_deinit(&threads[i].popped);
+    test_cl_buffer_deinit(&buffer);
+    link_pool_deinit(&pool);
+}
+
+void test_link_pool(double time, isize max_threads)
+{
+    test_link_pool_sequential(0);
+    test_link_pool_sequential(1);
+    test_link_pool_sequential(LINK_POOL_BLOCK_SIZE);
+    test_link_pool_sequential(LINK_POOL_BLOCK_SIZE + 1);
+    test_link_pool_sequential(100000);
+    test_link_pool_pop_many(1000, 1);
+    test_link_pool_pop_many(1000, 7);
+    test_link_pool_pop_many(1000, 64);
+    test_link_pool_pop_many(1000, 100);
+    test_link_pool_recycle(100000);
+    for(isize i = 1; i <= max_threads; i++)
+    {
+        test_link_pool_linearizable(time/max_threads/2, i, false);
+        test_link_pool_linearizable(time/max_threads/2, i, true);
+    }
+}
+
+typedef struct Bench_Link_Pool_Thread {
+    CL_QUEUE_ATOMIC(isize)* started;
+    CL_QUEUE_ATOMIC(isize)* finished;
+    CL_QUEUE_ATOMIC(isize)* run_test;
+
+    Link_Pool* link_pool; //NULL if testing lc_pool
+    LC_Pool* lc_pool;
+    int32_t handle;
+    bool is_push; //only pushes (1 push N pop)
+    bool is_pop; //only pops
+    isize pop_many; //if not 0 link_pool pops use link_pool_pop_many with this max_count
+    uint64_t ops;
+} Bench_Link_Pool_Thread;
+
+static void bench_link_pool_thread_func(void *arg)
+{
+    Bench_Link_Pool_Thread* thread = (Bench_Link_Pool_Thread*) arg;
+    atomic_fetch_add(thread->started, 1);
+    while(*thread->run_test == 0);
+
+    //same semi random push/pop sequence as bench_lc_pool_50_50_thread_func
+    uint64_t random_mask = 0xE0349F24ABC58B2F;
+    uint64_t ops = 0;
+    for(uint64_t iters = 0; atomic_load_explicit(thread->run_test, memory_order_relaxed) == 1; iters++)
+    {
+        uint64_t bit_i = ((uint64_t) thread->handle + iters) % 64;
+        bool push = thread->is_push || (thread->is_pop == false && (random_mask & ((uint64_t) 1 << bit_i)));
+
+        isize item = 0;
+        isize items[LINK_POOL_BLOCK_SIZE] = {0};
+        if(thread->link_pool)
+        {
+            if(push)
+            {
+                link_pool_push(thread->link_pool, thread->handle, &item, sizeof item);
+                ops += 1;
+            }
+            else if(thread->pop_many)
+                ops += (uint64_t) link_pool_pop_many(thread->link_pool, thread->handle, items, thread->pop_many, sizeof item);
+            else
+                ops += link_pool_pop(thread->link_pool, thread->handle, &item, sizeof item);
+        }
+        else
+        {
+            if(push)
+                ops += lc_pool_push(thread->lc_pool, thread->handle, &item, sizeof item);
+            else
+                ops += lc_pool_pop(thread->lc_pool, thread->handle, &item, sizeof item);
+        }
+    }
+
+    if(thread->is_push == false)
+        thread->ops = ops;
+    atomic_fetch_add(thread->finished, 1);
+}
+
+//returns millions of successful operations per second
+static double bench_link_pool_single(bool use_link_pool, bool one_pusher, isize pop_many, isize threads_count, double time)
+{
+    Link_Pool link_pool = {0};
+    LC_Pool lc_pool = {0};
+    link_pool_init(&link_pool, sizeof(isize), TEST_LINK_POOL_MAX_THREADS);
+    lc_pool_init(&lc_pool, sizeof(isize), TEST_LINK_POOL_MAX_THREADS);
+
+    CL_QUEUE_ATOMIC(isize) started = 0;
+    CL_QUEUE_ATOMIC(isize) finished = 0;
+    CL_QUEUE_ATOMIC(isize) run_test = 0;
+
+    Bench_Link_Pool_Thread threads[TEST_LINK_POOL_MAX_THREADS] = {0};
+    for(isize i = 0; i < threads_count; i++)
+    {
+        threads[i].started = &started;
+        threads[i].finished = &finished;
+        threads[i].run_test = &run_test;
+        threads[i].link_pool = use_link_pool ? &link_pool : NULL;
+        threads[i].lc_pool = &lc_pool;
+        threads[i].handle = use_link_pool ? link_pool_thread_add(&link_pool) : lc_pool_thread_add(&lc_pool);
+        threads[i].is_push = one_pusher && i == 0;
+        threads[i].is_pop = one_pusher && i != 0;
+        threads[i].pop_many = pop_many;
+        test_cl_launch_thread(bench_link_pool_thread_func, &threads[i]);
+    }
+
+    while(started != threads_count);
+    int64_t before = test_cl_clock_ns();
+    run_test = 1;
+    test_cl_sleep_thread(time);
+    run_test = 2;
+    int64_t after = test_cl_clock_ns();
+    while(finished != threads_count);
+
+    uint64_t ops = 0;
+    for(isize i = 0; i < threads_count; i++)
+        ops += threads[i].ops;
+
+    link_pool_deinit(&link_pool);
+    lc_pool_deinit(&lc_pool);
+    return (double) ops/((double) (after - before)*1e-3);
+}
+
+void bench_link_pool(double time, isize max_threads)
+{
+    for(isize i = 1; i <= max_threads; i++)
+    {
+        double lc = bench_link_pool_single(false, false, 0, i, time);
+        double link = bench_link_pool_single(true, false, 0, i, time);
+        printf("50/50: threads:%2lli lc_pool:%7.2lf link_pool:%7.2lf millions/s\n", i, lc, link);
+    }
+
+    for(isize i = 2; i <= max_threads; i++)
+    {
+        double lc = bench_link_pool_single(false, true, 0, i, time);
+        double link = bench_link_pool_single(true, true, 0, i, time);
+        double link_many = bench_link_pool_single(true, true, 16, i, time);
+        printf("1 push N pop: threads:%2lli lc_pool:%7.2lf link_pool:%7.2lf link_pool pop_many(16):%7.2lf millions/s (popped items)\n", i, lc, link, link_many);
+    }
+}
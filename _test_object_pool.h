@@ -0,0 +1,347 @@
+#pragma once
+
+#include "object_pool.h"
+
+#include "_test_chase_lev_queue.h"
+
+enum {TEST_OBJECT_POOL_MAX_THREADS = 64};
+
+//Freed objects get reused before new ones get allocated
+void test_object_pool_sequential(isize count, isize object_size)
+{
+    Object_Pool pool = {0};
+    object_pool_init(&pool, object_size);
+    Object_Pool_Cache cache = {0};
+
+    Test_CL_Buffer first = {0};
+    Test_CL_Buffer second = {0};
+    for(isize round = 0; round < 2; round++)
+    {
+        Test_CL_Buffer* buffer = round == 0 ? &first : &second;
+        for(isize i = 0; i < count; i++)
+        {
+            isize* object = (isize*) object_pool_alloc(&pool, &cache);
+            TEST((uintptr_t) object % OBJECT_POOL_ALIGN == 0);
+            memset(object, 0x55, (size_t) object_size);
+            *object = i;
+            test_cl_buffer_push(buffer, (isize*) (void*) &object, 1);
+        }
+
+        for(isize i = 0; i < count; i++)
+        {
+            isize* object = (isize*) buffer->data[i];
+            TEST(*object == i);
+            object_pool_free(&pool, &cache, object);
+        }
+    }
+
+    //the second round reused the objects of the first one
+    isize chunks_count = (count + OBJECT_POOL_MAGAZINE_CAPACITY - 1)/OBJECT_POOL_MAGAZINE_CAPACITY;
+    TEST(pool.chunks_count == chunks_count);
+    qsort(first.data, first.count, sizeof(isize), test_cl_isize_comp_func);
+    qsort(second.data, second.count, sizeof(isize), test_cl_isize_comp_func);
+    for(isize i = 1; i < count; i++)
+    {
+        TEST(first.data[i - 1] + pool.object_size <= first.data[i]);
+        TEST(second.data[i - 1] + pool.object_size <= second.data[i]);
+    }
+
+    //after flushing another cache gets the same objects as well
+    object_pool_cache_flush(&pool, &cache);
+    Object_Pool_Cache other = {0};
+    for(isize i = 0; i < count; i++)
+        second.data[i] = (isize) object_pool_alloc(&pool, &other);
+    TEST(pool.chunks_count == chunks_count);
+    for(isize i = 0; i < count; i++)
+        object_pool_free(&pool, &other, (void*) second.data[i]);
+    object_pool_cache_flush(&pool, &other);
+
+    test_cl_buffer_deinit(&first);
+    test_cl_buffer_deinit(&second);
+    object_pool_deinit(&pool);
+}
+
+typedef struct Test_Object_Pool_Object {
+    isize seq;
+    isize producer;
+    uint64_t check;
+} Test_Object_Pool_Object;
+
+typedef struct Test_Object_Pool_Thread {
+    CL_QUEUE_ATOMIC(isize)* started;
+    CL_QUEUE_ATOMIC(isize)* finished;
+    CL_QUEUE_ATOMIC(isize)* run_test;
+
+    Object_Pool* pool;
+    CL_Queue* queue; //producer pushes here, its consumer pops
+    isize index;
+    bool is_producer;
+    bool use_malloc; //for benchmarks
+    isize max_in_flight;
+    isize ops;
+} Test_Object_Pool_Thread;
+
+//The producer allocates objects and sends them to its consumer which checks and frees them.
+// Both also allocate and free some objects locally. If some object was handed out twice
+// its contents would get overwritten and the checks below fail.
+static void test_object_pool_cross_thread_func(void* arg)
+{
+    Test_Object_Pool_Thread* thread = (Test_Object_Pool_Thread*) arg;
+    Object_Pool_Cache cache = {0};
+    atomic_fetch_add(thread->started, 1);
+    while(*thread->run_test == 0);
+
+    isize seq = 0;
+    isize expected_seq = 0;
+    Test_Object_Pool_Object* local[16] = {0};
+    for(;;)
+    {
+        if(thread->is_producer)
+        {
+            if(*thread->run_test == 2)
+            {
+                //tell the consumer we are done
+                Test_Object_Pool_Object* done = NULL;
+                cl_queue_push(thread->queue, &done, sizeof done);
+                break;
+            }
+
+            if(cl_queue_count(thread->queue) >= thread->max_in_flight)
+                continue;
+
+            Test_Object_Pool_Object* object = thread->use_malloc
+                ? (Test_Object_Pool_Object*) malloc(sizeof(Test_Object_Pool_Object))
+                : (Test_Object_Pool_Object*) object_pool_alloc(thread->pool, &cache);
+            object->seq = seq;
+            object->producer = thread->index;
+            object->check = (uint64_t) seq * 0x9E3779B97F4A7C15ull ^ (uint64_t) thread->index;
+            cl_queue_push(thread->queue, &object, sizeof object);
+            seq += 1;
+        }
+        else
+        {
+            Test_Object_Pool_Object* object = NULL;
+            if(cl_queue_pop(thread->queue, &object, sizeof object) == false)
+                continue;
+            if(object == NULL)
+                break;
+
+            TEST(object->seq == expected_seq);
+            TEST(object->producer == thread->index);
+            TEST(object->check == ((uint64_t) expected_seq * 0x9E3779B97F4A7C15ull ^ (uint64_t) thread->index));
+            memset(object, 0xCC, sizeof *object);
+            expected_seq += 1;
+            if(thread->use_malloc)
+                free(object);
+            else
+                object_pool_free(thread->pool, &cache, object);
+        }
+
+        //some local traffic so that magazines go both ways
+        if(thread->use_malloc == false && thread->ops % 64 == 0)
+        {
+            for(isize i = 0; i < 16; i++)
+            {
+                local[i] = (Test_Object_Pool_Object*) object_pool_alloc(thread->pool, &cache);
+                local[i]->seq = -i;
+            }
+            for(isize i = 0; i < 16; i++)
+            {
+                TEST(local[i]->seq == -i);
+                object_pool_free(thread->pool, &cache, local[i]);
+            }
+        }
+        thread->ops += 1;
+    }
+
+    object_pool_cache_flush(thread->pool, &cache);
+    atomic_fetch_add(thread->finished, 1);
+}
+
+//Runs pairs of producer/consumer threads for the given time. Returns objects passed from producers to consumers.
+static isize test_object_pool_cross_thread_run(Object_Pool* pool, isize pairs, double time, isize max_in_flight, bool use_malloc)
+{
+    CL_QUEUE_ATOMIC(isize) started = 0;
+    CL_QUEUE_ATOMIC(isize) finished = 0;
+    CL_QUEUE_ATOMIC(isize) run_test = 0;
+
+    CL_Queue queues[TEST_OBJECT_POOL_MAX_THREADS] = {0};
+    Test_Object_Pool_Thread threads[TEST_OBJECT_POOL_MAX_THREADS] = {0};
+    for(isize i = 0; i < 2*pairs; i++)
+    {
+        threads[i].started = &started;
+        threads[i].finished = &finished;
+        threads[i].run_test = &run_test;
+        threads[i].pool = pool;
+        threads[i].queue = &queues[i/2];
+        threads[i].index = i/2;
+        threads[i].is_producer = i % 2 == 0;
+        threads[i].use_malloc = use_malloc;
+        threads[i].max_in_flight = max_in_flight;
+    }
+
+    for(isize i = 0; i < pairs; i++)
+        cl_queue_init(&queues[i], sizeof(void*), -1);
+    for(isize i = 0; i < 2*pairs; i++)
+        test_cl_launch_thread(test_object_pool_cross_thread_func, &threads[i]);
+
+    while(started != 2*pairs);
+    run_test = 1;
+    test_cl_sleep_thread(time);
+    run_test = 2;
+    while(finished != 2*pairs);
+
+    isize passed = 0;
+    for(isize i = 0; i < pairs; i++)
+    {
+        cl_queue_deinit(&queues[i]);
+        passed += threads[2*i + 1].ops;
+    }
+    return passed;
+}
+
+void test_object_pool_cross_thread(double time, isize pairs)
+{
+    Object_Pool pool = {0};
+    object_pool_init(&pool, sizeof(Test_Object_Pool_Object));
+
+    isize max_in_flight = 1000;
+    test_object_pool_cross_thread_run(&pool, pairs, time, max_in_flight, false);
+
+    //Memory stays bounded: at most max_in_flight objects per pair in the queue,
+    // two magazines in each cache plus the 16 local ones and the one freshly filled chunk we could not put anywhere
+    isize bound = pairs*(max_in_flight + 2*2*OBJECT_POOL_MAGAZINE_CAPACITY + 2*16 + 2*OBJECT_POOL_MAGAZINE_CAPACITY);
+    TEST(pool.chunks_count*OBJECT_POOL_MAGAZINE_CAPACITY <= bound);
+
+    //everything is back so a single cache can get all objects without allocating new ones
+    Object_Pool_Cache cache = {0};
+    isize chunks_count = pool.chunks_count;
+    isize objects_count = chunks_count*OBJECT_POOL_MAGAZINE_CAPACITY;
+    void** objects = (void**) malloc(objects_count*sizeof(void*));
+    for(isize i = 0; i < objects_count; i++)
+        objects[i] = object_pool_alloc(&pool, &cache);
+    TEST(pool.chunks_count == chunks_count);
+    qsort(objects, objects_count, sizeof(void*), test_cl_isize_comp_func);
+    for(isize i = 1; i < objects_count; i++)
+        TEST(objects[i - 1] != objects[i]);
+
+    for(isize i = 0; i < objects_count; i++)
+        object_pool_free(&pool, &cache, objects[i]);
+    object_pool_cache_flush(&pool, &cache);
+
+    free(objects);
+    object_pool_deinit(&pool);
+}
+
+void test_object_pool(double time, isize max_threads)
+{
+    test_object_pool_sequential(0, 8);
+    test_object_pool_sequential(1, 8);
+    test_object_pool_sequential(100, 1);
+    test_object_pool_sequential(10000, 24);
+    test_object_pool_sequential(10000, 100);
+    for(isize pairs = 1; pairs <= max_threads/2; pairs++)
+        test_object_pool_cross_thread(time/max_threads, pairs);
+}
+
+typedef struct Bench_Object_Pool_Local {
+    CL_QUEUE_ATOMIC(isize)* started;
+    CL_QUEUE_ATOMIC(isize)* finished;
+    CL_QUEUE_ATOMIC(isize)* run_test;
+    Object_Pool* pool;
+    bool use_malloc;
+    isize batch;
+    isize ops;
+} Bench_Object_Pool_Local;
+
+//allocates batch objects and frees them again
+static void bench_object_pool_local_func(void* arg)
+{
+    Bench_Object_Pool_Local* thread = (Bench_Object_Pool_Local*) arg;
+    Object_Pool_Cache cache = {0};
+    void* objects[256] = {0};
+    atomic_fetch_add(thread->started, 1);
+    while(*thread->run_test == 0);
+
+    while(*thread->run_test == 1)
+    {
+        for(isize i = 0; i < thread->batch; i++)
+        {
+            objects[i] = thread->use_malloc ? malloc((size_t) thread->pool->object_size) : object_pool_alloc(thread->pool, &cache);
+            *(volatile isize*) objects[i] = i;
+        }
+        for(isize i = 0; i < thread->batch; i++)
+        {
+            if(thread->use_malloc)
+                free(objects[i]);
+            else
+                object_pool_free(thread->pool, &cache, objects[i]);
+        }
+        thread->ops += thread->batch;
+    }
+
+    object_pool_cache_flush(thread->pool, &cache);
+    atomic_fetch_add(thread->finished, 1);
+}
+
+static double bench_object_pool_local_single(isize threads_count, isize batch, isize object_size, bool use_malloc, double time)
+{
+    Object_Pool pool = {0};
+    object_pool_init(&pool, object_size);
+    CL_QUEUE_ATOMIC(isize) started = 0;
+    CL_QUEUE_ATOMIC(isize) finished = 0;
+    CL_QUEUE_ATOMIC(isize) run_test = 0;
+
+    Bench_Object_Pool_Local threads[TEST_OBJECT_POOL_MAX_THREADS] = {0};
+    for(isize i = 0; i < threads_count; i++)
+    {
+        threads[i].started = &started;
+        threads[i].finished = &finished;
+        threads[i].run_test = &run_test;
+        threads[i].pool = &pool;
+        threads[i].use_malloc = use_malloc;
+        threads[i].batch = batch;
+        test_cl_launch_thread(bench_object_pool_local_func, &threads[i]);
+    }
+
+    while(started != threads_count);
+    int64_t before = test_cl_clock_ns();
+    run_test = 1;
+    test_cl_sleep_thread(time);
+    run_test = 2;
+    int64_t after = test_cl_clock_ns();
+    while(finished != threads_count);
+
+    isize ops = 0;
+    for(isize i = 0; i < threads_count; i++)
+        ops += threads[i].ops;
+
+    object_pool_deinit(&pool);
+    return (double) ops/((double) (after - before)*1e-9);
+}
+
+void bench_object_pool(double time, isize max_threads)
+{
+    isize object_size = sizeof(Test_Object_Pool_Object);
+    for(isize batch = 1; batch <= 256; batch *= 16)
+        for(isize threads = 1; threads <= max_threads; threads++)
+        {
+            double with_malloc = bench_object_pool_local_single(threads, batch, object_size, true, time);
+            double with_pool = bench_object_pool_local_single(threads, batch, object_size, false, time);
+            printf("object pool local batch:%3lli threads:%2lli malloc:%7.2lf M/s pool:%7.2lf M/s (%.2lfx)\n",
+                batch, threads, with_malloc*1e-6, with_pool*1e-6, with_pool/with_malloc);
+        }
+
+    //allocate on producer, free on consumer
+    for(isize pairs = 1; pairs <= max_threads/2; pairs++)
+    {
+        Object_Pool pool = {0};
+        object_pool_init(&pool, object_size);
+        isize with_malloc = test_object_pool_cross_thread_run(&pool, pairs, time, 1000, true);
+        isize with_pool = test_object_pool_cross_thread_run(&pool, pairs, time, 1000, false);
+        object_pool_deinit(&pool);
+
+        printf("object pool cross thread pairs:%2lli malloc:%7.2lf M/s pool:%7.2lf M/s (%.2lfx)\n",
+            pairs, with_malloc/time*1e-6, with_pool/time*1e-6, (double) with_pool/(double) with_malloc);
+    }
+}
@@ -1,8 +1,10 @@
 #pragma once
 
 #include "lc_pool.h"
+#include "sync_stacks.h"
 
 #include "_test_chase_lev_queue.h"
+#include "_bench_runner.h"
 
 enum {TEST_MAX_THREADS = 64};
 
@@ -89,9 +91,6 @@ static void test_lc_pool_ping_pong_thread_func(void *arg)
     atomic_fetch_add(thread->finished, 1);
 }
 
-#include <Windows.h>
-
-//#pragma comment(lib, "kernel32.lib")
 static void test_lc_pool_ping_pong(isize item_count, isize a_count, isize b_count, double time, double reverse_chance)
 {
     LC_Pool pool_a = {0};
@@ -100,6 +99,10 @@ static void test_lc_pool_ping_pong(isize item_count, isize a_count, isize b_coun
     lc_pool_init(&pool_a, sizeof(isize), TEST_MAX_THREADS);
     lc_pool_init(&pool_b, sizeof(isize), TEST_MAX_THREADS);
     
+    //all victim policies must behave the same
+    lc_pool_set_victim_policy(&pool_a, (LC_Pool_Victim_Policy) (rand() % 4));
+    lc_pool_set_victim_policy(&pool_b, (LC_Pool_Victim_Policy) (rand() % 4));
+    
     //prefill pools
     {
         uint32_t handle_a = lc_pool_thread_add(&pool_a);
@@ -139,76 +142,879 @@ static void test_lc_pool_ping_pong(isize item_count, isize a_count, isize b_coun
     {
         while(started != a_count + b_count);
         run_test = 1;
-        isize clocks_before = clock();
-        
-        //void __declspec(dllimport) __stdcall Sleep(unsigned long dwMilliseconds);
-        Sleep((unsigned long) (time*1000));
-
+        int64_t before = test_cl_clock_ns();
+        test_cl_sleep_thread(time);
         run_test = 2;
-        isize clocks_after = clock();
+        int64_t after = test_cl_clock_ns();
         while(finished != a_count + b_count);
 
-        //sleep is very inacurrate on windows so we use the time the test really took
-        actual_time = (double)(clocks_after - clocks_before)/CLOCKS_PER_SEC;
+        //sleep is very inacurrate on windows so we use the time the test really took
+        // (wall time, clock() is cpu time of the whole process on linux)
+        actual_time = (double)(after - before)*1e-9;
+    }
+
+    //pop all remaining items
+    Test_CL_Buffer buffer = {0};
+    uint32_t handle_a = lc_pool_thread_add(&pool_a);
+    uint32_t handle_b = lc_pool_thread_add(&pool_b);
+    {
+        isize popped = 0;
+        while(lc_pool_pop(&pool_a, handle_a, &popped, sizeof popped))
+            test_cl_buffer_push(&buffer, &popped, 1);
+            
+        while(lc_pool_pop(&pool_b, handle_a, &popped, sizeof popped))
+            test_cl_buffer_push(&buffer, &popped, 1);
+    }
+    
+    TEST(buffer.count == 2*item_count);
+        
+    //test if items are valid
+    qsort(buffer.data, buffer.count, sizeof(isize), test_cl_isize_comp_func);
+    for(isize i = 0; i < item_count; i ++)
+    {
+        TEST(buffer.data[2*i] == i);
+        TEST(buffer.data[2*i+1] == i);
+    }
+    
+    isize total_iters = 0;
+    for(isize i = 0; i < a_count + b_count; i++)
+        total_iters += threads[i].iters;
+
+    printf("a:%lli b:%lli total:%lli throughput:%.2lf millions/s\n", a_count, b_count, total_iters, (double) total_iters/(actual_time*1e6));
+    
+    free(buffer.data);
+    lc_pool_deinit(&pool_a);
+    lc_pool_deinit(&pool_b);
+}
+
+
+void test_lc_pool_stress(double time, isize max_threads) 
+{
+    for(int64_t deadline = test_cl_clock_ns() + (int64_t) (time*1e9);;)
+    {
+        int64_t now = test_cl_clock_ns();
+        if(now >= deadline)
+            break;
+
+        double single_test = (double) rand() / RAND_MAX * 0.1;
+        if(single_test > (double) (deadline - now)*1e-9)
+            single_test = (double) (deadline - now)*1e-9;
+
+        isize threads_a = rand() % (max_threads/2);
+        isize threads_b = rand() % ((max_threads + 1)/2);
+        isize items = rand() % 10000;
+        double reverse_chance = (double) rand() / RAND_MAX / 10;
+
+        test_lc_pool_ping_pong(items, threads_a, threads_b, single_test, reverse_chance);
+    }
+}
+
+void test_lc_pool_topology()
+{
+    //fake machine with 2 sockets each with 2 caches each shared by 2 cpus
+    int32_t cache_of_cpu[8] = {0, 0, 2, 2, 4, 4, 6, 6};
+    int32_t socket_of_cpu[8] = {0, 0, 0, 0, 1, 1, 1, 1};
+    LC_Pool_Topology topology = {cache_of_cpu, socket_of_cpu, 8};
+
+    LC_Pool pool = {0};
+    lc_pool_init(&pool, sizeof(isize), TEST_MAX_THREADS);
+    lc_pool_set_topology(&pool, &topology);
+
+    //assign cpus in reverse so that handles dont match cpus. 
+    //Each thread pushes its cpu.
+    int32_t threads[8] = {0};
+    for(isize i = 0; i < 8; i++)
+    {
+        isize cpu = 7 - i;
+        threads[i] = lc_pool_thread_add(&pool);
+        lc_pool_thread_set_cpu(&pool, threads[i], (int32_t) cpu);
+        TEST(lc_pool_push(&pool, threads[i], &cpu, sizeof(isize)));
+    }
+
+    //thread on cpu 0 has to steal from cpu 1 first, then 2, 3 and only then from the other socket
+    int32_t thread = threads[7];
+    isize popped = 0;
+    TEST(lc_pool_pop_others(&pool, thread, &popped, sizeof(isize)) && popped == 1);
+    for(isize i = 0; i < 2; i++)
+        TEST(lc_pool_pop_others(&pool, thread, &popped, sizeof(isize)) && 2 <= popped && popped <= 3);
+    for(isize i = 0; i < 4; i++)
+        TEST(lc_pool_pop_others(&pool, thread, &popped, sizeof(isize)) && 4 <= popped && popped <= 7);
+
+    TEST(lc_pool_pop_others(&pool, thread, &popped, sizeof(isize)) == false);
+    TEST(lc_pool_pop(&pool, thread, &popped, sizeof(isize)) && popped == 0);
+    TEST(lc_pool_pop(&pool, thread, &popped, sizeof(isize)) == false);
+
+    lc_pool_deinit(&pool);
+}
+
+typedef struct Test_Pool_Wait_Thread {
+    CL_QUEUE_ATOMIC(isize)* started; 
+    CL_QUEUE_ATOMIC(isize)* finished; 
+    CL_QUEUE_ATOMIC(isize)* run_test; 
+    CL_QUEUE_ATOMIC(isize)* popped_count; 
+
+    LC_Pool* pool;
+    int32_t thread;
+    Test_CL_Buffer popped;
+} Test_Pool_Wait_Thread;
+
+static void test_lc_pool_wait_thread_func(void *arg)
+{
+    Test_Pool_Wait_Thread* thread = (Test_Pool_Wait_Thread*) arg;
+    atomic_fetch_add(thread->started, 1);
+
+    while(*thread->run_test == 1)
+    {
+        isize item = 0;
+        if(lc_pool_pop_wait(thread->pool, thread->thread, &item, sizeof item, 0.05))
+        {
+            test_cl_buffer_push(&thread->popped, &item, 1);
+            atomic_fetch_add(thread->popped_count, 1);
+        }
+    }
+    
+    atomic_fetch_add(thread->finished, 1);
+}
+
+//pushes items slowly enough that the waiters park in between and checks 
+// that every item gets woken up for and popped exactly once
+void test_lc_pool_wait(isize item_count, isize waiters_count)
+{
+    LC_Pool pool = {0};
+    lc_pool_init(&pool, sizeof(isize), TEST_MAX_THREADS);
+    
+    //timeout on empty pool
+    {
+        int32_t thread = lc_pool_thread_add(&pool);
+        isize dummy = 0;
+        int64_t before = _lc_pool_clock_ns();
+        TEST(lc_pool_pop_wait(&pool, thread, &dummy, sizeof dummy, 0.02) == false);
+        TEST(_lc_pool_clock_ns() - before >= 20*1000*1000);
+        TEST(lc_pool_pop_wait(&pool, thread, &dummy, sizeof dummy, 0) == false);
+        lc_pool_thread_remove(&pool, thread);
+    }
+
+    CL_QUEUE_ATOMIC(isize) started = 0;
+    CL_QUEUE_ATOMIC(isize) finished = 0;
+    CL_QUEUE_ATOMIC(isize) run_test = 1;
+    CL_QUEUE_ATOMIC(isize) popped_count = 0;
+
+    Test_Pool_Wait_Thread threads[TEST_MAX_THREADS] = {0};
+    for(isize i = 0; i < waiters_count; i++)
+    {
+        threads[i].started = &started;
+        threads[i].finished = &finished;
+        threads[i].run_test = &run_test;
+        threads[i].popped_count = &popped_count;
+        threads[i].pool = &pool;
+        threads[i].thread = lc_pool_thread_add(&pool);
+        test_cl_launch_thread(test_lc_pool_wait_thread_func, &threads[i]);
+    }
+    
+    int32_t producer = lc_pool_thread_add(&pool);
+    while(started != waiters_count);
+    for(isize i = 0; i < item_count; i++)
+    {
+        if(i % 16 == 0)
+            test_cl_sleep_thread(0.001);
+        TEST(lc_pool_push(&pool, producer, &i, sizeof i));
+    }
+
+    //wait for the waiters to get all items
+    int64_t deadline = _lc_pool_clock_ns() + (int64_t) 5*1000*1000*1000;
+    while(popped_count != item_count && _lc_pool_clock_ns() < deadline)
+        test_cl_sleep_thread(0.001);
+
+    run_test = 2;
+    lc_pool_wake_all(&pool);
+    while(finished != waiters_count);
+    
+    Test_CL_Buffer buffer = {0};
+    for(isize i = 0; i < waiters_count; i++)
+        test_cl_buffer_push(&buffer, threads[i].popped.data, threads[i].popped.count);
+
+    TEST(buffer.count == item_count);
+    qsort(buffer.data, buffer.count, sizeof(isize), test_cl_isize_comp_func);
+    for(isize i = 0; i < item_count; i++)
+        TEST(buffer.data[i] == i);
+    
+    for(isize i = 0; i < waiters_count; i++)
+        test_cl_buffer_deinit(&threads[i].popped);
+    test_cl_buffer_deinit(&buffer);
+    lc_pool_deinit(&pool);
+}
+
+typedef struct Test_Pool_Remove_Thread {
+    CL_QUEUE_ATOMIC(isize)* started; 
+    CL_QUEUE_ATOMIC(isize)* finished; 
+    CL_QUEUE_ATOMIC(isize)* popped_count; 
+
+    LC_Pool* pool;
+    int32_t handle; //only for consumers
+    isize index;
+    isize rounds;
+    isize items_per_round;
+    isize item_count; //total. consumers stop once this many items were popped
+    Test_CL_Buffer popped;
+} Test_Pool_Remove_Thread;
+
+//Comes and goes each round, leaving all pushed items behind
+static void test_lc_pool_remove_producer_func(void *arg)
+{
+    Test_Pool_Remove_Thread* thread = (Test_Pool_Remove_Thread*) arg;
+    atomic_fetch_add(thread->started, 1);
+
+    for(isize round = 0; round < thread->rounds; round++)
+    {
+        //Threads with items left behind cant be reused until the consumers empty them.
+        // If there are too many of those we have to wait.
+        int32_t handle = lc_pool_thread_add(thread->pool);
+        for(; handle == -1; handle = lc_pool_thread_add(thread->pool))
+            test_cl_sleep_thread(0);
+        
+        //big enough so that the queue needs to grow and has blocks to release
+        lc_pool_reserve(thread->pool, handle, thread->items_per_round, sizeof(isize));
+        isize from = (thread->index*thread->rounds + round)*thread->items_per_round;
+        for(isize i = from; i < from + thread->items_per_round; i++)
+            TEST(lc_pool_push(thread->pool, handle, &i, sizeof i));
+            
+        lc_pool_thread_remove(thread->pool, handle);
+    }
+    
+    atomic_fetch_add(thread->finished, 1);
+}
+
+static void test_lc_pool_remove_consumer_func(void *arg)
+{
+    Test_Pool_Remove_Thread* thread = (Test_Pool_Remove_Thread*) arg;
+    atomic_fetch_add(thread->started, 1);
+
+    int32_t handle = thread->handle;
+    while(*thread->popped_count < thread->item_count)
+    {
+        isize item = 0;
+        if(lc_pool_pop(thread->pool, handle, &item, sizeof item))
+        {
+            test_cl_buffer_push(&thread->popped, &item, 1);
+            atomic_fetch_add(thread->popped_count, 1);
+        }
+    }
+    
+    lc_pool_thread_remove(thread->pool, handle);
+    atomic_fetch_add(thread->finished, 1);
+}
+
+//Producers remove themselves with full queues. Checks that all their items 
+// get popped exactly once and that once everyone is gone only small blocks remain.
+void test_lc_pool_remove(isize rounds, isize producers_count, isize consumers_count, isize items_per_round)
+{
+    LC_Pool pool = {0};
+    lc_pool_init(&pool, sizeof(isize), TEST_MAX_THREADS);
+
+    CL_QUEUE_ATOMIC(isize) started = 0;
+    CL_QUEUE_ATOMIC(isize) finished = 0;
+    CL_QUEUE_ATOMIC(isize) popped_count = 0;
+
+    isize threads_count = producers_count + consumers_count;
+    isize item_count = rounds*producers_count*items_per_round;
+    Test_Pool_Remove_Thread threads[TEST_MAX_THREADS] = {0};
+    for(isize i = 0; i < threads_count; i++)
+    {
+        threads[i].started = &started;
+        threads[i].finished = &finished;
+        threads[i].popped_count = &popped_count;
+        threads[i].pool = &pool;
+        threads[i].index = i;
+        threads[i].rounds = rounds;
+        threads[i].items_per_round = items_per_round;
+        threads[i].item_count = item_count;
+        if(i >= producers_count)
+            threads[i].handle = lc_pool_thread_add(&pool);
+    }
+
+    for(isize i = 0; i < threads_count; i++)
+    {
+        test_cl_launch_thread(i < producers_count 
+            ? test_lc_pool_remove_producer_func 
+            : test_lc_pool_remove_consumer_func, &threads[i]);
+    }
+    
+    while(finished != threads_count);
+    
+    Test_CL_Buffer buffer = {0};
+    for(isize i = 0; i < threads_count; i++)
+        test_cl_buffer_push(&buffer, threads[i].popped.data, threads[i].popped.count);
+
+    TEST(buffer.count == item_count);
+    qsort(buffer.data, buffer.count, sizeof(isize), test_cl_isize_comp_func);
+    for(isize i = 0; i < item_count; i++)
+        TEST(buffer.data[i] == i);
+        
+    //everyone is removed and nobody is stealing so everything can be freed
+    _lc_pool_reclaim(&pool);
+    TEST(pool.retired == NULL);
+    TEST(pool.orphan_mask == 0);
+    for(isize i = 0; i < pool.threads_count; i++)
+    {
+        TEST(pool.threads[i].removed);
+        TEST(pool.threads[i].orphaned == false);
+        TEST(cl_queue_capacity(&pool.threads[i].queue) <= LC_POOL_KEPT_CAPACITY);
+    }
+
+    for(isize i = 0; i < threads_count; i++)
+        test_cl_buffer_deinit(&threads[i].popped);
+    test_cl_buffer_deinit(&buffer);
+    lc_pool_deinit(&pool);
+}
+
+void test_lc_pool_capacity_sequential(isize max_capacity)
+{
+    LC_Pool pool = {0};
+    lc_pool_init(&pool, sizeof(isize), TEST_MAX_THREADS);
+    lc_pool_set_max_capacity(&pool, max_capacity, LC_POOL_FULL_FAIL);
+    int32_t thread = lc_pool_thread_add(&pool);
+    
+    //with single thread all credits end up with us so the limit is exact
+    for(isize round = 0; round < 3; round++)
+    {
+        isize pushed = 0;
+        while(lc_pool_push(&pool, thread, &pushed, sizeof pushed))
+            pushed += 1;
+
+        TEST(pushed == max_capacity);
+        isize popped = 0;
+        if(max_capacity > 0)
+        {
+            TEST(lc_pool_pop(&pool, thread, &popped, sizeof popped));
+            TEST(lc_pool_push(&pool, thread, &popped, sizeof popped));
+            TEST(lc_pool_push(&pool, thread, &popped, sizeof popped) == false);
+        }
+
+        for(isize i = 0; i < max_capacity; i++)
+            TEST(lc_pool_pop(&pool, thread, &popped, sizeof popped));
+        TEST(lc_pool_pop(&pool, thread, &popped, sizeof popped) == false);
+    }
+
+    lc_pool_deinit(&pool);
+}
+
+typedef struct Test_Pool_Runaway_Thread {
+    CL_QUEUE_ATOMIC(isize)* started; 
+    CL_QUEUE_ATOMIC(isize)* finished; 
+    CL_QUEUE_ATOMIC(isize)* popped_count; 
+    CL_QUEUE_ATOMIC(isize)* pushed_count; 
+
+    LC_Pool* pool;
+    int32_t handle;
+    bool is_producer;
+    isize from;
+    isize to;
+    isize item_count;
+    isize pop_delay; //consumers spin this many times after each pop to be slower than the producers
+    Test_CL_Buffer popped;
+} Test_Pool_Runaway_Thread;
+
+//Two producers and a consumer on a small pool. Whatever credits the first producer and 
+// the consumer keep to themselves after going idle must not stop the second producer 
+// from filling at least half of the pool (with LC_POOL_FULL_BLOCK it would block forever).
+void test_lc_pool_capacity_producers(isize max_capacity, LC_Pool_Full_Policy policy)
+{
+    LC_Pool pool = {0};
+    lc_pool_init(&pool, sizeof(isize), TEST_MAX_THREADS);
+    lc_pool_set_max_capacity(&pool, max_capacity, policy);
+    int32_t a = lc_pool_thread_add(&pool);
+    int32_t b = lc_pool_thread_add(&pool);
+    int32_t consumer = lc_pool_thread_add(&pool);
+    
+    isize item = 0;
+    TEST(lc_pool_push(&pool, a, &item, sizeof item));
+    TEST(lc_pool_pop(&pool, consumer, &item, sizeof item));
+
+    //pushes only fail with LC_POOL_FULL_FAIL, so only try that many with LC_POOL_FULL_BLOCK
+    isize pushed = 0;
+    isize half = (max_capacity + 1)/2;
+    while((policy == LC_POOL_FULL_FAIL || pushed < half) && lc_pool_push(&pool, b, &pushed, sizeof pushed))
+        pushed += 1;
+
+    TEST(half <= pushed && pushed <= max_capacity);
+    for(isize i = 0; i < pushed; i++)
+        TEST(lc_pool_pop(&pool, consumer, &item, sizeof item));
+    TEST(lc_pool_pop(&pool, consumer, &item, sizeof item) == false);
+    lc_pool_deinit(&pool);
+}
+
+static void test_lc_pool_runaway_thread_func(void *arg)
+{
+    Test_Pool_Runaway_Thread* thread = (Test_Pool_Runaway_Thread*) arg;
+    atomic_fetch_add(thread->started, 1);
+
+    if(thread->is_producer)
+    {
+        for(isize i = thread->from; i < thread->to; i++)
+        {
+            TEST(lc_pool_push(thread->pool, thread->handle, &i, sizeof i));
+            atomic_fetch_add(thread->pushed_count, 1);
+        }
+    }
+    else
+    {
+        while(*thread->popped_count < thread->item_count)
+        {
+            isize item = 0;
+            if(lc_pool_pop(thread->pool, thread->handle, &item, sizeof item))
+            {
+                test_cl_buffer_push(&thread->popped, &item, 1);
+                atomic_fetch_add(thread->popped_count, 1);
+                for(volatile isize k = 0; k < thread->pop_delay; k++);
+            }
+        }
+    }
+
+    atomic_fetch_add(thread->finished, 1);
+}
+
+typedef struct Test_Pool_Runaway_Result {
+    isize max_items;      //most items seen in the pool at once (up to consumers_count pops which were not counted yet)
+    isize max_block_size; //most memory in the blocks of all queues at once (in bytes)
+} Test_Pool_Runaway_Result;
+
+//Producers push as fast as they can into a pool (possibly) limited to max_capacity with LC_POOL_FULL_BLOCK 
+// while slower consumers pop. Checks that all items get popped exactly once and 
+// returns how many items and how much memory the pool held at its peak.
+Test_Pool_Runaway_Result test_lc_pool_runaway(isize max_capacity_or_negative_if_infinite, isize producers_count, isize consumers_count, isize item_count, isize pop_delay)
+{
+    LC_Pool pool = {0};
+    lc_pool_init(&pool, sizeof(isize), TEST_MAX_THREADS);
+    lc_pool_set_max_capacity(&pool, max_capacity_or_negative_if_infinite, LC_POOL_FULL_BLOCK);
+
+    CL_QUEUE_ATOMIC(isize) started = 0;
+    CL_QUEUE_ATOMIC(isize) finished = 0;
+    CL_QUEUE_ATOMIC(isize) popped_count = 0;
+    CL_QUEUE_ATOMIC(isize) pushed_count = 0;
+
+    isize threads_count = producers_count + consumers_count;
+    Test_Pool_Runaway_Thread threads[TEST_MAX_THREADS] = {0};
+    for(isize i = 0; i < threads_count; i++)
+    {
+        threads[i].started = &started;
+        threads[i].finished = &finished;
+        threads[i].popped_count = &popped_count;
+        threads[i].pushed_count = &pushed_count;
+        threads[i].pool = &pool;
+        threads[i].handle = lc_pool_thread_add(&pool);
+        threads[i].is_producer = i < producers_count;
+        threads[i].from = item_count*i/producers_count;
+        threads[i].to = item_count*(i + 1)/producers_count;
+        threads[i].item_count = item_count;
+        threads[i].pop_delay = pop_delay;
+    }
+
+    for(isize i = 0; i < threads_count; i++)
+        test_cl_launch_thread(test_lc_pool_runaway_thread_func, &threads[i]);
+
+    Test_Pool_Runaway_Result out = {0};
+    while(finished != threads_count)
+    {
+        //Summing the counts of the queues one by one can count items pushed with credits of items 
+        // popped from a queue we already looked at. Counting pushes first and pops second can 
+        // only overcount by the pops which finished but were not counted yet.
+        isize items = atomic_load(&pushed_count);
+        items -= atomic_load(&popped_count);
+        isize block_size = 0;
+        for(isize i = 0; i < threads_count; i++)
+            block_size += cl_queue_capacity(&pool.threads[i].queue)*(isize) sizeof(isize);
+
+        if(out.max_items < items)
+            out.max_items = items;
+        if(out.max_block_size < block_size)
+            out.max_block_size = block_size;
+    }
+
+    Test_CL_Buffer buffer = {0};
+    for(isize i = 0; i < threads_count; i++)
+        test_cl_buffer_push(&buffer, threads[i].popped.data, threads[i].popped.count);
+
+    TEST(buffer.count == item_count);
+    qsort(buffer.data, buffer.count, sizeof(isize), test_cl_isize_comp_func);
+    for(isize i = 0; i < item_count; i++)
+        TEST(buffer.data[i] == i);
+
+    //the pool is empty so all credits have to be back
+    if(max_capacity_or_negative_if_infinite >= 0)
+    {
+        isize credits = pool.free_capacity;
+        for(isize i = 0; i < threads_count; i++)
+            credits += pool.threads[i].credits;
+        TEST(credits == max_capacity_or_negative_if_infinite);
+    }
+
+    for(isize i = 0; i < threads_count; i++)
+        test_cl_buffer_deinit(&threads[i].popped);
+    test_cl_buffer_deinit(&buffer);
+    lc_pool_deinit(&pool);
+    return out;
+}
+
+void test_lc_pool_stale_bits()
+{
+    LC_Pool pool = {0};
+    lc_pool_init(&pool, sizeof(isize), TEST_MAX_THREADS);
+    int32_t a = lc_pool_thread_add(&pool);
+    int32_t b = lc_pool_thread_add(&pool);
+    uint64_t a_bit = (uint64_t) 1 << a;
+    pool.stale_interval_ns = 0; //clear on every failed search
+
+    for(isize i = 0; i < 10; i++)
+    {
+        //b steals the item of a. a does not know its queue is empty so its bit stays set ...
+        isize popped = -1;
+        TEST(lc_pool_push(&pool, a, &i, sizeof i));
+        TEST(pool.non_empty_mask == a_bit);
+        TEST(lc_pool_pop(&pool, b, &popped, sizeof popped) && popped == i);
+        TEST(pool.non_empty_mask == a_bit);
+
+        //... until someone fails to find anything
+        TEST(lc_pool_pop(&pool, b, &popped, sizeof popped) == false);
+        if(pool.asymmetric_barrier)
+            TEST(pool.non_empty_mask == 0);
+
+        //a has to set the bit again even though it never saw its queue empty
+        TEST(lc_pool_push(&pool, a, &i, sizeof i));
+        TEST(pool.non_empty_mask == a_bit);
+        if(i % 2)
+            TEST(lc_pool_pop(&pool, a, &popped, sizeof popped) && popped == i);
+        else
+            TEST(lc_pool_pop(&pool, b, &popped, sizeof popped) && popped == i);
+        TEST(lc_pool_pop(&pool, a, &popped, sizeof popped) == false);
+        TEST(lc_pool_pop(&pool, b, &popped, sizeof popped) == false);
+    }
+
+    lc_pool_deinit(&pool);
+}
+
+//A thief clearing the stale bit of a queue its owner pushes into at the same time must not lose the item
+void test_lc_pool_stale_race()
+{
+    LC_Pool pool = {0};
+    lc_pool_init(&pool, sizeof(isize), TEST_MAX_THREADS);
+    int32_t a = lc_pool_thread_add(&pool);
+    int32_t b = lc_pool_thread_add(&pool);
+    uint64_t a_bit = (uint64_t) 1 << a;
+    pool.stale_interval_ns = 0; //clear on every failed search
+
+    for(isize i = 0; i < 10; i++)
+    {
+        //b drains the queue of a so its bit is stale
+        isize popped = -1;
+        isize item = i*10;
+        TEST(lc_pool_push(&pool, a, &item, sizeof item));
+        TEST(lc_pool_pop(&pool, b, &popped, sizeof popped) && popped == item);
+        TEST(pool.non_empty_mask == a_bit);
+
+        //The push completes after the search found the queue empty but before the clear. 
+        // The recheck after the barrier has to see it and leave the bit alone.
+        uint64_t empty_bits = 0;
+        TEST(lc_pool_push(&pool, a, &++item, sizeof item));
+        TEST(_lc_pool_stale_begin(&pool, a_bit, &empty_bits) && empty_bits == 0);
+        _lc_pool_stale_clear(&pool, empty_bits);
+        TEST(pool.non_empty_mask == a_bit);
+        TEST(lc_pool_pop(&pool, b, &popped, sizeof popped) && popped == item);
+        _lc_pool_stale_end(&pool, empty_bits);
+        TEST(pool.stale_seq % 2 == 0);
+
+        //The owner pushes after the barrier. It sees advertised cleared and sets 
+        // its bit (already set) just before the thief clears it.
+        TEST(_lc_pool_stale_begin(&pool, a_bit, &empty_bits) && empty_bits == a_bit);
+        TEST(pool.threads[a].advertised == false);
+        TEST(_lc_pool_stale_begin(&pool, a_bit, &empty_bits) == false); //only one clears at a time
+        TEST(lc_pool_push(&pool, a, &++item, sizeof item));
+        _lc_pool_stale_clear(&pool, empty_bits);
+        TEST(pool.non_empty_mask == 0);
+
+        //The mask is wrong for now but searches do not trust it while a clear is running ...
+        TEST(lc_pool_pop(&pool, b, &popped, sizeof popped) && popped == item);
+        TEST(lc_pool_push(&pool, a, &++item, sizeof item));
+        TEST(pool.non_empty_mask == 0);
+
+        //... and the clear puts the bit back in the end
+        _lc_pool_stale_end(&pool, empty_bits);
+        TEST(pool.non_empty_mask == a_bit);
+        TEST(lc_pool_pop(&pool, b, &popped, sizeof popped) && popped == item);
+        TEST(lc_pool_pop(&pool, b, &popped, sizeof popped) == false);
+        TEST(lc_pool_pop(&pool, a, &popped, sizeof popped) == false);
+    }
+
+    lc_pool_deinit(&pool);
+}
+
+//Bounded queues spill into the injection queue, items submitted from outside get popped 
+// by the threads of the pool and the injection queue gets polled even if a thread keeps on feeding itself.
+void test_lc_pool_injection(isize item_count)
+{
+    LC_Pool pool = {0};
+    lc_pool_init(&pool, sizeof(isize), TEST_MAX_THREADS);
+    lc_pool_set_local_capacity(&pool, 256);
+    int32_t a = lc_pool_thread_add(&pool);
+    int32_t b = lc_pool_thread_add(&pool);
+
+    for(isize i = 0; i < item_count; i++)
+    {
+        if(i % 3 == 0)
+            TEST(lc_pool_submit(&pool, &i, sizeof i));
+        else
+            TEST(lc_pool_push(&pool, a, &i, sizeof i));
+    }
+
+    TEST(cl_queue_capacity(&pool.threads[a].queue) <= 256);
+    TEST(cl_queue_count(&pool.threads[a].queue) + pool.injection.count == item_count);
+
+    Test_CL_Buffer buffer = {0};
+    for(isize i = 0;; i++)
+    {
+        isize popped = -1;
+        if(lc_pool_pop(&pool, i % 2 ? a : b, &popped, sizeof popped) == false)
+            break;
+        test_cl_buffer_push(&buffer, &popped, 1);
+        TEST(cl_queue_capacity(&pool.threads[a].queue) <= 256);
+        TEST(cl_queue_capacity(&pool.threads[b].queue) <= 256);
+    }
+
+    TEST(buffer.count == item_count);
+    TEST(pool.injection.count == 0);
+    qsort(buffer.data, buffer.count, sizeof(isize), test_cl_isize_comp_func);
+    for(isize i = 0; i < item_count; i++)
+        TEST(buffer.data[i] == i);
+
+    //a pushes and pops its own items but has to get to the submitted one eventually
+    isize submitted = -1;
+    TEST(lc_pool_submit(&pool, &submitted, sizeof submitted));
+    bool found = false;
+    for(isize i = 0; i < LC_POOL_INJECTION_POLL && found == false; i++)
+    {
+        isize popped = 0;
+        TEST(lc_pool_push(&pool, a, &i, sizeof i));
+        TEST(lc_pool_pop(&pool, a, &popped, sizeof popped));
+        found = popped == submitted;
+    }
+    TEST(found);
+
+    test_cl_buffer_deinit(&buffer);
+    lc_pool_deinit(&pool);
+}
+
+//Items pushed to a thread get popped by it first, by thieves if it does not come 
+// and stay part of the pool when the thread gets removed.
+void test_lc_pool_push_to()
+{
+    LC_Pool pool = {0};
+    lc_pool_init(&pool, sizeof(isize), TEST_MAX_THREADS);
+    lc_pool_set_local_capacity(&pool, 64);
+    int32_t a = lc_pool_thread_add(&pool);
+    int32_t b = lc_pool_thread_add(&pool);
+
+    //b gets the items pushed to it before the ones of a, in the order of its own queue
+    isize popped = -1;
+    for(isize i = 0; i < 10; i++)
+        TEST(lc_pool_push(&pool, a, &i, sizeof i));
+    for(isize i = 10; i < 20; i++)
+        TEST(lc_pool_push_to(&pool, b, &i, sizeof i));
+    for(isize i = 19; i >= 10; i--)
+        TEST(lc_pool_pop(&pool, b, &popped, sizeof popped) && popped == i);
+    for(isize i = 9; i >= 0; i--)
+        TEST(lc_pool_pop(&pool, a, &popped, sizeof popped) && popped == i);
+    TEST(lc_pool_pop(&pool, b, &popped, sizeof popped) == false);
+
+    //a steals from the mailbox of b
+    for(isize i = 0; i < 10; i++)
+        TEST(lc_pool_push_to(&pool, b, &i, sizeof i));
+    for(isize i = 0; i < 10; i++)
+        TEST(lc_pool_pop(&pool, a, &popped, sizeof popped) && popped == i);
+    TEST(lc_pool_pop(&pool, a, &popped, sizeof popped) == false);
+    TEST(lc_pool_pop(&pool, b, &popped, sizeof popped) == false);
+
+    //more than fits into the bounded queue of b goes to the injection queue
+    for(isize i = 0; i < 1000; i++)
+        TEST(lc_pool_push_to(&pool, b, &i, sizeof i));
+    TEST(lc_pool_pop(&pool, b, &popped, sizeof popped));
+    TEST(pool.threads[b].mailbox.count == 0);
+    TEST(cl_queue_capacity(&pool.threads[b].queue) <= 64);
+
+    //b leaves with items in its queue and mailbox, a takes them all
+    for(isize i = 1000; i < 1010; i++)
+        TEST(lc_pool_push_to(&pool, b, &i, sizeof i));
+    lc_pool_thread_remove(&pool, b);
+    Test_CL_Buffer buffer = {0};
+    test_cl_buffer_push(&buffer, &popped, 1);
+    while(lc_pool_pop(&pool, a, &popped, sizeof popped))
+        test_cl_buffer_push(&buffer, &popped, 1);
+
+    TEST(buffer.count == 1010);
+    qsort(buffer.data, buffer.count, sizeof(isize), test_cl_isize_comp_func);
+    for(isize i = 0; i < 1010; i++)
+        TEST(buffer.data[i] == i);
+
+    test_cl_buffer_deinit(&buffer);
+    lc_pool_deinit(&pool);
+}
+
+typedef struct Test_Pool_Linearizable_Thread {
+    CL_QUEUE_ATOMIC(isize)* started; 
+    CL_QUEUE_ATOMIC(isize)* finished; 
+    CL_QUEUE_ATOMIC(isize)* pushes_done; 
+    CL_QUEUE_ATOMIC(isize)* pops_maybe; 
+
+    LC_Pool* pool;
+    int32_t handle;
+    isize index;
+    isize threads_count;
+    int64_t deadline;
+    isize pushed_count;
+    Test_CL_Buffer popped;
+} Test_Pool_Linearizable_Thread;
+
+static void test_lc_pool_linearizable_thread_func(void *arg)
+{
+    Test_Pool_Linearizable_Thread* thread = (Test_Pool_Linearizable_Thread*) arg;
+    atomic_fetch_add(thread->started, 1);
+
+    uint64_t rng = (uint64_t) (thread->index + 1)*0x9E3779B97F4A7C15ull;
+    for(isize iter = 0; iter % 256 != 0 || _lc_pool_clock_ns() < thread->deadline; iter++)
+    {
+        //Mostly pops, so that queues keep on running empty (and their bits going stale)
+        uint64_t random = _lc_pool_xorshift64(&rng);
+        if(random % 4 == 0)
+        {
+            //some go through the injection queue
+            isize item = thread->index << 40 | thread->pushed_count;
+            if(random % 32 == 0)
+                TEST(lc_pool_submit(thread->pool, &item, sizeof item));
+            else if(random % 32 == 4)
+                TEST(lc_pool_push_to(thread->pool, (int32_t) ((random >> 32) % (uint64_t) thread->threads_count), &item, sizeof item));
+            else
+                TEST(lc_pool_push(thread->pool, thread->handle, &item, sizeof item));
+            thread->pushed_count += 1;
+            atomic_fetch_add(thread->pushes_done, 1);
+        }
+        else
+        {
+            isize pushes_before = atomic_load(thread->pushes_done);
+            atomic_fetch_add(thread->pops_maybe, 1);
+
+            isize item = 0;
+            if(lc_pool_pop(thread->pool, thread->handle, &item, sizeof item))
+                test_cl_buffer_push(&thread->popped, &item, 1);
+            else
+            {
+                //The pool was empty at some point during our pop. All pushes which finished 
+                // before we started were in the pool by then so they must have been popped 
+                // by pops which started before we finished (not counting us).
+                TEST(pushes_before <= atomic_load(thread->pops_maybe) - 1);
+                atomic_fetch_sub(thread->pops_maybe, 1);
+            }
+        }
+    }
+
+    atomic_fetch_add(thread->finished, 1);
+}
+
+//All threads randomly push and pop. Checks that no failed pop ever misses an item and that
+// all items get popped exactly once.
+void test_lc_pool_linearizable(double time, isize threads_count, isize local_capacity_or_negative_if_infinite)
+{
+    LC_Pool pool = {0};
+    lc_pool_init(&pool, sizeof(isize), TEST_MAX_THREADS);
+    lc_pool_set_local_capacity(&pool, local_capacity_or_negative_if_infinite);
+
+    CL_QUEUE_ATOMIC(isize) started = 0;
+    CL_QUEUE_ATOMIC(isize) finished = 0;
+    CL_QUEUE_ATOMIC(isize) pushes_done = 0;
+    CL_QUEUE_ATOMIC(isize) pops_maybe = 0;
+
+    Test_Pool_Linearizable_Thread threads[TEST_MAX_THREADS] = {0};
+    int64_t deadline = _lc_pool_clock_ns() + (int64_t) (time*1e9);
+    for(isize i = 0; i < threads_count; i++)
+    {
+        threads[i].started = &started;
+        threads[i].finished = &finished;
+        threads[i].pushes_done = &pushes_done;
+        threads[i].pops_maybe = &pops_maybe;
+        threads[i].pool = &pool;
+        threads[i].handle = lc_pool_thread_add(&pool);
+        threads[i].index = i;
+        threads[i].threads_count = threads_count;
+        threads[i].deadline = deadline;
     }
 
-    //pop all remaining items
+    for(isize i = 0; i < threads_count; i++)
+        test_cl_launch_thread(test_lc_pool_linearizable_thread_func, &threads[i]);
+
+    while(finished != threads_count);
+
     Test_CL_Buffer buffer = {0};
-    uint32_t handle_a = lc_pool_thread_add(&pool_a);
-    uint32_t handle_b = lc_pool_thread_add(&pool_b);
-    {
-        isize popped = 0;
-        while(lc_pool_pop(&pool_a, handle_a, &popped, sizeof popped))
-            test_cl_buffer_push(&buffer, &popped, 1);
-            
-        while(lc_pool_pop(&pool_b, handle_a, &popped, sizeof popped))
-            test_cl_buffer_push(&buffer, &popped, 1);
-    }
-    
-    TEST(buffer.count == 2*item_count);
-        
-    //test if items are valid
-    qsort(buffer.data, buffer.count, sizeof(isize), test_cl_isize_comp_func);
-    for(isize i = 0; i < item_count; i ++)
-    {
-        TEST(buffer.data[2*i] == i);
-        TEST(buffer.data[2*i+1] == i);
-    }
-    
-    isize total_iters = 0;
-    for(isize i = 0; i < a_count + b_count; i++)
-        total_iters += threads[i].iters;
+    for(isize i = 0; i < threads_count; i++)
+        test_cl_buffer_push(&buffer, threads[i].popped.data, threads[i].popped.count);
 
-    printf("a:%lli b:%lli total:%lli throughput:%.2lf millions/s\n", a_count, b_count, total_iters, (double) total_iters/(actual_time*1e6));
-    
-    free(buffer.data);
-    lc_pool_deinit(&pool_a);
-    lc_pool_deinit(&pool_b);
-}
+    isize rest = 0;
+    while(lc_pool_pop(&pool, threads[0].handle, &rest, sizeof rest))
+        test_cl_buffer_push(&buffer, &rest, 1);
 
+    //each thread pushed 0..pushed_count-1 tagged by its index
+    qsort(buffer.data, buffer.count, sizeof(isize), test_cl_isize_comp_func);
+    isize at = 0;
+    for(isize i = 0; i < threads_count; i++)
+        for(isize k = 0; k < threads[i].pushed_count; k++, at++)
+            TEST(at < buffer.count && buffer.data[at] == (i << 40 | k));
+    TEST(at == buffer.count);
+
+    for(isize i = 0; i < threads_count; i++)
+        test_cl_buffer_deinit(&threads[i].popped);
+    test_cl_buffer_deinit(&buffer);
+    lc_pool_deinit(&pool);
+}
 
-void test_lc_pool_stress(double time, isize max_threads) 
+#ifdef __cplusplus
+//Waves of short lived threads push through the thread local handles. 
+// Their threads must get reused (once we took the items they left behind) and no item can get lost.
+void test_lc_pool_local(isize waves, isize threads_per_wave, isize items_per_thread)
 {
-    for(isize deadline = clock() + (isize) (time*CLOCKS_PER_SEC);;)
+    LC_Pool pool = {0};
+    lc_pool_init(&pool, sizeof(isize), TEST_MAX_THREADS);
+
+    Test_CL_Buffer buffer = {0};
+    isize popped = 0;
+    for(isize wave = 0; wave < waves; wave++)
     {
-        isize now = clock();
-        if(now >= deadline)
-            break;
+        std::thread threads[TEST_MAX_THREADS];
+        for(isize i = 0; i < threads_per_wave; i++)
+        {
+            isize from = (wave*threads_per_wave + i)*items_per_thread;
+            threads[i] = std::thread([&pool, from, items_per_thread]{
+                for(isize k = from; k < from + items_per_thread; k++)
+                    TEST(lc_pool_local_push(&pool, &k, sizeof k));
+            });
+        }
 
-        isize max_single_test = (isize) (0.1*CLOCKS_PER_SEC);
-        isize single_test_clocks = rand() % max_single_test;
-        if(single_test_clocks > deadline - now)
-            single_test_clocks = deadline - now;
+        for(isize i = 0; i < threads_per_wave; i++)
+            threads[i].join();
 
-        double single_test = (double) single_test_clocks / CLOCKS_PER_SEC;
-        isize threads_a = rand() % (max_threads/2);
-        isize threads_b = rand() % ((max_threads + 1)/2);
-        isize items = rand() % 10000;
-        double reverse_chance = (double) rand() / CLOCKS_PER_SEC / 10;
+        while(lc_pool_local_pop(&pool, &popped, sizeof popped))
+            test_cl_buffer_push(&buffer, &popped, 1);
 
-        test_lc_pool_ping_pong(items, threads_a, threads_b, single_test, reverse_chance);
+        //+1 for us
+        TEST(pool.threads_count <= threads_per_wave + 1);
     }
+    lc_pool_local_release(&pool);
+
+    isize item_count = waves*threads_per_wave*items_per_thread;
+    TEST(buffer.count == item_count);
+    qsort(buffer.data, buffer.count, sizeof(isize), test_cl_isize_comp_func);
+    for(isize i = 0; i < item_count; i++)
+        TEST(buffer.data[i] == i);
+
+    test_cl_buffer_deinit(&buffer);
+    lc_pool_deinit(&pool);
 }
+#endif
 
 void test_lc_pool(double time, isize max_threads) 
 {
@@ -216,6 +1022,51 @@ void test_lc_pool(double time, isize max_threads)
     test_lc_pool_sequential(10);
     test_lc_pool_sequential(100);
     test_lc_pool_sequential(1000);
+    test_lc_pool_topology();
+    test_lc_pool_wait(1000, max_threads - 1);
+    test_lc_pool_remove(100, max_threads/2, (max_threads + 1)/2, 1000);
+    test_lc_pool_stale_bits();
+    test_lc_pool_stale_race();
+    test_lc_pool_injection(10);
+    test_lc_pool_injection(1000);
+    test_lc_pool_injection(100000);
+    test_lc_pool_push_to();
+    for(isize i = 1; i <= max_threads; i++)
+    {
+        test_lc_pool_linearizable(time/max_threads/2, i, -1);
+        test_lc_pool_linearizable(time/max_threads/2, i, 64);
+    }
+    test_lc_pool_capacity_sequential(0);
+    test_lc_pool_capacity_sequential(1);
+    test_lc_pool_capacity_sequential(1000);
+    for(isize max_capacity = 1; max_capacity <= 1024; max_capacity *= 2)
+    {
+        test_lc_pool_capacity_producers(max_capacity, LC_POOL_FULL_FAIL);
+        test_lc_pool_capacity_producers(max_capacity, LC_POOL_FULL_BLOCK);
+    }
+    for(isize producers = 1; producers < max_threads; producers++)
+    {
+        //Each queue holds at most max_capacity items so its block is at most that rounded up to a power of two.
+        isize max_capacity = 10000;
+        isize consumers = max_threads - producers;
+        Test_Pool_Runaway_Result res = test_lc_pool_runaway(max_capacity, producers, consumers, 200000, 100);
+        TEST(res.max_block_size <= max_threads*16384*(isize) sizeof(isize));
+        TEST(res.max_items <= max_capacity + consumers);
+    }
+    {
+        //Slow consumers so that without the limit nearly all items pile up in the pool
+        isize max_capacity = 10000;
+        isize producers = (max_threads + 1)/2;
+        isize consumers = max_threads - producers > 0 ? max_threads - producers : 1;
+        Test_Pool_Runaway_Result limited = test_lc_pool_runaway(max_capacity, producers, consumers, 1000*1000, 1000);
+        Test_Pool_Runaway_Result unlimited = test_lc_pool_runaway(-1, producers, consumers, 1000*1000, 1000);
+        TEST(limited.max_items <= max_capacity + consumers);
+        TEST(unlimited.max_items > 10*max_capacity);
+        TEST(limited.max_block_size*4 <= unlimited.max_block_size);
+    }
+    #ifdef __cplusplus
+    test_lc_pool_local(10, max_threads, 100);
+    #endif
     
     test_lc_pool_stress(time, max_threads);
 }
@@ -225,7 +1076,8 @@ typedef struct Bench_Pool_Thread {
     CL_QUEUE_ATOMIC(isize)* started; 
     CL_QUEUE_ATOMIC(isize)* finished; 
     CL_QUEUE_ATOMIC(isize)* run_test; 
-    CL_QUEUE_ATOMIC(uint64_t)* target; 
+    CL_QUEUE_ATOMIC(uint64_t)* target; //16 bytes, 16 byte aligned
+    Fat_Stack* fat_stack;
 
     LC_Pool* pool;
     int32_t thread;
@@ -240,6 +1092,10 @@ typedef struct Bench_Pool_Thread {
 
     uint64_t user;
     bool is_push;
+    int32_t pin_cpu; //-1 if not pinned
+    uint64_t latency_sum;
+    uint64_t latency_max;
+    Bench_Hist* latency_hist; //NULL if not wanted
 } Bench_Pool_Thread;
 
 typedef struct Bench_Pool_Result {
@@ -258,6 +1114,50 @@ enum {
     BENCH_LC_POOL_CAS,
     BENCH_LC_POOL_HALF_FAA,
     BENCH_LC_POOL_HALF_CAS,
+    BENCH_LC_POOL_CAS128,
+    BENCH_LC_POOL_FAT_STACK,
+    BENCH_LC_POOL_FAT_STACK_LOCK,
+    BENCH_LC_POOL_IDLE_MASK,
+    BENCH_LC_POOL_IDLE_SCAN,
+    BENCH_LC_POOL_WAIT_SPIN,
+    BENCH_LC_POOL_WAIT_PARK,
+};
+
+//Adds and removes itself from the pool in a loop.
+// Measures the cost of registration for short lived threads.
+static void bench_lc_pool_register_thread_func(void *arg)
+{
+    Bench_Pool_Thread* thread = (Bench_Pool_Thread*) arg;
+    atomic_fetch_add(thread->started, 1);
+
+    //wait to run
+    while(*thread->run_test == 0); 
+    
+    LC_Pool* pool = thread->pool;
+    uint64_t iters = 0;
+    uint64_t ops = 0;
+    for(; atomic_load_explicit(thread->run_test, memory_order_relaxed) == 1; iters += 1) 
+    {
+        int32_t handle = lc_pool_thread_add(pool);
+        if(handle != -1)
+        {
+            lc_pool_thread_remove(pool, handle);
+            ops += 1;
+        }
+    }
+    
+    thread->iters = iters;
+    thread->ops = ops;
+    atomic_fetch_add(thread->finished, 1);
+}
+
+//flags which can be or-ed into user for the pool benchmarks
+enum {
+    BENCH_LC_POOL_PIN_THREADS = 1 << 16,  //pin i-th thread to i-th cpu
+    BENCH_LC_POOL_USE_TOPOLOGY = 1 << 17, //tell the pools where the threads are pinned
+    BENCH_LC_POOL_CLEAR_ALWAYS = 1 << 18, //failed searches clear stale bits every time (no stale_interval_ns)
+    BENCH_LC_POOL_CLEAR_NEVER = 1 << 19,  //failed searches never clear stale bits
+    BENCH_LC_POOL_POLICY_SHIFT = 20,      //bits 20-23 hold the LC_Pool_Victim_Policy of the pools
 };
 
 static void bench_lc_pool_faa_thread_func(void *arg)
@@ -317,6 +1217,28 @@ static void bench_lc_pool_faa_thread_func(void *arg)
             iters += 2;
         }
     }
+    if(thread->user == BENCH_LC_POOL_CAS128 && FAT_STACK_CAS128 && fat_stack_has_cas128())
+    {
+        //same as CAS but the whole 16 bytes (like a Fat_Stack head)
+        uint64_t my_value = (uint64_t) thread->thread;
+        while(atomic_load_explicit(run_test, memory_order_relaxed) == 1)
+        {
+            uint64_t expected[2] = {atomic_load_explicit(target, memory_order_relaxed), atomic_load_explicit(target + 1, memory_order_relaxed)};
+            ops += _fat_stack_cas128(target, expected, my_value, expected[1] + 1);
+            iters += 1;
+        }
+    }
+    if(thread->user == BENCH_LC_POOL_FAT_STACK || thread->user == BENCH_LC_POOL_FAT_STACK_LOCK)
+    {
+        //every thread pushes and pops in pairs so all contend on the head
+        while(atomic_load_explicit(run_test, memory_order_relaxed) == 1)
+        {
+            isize item = 0;
+            fat_stack_push(thread->fat_stack, &item, sizeof item);
+            ops += fat_stack_pop(thread->fat_stack, &item, sizeof item);
+            iters += 1;
+        }
+    }
     
     thread->iters = iters;
     thread->ops = ops;
@@ -328,6 +1250,9 @@ static void bench_lc_pool_50_50_thread_func(void *arg)
     Bench_Pool_Thread* thread = (Bench_Pool_Thread*) arg;
     atomic_fetch_add(thread->started, 1);
 
+    if(thread->pin_cpu >= 0)
+        test_cl_pin_thread(thread->pin_cpu);
+
     //wait to run
     while(*thread->run_test == 0); 
     
@@ -364,6 +1289,9 @@ static void bench_lc_pool_asymetric_thread_func(void *arg)
     isize index = atomic_fetch_add(thread->started, 1);
     srand((unsigned) index);
 
+    if(thread->pin_cpu >= 0)
+        test_cl_pin_thread(thread->pin_cpu);
+
     //wait to run
     while(*thread->run_test == 0); 
     
@@ -403,6 +1331,9 @@ static void bench_lc_pool_ping_pong_thread_func(void *arg)
     isize index = atomic_fetch_add(thread->started, 1);
     srand((unsigned) index);
 
+    if(thread->pin_cpu >= 0)
+        test_cl_pin_thread(thread->pin_cpu);
+
     //wait to run
     while(*thread->run_test == 0); 
     
@@ -436,6 +1367,154 @@ static void bench_lc_pool_ping_pong_thread_func(void *arg)
     atomic_fetch_add(thread->finished, 1);
 }
 
+//One busy worker pushing and popping its own items while everyone else is idle and keeps 
+// trying to steal. Measures how much the idle thieves disturb the worker. 
+// With BENCH_LC_POOL_IDLE_SCAN the thieves scan all queues ignoring the non empty mask.
+static void bench_lc_pool_idle_thread_func(void *arg)
+{
+    Bench_Pool_Thread* thread = (Bench_Pool_Thread*) arg;
+    atomic_fetch_add(thread->started, 1);
+
+    //wait to run
+    while(*thread->run_test == 0); 
+    
+    int32_t handle = thread->thread;
+    LC_Pool* pool = thread->pool;
+    uint64_t iters = 0;
+    uint64_t ops = 0;
+    if(thread->is_push)
+    {
+        for(; atomic_load_explicit(thread->run_test, memory_order_relaxed) == 1;) {
+            isize item = 0;
+            ops += lc_pool_push(pool, handle, &item, sizeof item);
+            ops += lc_pool_pop(pool, handle, &item, sizeof item);
+        }
+    }
+    else
+    {
+        for(; atomic_load_explicit(thread->run_test, memory_order_relaxed) == 1; iters += 1) {
+            isize item = 0;
+            if(thread->user == BENCH_LC_POOL_IDLE_SCAN)
+                lc_pool_pop_others_old(pool, handle, &item, sizeof item);
+            else
+                lc_pool_pop(pool, handle, &item, sizeof item);
+        }
+    }
+    
+    thread->iters = iters;
+    thread->ops = ops;
+    atomic_fetch_add(thread->finished, 1);
+}
+
+//Waits for items pushed by a slow producer either by spinning on lc_pool_pop 
+// (BENCH_LC_POOL_WAIT_SPIN) or by lc_pool_pop_wait (BENCH_LC_POOL_WAIT_PARK).
+// Items are the timestamps of when they were pushed.
+static void bench_lc_pool_wait_thread_func(void *arg)
+{
+    Bench_Pool_Thread* thread = (Bench_Pool_Thread*) arg;
+    atomic_fetch_add(thread->started, 1);
+
+    //wait to run
+    while(*thread->run_test == 0); 
+    
+    int32_t handle = thread->thread;
+    LC_Pool* pool = thread->pool;
+    while(atomic_load_explicit(thread->run_test, memory_order_relaxed) == 1)
+    {
+        isize item = 0;
+        bool popped = thread->user == BENCH_LC_POOL_WAIT_PARK
+            ? lc_pool_pop_wait(pool, handle, &item, sizeof item, 0.05)
+            : lc_pool_pop(pool, handle, &item, sizeof item);
+
+        if(popped)
+        {
+            uint64_t latency = (uint64_t) (test_cl_clock_ns() - item);
+            thread->latency_sum += latency;
+            if(thread->latency_max < latency)
+                thread->latency_max = latency;
+            if(thread->latency_hist)
+                bench_hist_record(thread->latency_hist, latency);
+            thread->ops += 1;
+        }
+    }
+    
+    atomic_fetch_add(thread->finished, 1);
+}
+
+typedef struct Bench_Pool_Wait_Result {
+    double cpu_usage; //in cores
+    double latency_avg_us;
+    double latency_max_us;
+    uint64_t items;
+} Bench_Pool_Wait_Result;
+
+//If latency_hist is not NULL the latencies in ns of all items are added to it
+static Bench_Pool_Wait_Result bench_lc_pool_wait_single(uint64_t user, isize waiters_count, double time, double push_interval, Bench_Hist* latency_hist)
+{
+    LC_Pool pool = {0};
+    lc_pool_init(&pool, sizeof(isize), TEST_MAX_THREADS);
+
+    CL_QUEUE_ATOMIC(isize) started = 0;
+    CL_QUEUE_ATOMIC(isize) finished = 0;
+    CL_QUEUE_ATOMIC(isize) run_test = 0;
+
+    Bench_Pool_Thread threads[TEST_MAX_THREADS] = {0};
+    for(isize i = 0; i < waiters_count; i++)
+    {
+        threads[i].started = &started;
+        threads[i].finished = &finished;
+        threads[i].run_test = &run_test;
+        threads[i].pool = &pool;
+        threads[i].thread = lc_pool_thread_add(&pool);
+        threads[i].user = user;
+        threads[i].latency_hist = latency_hist ? (Bench_Hist*) calloc(1, sizeof(Bench_Hist)) : NULL;
+        test_cl_launch_thread(bench_lc_pool_wait_thread_func, &threads[i]);
+    }
+
+    int32_t producer = lc_pool_thread_add(&pool);
+    while(started != waiters_count);
+
+    int64_t before = test_cl_clock_ns();
+    double cpu_before = test_cl_process_cpu_seconds();
+    int64_t deadline = before + (int64_t) (time*1e9);
+    run_test = 1;
+    while(test_cl_clock_ns() < deadline)
+    {
+        test_cl_sleep_thread(push_interval);
+        isize item = test_cl_clock_ns();
+        lc_pool_push(&pool, producer, &item, sizeof item);
+    }
+    
+    run_test = 2;
+    lc_pool_wake_all(&pool);
+    while(finished != waiters_count);
+    
+    double cpu_after = test_cl_process_cpu_seconds();
+    int64_t after = test_cl_clock_ns();
+
+    Bench_Pool_Wait_Result result = {0};
+    uint64_t latency_sum = 0;
+    uint64_t latency_max = 0;
+    for(isize i = 0; i < waiters_count; i++)
+    {
+        result.items += threads[i].ops;
+        latency_sum += threads[i].latency_sum;
+        if(latency_max < threads[i].latency_max)
+            latency_max = threads[i].latency_max;
+        if(latency_hist)
+        {
+            bench_hist_merge(latency_hist, threads[i].latency_hist);
+            free(threads[i].latency_hist);
+        }
+    }
+
+    result.cpu_usage = (cpu_after - cpu_before) / ((double) (after - before)/1e9);
+    result.latency_avg_us = result.items ? (double) latency_sum/result.items/1e3 : 0;
+    result.latency_max_us = (double) latency_max/1e3;
+    lc_pool_deinit(&pool);
+    return result;
+}
+
 //#pragma comment(lib, "kernel32.lib")
 static Bench_Pool_Result bench_lc_pool_single(uint64_t user, bool double_sided, isize item_count, isize a_count, isize b_count, double time, void (*func)(void*))
 {
@@ -443,11 +1522,29 @@ static Bench_Pool_Result bench_lc_pool_single(uint64_t user, bool double_sided,
     LC_Pool pool_b = {0};
     lc_pool_init(&pool_a, sizeof(isize), TEST_MAX_THREADS);
     lc_pool_init(&pool_b, sizeof(isize), TEST_MAX_THREADS);
+    lc_pool_set_victim_policy(&pool_a, (LC_Pool_Victim_Policy) ((user >> BENCH_LC_POOL_POLICY_SHIFT) & 0xF));
+    lc_pool_set_victim_policy(&pool_b, (LC_Pool_Victim_Policy) ((user >> BENCH_LC_POOL_POLICY_SHIFT) & 0xF));
+    if(user & BENCH_LC_POOL_CLEAR_ALWAYS)
+        pool_a.stale_interval_ns = pool_b.stale_interval_ns = 0;
+    if(user & BENCH_LC_POOL_CLEAR_NEVER)
+        pool_a.asymmetric_barrier = pool_b.asymmetric_barrier = false;
 
     CL_QUEUE_ATOMIC(isize) started = 0;
     CL_QUEUE_ATOMIC(isize) finished = 0;
     CL_QUEUE_ATOMIC(isize) run_test = 0;
-    CL_QUEUE_ATOMIC(uint64_t) target = 0;
+    alignas(16) CL_QUEUE_ATOMIC(uint64_t) target[2] = {0};
+    Fat_Stack fat_stack = {0};
+    fat_stack_init(&fat_stack);
+    fat_stack.use_lock = fat_stack.use_lock || user == BENCH_LC_POOL_FAT_STACK_LOCK;
+
+    LC_Pool_Topology topology = {0};
+    lc_pool_topology_read(&topology);
+    isize cpus_count = topology.cpus_count > 0 ? topology.cpus_count : TEST_MAX_THREADS;
+    if(user & BENCH_LC_POOL_USE_TOPOLOGY)
+    {
+        lc_pool_set_topology(&pool_a, &topology);
+        lc_pool_set_topology(&pool_b, &topology);
+    }
     
     //start all threads
     Bench_Pool_Thread threads[TEST_MAX_THREADS] = {0};
@@ -488,7 +1585,8 @@ static Bench_Pool_Result bench_lc_pool_single(uint64_t user, bool double_sided,
         threads[i].started = &started;
         threads[i].finished = &finished;
         threads[i].run_test = &run_test;
-        threads[i].target = &target;
+        threads[i].target = target;
+        threads[i].fat_stack = &fat_stack;
         threads[i].is_push = i < a_count;
         threads[i].pool = &pool_a;
         threads[i].thread = handle_a;
@@ -498,6 +1596,13 @@ static Bench_Pool_Result bench_lc_pool_single(uint64_t user, bool double_sided,
         threads[i].pool_b = &pool_b;
         threads[i].thread_a = handle_a;
         threads[i].thread_b = handle_b;
+        threads[i].pin_cpu = user & BENCH_LC_POOL_PIN_THREADS ? (int32_t) (i % cpus_count) : -1;
+
+        if(user & BENCH_LC_POOL_USE_TOPOLOGY)
+        {
+            lc_pool_thread_set_cpu(&pool_a, handle_a, threads[i].pin_cpu);
+            lc_pool_thread_set_cpu(&pool_b, handle_b, threads[i].pin_cpu);
+        }
 
         test_cl_launch_thread(func, &threads[i]);
     }
@@ -507,17 +1612,15 @@ static Bench_Pool_Result bench_lc_pool_single(uint64_t user, bool double_sided,
     {
         while(started != a_count + b_count);
         run_test = 1;
-        isize clocks_before = clock();
-        
-        //void __declspec(dllimport) __stdcall Sleep(unsigned long dwMilliseconds);
-        Sleep((unsigned long) (time*1000));
-
+        int64_t before = test_cl_clock_ns();
+        test_cl_sleep_thread(time);
         run_test = 2;
-        isize clocks_after = clock();
+        int64_t after = test_cl_clock_ns();
         while(finished != a_count + b_count);
 
         //sleep is very inacurrate on windows so we use the time the test really took
-        actual_time = (double)(clocks_after - clocks_before)/CLOCKS_PER_SEC;
+        // (wall time, clock() is cpu time of the whole process on linux)
+        actual_time = (double)(after - before)*1e-9;
     }
     
     Bench_Pool_Result result = {0};
@@ -541,8 +1644,10 @@ static Bench_Pool_Result bench_lc_pool_single(uint64_t user, bool double_sided,
             result.capacity_max = (uint64_t) capacity_b;
     }
 
+    lc_pool_topology_deinit(&topology);
     lc_pool_deinit(&pool_a);
     lc_pool_deinit(&pool_b);
+    fat_stack_deinit(&fat_stack);
     return result;
 }
 
@@ -598,6 +1703,27 @@ void bench_lc_pool(double time, isize max_threads)
             printf(" reserved:%lli MB max_capacity:%lli MB \n", reserve_count/(1024*1024), res.capacity_max/(1024*1024));
     }
     
+    //if(0)
+    for(isize i = 2; i <= max_threads; i++)
+    {
+        const char* names[3] = {"ping/pong", "50/50", "1 push N pop"};
+        const char* policy_names[4] = {"sequential", "random", "two choices", "sticky"};
+        void (*funcs[3])(void*) = {bench_lc_pool_ping_pong_thread_func, bench_lc_pool_50_50_thread_func, bench_lc_pool_asymetric_thread_func};
+        for(isize k = 0; k < 3; k++)
+        {
+            isize a_count = k == 2 ? 1 : i/2;
+            isize b_count = k == 2 ? i - 1 : (i + 1)/2;
+            printf("%s victims: threads:%2lli", names[k], i);
+            for(isize policy = 0; policy < 4; policy++)
+            {
+                uint64_t user = (uint64_t) policy << BENCH_LC_POOL_POLICY_SHIFT;
+                Bench_Pool_Result res = bench_lc_pool_repeated(user, false, reserve_count, a_count, b_count, time, repeats, funcs[k]);
+                printf(" %s:%7.2lf", policy_names[policy], (double) res.ops/(res.time*1e6));
+            }
+            printf(" millions/s\n");
+        }
+    }
+
     reserve_count = 1024*1024*16;
     if(0)
     for(isize i = 1; i < max_threads; i++)
@@ -623,6 +1749,85 @@ void bench_lc_pool(double time, isize max_threads)
             printf(" reserved:%lli MB max_capacity:%lli MB \n", reserve_count/(1024*1024), res.capacity_max/(1024*1024));
     }
     
+    //if(0)
+    for(isize i = 2; i <= max_threads; i++)
+    {
+        //Producers outrun the consumers. Without a limit the pool keeps on growing.
+        isize item_count = 1000*1000*10;
+        Test_Pool_Runaway_Result unlimited = test_lc_pool_runaway(-1, i/2, (i + 1)/2, item_count, 100);
+        Test_Pool_Runaway_Result limited = test_lc_pool_runaway(100000, i/2, (i + 1)/2, item_count, 100);
+        printf("runaway producers: threads:%2lli unlimited: items:%9lli blocks:%7.2lf MB limited: items:%9lli blocks:%7.2lf MB\n", 
+            i, unlimited.max_items, (double) unlimited.max_block_size/(1024*1024), limited.max_items, (double) limited.max_block_size/(1024*1024));
+    }
+
+    //if(0)
+    for(isize i = 1; i <= max_threads; i++)
+    {
+        //All threads are already added (and removed) by bench_lc_pool_single so reusing
+        // a thread used to mean scanning all of them. 
+        Bench_Pool_Result res = bench_lc_pool_repeated(0, false, 0, i, 0, time, repeats, bench_lc_pool_register_thread_func);
+        printf("thread add/remove: threads:%2lli throughput:%7.2lf millions/s total:%10lli (%4.2lf success rate) \n", i, (double) res.ops/(res.time*1e6), res.ops, (double)res.ops/res.tries);
+    }
+
+    //if(0)
+    for(isize i = 1; i < max_threads; i++)
+    {
+        //a push every 1ms so the pool is idle most of the time
+        Bench_Pool_Wait_Result spin = bench_lc_pool_wait_single(BENCH_LC_POOL_WAIT_SPIN, i, time, 0.001, NULL);
+        Bench_Pool_Wait_Result park = bench_lc_pool_wait_single(BENCH_LC_POOL_WAIT_PARK, i, time, 0.001, NULL);
+        printf("wait spin/park: waiters:%2lli cpu:%5.2lf/%5.2lf cores latency avg:%7.2lf/%7.2lf us max:%8.2lf/%8.2lf us\n", i, 
+            spin.cpu_usage, park.cpu_usage, spin.latency_avg_us, park.latency_avg_us, spin.latency_max_us, park.latency_max_us);
+    }
+
+    //if(0)
+    for(isize i = 2; i <= max_threads; i++)
+    {
+        //both pinned the same way, only the second one knows about the topology
+        uint64_t pinned = BENCH_LC_POOL_PIN_THREADS;
+        uint64_t hierarchical = BENCH_LC_POOL_PIN_THREADS | BENCH_LC_POOL_USE_TOPOLOGY;
+        Bench_Pool_Result flat = bench_lc_pool_repeated(pinned, false, reserve_count, i/2, (i + 1)/2, time, repeats, bench_lc_pool_50_50_thread_func);
+        Bench_Pool_Result topo = bench_lc_pool_repeated(hierarchical, false, reserve_count, i/2, (i + 1)/2, time, repeats, bench_lc_pool_50_50_thread_func);
+        printf("50/50 pinned: threads:%2lli round-robin/hierarchical:%7.2lf/%7.2lf millions/s\n", i, 
+            (double) flat.ops/(flat.time*1e6), (double) topo.ops/(topo.time*1e6));
+        
+        flat = bench_lc_pool_repeated(pinned, false, reserve_count, 1, i - 1, time, repeats, bench_lc_pool_asymetric_thread_func);
+        topo = bench_lc_pool_repeated(hierarchical, false, reserve_count, 1, i - 1, time, repeats, bench_lc_pool_asymetric_thread_func);
+        printf("1 push N pop pinned: threads:%2lli round-robin/hierarchical:%7.2lf/%7.2lf millions/s\n", i, 
+            (double) flat.ops/(flat.time*1e6), (double) topo.ops/(topo.time*1e6));
+    }
+
+    //if(0)
+    for(isize i = 1; i <= max_threads; i++)
+    {
+        //ops are the ops of the single busy worker, tries are the (mostly failed) steal attempts of the idle ones
+        Bench_Pool_Result mask = bench_lc_pool_repeated(BENCH_LC_POOL_IDLE_MASK, false, 0, 1, i - 1, time, repeats, bench_lc_pool_idle_thread_func);
+        Bench_Pool_Result scan = bench_lc_pool_repeated(BENCH_LC_POOL_IDLE_SCAN, false, 0, 1, i - 1, time, repeats, bench_lc_pool_idle_thread_func);
+        printf("1 busy N idle: threads:%2lli worker mask/scan:%7.2lf/%7.2lf millions/s idle pops mask/scan:%7.2lf/%7.2lf millions/s \n", i, 
+            (double) mask.ops/(mask.time*1e6), (double) scan.ops/(scan.time*1e6), 
+            (double) mask.tries/(mask.time*1e6), (double) scan.tries/(scan.time*1e6));
+    }
+
+    //if(0)
+    for(isize i = 2; i <= max_threads; i++)
+    {
+        //Nearly every failed steal finds the queue of the producer drained with its bit still set. 
+        // Clearing it costs a barrier on every cpu, never clearing it makes failed pops visit the queue.
+        uint64_t never = BENCH_LC_POOL_CLEAR_NEVER;
+        uint64_t always = BENCH_LC_POOL_CLEAR_ALWAYS;
+        Bench_Pool_Result none = bench_lc_pool_repeated(never, false, reserve_count, 1, i - 1, time, repeats, bench_lc_pool_asymetric_thread_func);
+        Bench_Pool_Result each = bench_lc_pool_repeated(always, false, reserve_count, 1, i - 1, time, repeats, bench_lc_pool_asymetric_thread_func);
+        Bench_Pool_Result limited = bench_lc_pool_repeated(0, false, reserve_count, 1, i - 1, time, repeats, bench_lc_pool_asymetric_thread_func);
+        printf("1 push N pop stale bits: threads:%2lli never/always/limited clear:%7.2lf/%7.2lf/%7.2lf millions/s\n", i, 
+            (double) none.ops/(none.time*1e6), (double) each.ops/(each.time*1e6), (double) limited.ops/(limited.time*1e6));
+        
+        none = bench_lc_pool_repeated(BENCH_LC_POOL_IDLE_MASK | never, false, 0, 1, i - 1, time, repeats, bench_lc_pool_idle_thread_func);
+        each = bench_lc_pool_repeated(BENCH_LC_POOL_IDLE_MASK | always, false, 0, 1, i - 1, time, repeats, bench_lc_pool_idle_thread_func);
+        limited = bench_lc_pool_repeated(BENCH_LC_POOL_IDLE_MASK, false, 0, 1, i - 1, time, repeats, bench_lc_pool_idle_thread_func);
+        printf("1 busy N idle stale bits: threads:%2lli never/always/limited clear worker:%7.2lf/%7.2lf/%7.2lf millions/s idle pops:%7.2lf/%7.2lf/%7.2lf millions/s\n", i, 
+            (double) none.ops/(none.time*1e6), (double) each.ops/(each.time*1e6), (double) limited.ops/(limited.time*1e6),
+            (double) none.tries/(none.time*1e6), (double) each.tries/(each.time*1e6), (double) limited.tries/(limited.time*1e6));
+    }
+
     //if(0)
     for(isize i = 1; i <= max_threads; i++)
     {
@@ -650,4 +1855,25 @@ void bench_lc_pool(double time, isize max_threads)
         Bench_Pool_Result res = bench_lc_pool_repeated(BENCH_LC_POOL_HALF_CAS, false, 0, i, 0, time, repeats, bench_lc_pool_faa_thread_func);
         printf("half CAS: threads:%2lli throughput:%7.2lf millions/s total:%10lli (%4.2lf success rate) \n", i, (double) res.ops/(res.time*1e6), res.ops, (double)res.ops/res.tries);
     }
+    
+    if(FAT_STACK_CAS128 && fat_stack_has_cas128())
+    for(isize i = 1; i <= max_threads; i++)
+    {
+        Bench_Pool_Result res = bench_lc_pool_repeated(BENCH_LC_POOL_CAS128, false, 0, i, 0, time, repeats, bench_lc_pool_faa_thread_func);
+        printf("CAS128: threads:%2lli throughput:%7.2lf millions/s total:%10lli (%4.2lf success rate) \n", i, (double) res.ops/(res.time*1e6), res.ops, (double)res.ops/res.tries);
+    }
+    
+    //if(0)
+    for(isize i = 1; i <= max_threads; i++)
+    {
+        Bench_Pool_Result res = bench_lc_pool_repeated(BENCH_LC_POOL_FAT_STACK, false, 0, i, 0, time, repeats, bench_lc_pool_faa_thread_func);
+        printf("fat stack: threads:%2lli throughput:%7.2lf millions/s total:%10lli (%4.2lf success rate) \n", i, (double) res.ops/(res.time*1e6), res.ops, (double)res.ops/res.tries);
+    }
+    
+    //if(0)
+    for(isize i = 1; i <= max_threads; i++)
+    {
+        Bench_Pool_Result res = bench_lc_pool_repeated(BENCH_LC_POOL_FAT_STACK_LOCK, false, 0, i, 0, time, repeats, bench_lc_pool_faa_thread_func);
+        printf("fat stack locked: threads:%2lli throughput:%7.2lf millions/s total:%10lli (%4.2lf success rate) \n", i, (double) res.ops/(res.time*1e6), res.ops, (double)res.ops/res.tries);
+    }
 }
\ No newline at end of file
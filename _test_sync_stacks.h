@@ -0,0 +1,584 @@
+#pragma once
+
+#include "sync_stacks.h"
+
+#include "_test_chase_lev_queue.h"
+
+enum {TEST_SYNC_STACKS_MAX_THREADS = 64};
+
+typedef enum Test_Sync_Stack_Kind {
+    TEST_SYNC_STACK_FAT,
+    TEST_SYNC_STACK_FAT_LOCK,
+    TEST_SYNC_STACK_PACK,
+    TEST_SYNC_STACK_INDEX,
+    TEST_SYNC_STACK_KIND_COUNT,
+} Test_Sync_Stack_Kind;
+
+static const char* test_sync_stack_kind_names[TEST_SYNC_STACK_KIND_COUNT] = {"fat", "fat locked", "pack", "index"};
+
+//All stacks behind one interface so that the tests and benches can be shared
+typedef struct Test_Sync_Stack {
+    Fat_Stack fat;
+    Pack_Stack pack;
+    Index_Stack index;
+    Test_Sync_Stack_Kind kind;
+} Test_Sync_Stack;
+
+static void test_sync_stack_init(Test_Sync_Stack* stack, Test_Sync_Stack_Kind kind, bool elimination)
+{
+    stack->kind = kind;
+    if(kind == TEST_SYNC_STACK_PACK)
+    {
+        TEST(pack_stack_init(&stack->pack));
+        if(elimination)
+            pack_stack_enable_elimination(&stack->pack);
+    }
+    else if(kind == TEST_SYNC_STACK_INDEX)
+    {
+        index_stack_init(&stack->index, sizeof(isize));
+        if(elimination)
+            index_stack_enable_elimination(&stack->index);
+    }
+    else
+    {
+        fat_stack_init(&stack->fat);
+        stack->fat.use_lock = stack->fat.use_lock || kind == TEST_SYNC_STACK_FAT_LOCK;
+        if(elimination)
+            fat_stack_enable_elimination(&stack->fat);
+    }
+}
+
+static void test_sync_stack_deinit(Test_Sync_Stack* stack)
+{
+    if(stack->kind == TEST_SYNC_STACK_PACK)
+        pack_stack_deinit(&stack->pack);
+    else if(stack->kind == TEST_SYNC_STACK_INDEX)
+        index_stack_deinit(&stack->index);
+    else
+        fat_stack_deinit(&stack->fat);
+}
+
+static void test_sync_stack_push(Test_Sync_Stack* stack, isize item)
+{
+    if(stack->kind == TEST_SYNC_STACK_PACK)
+        pack_stack_push(&stack->pack, &item, sizeof item);
+    else if(stack->kind == TEST_SYNC_STACK_INDEX)
+        index_stack_push(&stack->index, &item);
+    else
+        fat_stack_push(&stack->fat, &item, sizeof item);
+}
+
+static bool test_sync_stack_pop(Test_Sync_Stack* stack, isize* item)
+{
+    if(stack->kind == TEST_SYNC_STACK_PACK)
+        return pack_stack_pop(&stack->pack, item, sizeof *item);
+    else if(stack->kind == TEST_SYNC_STACK_INDEX)
+        return index_stack_pop(&stack->index, item);
+    else
+        return fat_stack_pop(&stack->fat, item, sizeof *item);
+}
+
+void test_gen_ptr_pack()
+{
+    uint64_t ptrs[] = {0, 16, 0x7FFFFFFFFFF0, 0xFFFFFFFFFFF0, 0x123456789AB0};
+    uint64_t gens[] = {0, 1, 12345, ((uint64_t) 1 << 20) - 1};
+    for(isize i = 0; i < (isize) (sizeof ptrs / sizeof *ptrs); i++)
+        for(isize k = 0; k < (isize) (sizeof gens / sizeof *gens); k++)
+        {
+            Pack_Ptr packed = gen_ptr_pack((void*) (uintptr_t) ptrs[i], gens[k], PACK_STACK_ALIGN);
+            Unpack_Ptr unpacked = gen_ptr_unpack(packed, PACK_STACK_ALIGN);
+            TEST((uint64_t) (uintptr_t) unpacked.ptr == ptrs[i]);
+            TEST(unpacked.gen == gens[k]);
+        }
+
+    //the generation wraps without touching the pointer
+    Pack_Ptr wrapped = gen_ptr_pack((void*) (uintptr_t) 0x1230, (uint64_t) 1 << 20, PACK_STACK_ALIGN);
+    TEST(gen_ptr_unpack(wrapped, PACK_STACK_ALIGN).gen == 0);
+    TEST((uint64_t) (uintptr_t) gen_ptr_unpack(wrapped, PACK_STACK_ALIGN).ptr == 0x1230);
+
+    isize va_bits = pack_stack_va_bits();
+    TEST(va_bits >= 32 && va_bits <= 64);
+}
+
+void test_sync_stack_sequential(isize count, Test_Sync_Stack_Kind kind, bool elimination)
+{
+    Test_Sync_Stack stack = {0};
+    test_sync_stack_init(&stack, kind, elimination);
+
+    isize dummy = 0;
+    TEST(test_sync_stack_pop(&stack, &dummy) == false);
+    for(isize round = 0; round < 2; round++)
+    {
+        for(isize i = 0; i < count; i++)
+            test_sync_stack_push(&stack, i);
+
+        //LIFO
+        for(isize i = count; i-- > 0; )
+        {
+            isize popped = -1;
+            TEST(test_sync_stack_pop(&stack, &popped));
+            TEST(popped == i);
+        }
+        TEST(test_sync_stack_pop(&stack, &dummy) == false);
+    }
+
+    test_sync_stack_deinit(&stack);
+}
+
+typedef struct Test_Sync_Stack_Thread {
+    CL_QUEUE_ATOMIC(isize)* started;
+    CL_QUEUE_ATOMIC(isize)* finished;
+    Test_Sync_Stack* stack;
+
+    isize index;
+    int64_t deadline;
+    isize pushed_count;
+    Test_CL_Buffer popped;
+} Test_Sync_Stack_Thread;
+
+static void test_sync_stack_thread_func(void* arg)
+{
+    Test_Sync_Stack_Thread* thread = (Test_Sync_Stack_Thread*) arg;
+    atomic_fetch_add(thread->started, 1);
+
+    for(isize iter = 0; iter % 256 != 0 || test_cl_clock_ns() < thread->deadline; iter++)
+    {
+        //pushes in bursts so that the stack grows and shrinks
+        if(iter % 64 < 32)
+        {
+            test_sync_stack_push(thread->stack, thread->index << 40 | thread->pushed_count);
+            thread->pushed_count += 1;
+        }
+        else
+        {
+            isize item = 0;
+            if(test_sync_stack_pop(thread->stack, &item))
+                test_cl_buffer_push(&thread->popped, &item, 1);
+        }
+    }
+
+    atomic_fetch_add(thread->finished, 1);
+}
+
+//All threads push and pop. Checks that every item gets popped exactly once.
+void test_sync_stack_concurrent(double time, isize threads_count, Test_Sync_Stack_Kind kind, bool elimination)
+{
+    Test_Sync_Stack stack = {0};
+    test_sync_stack_init(&stack, kind, elimination);
+
+    CL_QUEUE_ATOMIC(isize) started = 0;
+    CL_QUEUE_ATOMIC(isize) finished = 0;
+    Test_Sync_Stack_Thread threads[TEST_SYNC_STACKS_MAX_THREADS] = {0};
+    int64_t deadline = test_cl_clock_ns() + (int64_t) (time*1e9);
+    for(isize i = 0; i < threads_count; i++)
+    {
+        threads[i].started = &started;
+        threads[i].finished = &finished;
+        threads[i].stack = &stack;
+        threads[i].index = i;
+        threads[i].deadline = deadline;
+        test_cl_launch_thread(test_sync_stack_thread_func, &threads[i]);
+    }
+
+    while(finished != threads_count);
+
+    Test_CL_Buffer buffer = {0};
+    for(isize i = 0; i < threads_count; i++)
+        test_cl_buffer_push(&buffer, threads[i].popped.data, threads[i].popped.count);
+
+    isize rest = 0;
+    while(test_sync_stack_pop(&stack, &rest))
+        test_cl_buffer_push(&buffer, &rest, 1);
+
+    qsort(buffer.data, buffer.count, sizeof(isize), test_cl_isize_comp_func);
+    isize at = 0;
+    for(isize i = 0; i < threads_count; i++)
+        for(isize k = 0; k < threads[i].pushed_count; k++, at++)
+            TEST(at < buffer.count && buffer.data[at] == (i << 40 | k));
+    TEST(at == buffer.count);
+
+    for(isize i = 0; i < threads_count; i++)
+        test_cl_buffer_deinit(&threads[i].popped);
+    test_cl_buffer_deinit(&buffer);
+    test_sync_stack_deinit(&stack);
+}
+
+typedef struct Test_Index_Stack_Alloc_Thread {
+    CL_QUEUE_ATOMIC(isize)* started;
+    CL_QUEUE_ATOMIC(isize)* finished;
+    Index_Stack* stack;
+    isize index;
+    int64_t deadline;
+} Test_Index_Stack_Alloc_Thread;
+
+static void test_index_stack_alloc_thread_func(void* arg)
+{
+    Test_Index_Stack_Alloc_Thread* thread = (Test_Index_Stack_Alloc_Thread*) arg;
+    atomic_fetch_add(thread->started, 1);
+
+    Index_Stack_Allocation allocations[64] = {0};
+    uint64_t random = (uint64_t) thread->index*0x9E3779B97F4A7C15 + 1;
+    for(isize iter = 0, seq = 0; iter % 16 != 0 || test_cl_clock_ns() < thread->deadline; iter++)
+    {
+        random = random*6364136223846793005 + 1442695040888963407;
+        isize count = (isize) (random >> 58) + 1;
+        for(isize i = 0; i < count; i++, seq++)
+        {
+            allocations[i] = index_stack_alloc(thread->stack);
+            TEST(allocations[i].ptr != NULL);
+            TEST(allocations[i].ptr == index_stack_at(thread->stack, allocations[i].index));
+            //everything is zeroed on free so anything else means someone else holds it as well
+            TEST(*(isize*) allocations[i].ptr == 0);
+            *(isize*) allocations[i].ptr = thread->index << 40 | seq;
+        }
+
+        for(isize i = 0; i < count; i++)
+        {
+            TEST(*(isize*) allocations[i].ptr == (thread->index << 40 | (seq - count + i)));
+            *(isize*) allocations[i].ptr = 0;
+            index_stack_free(thread->stack, allocations[i].index);
+        }
+    }
+
+    atomic_fetch_add(thread->finished, 1);
+}
+
+//Index_Stack used as an allocator. Checks that no object is ever handed out twice.
+void test_index_stack_alloc_concurrent(double time, isize threads_count)
+{
+    Index_Stack stack = {0};
+    index_stack_init(&stack, sizeof(isize));
+
+    CL_QUEUE_ATOMIC(isize) started = 0;
+    CL_QUEUE_ATOMIC(isize) finished = 0;
+    Test_Index_Stack_Alloc_Thread threads[TEST_SYNC_STACKS_MAX_THREADS] = {0};
+    int64_t deadline = test_cl_clock_ns() + (int64_t) (time*1e9);
+    for(isize i = 0; i < threads_count; i++)
+    {
+        threads[i].started = &started;
+        threads[i].finished = &finished;
+        threads[i].stack = &stack;
+        threads[i].index = i;
+        threads[i].deadline = deadline;
+        test_cl_launch_thread(test_index_stack_alloc_thread_func, &threads[i]);
+    }
+
+    while(finished != threads_count);
+
+    //everything got freed so we can allocate the whole capacity exactly once without growing
+    isize capacity = atomic_load(&stack.mem.capacity);
+    TEST(capacity <= INDEX_STACK_BLOCK_SIZE*threads_count*2);
+    Test_CL_Buffer indices = {0};
+    for(isize i = 0; i < capacity; i++)
+    {
+        isize index = (isize) index_stack_alloc(&stack).index;
+        test_cl_buffer_push(&indices, &index, 1);
+    }
+    TEST(atomic_load(&stack.mem.capacity) == capacity);
+
+    qsort(indices.data, indices.count, sizeof(isize), test_cl_isize_comp_func);
+    for(isize i = 0; i < indices.count; i++)
+        TEST(indices.data[i] == i);
+
+    test_cl_buffer_deinit(&indices);
+    index_stack_deinit(&stack);
+}
+
+typedef struct Test_Elim_Thread {
+    Elim_Array* elim;
+    isize count;
+    CL_QUEUE_ATOMIC(isize)* finished;
+} Test_Elim_Thread;
+
+static void test_elim_pusher_func(void* arg)
+{
+    Test_Elim_Thread* thread = (Test_Elim_Thread*) arg;
+    for(isize i = 0; i < thread->count; i++)
+        while(_elim_try_push(thread->elim, &i) == false);
+    atomic_fetch_add(thread->finished, 1);
+}
+
+//One thread only offers, the other only takes. Every item has to arrive exactly once and in order.
+void test_elim_array_exchange(isize count)
+{
+    Elim_Array* elim = elim_array_new();
+    CL_QUEUE_ATOMIC(isize) finished = 0;
+    Test_Elim_Thread pusher = {elim, count, &finished};
+    test_cl_launch_thread(test_elim_pusher_func, &pusher);
+
+    for(isize i = 0; i < count; i++)
+    {
+        isize item = -1;
+        while(_elim_try_pop(elim, &item, sizeof item) == false);
+        TEST(item == i);
+    }
+
+    while(finished != 1);
+    TEST(atomic_load(&elim->width) >= 1 && atomic_load(&elim->width) <= ELIM_MAX_WIDTH);
+    for(isize i = 0; i < ELIM_MAX_WIDTH; i++)
+        TEST(atomic_load(&elim->slots[i].state) == ELIM_EMPTY);
+    free(elim);
+}
+
+void test_sync_stacks(double time, isize max_threads)
+{
+    test_gen_ptr_pack();
+    test_elim_array_exchange(100);
+    for(isize elimination = 0; elimination < 2; elimination++)
+        for(isize kind = 0; kind < TEST_SYNC_STACK_KIND_COUNT; kind++)
+        {
+            test_sync_stack_sequential(0, (Test_Sync_Stack_Kind) kind, elimination);
+            test_sync_stack_sequential(1, (Test_Sync_Stack_Kind) kind, elimination);
+            test_sync_stack_sequential(1000, (Test_Sync_Stack_Kind) kind, elimination);
+            for(isize i = 1; i <= max_threads; i++)
+                test_sync_stack_concurrent(time/max_threads/TEST_SYNC_STACK_KIND_COUNT/2, i, (Test_Sync_Stack_Kind) kind, elimination);
+        }
+
+    for(isize i = 1; i <= max_threads; i++)
+        test_index_stack_alloc_concurrent(time/max_threads/TEST_SYNC_STACK_KIND_COUNT, i);
+}
+
+typedef struct Bench_Sync_Stack_Thread {
+    CL_QUEUE_ATOMIC(isize)* started;
+    CL_QUEUE_ATOMIC(isize)* finished;
+    CL_QUEUE_ATOMIC(isize)* run_test;
+    Test_Sync_Stack* stack;
+    isize push_percent; //0 means push + pop pairs
+    isize index;
+    isize ops;
+} Bench_Sync_Stack_Thread;
+
+static void bench_sync_stack_func(void* arg)
+{
+    Bench_Sync_Stack_Thread* thread = (Bench_Sync_Stack_Thread*) arg;
+    atomic_fetch_add(thread->started, 1);
+    while(*thread->run_test == 0);
+
+    //push + pop pairs so that everyone hammers the same head
+    isize item = 0;
+    if(thread->push_percent == 0)
+        while(*thread->run_test == 1)
+        {
+            test_sync_stack_push(thread->stack, item);
+            thread->ops += test_sync_stack_pop(thread->stack, &item);
+        }
+    //random looking mix. 37 is coprime with 100 so every 100 iterations cover all percents.
+    else
+        for(isize iter = thread->index*13; *thread->run_test == 1; iter++)
+        {
+            if(iter*37 % 100 < thread->push_percent)
+            {
+                test_sync_stack_push(thread->stack, item);
+                thread->ops += 1;
+            }
+            else
+                thread->ops += test_sync_stack_pop(thread->stack, &item);
+        }
+
+    atomic_fetch_add(thread->finished, 1);
+}
+
+static double bench_sync_stack_single(isize threads_count, Test_Sync_Stack_Kind kind, bool elimination, isize push_percent, double time)
+{
+    Test_Sync_Stack stack = {0};
+    test_sync_stack_init(&stack, kind, elimination);
+    CL_QUEUE_ATOMIC(isize) started = 0;
+    CL_QUEUE_ATOMIC(isize) finished = 0;
+    CL_QUEUE_ATOMIC(isize) run_test = 0;
+
+    Bench_Sync_Stack_Thread threads[TEST_SYNC_STACKS_MAX_THREADS] = {0};
+    for(isize i = 0; i < threads_count; i++)
+    {
+        threads[i].started = &started;
+        threads[i].finished = &finished;
+        threads[i].run_test = &run_test;
+        threads[i].stack = &stack;
+        threads[i].push_percent = push_percent;
+        threads[i].index = i;
+        test_cl_launch_thread(bench_sync_stack_func, &threads[i]);
+    }
+
+    while(started != threads_count);
+    int64_t before = test_cl_clock_ns();
+    run_test = 1;
+    test_cl_sleep_thread(time);
+    run_test = 2;
+    int64_t after = test_cl_clock_ns();
+    while(finished != threads_count);
+
+    isize ops = 0;
+    for(isize i = 0; i < threads_count; i++)
+        ops += threads[i].ops;
+
+    test_sync_stack_deinit(&stack);
+    return (double) ops/((double) (after - before)*1e-9);
+}
+
+//push+pop pairs per second for each stack side by side
+void bench_sync_stacks(double time, isize max_threads)
+{
+    printf("sync stacks: cas128:%i va bits:%lli\n", (int) (FAT_STACK_CAS128 && fat_stack_has_cas128()), pack_stack_va_bits());
+    if(max_threads > TEST_SYNC_STACKS_MAX_THREADS)
+        max_threads = TEST_SYNC_STACKS_MAX_THREADS;
+
+    for(isize threads = 1; threads <= max_threads; threads++)
+    {
+        printf("sync stacks threads:%2lli", threads);
+        for(isize kind = 0; kind < TEST_SYNC_STACK_KIND_COUNT; kind++)
+        {
+            double ops = bench_sync_stack_single(threads, (Test_Sync_Stack_Kind) kind, false, 0, time);
+            printf(" %s:%7.2lf M/s", test_sync_stack_kind_names[kind], ops*1e-6);
+        }
+        printf("\n");
+    }
+}
+
+//Successful pushes and pops per second with and without the elimination array.
+// 50/50 is the symmetric case where elimination should shine. 
+// In 90/10 90% are pops so the stack is mostly empty and pops mostly wait for pushes.
+void bench_sync_stacks_elimination(double time, isize max_threads)
+{
+    if(max_threads > TEST_SYNC_STACKS_MAX_THREADS)
+        max_threads = TEST_SYNC_STACKS_MAX_THREADS;
+
+    Test_Sync_Stack_Kind kinds[3] = {TEST_SYNC_STACK_FAT, TEST_SYNC_STACK_PACK, TEST_SYNC_STACK_INDEX};
+    isize push_percents[2] = {50, 10};
+    const char* mix_names[2] = {"50/50", "90/10"};
+    for(isize mix = 0; mix < 2; mix++)
+        for(isize threads = 1; threads <= max_threads; threads++)
+        {
+            printf("elimination %s threads:%2lli", mix_names[mix], threads);
+            for(isize k = 0; k < 3; k++)
+            {
+                double off = bench_sync_stack_single(threads, kinds[k], false, push_percents[mix], time);
+                double on = bench_sync_stack_single(threads, kinds[k], true, push_percents[mix], time);
+                printf(" %s:%6.2lf/%6.2lf M/s", test_sync_stack_kind_names[kinds[k]], off*1e-6, on*1e-6);
+            }
+            printf("\n");
+        }
+}
+
+typedef enum Bench_Sync_Alloc_Kind {
+    BENCH_SYNC_ALLOC_MALLOC,
+    BENCH_SYNC_ALLOC_PACK,
+    BENCH_SYNC_ALLOC_INDEX,
+    BENCH_SYNC_ALLOC_KIND_COUNT,
+} Bench_Sync_Alloc_Kind;
+
+typedef struct Bench_Sync_Alloc_Thread {
+    CL_QUEUE_ATOMIC(isize)* started;
+    CL_QUEUE_ATOMIC(isize)* finished;
+    CL_QUEUE_ATOMIC(isize)* run_test;
+    Bench_Sync_Alloc_Kind kind;
+    Index_Stack* index_stack;
+    CL_QUEUE_ATOMIC(Pack_Ptr)* pack_free_list;
+    isize object_size;
+    isize batch;
+    isize ops;
+} Bench_Sync_Alloc_Thread;
+
+static void bench_sync_alloc_func(void* arg)
+{
+    Bench_Sync_Alloc_Thread* thread = (Bench_Sync_Alloc_Thread*) arg;
+    void* objects[256] = {0};
+    uint32_t indices[256] = {0};
+    atomic_fetch_add(thread->started, 1);
+    while(*thread->run_test == 0);
+
+    while(*thread->run_test == 1)
+    {
+        for(isize i = 0; i < thread->batch; i++)
+        {
+            if(thread->kind == BENCH_SYNC_ALLOC_MALLOC)
+                objects[i] = malloc((size_t) thread->object_size);
+            else if(thread->kind == BENCH_SYNC_ALLOC_PACK)
+            {
+                Fat_Stack_Slot* slot = _pack_stack_pop(thread->pack_free_list);
+                if(slot == NULL)
+                    slot = (Fat_Stack_Slot*) malloc(sizeof(Fat_Stack_Slot) + (size_t) thread->object_size);
+                objects[i] = slot->data;
+            }
+            else
+            {
+                Index_Stack_Allocation allocation = index_stack_alloc(thread->index_stack);
+                objects[i] = allocation.ptr;
+                indices[i] = allocation.index;
+            }
+            *(volatile isize*) objects[i] = i;
+        }
+
+        for(isize i = 0; i < thread->batch; i++)
+        {
+            if(thread->kind == BENCH_SYNC_ALLOC_MALLOC)
+                free(objects[i]);
+            else if(thread->kind == BENCH_SYNC_ALLOC_PACK)
+                _pack_stack_push(thread->pack_free_list, (Fat_Stack_Slot*) objects[i] - 1);
+            else
+                index_stack_free(thread->index_stack, indices[i]);
+        }
+        thread->ops += thread->batch;
+    }
+
+    atomic_fetch_add(thread->finished, 1);
+}
+
+static double bench_sync_alloc_single(isize threads_count, isize batch, isize object_size, Bench_Sync_Alloc_Kind kind, double time)
+{
+    Index_Stack index_stack = {0};
+    index_stack_init(&index_stack, object_size);
+    Pack_Stack pack_stack = {0};
+    TEST(pack_stack_init(&pack_stack));
+
+    CL_QUEUE_ATOMIC(isize) started = 0;
+    CL_QUEUE_ATOMIC(isize) finished = 0;
+    CL_QUEUE_ATOMIC(isize) run_test = 0;
+    Bench_Sync_Alloc_Thread threads[TEST_SYNC_STACKS_MAX_THREADS] = {0};
+    for(isize i = 0; i < threads_count; i++)
+    {
+        threads[i].started = &started;
+        threads[i].finished = &finished;
+        threads[i].run_test = &run_test;
+        threads[i].kind = kind;
+        threads[i].index_stack = &index_stack;
+        threads[i].pack_free_list = &pack_stack.first_free;
+        threads[i].object_size = object_size;
+        threads[i].batch = batch;
+        test_cl_launch_thread(bench_sync_alloc_func, &threads[i]);
+    }
+
+    while(started != threads_count);
+    int64_t before = test_cl_clock_ns();
+    run_test = 1;
+    test_cl_sleep_thread(time);
+    run_test = 2;
+    int64_t after = test_cl_clock_ns();
+    while(finished != threads_count);
+
+    isize ops = 0;
+    for(isize i = 0; i < threads_count; i++)
+        ops += threads[i].ops;
+
+    pack_stack_deinit(&pack_stack);
+    index_stack_deinit(&index_stack);
+    return (double) ops/((double) (after - before)*1e-9);
+}
+
+//The stacks used as a shared free list of fixed size objects (alloc batch then free batch) against malloc.
+void bench_sync_stacks_alloc(double time, isize max_threads)
+{
+    static const char* names[BENCH_SYNC_ALLOC_KIND_COUNT] = {"malloc", "pack", "index"};
+    if(max_threads > TEST_SYNC_STACKS_MAX_THREADS)
+        max_threads = TEST_SYNC_STACKS_MAX_THREADS;
+
+    for(isize batch = 1; batch <= 256; batch *= 16)
+        for(isize threads = 1; threads <= max_threads; threads++)
+        {
+            printf("sync stacks alloc batch:%3lli threads:%2lli", batch, threads);
+            for(isize kind = 0; kind < BENCH_SYNC_ALLOC_KIND_COUNT; kind++)
+            {
+                double ops = bench_sync_alloc_single(threads, batch, 64, (Bench_Sync_Alloc_Kind) kind, time);
+                printf(" %s:%7.2lf M/s", names[kind], ops*1e-6);
+            }
+            printf("\n");
+        }
+}
@@ -0,0 +1,206 @@
+#pragma once
+
+//Hazard pointers (Michael: Hazard Pointers: Safe Memory Reclamation for Lock-Free Objects).
+//Each thread owns a Hazard_Thread record with HAZARD_PTR_SLOTS slots. Before dereferencing a node
+// which another thread might free the reader publishes its address in a slot and then checks that
+// the node is still reachable. Nodes removed from a structure are retired instead of freed. Once a
+// thread has retired enough of them it scans the slots of all threads and frees everything no one
+// protects. The threshold grows with the number of threads so each scan frees at least half of
+// what was retired and the cost of scanning is amortized to O(1) per retired node.
+//Records are never freed before hazard_domain_deinit. Released records are reused by
+// hazard_thread_acquire together with whatever was left on their retired list.
+
+#include "chase_lev_queue.h"
+
+enum {
+    HAZARD_PTR_SLOTS = 4,
+    HAZARD_PTR_RETIRE_BATCH = 64, //smallest number of retired nodes that triggers a scan
+};
+
+typedef void (*Hazard_Free_Func)(void* ptr);
+
+typedef struct Hazard_Retired {
+    void* ptr;
+    Hazard_Free_Func free_func;
+} Hazard_Retired;
+
+typedef struct Hazard_Thread {
+    //Read by scanning threads
+    alignas(64)
+    CL_QUEUE_ATOMIC(void*) slots[HAZARD_PTR_SLOTS];
+    CL_QUEUE_ATOMIC(uint32_t) active;
+    struct Hazard_Thread* next; //never changes once the record is linked
+
+    //The rest is only used by the owner
+    alignas(64)
+    Hazard_Retired* retired;
+    isize retired_count;
+    isize retired_capacity;
+    void** scan_buffer; //all hazards found in the last scan
+    isize scan_capacity;
+    isize freed_count; //for stats
+} Hazard_Thread;
+
+typedef struct Hazard_Domain {
+    CL_QUEUE_ATOMIC(Hazard_Thread*) threads;
+    CL_QUEUE_ATOMIC(isize) threads_count;
+} Hazard_Domain;
+
+void hazard_domain_init(Hazard_Domain* domain);
+//Frees all records and everything still retired. No other thread may use the domain anymore.
+void hazard_domain_deinit(Hazard_Domain* domain);
+//Returns a record for the calling thread. Must be used by one thread at a time.
+Hazard_Thread* hazard_thread_acquire(Hazard_Domain* domain);
+//Clears the slots and gives the record back. Retired nodes which are still protected stay with the record.
+void hazard_thread_release(Hazard_Domain* domain, Hazard_Thread* thread);
+
+//Publishes ptr in slot. The caller still has to check ptr is reachable afterwards.
+CL_QUEUE_API_INLINE void hazard_set(Hazard_Thread* thread, isize slot, void* ptr);
+CL_QUEUE_API_INLINE void hazard_clear(Hazard_Thread* thread, isize slot);
+//Loads *from and protects it. Returns a pointer which stays valid until the slot is cleared or reused.
+CL_QUEUE_API_INLINE void* hazard_protect(Hazard_Thread* thread, isize slot, CL_QUEUE_ATOMIC(void*)* from);
+//ptr must be already unreachable for new readers. It is freed by free_func once no slot holds it.
+CL_QUEUE_API void hazard_retire(Hazard_Domain* domain, Hazard_Thread* thread, void* ptr, Hazard_Free_Func free_func);
+//Frees all retired nodes no one protects. Called by hazard_retire when needed.
+CL_QUEUE_API void hazard_scan(Hazard_Domain* domain, Hazard_Thread* thread);
+
+CL_QUEUE_API_INLINE void hazard_set(Hazard_Thread* thread, isize slot, void* ptr)
+{
+    ASSERT(0 <= slot && slot < HAZARD_PTR_SLOTS);
+    //The fence keeps the store from being reordered with the validating load which follows
+    // (pairs with the fence in hazard_scan). Its the only fence on the read side.
+    atomic_store_explicit(&thread->slots[slot], ptr, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+CL_QUEUE_API_INLINE void hazard_clear(Hazard_Thread* thread, isize slot)
+{
+    atomic_store_explicit(&thread->slots[slot], (void*) NULL, memory_order_release);
+}
+
+CL_QUEUE_API_INLINE void* hazard_protect(Hazard_Thread* thread, isize slot, CL_QUEUE_ATOMIC(void*)* from)
+{
+    void* ptr = atomic_load_explicit(from, memory_order_relaxed);
+    for(;;) {
+        hazard_set(thread, slot, ptr);
+        void* reloaded = atomic_load_explicit(from, memory_order_acquire);
+        if(reloaded == ptr)
+            return ptr;
+        ptr = reloaded;
+    }
+}
+
+void hazard_domain_init(Hazard_Domain* domain)
+{
+    atomic_store(&domain->threads, (Hazard_Thread*) NULL);
+    atomic_store(&domain->threads_count, (isize) 0);
+}
+
+void hazard_domain_deinit(Hazard_Domain* domain)
+{
+    for(Hazard_Thread* thread = atomic_load(&domain->threads); thread; )
+    {
+        Hazard_Thread* next = thread->next;
+        for(isize i = 0; i < thread->retired_count; i++)
+            thread->retired[i].free_func(thread->retired[i].ptr);
+        free(thread->retired);
+        free(thread->scan_buffer);
+        free(thread);
+        thread = next;
+    }
+    hazard_domain_init(domain);
+}
+
+Hazard_Thread* hazard_thread_acquire(Hazard_Domain* domain)
+{
+    for(Hazard_Thread* thread = atomic_load(&domain->threads); thread; thread = thread->next)
+    {
+        uint32_t active = 0;
+        if(atomic_load_explicit(&thread->active, memory_order_relaxed) == 0
+            && atomic_compare_exchange_strong(&thread->active, &active, 1))
+            return thread;
+    }
+
+    Hazard_Thread* thread = (Hazard_Thread*) calloc(1, sizeof(Hazard_Thread));
+    atomic_store(&thread->active, 1);
+    thread->next = atomic_load(&domain->threads);
+    while(atomic_compare_exchange_weak(&domain->threads, &thread->next, thread) == false);
+    atomic_fetch_add(&domain->threads_count, 1);
+    return thread;
+}
+
+void hazard_thread_release(Hazard_Domain* domain, Hazard_Thread* thread)
+{
+    for(isize i = 0; i < HAZARD_PTR_SLOTS; i++)
+        hazard_clear(thread, i);
+    if(thread->retired_count > 0)
+        hazard_scan(domain, thread);
+    atomic_store_explicit(&thread->active, 0, memory_order_release);
+}
+
+static int _hazard_ptr_comp_func(const void* a, const void* b)
+{
+    uintptr_t x = *(const uintptr_t*) a;
+    uintptr_t y = *(const uintptr_t*) b;
+    return (x > y) - (x < y);
+}
+
+CL_QUEUE_API void hazard_scan(Hazard_Domain* domain, Hazard_Thread* thread)
+{
+    //Everything retired so far is unreachable. Anyone who got a pointer to it before that
+    // has it published by now (fence in hazard_set) or is going to fail its validation.
+    atomic_thread_fence(memory_order_seq_cst);
+
+    isize found = 0;
+    for(Hazard_Thread* other = atomic_load_explicit(&domain->threads, memory_order_acquire); other; other = other->next)
+        for(isize i = 0; i < HAZARD_PTR_SLOTS; i++)
+        {
+            void* ptr = atomic_load_explicit(&other->slots[i], memory_order_acquire);
+            if(ptr == NULL)
+                continue;
+
+            if(found >= thread->scan_capacity)
+            {
+                thread->scan_capacity = thread->scan_capacity*2 + 16;
+                thread->scan_buffer = (void**) realloc(thread->scan_buffer, (size_t) thread->scan_capacity*sizeof(void*));
+            }
+            thread->scan_buffer[found++] = ptr;
+        }
+
+    if(found > 0)
+        qsort(thread->scan_buffer, (size_t) found, sizeof(void*), _hazard_ptr_comp_func);
+
+    isize kept = 0;
+    for(isize i = 0; i < thread->retired_count; i++)
+    {
+        Hazard_Retired retired = thread->retired[i];
+        void* key = retired.ptr;
+        if(found > 0 && bsearch(&key, thread->scan_buffer, (size_t) found, sizeof(void*), _hazard_ptr_comp_func))
+            thread->retired[kept++] = retired;
+        else
+        {
+            retired.free_func(retired.ptr);
+            thread->freed_count += 1;
+        }
+    }
+    thread->retired_count = kept;
+}
+
+CL_QUEUE_API void hazard_retire(Hazard_Domain* domain, Hazard_Thread* thread, void* ptr, Hazard_Free_Func free_func)
+{
+    if(thread->retired_count >= thread->retired_capacity)
+    {
+        thread->retired_capacity = thread->retired_capacity*2 + HAZARD_PTR_RETIRE_BATCH;
+        thread->retired = (Hazard_Retired*) realloc(thread->retired, (size_t) thread->retired_capacity*sizeof(Hazard_Retired));
+    }
+
+    Hazard_Retired retired = {ptr, free_func};
+    thread->retired[thread->retired_count++] = retired;
+
+    //at most that many can be protected so a scan frees at least half
+    isize threshold = 2*HAZARD_PTR_SLOTS*atomic_load_explicit(&domain->threads_count, memory_order_relaxed);
+    if(threshold < HAZARD_PTR_RETIRE_BATCH)
+        threshold = HAZARD_PTR_RETIRE_BATCH;
+    if(thread->retired_count >= threshold)
+        hazard_scan(domain, thread);
+}
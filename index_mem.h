@@ -0,0 +1,143 @@
+#pragma once
+
+//Growable array of items split into blocks of block_size items. Blocks never move so
+// pointers to items stay valid until deinit and lookups can run concurrently with growing.
+// A lookup is two dependent loads: the table of block pointers and the block pointer in it.
+//Growing is single writer (callers serialize it themselves, for example with a mutex).
+// When the table of block pointers is full it is replaced by one twice the size. The old ones are retired
+// into a list because readers might still be looking at them. They always sum up to less than the current table.
+// They are freed in index_mem_unsafe_reclaim (once no reader can hold them) or in deinit.
+// index_mem_unsafe_reserve sizes the table up front so that nothing gets retired at all.
+//block_size and item_size are passed to every call so that they can be compile time constants.
+// block_size should be a power of two so that the division turns into a shift.
+
+#include "chase_lev_queue.h"
+
+typedef struct Index_Mem_Node {
+    struct Index_Mem_Node* next; //previous (smaller) retired table
+    uint32_t capacity;
+    uint32_t count;
+    //CL_QUEUE_ATOMIC(void*) blocks[capacity] here...
+} Index_Mem_Node;
+
+typedef struct Index_Mem {
+    CL_QUEUE_ATOMIC(Index_Mem_Node*) node;
+    CL_QUEUE_ATOMIC(isize) capacity; //in items
+} Index_Mem;
+
+//index has to be smaller than a capacity previously observed (or returned by grow)
+CL_QUEUE_API_INLINE void* index_mem_get(Index_Mem* mem, isize index, isize block_size, isize item_size);
+CL_QUEUE_API_INLINE isize index_mem_capacity(Index_Mem* mem);
+
+//Adds one block (zeroed) and returns it. Must be only called by one thread at a time.
+// Other threads can still call index_mem_get.
+CL_QUEUE_API void* index_mem_unsafe_grow(Index_Mem* mem, isize block_size, isize item_size);
+//Makes room for at least blocks_count blocks in the table. Same rules as index_mem_unsafe_grow.
+CL_QUEUE_API void index_mem_unsafe_reserve(Index_Mem* mem, isize blocks_count);
+//Frees the retired tables. Only the writer may call this and only at a point where no reader
+// can still be using a table it loaded before the last grow (e.g. all readers have passed a barrier).
+// Returns the number of bytes freed.
+CL_QUEUE_API isize index_mem_unsafe_reclaim(Index_Mem* mem);
+//No other thread may use mem anymore
+CL_QUEUE_API void index_mem_unsafe_deinit(Index_Mem* mem);
+
+CL_QUEUE_API_INLINE CL_QUEUE_ATOMIC(void*)* _index_mem_blocks(Index_Mem_Node* node)
+{
+    return (CL_QUEUE_ATOMIC(void*)*) (void*) (node + 1);
+}
+
+CL_QUEUE_API_INLINE void* index_mem_get(Index_Mem* mem, isize index, isize block_size, isize item_size)
+{
+    Index_Mem_Node* node = atomic_load_explicit(&mem->node, memory_order_acquire);
+    uint64_t block_i = (uint64_t) index / (uint64_t) block_size;
+    uint64_t item_i = (uint64_t) index % (uint64_t) block_size;
+    ASSERT(0 <= index && index < atomic_load_explicit(&mem->capacity, memory_order_relaxed));
+    ASSERT(node && block_i < node->capacity);
+
+    uint8_t* block = (uint8_t*) atomic_load_explicit(&_index_mem_blocks(node)[block_i], memory_order_acquire);
+    return block + (uint64_t) item_size*item_i;
+}
+
+CL_QUEUE_API_INLINE isize index_mem_capacity(Index_Mem* mem)
+{
+    return atomic_load_explicit(&mem->capacity, memory_order_acquire);
+}
+
+CL_QUEUE_API void _index_mem_resize_table(Index_Mem* mem, uint32_t new_capacity)
+{
+    Index_Mem_Node* node = atomic_load_explicit(&mem->node, memory_order_relaxed);
+    uint32_t old_count = node ? node->count : 0;
+    Index_Mem_Node* new_node = (Index_Mem_Node*) calloc(1, sizeof(Index_Mem_Node) + new_capacity*sizeof(CL_QUEUE_ATOMIC(void*)));
+    new_node->capacity = new_capacity;
+    new_node->count = old_count;
+    new_node->next = node;
+    for(uint32_t i = 0; i < old_count; i++)
+        atomic_store_explicit(&_index_mem_blocks(new_node)[i], atomic_load_explicit(&_index_mem_blocks(node)[i], memory_order_relaxed), memory_order_relaxed);
+
+    atomic_store_explicit(&mem->node, new_node, memory_order_release);
+}
+
+CL_QUEUE_API void* index_mem_unsafe_grow(Index_Mem* mem, isize block_size, isize item_size)
+{
+    Index_Mem_Node* node = atomic_load_explicit(&mem->node, memory_order_relaxed);
+    if(node == NULL || node->count >= node->capacity)
+    {
+        _index_mem_resize_table(mem, node ? node->capacity*2 : 64);
+        node = atomic_load_explicit(&mem->node, memory_order_relaxed);
+    }
+
+    void* block = calloc(1, (size_t) (block_size*item_size));
+    atomic_store_explicit(&_index_mem_blocks(node)[node->count], block, memory_order_release);
+    node->count += 1;
+    atomic_fetch_add_explicit(&mem->capacity, block_size, memory_order_release);
+    return block;
+}
+
+CL_QUEUE_API void index_mem_unsafe_reserve(Index_Mem* mem, isize blocks_count)
+{
+    Index_Mem_Node* node = atomic_load_explicit(&mem->node, memory_order_relaxed);
+    uint32_t capacity = node ? node->capacity : 0;
+    if((isize) capacity < blocks_count)
+    {
+        uint32_t new_capacity = 64;
+        while((isize) new_capacity < blocks_count)
+            new_capacity *= 2;
+        _index_mem_resize_table(mem, new_capacity);
+    }
+}
+
+CL_QUEUE_API isize index_mem_unsafe_reclaim(Index_Mem* mem)
+{
+    isize freed = 0;
+    Index_Mem_Node* node = atomic_load_explicit(&mem->node, memory_order_relaxed);
+    if(node)
+    {
+        for(Index_Mem_Node* retired = node->next; retired != NULL; )
+        {
+            Index_Mem_Node* next = retired->next;
+            freed += (isize) (sizeof(Index_Mem_Node) + retired->capacity*sizeof(CL_QUEUE_ATOMIC(void*)));
+            free(retired);
+            retired = next;
+        }
+        node->next = NULL;
+    }
+    return freed;
+}
+
+CL_QUEUE_API void index_mem_unsafe_deinit(Index_Mem* mem)
+{
+    Index_Mem_Node* last = atomic_load(&mem->node);
+    if(last)
+        for(uint32_t i = 0; i < last->count; i++)
+            free(atomic_load(&_index_mem_blocks(last)[i]));
+
+    for(Index_Mem_Node* node = last; node != NULL; )
+    {
+        Index_Mem_Node* next = node->next;
+        free(node);
+        node = next;
+    }
+
+    atomic_store(&mem->node, (Index_Mem_Node*) NULL);
+    atomic_store(&mem->capacity, (isize) 0);
+}
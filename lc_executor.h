@@ -0,0 +1,361 @@
+#pragma once
+
+//Work stealing executor built on LC_Pool.
+// Each worker owns a thread of the pool, pushes tasks it spawns onto its own queue
+// and steals from others when it runs out. Tasks are stored inline in the queues.
+// As in the Go scheduler the queues are bounded (overflow goes to the pools injection queue) 
+// and tasks spawned from outside go straight into the injection queue.
+
+#include "lc_pool.h"
+
+#ifdef __cplusplus
+    #define LC_EXECUTOR_THREAD_LOCAL thread_local
+#else
+    #define LC_EXECUTOR_THREAD_LOCAL _Thread_local
+#endif
+
+typedef void (*LC_Task_Func)(void* payload);
+//body of lc_executor_parallel_for. Processes iterations [from, to).
+typedef void (*LC_For_Func)(isize from, isize to, void* context);
+
+enum {
+    LC_TASK_PAYLOAD_SIZE = 24, //so that a task is 32B, two tasks per cache line
+    LC_EXECUTOR_MAX_WORKERS = 64,
+    LC_EXECUTOR_LOCAL_CAPACITY = 256, //tasks in the queue of each worker, the rest spills into the injection queue
+};
+
+//The payload is copied into the queue slot and passed to func when the task runs.
+// It is aligned to 8 bytes.
+typedef struct LC_Task {
+    LC_Task_Func func;
+    uint64_t payload[LC_TASK_PAYLOAD_SIZE/8];
+} LC_Task;
+
+typedef struct LC_Executor LC_Executor;
+
+typedef struct LC_Executor_Worker {
+    alignas(64)
+    //How many tasks were spawned/finished by this worker.
+    // Only ever written by their worker so they are just counters on our own cache line
+    // and wait_all sums them.
+    CL_QUEUE_ATOMIC(uint64_t) spawned;
+    CL_QUEUE_ATOMIC(uint64_t) finished;
+    LC_Executor* executor;
+    int32_t handle;
+    int32_t index;
+} LC_Executor_Worker;
+
+typedef struct LC_Executor {
+    LC_Pool pool;
+    //workers_count workers plus one more at the end (without a handle) 
+    // counting the tasks spawned from outside.
+    LC_Executor_Worker* workers;
+    isize workers_count;
+
+    CL_QUEUE_ATOMIC(bool) running;
+    CL_QUEUE_ATOMIC(isize) stopped; //workers which exited
+} LC_Executor;
+
+//Starts workers_count worker threads.
+void lc_executor_init(LC_Executor* executor, isize workers_count);
+//Waits for all tasks to finish and then stops the workers.
+void lc_executor_deinit(LC_Executor* executor);
+
+//Runs func(payload) on some worker. payload_size must be at most LC_TASK_PAYLOAD_SIZE.
+// Can be called from tasks (cheap, pushes to the workers own queue) or from any other thread.
+CL_QUEUE_API_INLINE void lc_executor_spawn(LC_Executor* executor, LC_Task_Func func, const void* payload, isize payload_size);
+//Same as lc_executor_spawn but hints that the task should run on the given worker 
+// (because it has the data in cache). The worker picks it up on its next pop, 
+// other workers take it only if they run out of work.
+void lc_executor_spawn_to(LC_Executor* executor, isize worker_index, LC_Task_Func func, const void* payload, isize payload_size);
+//Waits until all spawned tasks (including the ones they spawned) finished.
+// Must not be called from a task.
+void lc_executor_wait_all(LC_Executor* executor);
+//index of the worker running the calling thread or -1 if called from outside
+CL_QUEUE_API_INLINE isize lc_executor_worker_index(LC_Executor* executor);
+
+//Calls body on disjoint subranges of [begin, end) in parallel and waits for all of them. 
+// Ranges are split lazily: a task runs grain iterations at a time and splits off half of what 
+// is left only when its own queue is empty, that is when thieves would have nothing to steal. 
+// So the queues never fill up with tiny range tasks. 
+//Can be called from tasks (the worker helps with other tasks while waiting) or from outside.
+void lc_executor_parallel_for(LC_Executor* executor, isize begin, isize end, isize grain, LC_For_Func body, void* context);
+
+enum {
+    LC_EXECUTOR_IDLE_WAIT_MS = 50, //idle workers park in lc_pool_pop_wait for at most this long before checking if they should stop
+};
+
+static LC_EXECUTOR_THREAD_LOCAL LC_Executor_Worker* _lc_executor_current_worker = NULL;
+static void _lc_executor_launch_thread(void (*func)(void*), void* context);
+
+CL_QUEUE_API_INLINE isize lc_executor_worker_index(LC_Executor* executor)
+{
+    LC_Executor_Worker* worker = _lc_executor_current_worker;
+    if(worker && worker->executor == executor)
+        return worker->index;
+    return -1;
+}
+
+//Counts the task as spawned by the calling thread. Has to happen before the task can be popped and finished.
+// See lc_executor_wait_all.
+CL_QUEUE_API_INLINE void _lc_executor_count_spawn(LC_Executor* executor)
+{
+    LC_Executor_Worker* worker = _lc_executor_current_worker;
+    if(worker && worker->executor == executor)
+    {
+        uint64_t spawned = atomic_load_explicit(&worker->spawned, memory_order_relaxed);
+        atomic_store_explicit(&worker->spawned, spawned + 1, memory_order_release);
+    }
+    else
+    {
+        //shared by all outside threads so it has to be an atomic add
+        atomic_fetch_add(&executor->workers[executor->workers_count].spawned, 1);
+    }
+}
+
+void lc_executor_spawn_to(LC_Executor* executor, isize worker_index, LC_Task_Func func, const void* payload, isize payload_size)
+{
+    ASSERT(0 <= payload_size && payload_size <= LC_TASK_PAYLOAD_SIZE);
+    ASSERT(0 <= worker_index && worker_index < executor->workers_count);
+    LC_Task task;
+    task.func = func;
+    memcpy(task.payload, payload, (size_t) payload_size);
+
+    _lc_executor_count_spawn(executor);
+    lc_pool_push_to(&executor->pool, executor->workers[worker_index].handle, &task, sizeof task);
+}
+
+CL_QUEUE_API_INLINE void lc_executor_spawn(LC_Executor* executor, LC_Task_Func func, const void* payload, isize payload_size)
+{
+    ASSERT(0 <= payload_size && payload_size <= LC_TASK_PAYLOAD_SIZE);
+    LC_Task task;
+    task.func = func;
+    memcpy(task.payload, payload, (size_t) payload_size);
+
+    _lc_executor_count_spawn(executor);
+    LC_Executor_Worker* worker = _lc_executor_current_worker;
+    if(worker && worker->executor == executor)
+        lc_pool_push(&executor->pool, worker->handle, &task, sizeof task);
+    else
+        lc_pool_submit(&executor->pool, &task, sizeof task);
+}
+
+static void _lc_executor_run(LC_Executor_Worker* worker, LC_Task* task)
+{
+    task->func(task->payload);
+    uint64_t finished = atomic_load_explicit(&worker->finished, memory_order_relaxed);
+    atomic_store_explicit(&worker->finished, finished + 1, memory_order_release);
+}
+
+static void _lc_executor_worker_func(void* context)
+{
+    LC_Executor_Worker* worker = (LC_Executor_Worker*) context;
+    LC_Executor* executor = worker->executor;
+    _lc_executor_current_worker = worker;
+
+    while(atomic_load_explicit(&executor->running, memory_order_relaxed))
+    {
+        LC_Task task;
+        if(lc_pool_pop_wait(&executor->pool, worker->handle, &task, sizeof task, LC_EXECUTOR_IDLE_WAIT_MS/1000.0))
+            _lc_executor_run(worker, &task);
+    }
+
+    _lc_executor_current_worker = NULL;
+    atomic_fetch_add(&executor->stopped, 1);
+}
+
+void lc_executor_init(LC_Executor* executor, isize workers_count)
+{
+    ASSERT(0 < workers_count && workers_count <= LC_EXECUTOR_MAX_WORKERS);
+    memset(executor, 0, sizeof *executor);
+    lc_pool_init(&executor->pool, sizeof(LC_Task), workers_count);
+    lc_pool_set_local_capacity(&executor->pool, LC_EXECUTOR_LOCAL_CAPACITY);
+
+    executor->workers_count = workers_count;
+    executor->workers = (LC_Executor_Worker*) calloc(workers_count + 1, sizeof(LC_Executor_Worker));
+    for(isize i = 0; i < workers_count + 1; i++)
+    {
+        executor->workers[i].executor = executor;
+        executor->workers[i].handle = i < workers_count ? lc_pool_thread_add(&executor->pool) : -1;
+        executor->workers[i].index = (int32_t) i;
+    }
+
+    atomic_store(&executor->running, true);
+    for(isize i = 0; i < workers_count; i++)
+        _lc_executor_launch_thread(_lc_executor_worker_func, &executor->workers[i]);
+}
+
+void lc_executor_deinit(LC_Executor* executor)
+{
+    if(executor->workers == NULL)
+        return;
+
+    lc_executor_wait_all(executor);
+    atomic_store(&executor->running, false);
+    lc_pool_wake_all(&executor->pool);
+    while(atomic_load(&executor->stopped) != executor->workers_count)
+        _lc_pool_pause();
+
+    lc_pool_deinit(&executor->pool);
+    free(executor->workers);
+    memset(executor, 0, sizeof *executor);
+}
+
+void lc_executor_wait_all(LC_Executor* executor)
+{
+    //We sum all finished counters and only then all spawned counters.
+    // Every finished task we counted was spawned before so it is counted in spawned as well.
+    // If the sums match there are no tasks left: the only ones which could spawn more
+    // would have to be running, thus not finished yet, thus spawned > finished.
+    for(isize iter = 0;; iter++)
+    {
+        uint64_t finished = 0;
+        uint64_t spawned = 0;
+        for(isize i = 0; i <= executor->workers_count; i++)
+            finished += atomic_load(&executor->workers[i].finished);
+        for(isize i = 0; i <= executor->workers_count; i++)
+            spawned += atomic_load(&executor->workers[i].spawned);
+
+        if(finished == spawned)
+            break;
+
+        //first spin then give the cpu to the workers
+        if(iter < LC_POOL_WAIT_SPINS)
+            _lc_pool_pause();
+        else
+            _lc_pool_futex_wait(&executor->pool.wake_epoch, atomic_load(&executor->pool.wake_epoch), 100*1000);
+    }
+}
+
+typedef struct _LC_Executor_For {
+    LC_Executor* executor;
+    LC_For_Func body;
+    void* context;
+    isize grain;
+    CL_QUEUE_ATOMIC(isize) remaining; //iterations not yet processed
+} _LC_Executor_For;
+
+typedef struct _LC_Executor_For_Task {
+    _LC_Executor_For* loop;
+    isize from;
+    isize to;
+} _LC_Executor_For_Task;
+
+static void _lc_executor_for_range(_LC_Executor_For* loop, isize from, isize to);
+
+static void _lc_executor_for_task(void* payload)
+{
+    _LC_Executor_For_Task task = {0};
+    memcpy(&task, payload, sizeof task);
+    _lc_executor_for_range(task.loop, task.from, task.to);
+}
+
+static void _lc_executor_for_range(_LC_Executor_For* loop, isize from, isize to)
+{
+    LC_Executor_Worker* worker = _lc_executor_current_worker;
+    CL_Queue* own_queue = &loop->executor->pool.threads[worker->handle].queue;
+
+    isize done = 0;
+    while(from < to)
+    {
+        //Once we split our queue is non empty until some thief takes the 
+        // other half so we dont split again until then.
+        if(to - from >= 2*loop->grain && cl_queue_count(own_queue) == 0)
+        {
+            _LC_Executor_For_Task other_half = {loop, from + (to - from)/2, to};
+            lc_executor_spawn(loop->executor, _lc_executor_for_task, &other_half, sizeof other_half);
+            to = other_half.from;
+        }
+
+        isize chunk_to = to - from > loop->grain ? from + loop->grain : to;
+        loop->body(from, chunk_to, loop->context);
+        done += chunk_to - from;
+        from = chunk_to;
+    }
+
+    //the loop lives on the stack of the caller so this has to be the last time we touch it
+    atomic_fetch_sub(&loop->remaining, done);
+}
+
+void lc_executor_parallel_for(LC_Executor* executor, isize begin, isize end, isize grain, LC_For_Func body, void* context)
+{
+    if(begin >= end)
+        return;
+
+    _LC_Executor_For loop = {0};
+    loop.executor = executor;
+    loop.body = body;
+    loop.context = context;
+    loop.grain = grain > 0 ? grain : 1;
+    atomic_store(&loop.remaining, end - begin);
+
+    LC_Executor_Worker* worker = _lc_executor_current_worker;
+    if(worker && worker->executor == executor)
+    {
+        //Run it ourselves and while others finish their parts help with whatever is in the pool.
+        // Blocking here could deadlock if all workers ended up waiting.
+        _lc_executor_for_range(&loop, begin, end);
+        while(atomic_load(&loop.remaining) > 0)
+        {
+            LC_Task task;
+            if(lc_pool_pop(&executor->pool, worker->handle, &task, sizeof task))
+                _lc_executor_run(worker, &task);
+            else
+                _lc_pool_pause();
+        }
+    }
+    else
+    {
+        _LC_Executor_For_Task all = {&loop, begin, end};
+        lc_executor_spawn(executor, _lc_executor_for_task, &all, sizeof all);
+        for(isize iter = 0; atomic_load(&loop.remaining) > 0; iter++)
+        {
+            if(iter < LC_POOL_WAIT_SPINS)
+                _lc_pool_pause();
+            else
+                _lc_pool_futex_wait(&executor->pool.wake_epoch, atomic_load(&executor->pool.wake_epoch), 100*1000);
+        }
+    }
+}
+
+#ifdef __cplusplus
+    #include <thread>
+    static void _lc_executor_launch_thread(void (*func)(void*), void* context)
+    {
+         std::thread(func, context).detach();
+    }
+#elif defined(_WIN32) || defined(_WIN64)
+    #include <process.h>
+    static void _lc_executor_launch_thread(void (*func)(void*), void* context)
+    {
+        _beginthread(func, 0, context);
+    }
+#else
+    #include <pthread.h>
+    static void* _lc_executor_launch_caster(void* func_and_context)
+    {
+        typedef void (*Void_Func)(void* context);
+
+        Void_Func func = (Void_Func) ((void**) func_and_context)[0];
+        void* context =              ((void**) func_and_context)[1];
+        free(func_and_context);
+        func(context);
+        return NULL;
+    }
+
+    static void _lc_executor_launch_thread(void (*func)(void*), void* context)
+    {
+        void** func_and_context = (void**) malloc(sizeof(void*)*2);
+        func_and_context[0] = (void*) func;
+        func_and_context[1] = context;
+
+        pthread_t handle = {0};
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        int error = pthread_create(&handle, &attr, _lc_executor_launch_caster, func_and_context);
+        pthread_attr_destroy(&attr);
+        ASSERT(error == 0);
+        (void) error;
+    }
+#endif
@@ -7,46 +7,220 @@
 
 typedef struct LC_Pool LC_Pool;
 
+//Decides where thieves start their search. The search itself always visits all 
+// (non empty) queues so all policies are equally linearizable.
+typedef enum LC_Pool_Victim_Policy {
+    LC_POOL_VICTIM_SEQUENTIAL = 0, //start one past the last thread we stole from (default)
+    LC_POOL_VICTIM_RANDOM,         //start at a random thread
+    LC_POOL_VICTIM_TWO_CHOICES,    //pick two random threads and start at the one with more items
+    LC_POOL_VICTIM_STICKY,         //start at the last thread we successfully stole from
+} LC_Pool_Victim_Policy;
+
+//What lc_pool_push does once the pool holds max_capacity items
+typedef enum LC_Pool_Full_Policy {
+    LC_POOL_FULL_FAIL = 0, //return false (default)
+    LC_POOL_FULL_BLOCK,    //wait until someone pops
+} LC_Pool_Full_Policy;
+
+//Ring of items under a spin lock. Used for the injection queue and the mailboxes of threads 
+// where items arrive in batches or from other threads, so a lock touched once per batch is good enough.
+typedef struct LC_Pool_Ring {
+    CL_QUEUE_ATOMIC(uint32_t) lock;
+    //incremented on every change so that a failed pop can tell 
+    // the ring stayed empty the whole time it was searching other queues.
+    CL_QUEUE_ATOMIC(uint32_t) version;
+    CL_QUEUE_ATOMIC(isize) count;
+    uint8_t* data;
+    isize capacity; //power of two (or 0)
+    isize head;
+} LC_Pool_Ring;
+
 typedef struct LC_Pool_Thread {
     alignas(64)
     CL_Queue queue;
     isize stealing_from;
+    uint64_t rng_state; //xorshift state for the randomized victim policies
+    //Items this thread can still push without touching the pools free_capacity. 
+    // Only used when the pool has max_capacity set. Changed only by the owner.
+    isize credits; 
+    //number of lc_pool_pop calls, every LC_POOL_INJECTION_POLL-th looks into the injection queue first
+    uint32_t pop_ticks;
+    //pool epoch at the time this thread started searching other queues or 0 if it is not searching. 
+    // Blocks of removed threads are only freed once no thief can still be reading them.
+    CL_QUEUE_ATOMIC(uint64_t) steal_epoch; 
 
+    //might have items. Read and written only by the owner (so it knows when to try lc_pool_pop_self).
     bool pushed;
+    //our bit in non_empty_mask is set. Cleared by the owner once its queue runs empty or
+    // by a thief which found it empty (see _lc_pool_clear_stale). Set again by the next push.
+    CL_QUEUE_ATOMIC(bool) advertised;
     //upon the call to lc_pool_thread_remove is set to true.
     // This has no effect on any logic in push/pop operations
     // but lc_pool_thread_add can reuse this thread
     CL_QUEUE_ATOMIC(bool) removed; 
+    //next removed thread in the pools free list (+1, 0 means none)
+    CL_QUEUE_ATOMIC(uint32_t) next_free; 
+    //the thread was removed while its queue still had items. Thieves steal from it first 
+    // and the one which finds it empty releases its blocks and puts it onto the free list.
+    CL_QUEUE_ATOMIC(bool) orphaned; 
+
+    //cpu this thread runs on or -1 if unknown. Set through lc_pool_thread_set_cpu.
+    CL_QUEUE_ATOMIC(int32_t) cpu;
+    //threads (bits as in non_empty_mask) sharing the last level cache/socket with us.
+    // Thieves visit these first. Both are zero without topology information.
+    CL_QUEUE_ATOMIC(uint64_t) cache_mask;
+    CL_QUEUE_ATOMIC(uint64_t) socket_mask;
+
+    //Items other threads pushed to us through lc_pool_push_to. We move them to our queue 
+    // on our next lc_pool_pop, thieves which find our queue empty can take them from here as well.
+    //On its own cache line so that the pushers dont disturb the owner.
+    alignas(64)
+    LC_Pool_Ring mailbox;
 } LC_Pool_Thread;
 
+//Maps each cpu to the last level cache and socket it belongs to. 
+//Is filled by lc_pool_topology_read or by hand (for testing).
+typedef struct LC_Pool_Topology {
+    int32_t* cache_of_cpu;  //the lowest cpu sharing the last level cache with the given one
+    int32_t* socket_of_cpu; //physical package id
+    int32_t cpus_count;
+} LC_Pool_Topology;
+
+//chain of blocks of a removed thread waiting for all thieves which might be reading them to finish
+typedef struct LC_Pool_Retired {
+    struct LC_Pool_Retired* next;
+    CL_Queue_Block* blocks;
+    uint64_t epoch;
+} LC_Pool_Retired;
+
 typedef struct LC_Pool {
     LC_Pool_Thread* threads;
     int32_t threads_capacity; 
     CL_QUEUE_ATOMIC(int32_t) threads_count;
     
-    union {
-        struct {
-            CL_QUEUE_ATOMIC(uint32_t) threads_added; 
-            CL_QUEUE_ATOMIC(uint32_t) threads_removed; 
-        };
-        CL_QUEUE_ATOMIC(uint64_t) threads_added_removed;
-    };
-
-    isize max_capacity;
+    //Treiber stack of removed threads which lc_pool_thread_add can reuse. 
+    // Low 32 bits are the index of the first thread + 1 (0 if empty), 
+    // high 32 bits are a generation incremented on every change to avoid ABA.
+    CL_QUEUE_ATOMIC(uint64_t) free_threads; 
+    //unique for every lc_pool_init so that stale thread local handles can be told apart
+    uint64_t id;
+
+    isize max_capacity; //negative if infinite
+    isize credit_batch; //LC_POOL_CREDIT_BATCH clamped so that small pools are not all held by threads (see lc_pool_set_max_capacity)
+    isize local_capacity; //of each threads queue, negative if infinite
     isize initial_capacity;
     isize item_size;
+    LC_Pool_Victim_Policy victim_policy;
+    LC_Pool_Full_Policy full_policy;
+    bool asymmetric_barrier; //_lc_pool_asymmetric_barrier is available so thieves can clear stale bits
+    int64_t stale_interval_ns; //shortest time between two clears of stale bits (see _lc_pool_clear_stale)
 
     CL_QUEUE_ATOMIC(uint64_t) alive_mask;
-    CL_QUEUE_ATOMIC(uint64_t) pusher_empty_mask; //top 32 bits are pusher bot 32 bits are empty mask
+    LC_Pool_Topology topology;
+
+    //bit i is set if thread i might have items in its queue. 
+    // It gets set by the owner on the first push after its queue ran empty 
+    // and cleared by the owner once its lc_pool_pop_self fails. 
+    // Thieves which failed to find anything clear the bits of the queues they found empty 
+    // (if the platform has asymmetric barriers) so once all queues are empty the mask is zero and 
+    // failed pops are O(1). Threads past LC_POOL_MASK_THREADS are 
+    // not tracked and are always visited.
+    alignas(64)
+    CL_QUEUE_ATOMIC(uint64_t) non_empty_mask; 
+    //bit i is set if thread i is orphaned (see LC_Pool_Thread). Only used to visit such threads first.
+    CL_QUEUE_ATOMIC(uint64_t) orphan_mask; 
+    //Odd while a thief is clearing stale bits of non_empty_mask. Searches which see it odd 
+    // or changed cannot trust the mask (see _lc_pool_search_mask).
+    CL_QUEUE_ATOMIC(uint64_t) stale_seq; 
+    CL_QUEUE_ATOMIC(int64_t) stale_cleared_ns; //when the last clear started
+
+    //Reclamation of blocks of removed threads. 
+    // epoch gets incremented on every retire, thieves announce it in their steal_epoch. 
+    // Thieves without a thread (lc_pool_pop_others_from) count themselves in external_stealers instead.
+    alignas(64)
+    CL_QUEUE_ATOMIC(uint64_t) epoch;
+    CL_QUEUE_ATOMIC(uint32_t) external_stealers;
+    CL_QUEUE_ATOMIC(uint32_t) retired_lock;
+    LC_Pool_Retired* retired;
+
+    //Eventcount used by lc_pool_pop_wait. Waiters announce themselves in sleepers 
+    // and park on wake_epoch. Pushers only look at sleepers (one relaxed load) 
+    // and bump wake_epoch when someone is actually parked.
+    alignas(64)
+    CL_QUEUE_ATOMIC(uint32_t) sleepers; 
+    CL_QUEUE_ATOMIC(uint32_t) wake_epoch; 
+
+    //Capacity accounting. Each item in the pool holds one credit. Threads take credits 
+    // from free_capacity in batches and keep them in their own LC_Pool_Thread::credits 
+    // so that the common push/pop only touches thread local state. 
+    //So items + all credits of threads + free_capacity == max_capacity at all times.
+    //Pushers blocked by LC_POOL_FULL_BLOCK park on space_epoch the same way as in lc_pool_pop_wait.
+    alignas(64)
+    CL_QUEUE_ATOMIC(isize) free_capacity; 
+    CL_QUEUE_ATOMIC(uint32_t) push_waiters; 
+    CL_QUEUE_ATOMIC(uint32_t) space_epoch; 
+
+    //Global queue as in the Go scheduler. lc_pool_submit puts items here (it needs no thread) 
+    // and full bounded queues (see lc_pool_set_local_capacity) spill half of their items here. 
+    alignas(64)
+    LC_Pool_Ring injection;
 } LC_Pool;
 
+enum {
+    LC_POOL_MASK_THREADS = 64,
+    LC_POOL_WAIT_SPINS = 256,  //how many times lc_pool_pop_wait tries to pop before parking
+    LC_POOL_PARK_SLICE_MS = 10, //longest a waiter stays parked before it looks again by itself
+    LC_POOL_KEPT_CAPACITY = 64, //removed threads keep a block of at most this many items
+    LC_POOL_CREDIT_BATCH = 32, //how many credits threads take from/return to free_capacity at once
+    LC_POOL_INJECTION_POLL = 61, //lc_pool_pop looks into the injection queue first every this many pops (same as Go)
+    LC_POOL_STALE_INTERVAL_US = 1000, //default of LC_Pool::stale_interval_ns
+};
+
 void lc_pool_init(LC_Pool* pool, isize item_size, isize thread_capacity);
 void lc_pool_deinit(LC_Pool* pool);
 
 //returns -1 if we used up all thread_capacity from lc_pool_init
 int32_t lc_pool_thread_add(LC_Pool* pool);
+//Must be called by the thread itself (or once it stopped using the handle). 
+// Items left in its queue stay in the pool and get stolen before any other. 
+// Once the queue is empty its blocks are freed (when no thief can be reading them anymore)
+// and the thread can get reused by lc_pool_thread_add.
 void lc_pool_thread_remove(LC_Pool* pool, int32_t thread);
 
+//reads topology of the current machine. Returns false and leaves topology empty 
+// if the information is not available (non linux platforms).
+bool lc_pool_topology_read(LC_Pool_Topology* topology);
+void lc_pool_topology_deinit(LC_Pool_Topology* topology);
+
+//copies topology into the pool. Threads whose cpu was set through lc_pool_thread_set_cpu 
+// will prefer stealing from threads sharing the same cache, then the same socket and only then the rest.
+void lc_pool_set_topology(LC_Pool* pool, const LC_Pool_Topology* topology);
+//tells the pool which cpu is thread pinned to. Pass -1 if unknown.
+void lc_pool_thread_set_cpu(LC_Pool* pool, int32_t thread, int32_t cpu);
+//should be called before any thread starts popping
+void lc_pool_set_victim_policy(LC_Pool* pool, LC_Pool_Victim_Policy policy);
+//Limits the number of items in the whole pool. Should be called before anything gets pushed.
+//Because threads hold some credits to themselves pushes can fail (or block) 
+// up to 2*LC_POOL_CREDIT_BATCH items per thread sooner, but the pool never holds more than max_capacity items.
+//The batch is made smaller for pools where that would be more than half of max_capacity 
+// (down to no credits kept at all) so a nearly empty pool never refuses a push.
+void lc_pool_set_max_capacity(LC_Pool* pool, isize max_capacity_or_negative_if_infinite, LC_Pool_Full_Policy policy);
+//Bounds the queue of each thread to local_capacity items (rounded up to a power of two, at least 64). 
+// Pushing into a full queue moves its older half together with the pushed item into the 
+// injection queue, so the memory held by a thread stays bounded no matter how unbalanced the pushes are.
+//Must be called before any thread gets added.
+void lc_pool_set_local_capacity(LC_Pool* pool, isize local_capacity_or_negative_if_infinite);
+//Pushes into the shared injection queue. Needs no thread so its the way to push from outside the pool. 
+// Threads take items from it in batches once their own queue is empty and also every 
+// LC_POOL_INJECTION_POLL pops so that submitted items dont starve behind the local ones.
+//Fails only because of max_capacity (see lc_pool_set_max_capacity).
+CL_QUEUE_API bool lc_pool_submit(LC_Pool* pool, const void* data, isize item_size);
+//Pushes into the mailbox of target_thread. Can be called from any thread (also from outside the pool). 
+// The target moves the item into its own queue on its next lc_pool_pop so it will likely run it, 
+// thieves can still take it if the target is busy. Useful when we know which thread has the data in cache.
+//target_thread must not get removed while this runs. Fails only because of max_capacity.
+CL_QUEUE_API bool lc_pool_push_to(LC_Pool* pool, int32_t target_thread, const void* data, isize item_size);
+
 CL_QUEUE_API_INLINE void lc_pool_reserve(LC_Pool* pool, int32_t thread, isize to_size, isize item_size);
 CL_QUEUE_API_INLINE bool lc_pool_push(LC_Pool* pool, int32_t thread, const void* data, isize item_size);
 CL_QUEUE_API_INLINE bool lc_pool_pop(LC_Pool* pool, int32_t thread, void* data, isize item_size);
@@ -54,15 +228,163 @@ CL_QUEUE_API_INLINE bool lc_pool_pop_self(LC_Pool* pool, int32_t thread, void* d
 CL_QUEUE_API_INLINE bool lc_pool_pop_others(LC_Pool* pool, int32_t thread, void* data, isize item_size);
 CL_QUEUE_API_INLINE bool lc_pool_pop_others_from(LC_Pool* pool, isize steal_base, void* data, isize item_size);
 
+//Same as lc_pool_pop but if there is nothing to pop spins for a while and then 
+// parks the thread until something gets pushed or the timeout runs out. 
+//Returns false on timeout.
+CL_QUEUE_API_INLINE bool lc_pool_pop_wait(LC_Pool* pool, int32_t thread, void* data, isize item_size, double timeout_or_negative_if_infinite);
+//wakes all threads parked in lc_pool_pop_wait. Useful when shutting down.
+CL_QUEUE_API void lc_pool_wake_all(LC_Pool* pool);
+
+#ifdef __cplusplus
+//Handle of the calling thread found through a thread_local cache keyed by pool. 
+// The thread gets added on first use and removed from the pool once it exits, 
+// so short lived threads dont have to carry handles around. 
+//The pool must outlive all threads using it this way or they have to 
+// call lc_pool_local_release before it gets deinit-ed. Returns -1 if the pool is full.
+CL_QUEUE_API_INLINE int32_t lc_pool_local_thread(LC_Pool* pool);
+CL_QUEUE_API void lc_pool_local_release(LC_Pool* pool);
+CL_QUEUE_API_INLINE bool lc_pool_local_push(LC_Pool* pool, const void* data, isize item_size);
+CL_QUEUE_API_INLINE bool lc_pool_local_pop(LC_Pool* pool, void* data, isize item_size);
+#endif
+
+CL_QUEUE_API void _lc_pool_wake(LC_Pool* pool);
+CL_QUEUE_API void _lc_pool_orphan_finish(LC_Pool* pool, int32_t thread);
+CL_QUEUE_API void _lc_pool_clear_stale(LC_Pool* pool, uint64_t bits);
+CL_QUEUE_API bool _lc_pool_stale_begin(LC_Pool* pool, uint64_t bits, uint64_t* empty_bits);
+CL_QUEUE_API void _lc_pool_stale_clear(LC_Pool* pool, uint64_t empty_bits);
+CL_QUEUE_API void _lc_pool_stale_end(LC_Pool* pool, uint64_t empty_bits);
+CL_QUEUE_API void _lc_pool_thread_release(LC_Pool* pool, int32_t thread);
+CL_QUEUE_API void _lc_pool_free_blocks(CL_Queue_Block* blocks);
+CL_QUEUE_API bool _lc_pool_credits_acquire(LC_Pool* pool, isize* credits, isize batch);
+CL_QUEUE_API void _lc_pool_credits_release(LC_Pool* pool, isize credits);
+CL_QUEUE_API bool _lc_pool_spill(LC_Pool* pool, int32_t thread, const void* data, isize item_size);
+CL_QUEUE_API bool _lc_pool_injection_pop(LC_Pool* pool, int32_t thread, void* data, isize item_size);
+CL_QUEUE_API void _lc_pool_mailbox_drain(LC_Pool* pool, int32_t thread);
+CL_QUEUE_API bool _lc_pool_ring_pop(LC_Pool_Ring* ring, void* data, isize item_size);
+static int64_t _lc_pool_clock_ns();
+static void _lc_pool_futex_wait(CL_QUEUE_ATOMIC(uint32_t)* state, uint32_t undesired, int64_t timeout_ns);
+static void _lc_pool_futex_wake(CL_QUEUE_ATOMIC(uint32_t)* state, bool all);
+//Executes a full memory barrier on all threads of this process. 
+// Lets the rare side of a Dekker style handshake pay for both sides. Returns false if not supported.
+static bool _lc_pool_asymmetric_barrier_init();
+static void _lc_pool_asymmetric_barrier();
+
+#if defined(_MSC_VER)
+    #include <intrin.h>
+    static int32_t _lc_pool_find_first_set_bit64(uint64_t num)
+    {
+        ASSERT(num != 0);
+        unsigned long out = 0;
+        _BitScanForward64(&out, (unsigned long long) num);
+        return (int32_t) out;
+    }
+    
+#elif defined(__GNUC__) || defined(__clang__)
+    static int32_t _lc_pool_find_first_set_bit64(uint64_t num)
+    {
+        ASSERT(num != 0);
+        return __builtin_ffsll((long long) num) - 1;
+    }
+
+#else
+    #error unsupported compiler!
+#endif
+
+static inline uint64_t _lc_pool_rotate_right64(uint64_t x, uint32_t bits)
+{
+    return bits ? (x >> bits) | (x << (64 - bits)) : x;
+}
+
+static inline uint64_t _lc_pool_xorshift64(uint64_t* state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+    #define _lc_pool_pause() _mm_pause()
+#else
+    #define _lc_pool_pause() (void) 0
+#endif
+
+//Publishes that the queue of thread is no longer empty. Has to be called by the owner after the push 
+// so that a thief which sees the bit also sees the item. 
+//This is the only place the bit gets set and happens once per push-from-empty 
+// (or after a thief cleared it) so the common push path only pays for a load of our own flag.
+//Thieves clearing the bit issue an asymmetric barrier between clearing advertised 
+// and looking at our queue again, so we only have to keep the compiler from 
+// reordering the push and the load.
+CL_QUEUE_API_INLINE void _lc_pool_advertise(LC_Pool* pool, int32_t thread)
+{
+    LC_Pool_Thread* self = &pool->threads[thread];
+    self->pushed = true;
+    atomic_signal_fence(memory_order_seq_cst);
+    if(atomic_load_explicit(&self->advertised, memory_order_relaxed) == false)
+    {
+        atomic_store_explicit(&self->advertised, true, memory_order_relaxed);
+        if(thread < LC_POOL_MASK_THREADS)
+            atomic_fetch_or(&pool->non_empty_mask, (uint64_t) 1 << thread);
+    }
+}
+
 CL_QUEUE_API_INLINE bool lc_pool_push(LC_Pool* pool, int32_t thread, const void* data, isize item_size)
 {
-    pool->threads[thread].pushed = true;
-    return cl_queue_push(&pool->threads[thread].queue, data, item_size);
+    LC_Pool_Thread* self = &pool->threads[thread];
+    if(pool->max_capacity >= 0)
+    {
+        if(self->credits <= 0 && _lc_pool_credits_acquire(pool, &self->credits, pool->credit_batch > 0 ? pool->credit_batch : 1) == false)
+            return false;
+
+        self->credits -= 1;
+    }
+
+    bool pushed = cl_queue_push(&self->queue, data, item_size);
+    if(pushed)
+        _lc_pool_advertise(pool, thread);
+    else if(pool->local_capacity >= 0)
+        pushed = _lc_pool_spill(pool, thread, data, item_size);
+
+    if(pushed == false && pool->max_capacity >= 0)
+        self->credits += 1;
+
+    //nothing new to pop for the sleepers if the push failed
+    if(pushed && atomic_load_explicit(&pool->sleepers, memory_order_relaxed) > 0)
+        _lc_pool_wake(pool);
+
+    return pushed;
+}
+
+//Gives the credit of a popped item to thread. Returns the surplus (or all if someone waits for it)
+CL_QUEUE_API_INLINE void _lc_pool_credits_on_pop(LC_Pool* pool, int32_t thread)
+{
+    if(pool->max_capacity >= 0)
+    {
+        LC_Pool_Thread* self = &pool->threads[thread];
+        self->credits += 1;
+        if(self->credits > 2*pool->credit_batch)
+        {
+            _lc_pool_credits_release(pool, self->credits - pool->credit_batch);
+            self->credits = pool->credit_batch;
+        }
+        else if(atomic_load_explicit(&pool->push_waiters, memory_order_relaxed) > 0)
+        {
+            _lc_pool_credits_release(pool, self->credits);
+            self->credits = 0;
+        }
+    }
 }
 
 CL_QUEUE_API_INLINE bool lc_pool_pop_self(LC_Pool* pool, int32_t thread, void* data, isize item_size)
 {
-    return cl_queue_pop_back(&pool->threads[thread].queue, data, item_size);
+    bool popped = cl_queue_pop_back(&pool->threads[thread].queue, data, item_size);
+    if(popped)
+        _lc_pool_credits_on_pop(pool, thread);
+    return popped;
 }
 
 CL_QUEUE_API_INLINE bool lc_pool_pop_others_old(LC_Pool* pool, int32_t thread, void* data, isize item_size)
@@ -126,6 +448,47 @@ CL_QUEUE_API_INLINE bool lc_pool_pop_others_old(LC_Pool* pool, int32_t thread, v
     return false;
 }
 
+//Tries to steal from a single queue. Returns 1 if stolen, 0 if the queue was found empty
+// and -1 if the queue changed since the last round (we have to start anew).
+CL_QUEUE_API_INLINE int32_t _lc_pool_try_steal(LC_Pool* pool, isize steal, isize round, uint64_t* bots, void* data, isize item_size)
+{
+    LC_Pool_Thread* steal_thread = &pool->threads[steal];
+    CL_Queue_Result result = cl_queue_result_pop(&steal_thread->queue, data, item_size);
+    if(result.state == CL_QUEUE_OK) 
+        return 1;
+
+    //Items pushed to the thread it did not get to yet. They change the mailbox version 
+    // (and moving them into the queue changes bot) so they are part of the ticket as well.
+    uint32_t mailbox_version = atomic_load(&steal_thread->mailbox.version);
+    if(atomic_load(&steal_thread->mailbox.count) > 0 && _lc_pool_ring_pop(&steal_thread->mailbox, data, item_size))
+        return 1;
+
+    uint64_t ticket = result.bot + atomic_load_explicit(&steal_thread->queue.bot_ticket, memory_order_relaxed) + mailbox_version;
+
+    //if is my first time around save the position of bot
+    if(round == 0)
+        bots[steal] = ticket;
+    //... so that the second round I can detect if someone else pushed 
+    // and if they did we have to go start the search anew.
+    // Yes, this is necessary to stay linearizable.
+    else if(bots[steal] != ticket)
+        return -1;
+
+    return 0;
+}
+
+//Bits of the queues a search has to visit. While a thief is clearing stale bits 
+// the mask can be missing the bit of a non empty queue for a moment so we visit all of them.
+CL_QUEUE_API_INLINE uint64_t _lc_pool_search_mask(LC_Pool* pool, isize threads_count, uint64_t* stale_seq)
+{
+    *stale_seq = atomic_load(&pool->stale_seq);
+    if(*stale_seq % 2 == 0)
+        return atomic_load(&pool->non_empty_mask);
+    if(threads_count >= LC_POOL_MASK_THREADS)
+        return ~(uint64_t) 0;
+    return ((uint64_t) 1 << threads_count) - 1;
+}
+
 CL_QUEUE_API_INLINE int32_t _lc_pool_pop_others_from(LC_Pool* pool, isize steal_base, int32_t thread, bool filter_thread, void* data, isize item_size)
 {
     //todo make dynamic
@@ -133,38 +496,93 @@ CL_QUEUE_API_INLINE int32_t _lc_pool_pop_others_from(LC_Pool* pool, isize steal_
     uint64_t bots[MAX_THREADS]; //1024 B
 
     isize threads_count = atomic_load_explicit(&pool->threads_count, memory_order_relaxed);
+    if(threads_count <= 0)
+        return -1;
+
+    uint64_t self_bit = filter_thread && thread < LC_POOL_MASK_THREADS ? (uint64_t) 1 << thread : 0;
+    uint64_t stale_seq = 0;
+    uint64_t mask = _lc_pool_search_mask(pool, threads_count, &stale_seq) & ~self_bit;
+    uint64_t empty_bits = 0; //queues found empty in the second round
     for(isize round = 0; round < 2; round++) {
-        isize steal = filter_thread ? steal_base : steal_base % threads_count;
-        for(isize k = 0; k < threads_count; k++)
+        empty_bits = 0;
+
+        //Items of removed threads are stolen first so that their blocks can be released soon.
+        uint64_t orphans = atomic_load_explicit(&pool->orphan_mask, memory_order_relaxed);
+
+        //Walk the set bits of the mask starting one past steal_base. 
+        // Rotating the mask makes bit 0 correspond to the first thread we want to visit
+        // so we dont need to care about the wrap around.
+        //We visit threads sharing the cache with us first, then the ones on the same socket 
+        // and then the rest. Without topology both near masks are zero and only 
+        // the last group is non empty.
+        uint64_t groups[4] = {mask & orphans, 0, 0, mask & ~orphans};
+        if(self_bit)
         {
-            //increment the steal from thread. We could also use modulo above but
-            // we strive to make the happy path as low latency as possible.
-            steal += 1;
-            if(steal >= threads_count)
-                steal = 0;
+            LC_Pool_Thread* self = &pool->threads[thread];
+            uint64_t cache_mask = atomic_load_explicit(&self->cache_mask, memory_order_relaxed);
+            uint64_t socket_mask = atomic_load_explicit(&self->socket_mask, memory_order_relaxed) | cache_mask;
+            groups[1] = groups[3] & cache_mask;
+            groups[2] = groups[3] & socket_mask & ~cache_mask;
+            groups[3] = groups[3] & ~socket_mask;
+        }
 
-            //dont steal from self
-            if(filter_thread == false || steal != thread)
+        uint32_t shift = (uint32_t) ((steal_base + 1) % threads_count % LC_POOL_MASK_THREADS);
+        int32_t state = 0;
+        for(isize group = 0; group < 4 && state == 0; group++)
+        {
+            uint64_t rotated = _lc_pool_rotate_right64(groups[group], shift);
+            while(rotated)
             {
-                LC_Pool_Thread* steal_thread = &pool->threads[steal];
-                CL_Queue_Result result = cl_queue_result_pop(&steal_thread->queue, data, item_size);
-                if(result.state == CL_QUEUE_OK) {
+                int32_t bit = _lc_pool_find_first_set_bit64(rotated);
+                rotated &= rotated - 1;
+
+                isize steal = (isize) ((bit + shift) % LC_POOL_MASK_THREADS);
+                state = _lc_pool_try_steal(pool, steal, round, bots, data, item_size);
+                //whoever takes the last item of an orphan releases it
+                if(group == 0 && state != -1 && cl_queue_count(&pool->threads[steal].queue) == 0)
+                    _lc_pool_orphan_finish(pool, (int32_t) steal);
+                if(state == 1)
                     return (int32_t) steal;
-                }
+                if(state == -1)
+                    break;
+                if(round == 1)
+                    empty_bits |= (uint64_t) 1 << steal;
+            }
+        }
 
-                uint64_t ticket = result.bot + atomic_load_explicit(&steal_thread->queue.bot_ticket, memory_order_relaxed);
+        //threads which dont fit into the mask are always visited
+        for(isize steal = LC_POOL_MASK_THREADS; state == 0 && steal < threads_count; steal++)
+        {
+            //dont steal from self
+            if(filter_thread && steal == thread)
+                continue;
 
-                //if is my first time around save the position of bot
-                if(round == 0)
-                    bots[steal] = ticket;
-                //... so that the second round I can detect if someone else pushed 
-                // and if they did we have to go start the search anew.
-                // Yes, this is necessary to stay linearizable.
-                else if(bots[steal] != ticket)
-                {
-                    round = -1;
-                    break;
-                }
+            state = _lc_pool_try_steal(pool, steal, round, bots, data, item_size);
+            if(state != -1 && atomic_load_explicit(&pool->threads[steal].orphaned, memory_order_relaxed) 
+                && cl_queue_count(&pool->threads[steal].queue) == 0)
+                _lc_pool_orphan_finish(pool, (int32_t) steal);
+            if(state == 1)
+                return (int32_t) steal;
+        }
+
+        if(state == -1)
+        {
+            mask = _lc_pool_search_mask(pool, threads_count, &stale_seq) & ~self_bit;
+            round = -1;
+            continue;
+        }
+
+        //If some queue became non empty since the first round we would not have
+        // visited it, so we have to start anew. Queues whose bit is 
+        // still clear are empty (up to pushes which havent returned yet) at this point and 
+        // the ones we did visit did not change between the two rounds. 
+        if(round == 0)
+        {
+            uint64_t new_mask = atomic_load(&pool->non_empty_mask) & ~self_bit;
+            if(new_mask & ~mask)
+            {
+                mask = new_mask;
+                round = -1;
             }
         }
 
@@ -174,127 +592,230 @@ CL_QUEUE_API_INLINE int32_t _lc_pool_pop_others_from(LC_Pool* pool, isize steal_
         if(threads_count != new_threads_count)
         {
             threads_count = new_threads_count;
+            mask = _lc_pool_search_mask(pool, threads_count, &stale_seq) & ~self_bit;
+            round = -1;
+        }
+
+        //A thief cleared bits while we were searching so the mask we used
+        // might have been missing a non empty queue. 
+        else if(round == 1 && atomic_load(&pool->stale_seq) != stale_seq)
+        {
+            mask = _lc_pool_search_mask(pool, threads_count, &stale_seq) & ~self_bit;
             round = -1;
         }
     }
 
+    //The pool was empty. Clear the bits of queues which were drained by thieves 
+    // so that the next failed search does not have to visit them.
+    if(empty_bits && pool->asymmetric_barrier)
+        _lc_pool_clear_stale(pool, empty_bits);
+
     return -1;
 }
 
+//Returns the thread *before* the one the search should start from
+CL_QUEUE_API_INLINE isize _lc_pool_steal_base(LC_Pool* pool, LC_Pool_Thread* self)
+{
+    switch(pool->victim_policy)
+    {
+        default:
+        case LC_POOL_VICTIM_SEQUENTIAL: 
+            return self->stealing_from;
+
+        case LC_POOL_VICTIM_STICKY: 
+            return self->stealing_from - 1;
+
+        case LC_POOL_VICTIM_RANDOM: {
+            isize threads_count = atomic_load_explicit(&pool->threads_count, memory_order_relaxed);
+            return (isize) (_lc_pool_xorshift64(&self->rng_state) % (uint64_t) threads_count);
+        }
+
+        case LC_POOL_VICTIM_TWO_CHOICES: {
+            //The counts are only estimates (we dont care about the races) 
+            // but they spread the thieves towards the queues with most work.
+            isize threads_count = atomic_load_explicit(&pool->threads_count, memory_order_relaxed);
+            uint64_t random = _lc_pool_xorshift64(&self->rng_state);
+            isize first = (isize) ((random & 0xFFFFFFFF) % (uint64_t) threads_count);
+            isize second = (isize) ((random >> 32) % (uint64_t) threads_count);
+            isize first_count = cl_queue_count(&pool->threads[first].queue);
+            isize second_count = cl_queue_count(&pool->threads[second].queue);
+            return (first_count >= second_count ? first : second) - 1;
+        }
+    }
+}
 
 CL_QUEUE_API_INLINE bool lc_pool_pop_others(LC_Pool* pool, int32_t thread, void* data, isize item_size)
 {
     LC_Pool_Thread* self = &pool->threads[thread];
-    isize steal_base = self->stealing_from;
-    int32_t finished = _lc_pool_pop_others_from(pool, steal_base, thread, true, data, item_size);
+    int32_t finished = -1;
+    for(;;) {
+        //The injection queue is part of the pool so the search only proves emptiness 
+        // if it was empty and did not change the whole time.
+        uint32_t injection_version = atomic_load(&pool->injection.version);
+        if(atomic_load(&pool->injection.count) > 0 && _lc_pool_injection_pop(pool, thread, data, item_size))
+        {
+            _lc_pool_credits_on_pop(pool, thread);
+            return true;
+        }
+
+        //Announce we might be reading blocks of other threads. Has to be seq_cst so that 
+        // either the reclaiming thread sees us or we see the blocks it already unlinked.
+        isize steal_base = _lc_pool_steal_base(pool, self);
+        atomic_store(&self->steal_epoch, atomic_load_explicit(&pool->epoch, memory_order_relaxed));
+        finished = _lc_pool_pop_others_from(pool, steal_base, thread, true, data, item_size);
+        atomic_store_explicit(&self->steal_epoch, 0, memory_order_release);
+        if(finished != -1 || atomic_load(&pool->injection.version) == injection_version)
+            break;
+    }
+
     if(finished == -1)
+    {
+        //We might be holding credits someone waits on. 
+        if(self->credits > 0 && atomic_load_explicit(&pool->push_waiters, memory_order_relaxed) > 0)
+        {
+            _lc_pool_credits_release(pool, self->credits);
+            self->credits = 0;
+        }
         return false;
+    }
 
     self->stealing_from = finished;
+    _lc_pool_credits_on_pop(pool, thread);
     return true;
 }
 
 CL_QUEUE_API_INLINE bool lc_pool_pop_others_from(LC_Pool* pool, isize steal_base, void* data, isize item_size)
 {
-    return _lc_pool_pop_others_from(pool, steal_base, 0, false, data, item_size) != -1;
+    int32_t finished = -1;
+    for(;;) {
+        //same as in lc_pool_pop_others
+        uint32_t injection_version = atomic_load(&pool->injection.version);
+        if(atomic_load(&pool->injection.count) > 0 && _lc_pool_injection_pop(pool, -1, data, item_size))
+            break;
+
+        atomic_fetch_add(&pool->external_stealers, 1);
+        finished = _lc_pool_pop_others_from(pool, steal_base, 0, false, data, item_size);
+        atomic_fetch_sub_explicit(&pool->external_stealers, 1, memory_order_release);
+        if(finished != -1)
+            break;
+        if(atomic_load(&pool->injection.version) == injection_version)
+            return false;
+    }
+
+    //we have no thread to give the credit to
+    if(pool->max_capacity >= 0)
+        _lc_pool_credits_release(pool, 1);
+    return true;
 }
 
 CL_QUEUE_API_INLINE bool lc_pool_pop(LC_Pool* pool, int32_t thread, void* data, isize item_size)
 {
+    //Items other threads pushed to us. The fast path only pays for a relaxed load.
+    if(atomic_load_explicit(&pool->threads[thread].mailbox.count, memory_order_relaxed) > 0)
+        _lc_pool_mailbox_drain(pool, thread);
+
+    //Every once in a while look into the injection queue first so that submitted (or spilled) 
+    // items dont wait forever behind a thread which keeps on feeding itself.
+    if(++pool->threads[thread].pop_ticks % LC_POOL_INJECTION_POLL == 0 
+        && atomic_load_explicit(&pool->injection.count, memory_order_relaxed) > 0
+        && _lc_pool_injection_pop(pool, thread, data, item_size))
+    {
+        _lc_pool_credits_on_pop(pool, thread);
+        return true;
+    }
+
     if(pool->threads[thread].pushed) {
         if(lc_pool_pop_self(pool, thread, data, item_size))
             return true;
         else
+        {
+            //Our queue is empty and only we can push to it so its safe to 
+            // clear our bit. The next push will set it again.
             pool->threads[thread].pushed = false;
+            atomic_store_explicit(&pool->threads[thread].advertised, false, memory_order_relaxed);
+            if(thread < LC_POOL_MASK_THREADS)
+                atomic_fetch_and(&pool->non_empty_mask, ~((uint64_t) 1 << thread));
+
+            //lc_pool_push_to which came after the drain above might have seen the bit still set 
+            // and not set it again. Both sides are seq_cst so either it sees it cleared or we see the item.
+            if(atomic_load(&pool->threads[thread].mailbox.count) > 0)
+            {
+                _lc_pool_mailbox_drain(pool, thread);
+                if(lc_pool_pop_self(pool, thread, data, item_size))
+                    return true;
+            }
+        }
     }
 
     return lc_pool_pop_others(pool, thread, data, item_size);
 }
 
-#if 0
-static inline uint32_t _lc_pool_find_rotate_left32(uint32_t x, uint32_t bits)
-{
-    return (x << bits) | (x >> (32 - bits));
-}
-
-static inline uint32_t _lc_pool_find_rotate_right32(uint32_t x, uint32_t bits)
-{
-    return (x >> bits) | (x << (32 - bits));
-}
-
-static int32_t _lc_pool_find_last_set_bit64(uint64_t num);
-static int32_t _lc_pool_find_first_set_bit64(uint64_t num);
-
-CL_QUEUE_API_INLINE bool lc_pool_pop_others_new(LC_Pool* pool, int32_t thread, void* data, isize item_size)
+CL_QUEUE_INLINE_NEVER
+CL_QUEUE_API bool _lc_pool_pop_wait_slow(LC_Pool* pool, int32_t thread, void* data, isize item_size, double timeout_or_negative_if_infinite)
 {
-    //todo make dynamic
-    enum {MAX_THREADS = 128};
-    uint64_t bots[MAX_THREADS]; //1024 B
-
-    LC_Pool_Thread* self = &pool->threads[thread];
-    uint32_t steal_base = (uint32_t) self->stealing_from;
-    
-    uint64_t pusher_empty_mask = atomic_load_explicit(&pool->pusher_empty_mask, memory_order_relaxed);
-    uint32_t empty_mask = (pusher_empty_mask & 0xffffffffu);
-    uint32_t rot_empty_mask = _lc_pool_find_rotate_right32(empty_mask, steal_base);
-
-    isize threads_count = atomic_load_explicit(&pool->threads_count, memory_order_relaxed);
-    for(isize round = 0; round < 2; round++) {
+    int64_t deadline = INT64_MAX;
+    if(timeout_or_negative_if_infinite >= 0)
+        deadline = _lc_pool_clock_ns() + (int64_t) (timeout_or_negative_if_infinite*1e9);
 
-        uint32_t prev_pos = 0;
-        for(;;)
+    for(;;) {
+        //Standard eventcount: first remember the epoch then announce ourselves and only then check 
+        // for the last time. If a push happens after the check it sees us in sleepers
+        // and bumps the epoch so the wait below returns immediately.
+        uint32_t epoch = atomic_load(&pool->wake_epoch);
+        atomic_fetch_add(&pool->sleepers, 1);
+        bool popped = lc_pool_pop(pool, thread, data, item_size);
+        int64_t now = _lc_pool_clock_ns();
+        if(popped == false && now < deadline)
         {
-            uint64_t mask_so_far = steal_base >> prev_pos;
-            if(mask_so_far == 0)
-                break;
-
-            uint32_t first_bit = (uint32_t) _lc_pool_find_first_set_bit64(mask_so_far);
-            uint32_t pos = (first_bit + steal_base) % 32 + prev_pos;
-            prev_pos = first_bit + 1;
-
-            //dont steal from self
-            if(pos != thread)
+            //Pushes into a queue which is already non empty dont issue a full barrier so 
+            // in a rare race the push might not see us. We never park for longer than the 
+            // slice so such a lost wakeup costs at most that much latency.
+            //Dont sit on credits while parked. Pushers could be waiting for them.
+            LC_Pool_Thread* self = &pool->threads[thread];
+            if(self->credits > 0)
             {
-                LC_Pool_Thread* steal_thread = &pool->threads[pos];
-                CL_Queue_Result result = cl_queue_result_pop(&steal_thread->queue, data, item_size);
-                if(result.state == CL_QUEUE_OK) {
-                
-                    self->stealing_from = pos;
-                    return true;
-                }
-
-                uint64_t ticket = result.bot + atomic_load_explicit(&steal_thread->queue.bot_ticket, memory_order_relaxed);
-
-                //if is my first time around save the position of bot
-                if(round == 0)
-                    bots[pos] = ticket;
-                //... so that the second round I can detect if someone else pushed 
-                // and if they did we have to go start the search anew.
-                // Yes, this is necessary to stay linearizable.
-                else if(bots[pos] != ticket)
-                {
-                    round = -1;
-                    break;
-                }
+                _lc_pool_credits_release(pool, self->credits);
+                self->credits = 0;
             }
 
-
+            int64_t slice = (int64_t) LC_POOL_PARK_SLICE_MS*1000*1000;
+            int64_t wait = deadline - now < slice ? deadline - now : slice;
+            _lc_pool_futex_wait(&pool->wake_epoch, epoch, wait);
         }
+        atomic_fetch_sub(&pool->sleepers, 1);
 
-        //if someone added a thread while we were searching (rare) 
-        // start anew just to be safe
-        isize new_threads_count = atomic_load_explicit(&pool->threads_count, memory_order_relaxed);
-        if(threads_count != new_threads_count)
-        {
-            threads_count = new_threads_count;
-            round = -1;
-        }
+        if(popped || lc_pool_pop(pool, thread, data, item_size))
+            return true;
+        if(_lc_pool_clock_ns() >= deadline)
+            return false;
+    }
+}
+
+CL_QUEUE_API_INLINE bool lc_pool_pop_wait(LC_Pool* pool, int32_t thread, void* data, isize item_size, double timeout_or_negative_if_infinite)
+{
+    for(isize i = 0; i < LC_POOL_WAIT_SPINS; i++)
+    {
+        if(lc_pool_pop(pool, thread, data, item_size))
+            return true;
 
+        _lc_pool_pause();
     }
 
-    return false;
+    return _lc_pool_pop_wait_slow(pool, thread, data, item_size, timeout_or_negative_if_infinite);
+}
+
+CL_QUEUE_INLINE_NEVER
+CL_QUEUE_API void _lc_pool_wake(LC_Pool* pool)
+{
+    atomic_fetch_add(&pool->wake_epoch, 1);
+    _lc_pool_futex_wake(&pool->wake_epoch, false);
+}
+
+CL_QUEUE_API void lc_pool_wake_all(LC_Pool* pool)
+{
+    atomic_fetch_add(&pool->wake_epoch, 1);
+    _lc_pool_futex_wake(&pool->wake_epoch, true);
 }
-#endif
 
 CL_QUEUE_API_INLINE void lc_pool_reserve(LC_Pool* pool, int32_t thread, isize to_size, isize item_size)
 {
@@ -312,6 +833,16 @@ void lc_pool_init(LC_Pool* pool, isize item_size, isize thread_capacity)
     pool->threads = (LC_Pool_Thread*) calloc(thread_capacity, sizeof(LC_Pool_Thread));
     pool->threads_capacity = (int32_t) thread_capacity;
 
+    static CL_QUEUE_ATOMIC(uint64_t) ids;
+    pool->id = atomic_fetch_add(&ids, 1) + 1;
+
+    //0 in steal_epoch means not stealing
+    atomic_store(&pool->epoch, 1);
+    pool->max_capacity = -1;
+    pool->local_capacity = -1;
+    pool->asymmetric_barrier = _lc_pool_asymmetric_barrier_init();
+    pool->stale_interval_ns = (int64_t) LC_POOL_STALE_INTERVAL_US*1000;
+
     atomic_store(&pool->threads_count, 0);
 }
 
@@ -320,7 +851,20 @@ void lc_pool_deinit(LC_Pool* pool)
     isize threads_count = pool->threads_count;
     for(isize i = 0; i < threads_count; i++)
         cl_queue_deinit(&pool->threads[i].queue);
+
+    for(LC_Pool_Retired* curr = pool->retired; curr; )
+    {
+        LC_Pool_Retired* next = curr->next;
+        _lc_pool_free_blocks(curr->blocks);
+        free(curr);
+        curr = next;
+    }
     
+    for(isize i = 0; i < threads_count; i++)
+        free(pool->threads[i].mailbox.data);
+
+    lc_pool_topology_deinit(&pool->topology);
+    free(pool->injection.data);
     free(pool->threads);
     memset(pool, 0, sizeof *pool);
     atomic_store(&pool->threads_count, 0);
@@ -332,18 +876,25 @@ int32_t lc_pool_thread_add(LC_Pool* pool)
     int32_t threads_count = atomic_load(&pool->threads_count);
     LC_Pool_Thread* threads = pool->threads;
 
-    //try to look for removed slot
+    //try to reuse a removed thread. 
+    // Threads are never deallocated so reading next_free of a thread 
+    // someone else popped in the meantime is fine, the generation makes the CAS fail.
     int32_t thread = -1;
-    for(int32_t i = 0; i < threads_count; i++)
+    for(uint64_t first = atomic_load(&pool->free_threads);;)
     {
-        if(threads[i].removed)
+        uint32_t index_plus_one = (uint32_t) first;
+        if(index_plus_one == 0)
+            break;
+
+        uint32_t next = atomic_load(&threads[index_plus_one - 1].next_free);
+        uint64_t new_first = (first & 0xFFFFFFFF00000000ull) + ((uint64_t) 1 << 32) + next;
+        if(atomic_compare_exchange_weak(&pool->free_threads, &first, new_first))
         {
-            bool old_val = true;
-            if(atomic_compare_exchange_strong(&threads[i].removed, &old_val, false))
-            {
-                thread = i;
-                break;
-            }
+            thread = (int32_t) index_plus_one - 1;
+            atomic_store(&threads[thread].removed, false);
+            //the new thread might run somewhere else
+            lc_pool_thread_set_cpu(pool, thread, -1);
+            break;
         }
     }
 
@@ -358,8 +909,10 @@ int32_t lc_pool_thread_add(LC_Pool* pool)
             if(atomic_compare_exchange_weak(&pool->threads_count, &threads_count, threads_count + 1))
             {
                 thread = threads_count;
-                cl_queue_init(&threads[thread].queue, pool->item_size, -1);
+                cl_queue_init(&threads[thread].queue, pool->item_size, pool->local_capacity);
                 threads[thread].stealing_from = thread;
+                threads[thread].rng_state = (uint64_t) (thread + 1) * 0x9E3779B97F4A7C15ull;
+                atomic_store(&threads[thread].cpu, -1);
                 break;
             }
         }    
@@ -371,41 +924,871 @@ int32_t lc_pool_thread_add(LC_Pool* pool)
 void lc_pool_thread_remove(LC_Pool* pool, int32_t thread)
 {
     //todo asserts
-    atomic_store(&pool->threads[thread].removed, true);
-}
+    LC_Pool_Thread* removed = &pool->threads[thread];
+    bool old_val = false;
+    if(atomic_compare_exchange_strong(&removed->removed, &old_val, true) == false)
+        return;
 
+    if(removed->credits > 0)
+        _lc_pool_credits_release(pool, removed->credits);
+    removed->credits = 0;
 
-#if defined(_MSC_VER)
-    #include <intrin.h>
-    static int32_t _lc_pool_find_last_set_bit64(uint64_t num)
+    //so that the items pushed to us end up orphaned like the rest
+    if(atomic_load(&removed->mailbox.count) > 0)
+        _lc_pool_mailbox_drain(pool, thread);
+
+    if(cl_queue_count(&removed->queue) > 0)
     {
-        ASSERT(num != 0);
-        unsigned long out = 0;
-        _BitScanReverse64(&out, (unsigned long long) num);
-        return (int32_t) out;
+        //Nobody will push here anymore so once thieves take all items it stays empty. 
+        // We mark it first and only then look again so that either some thief sees 
+        // the mark when it finds the queue empty or we see it empty here.
+        atomic_store(&removed->orphaned, true);
+        if(thread < LC_POOL_MASK_THREADS)
+            atomic_fetch_or(&pool->orphan_mask, (uint64_t) 1 << thread);
+
+        if(cl_queue_count(&removed->queue) > 0)
+            return;
+        
+        _lc_pool_orphan_finish(pool, thread);
     }
-    
-    static int32_t _lc_pool_find_first_set_bit64(uint64_t num)
-    {
-        ASSERT(num != 0);
-        unsigned long out = 0;
-        _BitScanForward64(&out, (unsigned long long) num);
-        return (int32_t) out;
+    else
+        _lc_pool_thread_release(pool, thread);
+}
+
+void lc_pool_set_victim_policy(LC_Pool* pool, LC_Pool_Victim_Policy policy)
+{
+    pool->victim_policy = policy;
+}
+
+void lc_pool_set_max_capacity(LC_Pool* pool, isize max_capacity_or_negative_if_infinite, LC_Pool_Full_Policy policy)
+{
+    pool->max_capacity = max_capacity_or_negative_if_infinite;
+    pool->full_policy = policy;
+
+    //Each thread keeps at most 2*credit_batch credits so together they hold at most half
+    isize batch = max_capacity_or_negative_if_infinite / (4*(isize) pool->threads_capacity);
+    if(batch > LC_POOL_CREDIT_BATCH || max_capacity_or_negative_if_infinite < 0)
+        batch = LC_POOL_CREDIT_BATCH;
+    pool->credit_batch = batch;
+    atomic_store(&pool->free_capacity, max_capacity_or_negative_if_infinite >= 0 ? max_capacity_or_negative_if_infinite : 0);
+}
+
+void lc_pool_set_local_capacity(LC_Pool* pool, isize local_capacity_or_negative_if_infinite)
+{
+    ASSERT(pool->threads_count == 0);
+    pool->local_capacity = local_capacity_or_negative_if_infinite;
+}
+
+//Takes up to batch credits from the pool and adds them to credits. 
+// Returns false if there are none and the policy is LC_POOL_FULL_FAIL, otherwise waits until there are.
+CL_QUEUE_INLINE_NEVER
+CL_QUEUE_API bool _lc_pool_credits_acquire(LC_Pool* pool, isize* credits, isize batch)
+{
+    for(;;) {
+        isize free_capacity = atomic_load(&pool->free_capacity);
+        while(free_capacity > 0)
+        {
+            isize take = free_capacity < batch ? free_capacity : batch;
+            if(atomic_compare_exchange_weak(&pool->free_capacity, &free_capacity, free_capacity - take))
+            {
+                *credits += take;
+                return true;
+            }
+        }
+
+        if(pool->full_policy == LC_POOL_FULL_FAIL)
+            return false;
+
+        //Same eventcount as in lc_pool_pop_wait. Poppers see us in push_waiters 
+        // and return all their credits instead of keeping them.
+        uint32_t epoch = atomic_load(&pool->space_epoch);
+        atomic_fetch_add(&pool->push_waiters, 1);
+        if(atomic_load(&pool->free_capacity) <= 0)
+            _lc_pool_futex_wait(&pool->space_epoch, epoch, (int64_t) LC_POOL_PARK_SLICE_MS*1000*1000);
+        atomic_fetch_sub(&pool->push_waiters, 1);
     }
-    
-#elif defined(__GNUC__) || defined(__clang__)
-    static int32_t _lc_pool_find_last_set_bit64(uint64_t num)
+}
+
+CL_QUEUE_INLINE_NEVER
+CL_QUEUE_API void _lc_pool_credits_release(LC_Pool* pool, isize credits)
+{
+    atomic_fetch_add(&pool->free_capacity, credits);
+    if(atomic_load(&pool->push_waiters) > 0)
     {
-        ASSERT(num != 0);
-        return 64 - __builtin_clzll((unsigned long long) num) - 1;
+        atomic_fetch_add(&pool->space_epoch, 1);
+        _lc_pool_futex_wake(&pool->space_epoch, true);
     }
-    
-    static int32_t _lc_pool_find_first_set_bit64(uint64_t num)
+}
+
+CL_QUEUE_API_INLINE void _lc_pool_ring_lock(LC_Pool_Ring* ring)
+{
+    while(atomic_exchange(&ring->lock, 1) != 0)
+        _lc_pool_pause();
+}
+
+//Publishes the new count, bumps the version and unlocks
+CL_QUEUE_API_INLINE void _lc_pool_ring_unlock(LC_Pool_Ring* ring, isize count)
+{
+    atomic_fetch_add(&ring->version, 1);
+    atomic_store(&ring->count, count);
+    atomic_store(&ring->lock, 0);
+}
+
+CL_QUEUE_API_INLINE void* _lc_pool_ring_slot(LC_Pool_Ring* ring, isize i, isize item_size)
+{
+    return ring->data + ((ring->head + i) & (ring->capacity - 1))*item_size;
+}
+
+CL_QUEUE_API_INLINE void _lc_pool_ring_pop_front(LC_Pool_Ring* ring)
+{
+    ring->head = (ring->head + 1) & (ring->capacity - 1);
+}
+
+//Grows the ring (under its lock) so that it fits to_count items
+CL_QUEUE_API void _lc_pool_ring_reserve(LC_Pool_Ring* ring, isize to_count, isize item_size)
+{
+    if(to_count <= ring->capacity)
+        return;
+
+    isize new_capacity = ring->capacity > 0 ? ring->capacity : 64;
+    while(new_capacity < to_count)
+        new_capacity *= 2;
+
+    uint8_t* new_data = (uint8_t*) malloc(new_capacity*item_size);
+    isize count = atomic_load_explicit(&ring->count, memory_order_relaxed);
+    for(isize i = 0; i < count; i++)
+        memcpy(new_data + i*item_size, _lc_pool_ring_slot(ring, i, item_size), item_size);
+
+    free(ring->data);
+    ring->data = new_data;
+    ring->capacity = new_capacity;
+    ring->head = 0;
+}
+
+CL_QUEUE_API void _lc_pool_ring_push(LC_Pool_Ring* ring, const void* data, isize item_size)
+{
+    _lc_pool_ring_lock(ring);
+    isize count = atomic_load_explicit(&ring->count, memory_order_relaxed);
+    _lc_pool_ring_reserve(ring, count + 1, item_size);
+    memcpy(_lc_pool_ring_slot(ring, count, item_size), data, item_size);
+    _lc_pool_ring_unlock(ring, count + 1);
+}
+
+CL_QUEUE_INLINE_NEVER
+CL_QUEUE_API bool _lc_pool_ring_pop(LC_Pool_Ring* ring, void* data, isize item_size)
+{
+    _lc_pool_ring_lock(ring);
+    isize count = atomic_load_explicit(&ring->count, memory_order_relaxed);
+    if(count == 0)
     {
-        ASSERT(num != 0);
-        return __builtin_ffsll((long long) num) - 1;
+        atomic_store(&ring->lock, 0);
+        return false;
+    }
+
+    memcpy(data, _lc_pool_ring_slot(ring, 0, item_size), item_size);
+    _lc_pool_ring_pop_front(ring);
+    _lc_pool_ring_unlock(ring, count - 1);
+    return true;
+}
+
+CL_QUEUE_API bool lc_pool_submit(LC_Pool* pool, const void* data, isize item_size)
+{
+    ASSERT(item_size == pool->item_size);
+    //Same accounting as lc_pool_push just without a thread to keep the credits in
+    if(pool->max_capacity >= 0)
+    {
+        isize credits = 0;
+        if(_lc_pool_credits_acquire(pool, &credits, 1) == false)
+            return false;
+    }
+
+    _lc_pool_ring_push(&pool->injection, data, item_size);
+
+    //Unlike pushes this can be the only thing happening so we dont want to 
+    // leave it to the park slice. Full barrier (seq_cst store above) against lc_pool_pop_wait.
+    if(atomic_load(&pool->sleepers) > 0)
+        _lc_pool_wake(pool);
+    return true;
+}
+
+CL_QUEUE_API bool lc_pool_push_to(LC_Pool* pool, int32_t target_thread, const void* data, isize item_size)
+{
+    ASSERT(item_size == pool->item_size);
+    if(pool->max_capacity >= 0)
+    {
+        isize credits = 0;
+        if(_lc_pool_credits_acquire(pool, &credits, 1) == false)
+            return false;
+    }
+
+    LC_Pool_Thread* target = &pool->threads[target_thread];
+    _lc_pool_ring_push(&target->mailbox, data, item_size);
+
+    //Thieves only visit threads with their bit set. Unlike the owner we cannot know 
+    // whether the bit is set so we always set it (after the item is visible). 
+    atomic_store(&target->advertised, true);
+    if(target_thread < LC_POOL_MASK_THREADS)
+        atomic_fetch_or(&pool->non_empty_mask, (uint64_t) 1 << target_thread);
+
+    //if we wake someone else it steals the item
+    if(atomic_load(&pool->sleepers) > 0)
+        _lc_pool_wake(pool);
+    return true;
+}
+
+//Called by the owner of a full bounded queue. Moves the older half of it and the item into the injection queue.
+CL_QUEUE_INLINE_NEVER
+CL_QUEUE_API bool _lc_pool_spill(LC_Pool* pool, int32_t thread, const void* data, isize item_size)
+{
+    CL_Queue* queue = &pool->threads[thread].queue;
+    LC_Pool_Ring* injection = &pool->injection;
+    _lc_pool_ring_lock(injection);
+
+    //We take from the top as thieves do. Thats slower than popping from the back 
+    // but these are the oldest items so they dont end up waiting behind the newer ones.
+    isize count = atomic_load_explicit(&injection->count, memory_order_relaxed);
+    isize half = cl_queue_count(queue)/2;
+    _lc_pool_ring_reserve(injection, count + half + 1, item_size);
+    for(isize i = 0; i < half; i++)
+    {
+        if(cl_queue_pop(queue, _lc_pool_ring_slot(injection, count, item_size), item_size) == false)
+            break;
+        count += 1;
+    }
+
+    memcpy(_lc_pool_ring_slot(injection, count, item_size), data, item_size);
+    _lc_pool_ring_unlock(injection, count + 1);
+    return true;
+}
+
+//Takes one item from the injection queue into data. If thread is not -1 also moves 
+// a batch of others into its queue so that the next pops are local again.
+CL_QUEUE_INLINE_NEVER
+CL_QUEUE_API bool _lc_pool_injection_pop(LC_Pool* pool, int32_t thread, void* data, isize item_size)
+{
+    LC_Pool_Ring* injection = &pool->injection;
+    _lc_pool_ring_lock(injection);
+
+    isize count = atomic_load_explicit(&injection->count, memory_order_relaxed);
+    if(count == 0)
+    {
+        atomic_store(&injection->lock, 0);
+        return false;
+    }
+
+    memcpy(data, _lc_pool_ring_slot(injection, 0, item_size), item_size);
+    _lc_pool_ring_pop_front(injection);
+    count -= 1;
+
+    if(thread != -1)
+    {
+        //As in Go take a fair share of what is there but at most half of our queue
+        isize threads_count = atomic_load_explicit(&pool->threads_count, memory_order_relaxed);
+        isize batch = count/threads_count + 1;
+        if(batch > count)
+            batch = count;
+        if(pool->local_capacity >= 0 && batch > pool->local_capacity/2)
+            batch = pool->local_capacity/2;
+
+        CL_Queue* queue = &pool->threads[thread].queue;
+        isize moved = 0;
+        for(; moved < batch; moved++)
+        {
+            if(cl_queue_push(queue, _lc_pool_ring_slot(injection, 0, item_size), item_size) == false)
+                break;
+            _lc_pool_ring_pop_front(injection);
+        }
+        count -= moved;
+
+        //Before the version changes. A searcher which sees the new version has to see our bit as well 
+        // otherwise it could skip our queue and report the pool empty while the items are in it.
+        if(moved > 0)
+            _lc_pool_advertise(pool, thread);
+    }
+
+    _lc_pool_ring_unlock(injection, count);
+    return true;
+}
+
+//Moves everything pushed to thread into its queue. Called by the owner. 
+// What does not fit into a bounded queue goes to the injection queue.
+CL_QUEUE_INLINE_NEVER
+CL_QUEUE_API void _lc_pool_mailbox_drain(LC_Pool* pool, int32_t thread)
+{
+    LC_Pool_Thread* self = &pool->threads[thread];
+    LC_Pool_Ring* mailbox = &self->mailbox;
+    isize item_size = pool->item_size;
+    _lc_pool_ring_lock(mailbox);
+
+    isize count = atomic_load_explicit(&mailbox->count, memory_order_relaxed);
+    isize moved = 0;
+    for(; moved < count; moved++)
+    {
+        if(cl_queue_push(&self->queue, _lc_pool_ring_slot(mailbox, 0, item_size), item_size) == false)
+            break;
+        _lc_pool_ring_pop_front(mailbox);
+    }
+
+    if(moved < count)
+    {
+        LC_Pool_Ring* injection = &pool->injection;
+        _lc_pool_ring_lock(injection);
+        isize injection_count = atomic_load_explicit(&injection->count, memory_order_relaxed);
+        _lc_pool_ring_reserve(injection, injection_count + count - moved, item_size);
+        for(isize i = moved; i < count; i++, injection_count++)
+        {
+            memcpy(_lc_pool_ring_slot(injection, injection_count, item_size), _lc_pool_ring_slot(mailbox, 0, item_size), item_size);
+            _lc_pool_ring_pop_front(mailbox);
+        }
+        _lc_pool_ring_unlock(injection, injection_count);
+    }
+
+    //before the version changes, see _lc_pool_injection_pop
+    if(moved > 0)
+        _lc_pool_advertise(pool, thread);
+    _lc_pool_ring_unlock(mailbox, 0);
+}
+
+CL_QUEUE_API void _lc_pool_free_blocks(CL_Queue_Block* blocks)
+{
+    for(CL_Queue_Block* curr = blocks; curr; )
+    {
+        CL_Queue_Block* next = curr->next;
+        free(curr);
+        curr = next;
+    }
+}
+
+//Frees retired blocks no thief can be reading anymore. 
+// A thief which announced an epoch at least as big as the one of the 
+// retired blocks started searching only after they were unlinked.
+CL_QUEUE_API void _lc_pool_reclaim(LC_Pool* pool)
+{
+    //someone else is already on it
+    if(atomic_exchange(&pool->retired_lock, 1) != 0)
+        return;
+
+    uint64_t oldest = UINT64_MAX;
+    if(atomic_load(&pool->external_stealers) > 0)
+        oldest = 0;
+
+    int32_t threads_count = atomic_load(&pool->threads_count);
+    for(int32_t i = 0; i < threads_count; i++)
+    {
+        uint64_t epoch = atomic_load(&pool->threads[i].steal_epoch);
+        if(epoch != 0 && epoch < oldest)
+            oldest = epoch;
+    }
+
+    for(LC_Pool_Retired** prev = &pool->retired; *prev; )
+    {
+        LC_Pool_Retired* curr = *prev;
+        if(curr->epoch <= oldest)
+        {
+            *prev = curr->next;
+            _lc_pool_free_blocks(curr->blocks);
+            free(curr);
+        }
+        else
+            prev = &curr->next;
+    }
+
+    atomic_store(&pool->retired_lock, 0);
+}
+
+//Releases all but the smallest block of an empty removed thread and puts it onto the free list. 
+// The queue keeps a single small block because a late thief which 
+// read stale top and bot might still look into it (its CAS fails afterwards).
+CL_QUEUE_API void _lc_pool_thread_release(LC_Pool* pool, int32_t thread)
+{
+    LC_Pool_Thread* removed = &pool->threads[thread];
+    CL_Queue* queue = &removed->queue;
+
+    //nobody can push here until we put it onto the free list so its safe to clear the bit
+    removed->pushed = false;
+    atomic_store(&removed->advertised, false);
+    if(thread < LC_POOL_MASK_THREADS)
+        atomic_fetch_and(&pool->non_empty_mask, ~((uint64_t) 1 << thread));
+
+    CL_Queue_Block* block = atomic_load(&queue->block);
+    CL_Queue_Block* retired = NULL;
+    if(block && block->mask + 1 > LC_POOL_KEPT_CAPACITY)
+    {
+        CL_Queue_Block* small = (CL_Queue_Block*) malloc(sizeof(CL_Queue_Block) + LC_POOL_KEPT_CAPACITY*pool->item_size);
+        small->next = NULL;
+        small->mask = LC_POOL_KEPT_CAPACITY - 1;
+        atomic_store(&queue->block, small);
+        retired = block;
+    }
+    else if(block)
+    {
+        retired = block->next;
+        block->next = NULL;
+    }
+
+    if(retired)
+    {
+        LC_Pool_Retired* node = (LC_Pool_Retired*) malloc(sizeof(LC_Pool_Retired));
+        node->blocks = retired;
+        node->epoch = atomic_fetch_add(&pool->epoch, 1) + 1;
+
+        while(atomic_exchange(&pool->retired_lock, 1) != 0)
+            _lc_pool_pause();
+        node->next = pool->retired;
+        pool->retired = node;
+        atomic_store(&pool->retired_lock, 0);
+    }
+
+    for(uint64_t first = atomic_load(&pool->free_threads);;)
+    {
+        atomic_store(&removed->next_free, (uint32_t) first);
+        uint64_t new_first = (first & 0xFFFFFFFF00000000ull) + ((uint64_t) 1 << 32) + (uint32_t) (thread + 1);
+        if(atomic_compare_exchange_weak(&pool->free_threads, &first, new_first))
+            break;
+    }
+
+    _lc_pool_reclaim(pool);
+}
+
+//Clears bits of queues a failed search found empty. The owners did not clear them 
+// because thieves emptied their queue. 
+//The problem is an owner pushing at the same time: it might see its advertised 
+// flag still set and skip setting the bit. Usually this would need a full barrier 
+// on every push (between pushing and loading advertised). Instead we clear advertised, 
+// issue a barrier on all threads and only then look at the queues again. Any push either 
+// happened before the barrier (and we see it) or loads advertised after it (and sets the bit itself).
+//Only the bits of queues still empty after that are cleared. An owner which loaded advertised 
+// after the barrier might have set its bit just before we cleared it, so we look at advertised 
+// once more and put such bits back.
+//Searches cannot trust the mask during all of this so it happens while stale_seq is odd. 
+//The barrier is an IPI to every cpu. When one producer feeds many thieves nearly every failed 
+// steal finds a drained queue whose bit is still set, so only one thief clears at a time 
+// and at most once per stale_interval_ns. Until then failed searches visit the stale queues.
+CL_QUEUE_INLINE_NEVER
+CL_QUEUE_API void _lc_pool_clear_stale(LC_Pool* pool, uint64_t bits)
+{
+    uint64_t empty_bits = 0;
+    if(_lc_pool_stale_begin(pool, bits, &empty_bits))
+    {
+        _lc_pool_stale_clear(pool, empty_bits);
+        _lc_pool_stale_end(pool, empty_bits);
+    }
+}
+
+//Returns false if someone else is clearing or the last clear was too recent. 
+// Otherwise fills the bits of queues still empty after the barrier and _lc_pool_stale_end has to follow.
+CL_QUEUE_API bool _lc_pool_stale_begin(LC_Pool* pool, uint64_t bits, uint64_t* empty_bits)
+{
+    int64_t now = _lc_pool_clock_ns();
+    if(now - atomic_load_explicit(&pool->stale_cleared_ns, memory_order_relaxed) < pool->stale_interval_ns)
+        return false;
+
+    uint64_t seq = atomic_load_explicit(&pool->stale_seq, memory_order_relaxed);
+    if(seq % 2 == 1 || atomic_compare_exchange_strong(&pool->stale_seq, &seq, seq + 1) == false)
+        return false;
+
+    atomic_store_explicit(&pool->stale_cleared_ns, now, memory_order_relaxed);
+    for(uint64_t rest = bits; rest; rest &= rest - 1)
+        atomic_store(&pool->threads[_lc_pool_find_first_set_bit64(rest)].advertised, false);
+
+    _lc_pool_asymmetric_barrier();
+
+    *empty_bits = 0;
+    for(uint64_t rest = bits; rest; rest &= rest - 1)
+    {
+        int32_t thread = _lc_pool_find_first_set_bit64(rest);
+        if(cl_queue_count(&pool->threads[thread].queue) > 0 || atomic_load(&pool->threads[thread].mailbox.count) > 0)
+            atomic_store(&pool->threads[thread].advertised, true);
+        else
+            *empty_bits |= (uint64_t) 1 << thread;
+    }
+    return true;
+}
+
+CL_QUEUE_API void _lc_pool_stale_clear(LC_Pool* pool, uint64_t empty_bits)
+{
+    if(empty_bits)
+        atomic_fetch_and(&pool->non_empty_mask, ~empty_bits);
+}
+
+CL_QUEUE_API void _lc_pool_stale_end(LC_Pool* pool, uint64_t empty_bits)
+{
+    //the owner set advertised (and its bit) again after the barrier but 
+    // its fetch_or might have come before our fetch_and
+    for(uint64_t rest = empty_bits; rest; rest &= rest - 1)
+    {
+        int32_t thread = _lc_pool_find_first_set_bit64(rest);
+        LC_Pool_Thread* owner = &pool->threads[thread];
+        if(atomic_load(&owner->advertised) || cl_queue_count(&owner->queue) > 0 || atomic_load(&owner->mailbox.count) > 0)
+            atomic_fetch_or(&pool->non_empty_mask, (uint64_t) 1 << thread);
+    }
+
+    atomic_fetch_add(&pool->stale_seq, 1);
+}
+
+//Called by thieves which found an orphaned thread empty. Only one of them does the release.
+CL_QUEUE_INLINE_NEVER
+CL_QUEUE_API void _lc_pool_orphan_finish(LC_Pool* pool, int32_t thread)
+{
+    LC_Pool_Thread* orphan = &pool->threads[thread];
+    for(;;) {
+        bool old_val = true;
+        if(atomic_compare_exchange_strong(&orphan->orphaned, &old_val, false) == false)
+            return;
+
+        if(cl_queue_count(&orphan->queue) == 0)
+            break;
+
+        //We found an earlier incarnation of this thread empty but it was released, 
+        // reused and removed again with items. Put the mark back (same dance as in lc_pool_thread_remove).
+        atomic_store(&orphan->orphaned, true);
+        if(cl_queue_count(&orphan->queue) > 0)
+            return;
+    }
+
+    if(thread < LC_POOL_MASK_THREADS)
+        atomic_fetch_and(&pool->orphan_mask, ~((uint64_t) 1 << thread));
+
+    _lc_pool_thread_release(pool, thread);
+}
+
+#ifdef __cplusplus
+struct _LC_Pool_Local_Cache {
+    enum {CAPACITY = 8};
+    LC_Pool* pools[CAPACITY];
+    uint64_t ids[CAPACITY];
+    int32_t threads[CAPACITY];
+    int32_t count;
+
+    void remove(int32_t i, bool remove_from_pool)
+    {
+        //only remove from the pool if its still the same pool we were added to
+        if(remove_from_pool && pools[i]->id == ids[i])
+            lc_pool_thread_remove(pools[i], threads[i]);
+
+        count -= 1;
+        pools[i] = pools[count];
+        ids[i] = ids[count];
+        threads[i] = threads[count];
+    }
+
+    ~_LC_Pool_Local_Cache()
+    {
+        while(count > 0)
+            remove(count - 1, true);
+    }
+};
+
+static thread_local _LC_Pool_Local_Cache _lc_pool_local_cache;
+
+CL_QUEUE_INLINE_NEVER
+CL_QUEUE_API int32_t _lc_pool_local_thread_slow(LC_Pool* pool)
+{
+    _LC_Pool_Local_Cache* cache = &_lc_pool_local_cache;
+
+    //the pool was deinit-ed and init-ed again at the same address. The old handle is meaningless.
+    for(int32_t i = 0; i < cache->count; i++)
+        if(cache->pools[i] == pool)
+            cache->remove(i--, false);
+
+    int32_t thread = lc_pool_thread_add(pool);
+    if(thread == -1)
+        return -1;
+
+    if(cache->count == _LC_Pool_Local_Cache::CAPACITY)
+        cache->remove(0, true);
+
+    cache->pools[cache->count] = pool;
+    cache->ids[cache->count] = pool->id;
+    cache->threads[cache->count] = thread;
+    cache->count += 1;
+    return thread;
+}
+
+CL_QUEUE_API_INLINE int32_t lc_pool_local_thread(LC_Pool* pool)
+{
+    _LC_Pool_Local_Cache* cache = &_lc_pool_local_cache;
+    for(int32_t i = 0; i < cache->count; i++)
+        if(cache->pools[i] == pool && cache->ids[i] == pool->id)
+            return cache->threads[i];
+
+    return _lc_pool_local_thread_slow(pool);
+}
+
+CL_QUEUE_API void lc_pool_local_release(LC_Pool* pool)
+{
+    _LC_Pool_Local_Cache* cache = &_lc_pool_local_cache;
+    for(int32_t i = 0; i < cache->count; i++)
+        if(cache->pools[i] == pool)
+            cache->remove(i--, true);
+}
+
+CL_QUEUE_API_INLINE bool lc_pool_local_push(LC_Pool* pool, const void* data, isize item_size)
+{
+    int32_t thread = lc_pool_local_thread(pool);
+    return thread != -1 && lc_pool_push(pool, thread, data, item_size);
+}
+
+CL_QUEUE_API_INLINE bool lc_pool_local_pop(LC_Pool* pool, void* data, isize item_size)
+{
+    int32_t thread = lc_pool_local_thread(pool);
+    return thread != -1 && lc_pool_pop(pool, thread, data, item_size);
+}
+#endif
+
+void lc_pool_topology_deinit(LC_Pool_Topology* topology)
+{
+    free(topology->cache_of_cpu);
+    free(topology->socket_of_cpu);
+    memset(topology, 0, sizeof *topology);
+}
+
+void lc_pool_set_topology(LC_Pool* pool, const LC_Pool_Topology* topology)
+{
+    lc_pool_topology_deinit(&pool->topology);
+    int32_t count = topology->cpus_count;
+    pool->topology.cache_of_cpu = (int32_t*) malloc(count*sizeof(int32_t));
+    pool->topology.socket_of_cpu = (int32_t*) malloc(count*sizeof(int32_t));
+    pool->topology.cpus_count = count;
+    memcpy(pool->topology.cache_of_cpu, topology->cache_of_cpu, count*sizeof(int32_t));
+    memcpy(pool->topology.socket_of_cpu, topology->socket_of_cpu, count*sizeof(int32_t));
+
+    //recalculate the masks of all threads
+    int32_t threads_count = atomic_load(&pool->threads_count);
+    for(int32_t i = 0; i < threads_count; i++)
+        lc_pool_thread_set_cpu(pool, i, atomic_load(&pool->threads[i].cpu));
+}
+
+void lc_pool_thread_set_cpu(LC_Pool* pool, int32_t thread, int32_t cpu)
+{
+    //todo asserts
+    const LC_Pool_Topology* topo = &pool->topology;
+    if(cpu >= topo->cpus_count)
+        cpu = -1;
+
+    atomic_store(&pool->threads[thread].cpu, cpu);
+    if(thread >= LC_POOL_MASK_THREADS)
+        return;
+
+    //The masks are only hints about the order in which thieves visit queues so 
+    // we dont care if some thief sees them half updated.
+    uint64_t cache_mask = 0;
+    uint64_t socket_mask = 0;
+    uint64_t self_bit = (uint64_t) 1 << thread;
+    int32_t threads_count = atomic_load(&pool->threads_count);
+    for(int32_t i = 0; i < threads_count && i < LC_POOL_MASK_THREADS; i++)
+    {
+        if(i == thread)
+            continue;
+
+        LC_Pool_Thread* other = &pool->threads[i];
+        int32_t other_cpu = atomic_load(&other->cpu);
+        bool same_cache = false;
+        bool same_socket = false;
+        if(cpu != -1 && other_cpu != -1 && other_cpu < topo->cpus_count)
+        {
+            same_cache = topo->cache_of_cpu[cpu] == topo->cache_of_cpu[other_cpu];
+            same_socket = topo->socket_of_cpu[cpu] == topo->socket_of_cpu[other_cpu];
+        }
+
+        uint64_t other_bit = (uint64_t) 1 << i;
+        if(same_cache)
+        {
+            cache_mask |= other_bit;
+            atomic_fetch_or(&other->cache_mask, self_bit);
+        }
+        else
+            atomic_fetch_and(&other->cache_mask, ~self_bit);
+
+        if(same_socket)
+        {
+            socket_mask |= other_bit;
+            atomic_fetch_or(&other->socket_mask, self_bit);
+        }
+        else
+            atomic_fetch_and(&other->socket_mask, ~self_bit);
     }
 
+    atomic_store(&pool->threads[thread].cache_mask, cache_mask);
+    atomic_store(&pool->threads[thread].socket_mask, socket_mask);
+}
+
+#if defined(__linux__)
+    #include <stdio.h>
+    #include <unistd.h>
+
+    static bool _lc_pool_read_int_file(const char* path, int32_t* out)
+    {
+        FILE* file = fopen(path, "rb");
+        if(file == NULL)
+            return false;
+
+        //also works for lists such as "0-3,8-11" in which case we get the first cpu
+        int value = 0;
+        bool state = fscanf(file, "%d", &value) == 1;
+        fclose(file);
+
+        if(state)
+            *out = (int32_t) value;
+        return state;
+    }
+
+    bool lc_pool_topology_read(LC_Pool_Topology* topology)
+    {
+        lc_pool_topology_deinit(topology);
+        long cpus_count = sysconf(_SC_NPROCESSORS_CONF);
+        if(cpus_count <= 0)
+            return false;
+
+        topology->cpus_count = (int32_t) cpus_count;
+        topology->cache_of_cpu = (int32_t*) malloc(cpus_count*sizeof(int32_t));
+        topology->socket_of_cpu = (int32_t*) malloc(cpus_count*sizeof(int32_t));
+
+        char path[256] = {0};
+        for(int32_t cpu = 0; cpu < cpus_count; cpu++)
+        {
+            //if we dont know treat the cpu as if it was on its own
+            int32_t socket = 0;
+            snprintf(path, sizeof path, "/sys/devices/system/cpu/cpu%i/topology/physical_package_id", (int) cpu);
+            if(_lc_pool_read_int_file(path, &socket) == false)
+                socket = -1 - cpu;
+
+            //find the highest level cache and use the first cpu that shares it as its id
+            int32_t cache = -1 - cpu;
+            int32_t max_level = 0;
+            for(int32_t index = 0;; index++)
+            {
+                int32_t level = 0;
+                int32_t first_cpu = 0;
+                snprintf(path, sizeof path, "/sys/devices/system/cpu/cpu%i/cache/index%i/level", (int) cpu, (int) index);
+                if(_lc_pool_read_int_file(path, &level) == false)
+                    break;
+
+                snprintf(path, sizeof path, "/sys/devices/system/cpu/cpu%i/cache/index%i/shared_cpu_list", (int) cpu, (int) index);
+                if(level > max_level && _lc_pool_read_int_file(path, &first_cpu))
+                {
+                    max_level = level;
+                    cache = first_cpu;
+                }
+            }
+
+            topology->socket_of_cpu[cpu] = socket;
+            topology->cache_of_cpu[cpu] = cache;
+        }
+
+        return true;
+    }
 #else
-    #error unsupported compiler!
-#endif
\ No newline at end of file
+    bool lc_pool_topology_read(LC_Pool_Topology* topology)
+    {
+        lc_pool_topology_deinit(topology);
+        return false;
+    }
+#endif
+
+#if defined(_WIN32) || defined(_WIN64)
+    #include <Windows.h>
+    #pragma comment(lib, "Synchronization.lib")
+
+    static int64_t _lc_pool_clock_ns()
+    {
+        LARGE_INTEGER counter = {0};
+        LARGE_INTEGER freq = {0};
+        QueryPerformanceCounter(&counter);
+        QueryPerformanceFrequency(&freq);
+        return (int64_t) ((double) counter.QuadPart / (double) freq.QuadPart * 1e9);
+    }
+
+    static void _lc_pool_futex_wait(CL_QUEUE_ATOMIC(uint32_t)* state, uint32_t undesired, int64_t timeout_ns)
+    {
+        DWORD ms = (DWORD) ((timeout_ns + 999999)/1000000);
+        WaitOnAddress((volatile void*) state, &undesired, sizeof undesired, ms);
+    }
+
+    static void _lc_pool_futex_wake(CL_QUEUE_ATOMIC(uint32_t)* state, bool all)
+    {
+        if(all)
+            WakeByAddressAll((void*) state);
+        else
+            WakeByAddressSingle((void*) state);
+    }
+
+    static bool _lc_pool_asymmetric_barrier_init()
+    {
+        return true;
+    }
+
+    static void _lc_pool_asymmetric_barrier()
+    {
+        FlushProcessWriteBuffers();
+    }
+#elif defined(__linux__)
+    #include <time.h>
+    #include <limits.h>
+    #include <unistd.h>
+    #include <sys/syscall.h>
+    #include <linux/futex.h>
+    #include <linux/membarrier.h>
+
+    static int64_t _lc_pool_clock_ns()
+    {
+        struct timespec ts = {0};
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (int64_t) ts.tv_sec*1000000000 + ts.tv_nsec;
+    }
+
+    static void _lc_pool_futex_wait(CL_QUEUE_ATOMIC(uint32_t)* state, uint32_t undesired, int64_t timeout_ns)
+    {
+        struct timespec ts = {0};
+        ts.tv_sec = timeout_ns / 1000000000;
+        ts.tv_nsec = timeout_ns % 1000000000;
+        syscall(SYS_futex, (void*) state, FUTEX_WAIT_PRIVATE, undesired, &ts, NULL, 0);
+    }
+
+    static void _lc_pool_futex_wake(CL_QUEUE_ATOMIC(uint32_t)* state, bool all)
+    {
+        syscall(SYS_futex, (void*) state, FUTEX_WAKE_PRIVATE, all ? INT_MAX : 1, NULL, NULL, 0);
+    }
+
+    //needs linux 4.14. The registration is per process and can be repeated.
+    static bool _lc_pool_asymmetric_barrier_init()
+    {
+        long supported = syscall(SYS_membarrier, MEMBARRIER_CMD_QUERY, 0, 0);
+        if(supported < 0 || (supported & MEMBARRIER_CMD_PRIVATE_EXPEDITED) == 0)
+            return false;
+
+        return syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0;
+    }
+
+    static void _lc_pool_asymmetric_barrier()
+    {
+        syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+    }
+#else
+    //No parking support. Waiters simply keep on spinning.
+    #include <time.h>
+    static int64_t _lc_pool_clock_ns()
+    {
+        struct timespec ts = {0};
+        timespec_get(&ts, TIME_UTC);
+        return (int64_t) ts.tv_sec*1000000000 + ts.tv_nsec;
+    }
+
+    static void _lc_pool_futex_wait(CL_QUEUE_ATOMIC(uint32_t)* state, uint32_t undesired, int64_t timeout_ns)
+    {
+        (void) state; (void) undesired; (void) timeout_ns;
+    }
+
+    static void _lc_pool_futex_wake(CL_QUEUE_ATOMIC(uint32_t)* state, bool all)
+    {
+        (void) state; (void) all;
+    }
+
+    //Without it stale bits stay until their owner pops.
+    static bool _lc_pool_asymmetric_barrier_init()
+    {
+        return false;
+    }
+
+    static void _lc_pool_asymmetric_barrier() {}
+#endif
@@ -0,0 +1,459 @@
+#pragma once
+
+//Pool where each thread pushes into its own linked list of blocks of LINK_POOL_BLOCK_SIZE slots.
+// Unlike LC_Pool growing never copies anything, a full block just gets a new one linked after it.
+// Anyone (the owner or thieves) takes an item by clearing its bit in the blocks occupied mask.
+// Thieves find the set bits with count trailing zeros and can claim many of them with a single fetch_and.
+// The owner takes from the end of its last block (LIFO) everyone else from the first block onwards.
+//Blocks whose slots were all claimed are unlinked from the head (by whoever finds them) and given back
+// to the owner which reuses them for its next blocks. Blocks are never freed before link_pool_deinit
+// so thieves can always safely read them. Because of that a block can get reused while a thief is still walking it. 
+// Each block has a generation incremented when its unlinked and thieves check it (like a seqlock) 
+// before following the next pointer.
+//Optionally (link_pool_enable_reclamation) blocks beyond what the owner wants to keep for reuse are freed.
+// Walkers then protect the blocks they visit with hazard pointers.
+
+#include "chase_lev_queue.h"
+#include "hazard_ptr.h"
+
+enum {LINK_POOL_BLOCK_SIZE = 64}; //one bit of Link_Pool_Block::occupied per slot
+
+typedef struct Link_Pool_Block {
+    //incremented each time the block gets unlinked. Whoever increments it gets to unlink it.
+    CL_QUEUE_ATOMIC(uint32_t) gen;
+    //number of slots claimed by pops, except for the ones the owner took back from the end of its last block.
+    // Once it reaches LINK_POOL_BLOCK_SIZE the block is empty for good.
+    CL_QUEUE_ATOMIC(uint32_t) taken;
+    CL_QUEUE_ATOMIC(struct Link_Pool_Block*) next;
+    struct Link_Pool_Block* next_recycled; //next in recycled_public/recycled_private
+
+    //bit i is set if slot i has an item. Set by the owners push, cleared by whoever claims the item.
+    CL_QUEUE_ATOMIC(uint64_t) occupied;
+    uint8_t items[];
+} Link_Pool_Block;
+
+typedef struct Link_Pool_Thread {
+    alignas(64)
+    //the first block which might have items. Changed only by the one unlinking it.
+    CL_QUEUE_ATOMIC(Link_Pool_Block*) head;
+    //incremented on every push so that a failed pop can tell nothing was added while it was searching
+    CL_QUEUE_ATOMIC(uint32_t) push_gen;
+    //blocks unlinked by others. The owner takes all of them at once so there is no ABA.
+    CL_QUEUE_ATOMIC(Link_Pool_Block*) recycled_public;
+    //blocks in recycled_public and recycled_private. Only maintained with reclamation.
+    CL_QUEUE_ATOMIC(isize) recycled_count;
+
+    //The rest is only used by the owner
+    alignas(64)
+    Link_Pool_Block* tail;
+    uint32_t push_index; //next slot in tail
+    int32_t stealing_from;
+    Link_Pool_Block* recycled_private; //unlinked blocks ready to be reused
+    uint32_t* generations; //push_gen of every thread as seen by the last search. Has threads_capacity entries.
+    Hazard_Thread* hazard; //NULL unless reclamation is enabled
+} Link_Pool_Thread;
+
+typedef struct Link_Pool {
+    Link_Pool_Thread* threads;
+    int32_t threads_capacity;
+    CL_QUEUE_ATOMIC(int32_t) threads_count;
+    isize item_size;
+    //Reclamation. Blocks unlinked while the owner already keeps max_recycled of them get retired.
+    isize max_recycled;
+    bool reclaim;
+    Hazard_Domain hazards;
+} Link_Pool;
+
+void link_pool_init(Link_Pool* pool, isize item_size, isize thread_capacity);
+void link_pool_deinit(Link_Pool* pool);
+//Returns the new thread or -1 if the pool is at its threads_capacity
+int32_t link_pool_thread_add(Link_Pool* pool);
+//Makes the pool free empty blocks once a thread has more than max_recycled of them waiting for reuse
+// (otherwise they are kept until deinit). Costs a fence per visited block when stealing.
+// Must be called before any thread is added.
+void link_pool_enable_reclamation(Link_Pool* pool, isize max_recycled);
+
+CL_QUEUE_API_INLINE void link_pool_push(Link_Pool* pool, int32_t thread, const void* data, isize item_size);
+CL_QUEUE_API_INLINE bool link_pool_pop(Link_Pool* pool, int32_t thread, void* data, isize item_size);
+//Pops only from other threads (and the non LIFO part of our own list).
+// Fails only if the whole pool was empty at some point during the call.
+CL_QUEUE_API bool link_pool_pop_others(Link_Pool* pool, int32_t thread, void* data, isize item_size);
+//Pops up to max_count items (into data, one after another) from the first block which has any. 
+// Those are claimed with a single atomic. Returns the number of popped items, 0 only if the pool was empty as above.
+CL_QUEUE_API isize link_pool_pop_many(Link_Pool* pool, int32_t thread, void* data, isize max_count, isize item_size);
+
+CL_QUEUE_API void _link_pool_next_block(Link_Pool* pool, Link_Pool_Thread* self);
+CL_QUEUE_API void _link_pool_trim(Link_Pool* pool, Link_Pool_Thread* self, Link_Pool_Thread* victim);
+CL_QUEUE_API isize _link_pool_pop_from(Link_Pool* pool, Link_Pool_Thread* self, Link_Pool_Thread* victim, void* data, isize max_count, isize item_size);
+
+#if defined(_MSC_VER)
+    #include <intrin.h>
+    static int32_t _link_pool_find_first_set_bit64(uint64_t num)
+    {
+        ASSERT(num != 0);
+        unsigned long out = 0;
+        _BitScanForward64(&out, (unsigned long long) num);
+        return (int32_t) out;
+    }
+
+    static int32_t _link_pool_pop_count64(uint64_t num)
+    {
+        return (int32_t) __popcnt64((unsigned long long) num);
+    }
+    
+#elif defined(__GNUC__) || defined(__clang__)
+    static int32_t _link_pool_find_first_set_bit64(uint64_t num)
+    {
+        ASSERT(num != 0);
+        return __builtin_ctzll((unsigned long long) num);
+    }
+
+    static int32_t _link_pool_pop_count64(uint64_t num)
+    {
+        return __builtin_popcountll((unsigned long long) num);
+    }
+
+#else
+    #error unsupported compiler!
+#endif
+
+CL_QUEUE_API_INLINE void link_pool_push(Link_Pool* pool, int32_t thread, const void* data, isize item_size)
+{
+    Link_Pool_Thread* self = &pool->threads[thread];
+    if(self->push_index >= LINK_POOL_BLOCK_SIZE)
+        _link_pool_next_block(pool, self);
+
+    Link_Pool_Block* block = self->tail;
+    uint32_t i = self->push_index++;
+    memcpy(block->items + i*item_size, data, (size_t) item_size);
+    atomic_fetch_or_explicit(&block->occupied, (uint64_t) 1 << i, memory_order_release);
+
+    uint32_t push_gen = atomic_load_explicit(&self->push_gen, memory_order_relaxed);
+    atomic_store_explicit(&self->push_gen, push_gen + 1, memory_order_release);
+}
+
+CL_QUEUE_API_INLINE bool link_pool_pop(Link_Pool* pool, int32_t thread, void* data, isize item_size)
+{
+    //Take back the last pushed item. If we are the ones to claim it nobody else
+    // can be reading the slot so we can push into it again.
+    Link_Pool_Thread* self = &pool->threads[thread];
+    uint32_t i = self->push_index;
+    if(i > 0)
+    {
+        Link_Pool_Block* block = self->tail;
+        uint64_t bit = (uint64_t) 1 << (i - 1);
+        if((atomic_load_explicit(&block->occupied, memory_order_relaxed) & bit)
+            && (atomic_fetch_and_explicit(&block->occupied, ~bit, memory_order_acquire) & bit))
+        {
+            memcpy(data, block->items + (i - 1)*item_size, (size_t) item_size);
+            self->push_index = i - 1;
+            return true;
+        }
+    }
+
+    return link_pool_pop_others(pool, thread, data, item_size);
+}
+
+//With reclamation the current block is protected by hazard slot 0 or 1 (alternating) 
+// and the next one by the other before it is read.
+CL_QUEUE_API isize _link_pool_pop_from(Link_Pool* pool, Link_Pool_Thread* self, Link_Pool_Thread* victim, void* data, isize max_count, isize item_size)
+{
+    //dont let anyone walk the empty blocks at the start again
+    _link_pool_trim(pool, self, victim);
+    Hazard_Thread* hazard = self->hazard;
+    for(;;) {
+        Link_Pool_Block* block = atomic_load_explicit(&victim->head, memory_order_acquire);
+        if(block == NULL)
+            return 0;
+
+        //the block might be freed already unless its still the head once protected
+        isize hazard_slot = 0;
+        if(hazard)
+        {
+            hazard_set(hazard, hazard_slot, block);
+            if(atomic_load_explicit(&victim->head, memory_order_acquire) != block)
+                continue;
+        }
+
+        //make sure the block was still the head at the generation we read
+        uint32_t gen = atomic_load_explicit(&block->gen, memory_order_acquire);
+        atomic_thread_fence(memory_order_acquire);
+        if(atomic_load_explicit(&victim->head, memory_order_relaxed) != block)
+            continue;
+
+        for(;;) {
+            for(uint64_t occupied = atomic_load_explicit(&block->occupied, memory_order_relaxed); occupied != 0; )
+            {
+                //the lowest max_count set bits
+                uint64_t wanted = occupied;
+                if(max_count < _link_pool_pop_count64(occupied))
+                {
+                    wanted = 0;
+                    for(isize k = 0; k < max_count; k++)
+                        wanted |= (occupied & ~wanted) & (0 - (occupied & ~wanted));
+                }
+
+                //Claim first and copy later. The block cannot be reused before we increment taken.
+                // (Even if it got reused before we claimed the slot the item is a valid one of the new generation)
+                uint64_t before = atomic_fetch_and_explicit(&block->occupied, ~wanted, memory_order_acquire);
+                uint64_t claimed = before & wanted;
+                if(claimed)
+                {
+                    isize count = 0;
+                    for(uint64_t rest = claimed; rest; rest &= rest - 1, count++)
+                    {
+                        int32_t i = _link_pool_find_first_set_bit64(rest);
+                        memcpy((uint8_t*) data + count*item_size, block->items + i*item_size, (size_t) item_size);
+                    }
+                    atomic_fetch_add_explicit(&block->taken, (uint32_t) count, memory_order_release);
+                    return count;
+                }
+
+                //someone was faster, try whatever is left
+                occupied = before & ~wanted;
+            }
+
+            //Read the generation of next before validating block. Blocks are unlinked in order
+            // so if block is still in the list next was too at the time we read its generation.
+            Link_Pool_Block* next = atomic_load_explicit(&block->next, memory_order_acquire);
+            if(hazard && next)
+            {
+                //block still linked means next is too (and so not retired)
+                hazard_set(hazard, 1 - hazard_slot, next);
+                if(atomic_load_explicit(&block->gen, memory_order_acquire) != gen)
+                    break;
+            }
+            uint32_t next_gen = next ? atomic_load_explicit(&next->gen, memory_order_acquire) : 0;
+            atomic_thread_fence(memory_order_acquire);
+            if(atomic_load_explicit(&block->gen, memory_order_relaxed) != gen)
+                break; //got unlinked while we were reading it, start over
+
+            if(next == NULL)
+                return 0;
+
+            block = next;
+            gen = next_gen;
+            hazard_slot = 1 - hazard_slot;
+        }
+    }
+}
+
+CL_QUEUE_API_INLINE void _link_pool_clear_hazards(Link_Pool_Thread* self)
+{
+    if(self->hazard)
+    {
+        hazard_clear(self->hazard, 0);
+        hazard_clear(self->hazard, 1);
+    }
+}
+
+CL_QUEUE_API isize _link_pool_pop_others(Link_Pool* pool, int32_t thread, void* data, isize max_count, isize item_size)
+{
+    //Double collect on push_gen: a thread whose push_gen did not change since we found it empty
+    // is still empty since pops only remove. Once a pass over all threads sees no change
+    // the whole pool was empty at the start of that pass.
+    Link_Pool_Thread* self = &pool->threads[thread];
+    uint32_t* gens = self->generations;
+
+    int32_t searched_count = 0;
+    for(bool changed = true; changed; )
+    {
+        changed = false;
+        int32_t threads_count = atomic_load(&pool->threads_count);
+        for(int32_t k = 0; k < threads_count; k++)
+        {
+            int32_t victim = (self->stealing_from + k) % threads_count;
+            uint32_t present_gen = atomic_load(&pool->threads[victim].push_gen);
+            if(victim < searched_count && gens[victim] == present_gen)
+                continue;
+
+            gens[victim] = present_gen;
+            changed = true;
+            isize popped = _link_pool_pop_from(pool, self, &pool->threads[victim], data, max_count, item_size);
+            if(popped > 0)
+            {
+                self->stealing_from = victim;
+                _link_pool_clear_hazards(self);
+                return popped;
+            }
+        }
+
+        searched_count = threads_count;
+    }
+
+    _link_pool_clear_hazards(self);
+    return 0;
+}
+
+CL_QUEUE_API bool link_pool_pop_others(Link_Pool* pool, int32_t thread, void* data, isize item_size)
+{
+    return _link_pool_pop_others(pool, thread, data, 1, item_size) > 0;
+}
+
+CL_QUEUE_API isize link_pool_pop_many(Link_Pool* pool, int32_t thread, void* data, isize max_count, isize item_size)
+{
+    if(max_count <= 0)
+        return 0;
+    return _link_pool_pop_others(pool, thread, data, max_count, item_size);
+}
+
+CL_QUEUE_API Link_Pool_Block* _link_pool_alloc_block(Link_Pool* pool)
+{
+    Link_Pool_Block* block = (Link_Pool_Block*) malloc(sizeof(Link_Pool_Block) + LINK_POOL_BLOCK_SIZE*pool->item_size);
+    memset(block, 0, sizeof(Link_Pool_Block));
+    return block;
+}
+
+//Unlinks the empty blocks at the head. Blocks in the middle are unlinked once all blocks before them are.
+// Can be called by anyone.
+// self is the calling thread. With reclamation its hazard slot 0 protects head.
+CL_QUEUE_API void _link_pool_trim(Link_Pool* pool, Link_Pool_Thread* self, Link_Pool_Thread* victim)
+{
+    for(;;) {
+        Link_Pool_Block* head = atomic_load_explicit(&victim->head, memory_order_acquire);
+        if(head == NULL)
+            return;
+
+        if(self->hazard)
+        {
+            hazard_set(self->hazard, 0, head);
+            if(atomic_load_explicit(&victim->head, memory_order_acquire) != head)
+                continue;
+        }
+        uint32_t gen = atomic_load_explicit(&head->gen, memory_order_acquire);
+        if(atomic_load_explicit(&victim->head, memory_order_acquire) != head
+            || atomic_load_explicit(&head->taken, memory_order_acquire) != LINK_POOL_BLOCK_SIZE)
+            return;
+
+        //next is NULL if the block is still the owners tail
+        Link_Pool_Block* next = atomic_load_explicit(&head->next, memory_order_acquire);
+        if(next == NULL)
+            return;
+
+        //The generation did not change so head was not reused and everything we read belongs to it.
+        // The winner of the CAS is the only one who can move the head until it does so.
+        // Walkers see the generation change before the head moves.
+        if(atomic_compare_exchange_strong(&head->gen, &gen, gen + 1) == false)
+            continue;
+
+        atomic_store_explicit(&victim->head, next, memory_order_release);
+
+        //The owner has enough blocks for reuse so this one goes. Its unreachable now but walkers
+        // might still be reading it.
+        if(pool->reclaim)
+        {
+            if(atomic_load_explicit(&victim->recycled_count, memory_order_relaxed) >= pool->max_recycled)
+            {
+                hazard_retire(&pool->hazards, self->hazard, head, free);
+                continue;
+            }
+            atomic_fetch_add_explicit(&victim->recycled_count, 1, memory_order_relaxed);
+        }
+
+        Link_Pool_Block* first = atomic_load_explicit(&victim->recycled_public, memory_order_relaxed);
+        do {
+            head->next_recycled = first;
+        } while(atomic_compare_exchange_weak_explicit(&victim->recycled_public, &first, head, memory_order_release, memory_order_relaxed) == false);
+    }
+}
+
+//Links a new block after tail and unlinks the empty blocks at the head
+CL_QUEUE_INLINE_NEVER
+CL_QUEUE_API void _link_pool_next_block(Link_Pool* pool, Link_Pool_Thread* self)
+{
+    if(self->recycled_private == NULL)
+        self->recycled_private = atomic_exchange_explicit(&self->recycled_public, (Link_Pool_Block*) NULL, memory_order_acquire);
+
+    Link_Pool_Block* block = self->recycled_private;
+    if(block)
+    {
+        //Thieves still walking the block see the generation change
+        // (incremented when unlinked) before any of the changes below.
+        self->recycled_private = block->next_recycled;
+        if(pool->reclaim)
+            atomic_fetch_sub_explicit(&self->recycled_count, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        atomic_store_explicit(&block->next, (Link_Pool_Block*) NULL, memory_order_relaxed);
+        atomic_store_explicit(&block->taken, 0, memory_order_relaxed);
+        //all slots were claimed and so occupied is already 0
+    }
+    else
+        block = _link_pool_alloc_block(pool);
+
+    atomic_store_explicit(&self->tail->next, block, memory_order_release);
+    self->tail = block;
+    self->push_index = 0;
+
+    _link_pool_trim(pool, self, self);
+    if(self->hazard)
+        hazard_clear(self->hazard, 0);
+}
+
+void link_pool_init(Link_Pool* pool, isize item_size, isize thread_capacity)
+{
+    memset(pool, 0, sizeof *pool);
+    pool->item_size = item_size;
+    pool->threads = (Link_Pool_Thread*) calloc(thread_capacity, sizeof(Link_Pool_Thread));
+    pool->threads_capacity = (int32_t) thread_capacity;
+    atomic_store(&pool->threads_count, 0);
+}
+
+void link_pool_deinit(Link_Pool* pool)
+{
+    int32_t threads_count = atomic_load(&pool->threads_count);
+    for(int32_t i = 0; i < threads_count; i++)
+    {
+        Link_Pool_Thread* thread = &pool->threads[i];
+        for(Link_Pool_Block* block = atomic_load(&thread->head); block; )
+        {
+            Link_Pool_Block* next = atomic_load(&block->next);
+            free(block);
+            block = next;
+        }
+        Link_Pool_Block* recycled[2] = {thread->recycled_private, atomic_load(&thread->recycled_public)};
+        for(isize k = 0; k < 2; k++)
+            for(Link_Pool_Block* block = recycled[k]; block; )
+            {
+                Link_Pool_Block* next = block->next_recycled;
+                free(block);
+                block = next;
+            }
+        free(thread->generations);
+    }
+
+    free(pool->threads);
+    if(pool->reclaim)
+        hazard_domain_deinit(&pool->hazards);
+    memset(pool, 0, sizeof *pool);
+    atomic_store(&pool->threads_count, 0);
+}
+
+int32_t link_pool_thread_add(Link_Pool* pool)
+{
+    for(;;) {
+        int32_t threads_count = atomic_load(&pool->threads_count);
+        if(threads_count == pool->threads_capacity)
+            return -1;
+
+        //The thread is zero (no head) until we set it up below so thieves see it as empty
+        if(atomic_compare_exchange_weak(&pool->threads_count, &threads_count, threads_count + 1))
+        {
+            Link_Pool_Thread* thread = &pool->threads[threads_count];
+            thread->generations = (uint32_t*) calloc(pool->threads_capacity, sizeof(uint32_t));
+            thread->stealing_from = threads_count;
+            if(pool->reclaim)
+                thread->hazard = hazard_thread_acquire(&pool->hazards);
+            thread->tail = _link_pool_alloc_block(pool);
+            atomic_store(&thread->head, thread->tail);
+            return threads_count;
+        }
+    }
+}
+
+void link_pool_enable_reclamation(Link_Pool* pool, isize max_recycled)
+{
+    ASSERT(atomic_load(&pool->threads_count) == 0);
+    pool->reclaim = true;
+    pool->max_recycled = max_recycled;
+    hazard_domain_init(&pool->hazards);
+}
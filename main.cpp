@@ -1,7 +1,16 @@
 
-//#include "_test_pools.h"
+#include "_test_pools.h"
+#include "_test_executor.h"
+#include "_test_object_pool.h"
+#include "_test_link_pool.h"
+#include "_test_sync_stacks.h"
+#include "_test_index_mem.h"
+#include "_test_hazard_ptr.h"
+#include "_test_latency.h"
+#include "_test_baselines.h"
 #include "_test_chase_lev_queue.h"
 //#include "_test_k_queue.h"
+#include "_bench_runner.h"
 
 typedef enum Reread_Operation {
     REREAD_READ_CAS,
@@ -42,12 +51,13 @@ static void bench_reread_thread_func(void *arg)
 
     while(*thread->run_test == 0); 
     
+    //deadline is in test_cl_ticks and only checked every few iterations (tries counts them)
     thread->start = test_cl_clock_ns();
     isize deadline = atomic_load_explicit(thread->deadline, memory_order_relaxed);
 
     if(thread->operation == REREAD_READ_CAS)
     {
-        while(test_cl_clock_ns() < deadline)
+        while(thread->tries % TEST_CL_DEADLINE_EVERY != 0 || test_cl_ticks() < deadline)
         {
             uint64_t val = atomic_load_explicit(thread->shared_val, memory_order_relaxed);
             thread->ops += atomic_compare_exchange_strong_explicit(thread->shared_val, &val, val + 1, memory_order_relaxed, memory_order_relaxed);
@@ -56,7 +66,7 @@ static void bench_reread_thread_func(void *arg)
     }
     if(thread->operation == REREAD_CAS)
     {
-        while(test_cl_clock_ns() < deadline)
+        while(thread->tries % TEST_CL_DEADLINE_EVERY != 0 || test_cl_ticks() < deadline)
         {
             uint64_t ops = thread->ops;
             thread->ops += atomic_compare_exchange_strong_explicit(thread->shared_val, &ops, ops + 1, memory_order_relaxed, memory_order_relaxed);
@@ -65,7 +75,7 @@ static void bench_reread_thread_func(void *arg)
     }
     if(thread->operation == REREAD_XCHG)
     {
-        while(test_cl_clock_ns() < deadline)
+        while(thread->tries % TEST_CL_DEADLINE_EVERY != 0 || test_cl_ticks() < deadline)
         {
             thread->private_val_nonatomic += atomic_exchange_explicit(thread->shared_val, 1, memory_order_relaxed);
             thread->ops += 1; 
@@ -74,7 +84,7 @@ static void bench_reread_thread_func(void *arg)
     }
     if(thread->operation == REREAD_OR)
     {
-        while(test_cl_clock_ns() < deadline)
+        while(thread->tries % TEST_CL_DEADLINE_EVERY != 0 || test_cl_ticks() < deadline)
         {
             atomic_fetch_or_explicit(thread->shared_val, 1, memory_order_relaxed);
             thread->ops += 1; 
@@ -83,7 +93,7 @@ static void bench_reread_thread_func(void *arg)
     }
     if(thread->operation == REREAD_FAA)
     {
-        while(test_cl_clock_ns() < deadline)
+        while(thread->tries % TEST_CL_DEADLINE_EVERY != 0 || test_cl_ticks() < deadline)
         {
             atomic_fetch_add_explicit(thread->shared_val, 1, memory_order_relaxed);
             thread->ops += 1; 
@@ -92,7 +102,7 @@ static void bench_reread_thread_func(void *arg)
     }
     if(thread->operation == REREAD_WRITE)
     {
-        while(test_cl_clock_ns() < deadline)
+        while(thread->tries % TEST_CL_DEADLINE_EVERY != 0 || test_cl_ticks() < deadline)
         {
             atomic_store_explicit(thread->shared_val, thread->ops, memory_order_relaxed);
             thread->ops += 1; 
@@ -101,7 +111,7 @@ static void bench_reread_thread_func(void *arg)
     }
     if(thread->operation == REREAD_READ)
     {
-        while(test_cl_clock_ns() < deadline)
+        while(thread->tries % TEST_CL_DEADLINE_EVERY != 0 || test_cl_ticks() < deadline)
         {
             uint64_t val = atomic_load_explicit(thread->shared_val, memory_order_relaxed);
             thread->private_val_nonatomic += val;
@@ -111,7 +121,7 @@ static void bench_reread_thread_func(void *arg)
     }
     if(thread->operation == REREAD_READ_PRIVATE)
     {
-        while(test_cl_clock_ns() < deadline)
+        while(thread->tries % TEST_CL_DEADLINE_EVERY != 0 || test_cl_ticks() < deadline)
         {
             uint64_t val = atomic_load_explicit(&thread->private_val, memory_order_relaxed);
             thread->private_val_nonatomic += val;
@@ -163,7 +173,7 @@ Bench_Reread_Result bench_reread_single(Reread_Operation op1, isize count1, Rere
     
     {
         while(started != count1 + count2);
-        deadline = test_cl_clock_ns() + (isize)(seconds * 1e9);
+        deadline = test_cl_ticks_after(seconds);
         run_test = 1;
         
         test_cl_sleep_thread(seconds);
@@ -195,27 +205,448 @@ Bench_Reread_Result bench_reread_single(Reread_Operation op1, isize count1, Rere
     return result;
 }
 
-void bench_reread_all(double seconds, isize threads)
+//BENCH RUNNER ENTRIES
+//Each measures all variants of one benchmark once for the given number of threads. See _bench_runner.h
+static void run_bench_reread(Bench_Runner* runner, isize threads)
 {
-    for(isize i = 0; i < threads - 1; i++)
+    //one thread writes, the rest read the same cache line
+    Bench_Reread_Result res = bench_reread_single(REREAD_XCHG, 1, REREAD_READ, threads - 1, runner->options.seconds);
+    bench_report(runner, "xchg", sizeof(uint64_t), res.ops1/res.duration1);
+    if(threads > 1)
+        bench_report(runner, "read", sizeof(uint64_t), res.ops2/res.duration2);
+}
+
+static void run_bench_chase_lev(Bench_Runner* runner, isize threads)
+{
+    //the owner pushes, the rest steal with a slowdown (pauses) between steals
+    isize slowdowns[4] = {0, 5, 10, 15};
+    for(isize k = 0; k < 4; k++)
+    {
+        char variant[64] = {0};
+        Bench_CL_Result res = bench_chase_lev_single(1024*1024*2, threads - 1, runner->options.seconds, slowdowns[k]);
+        snprintf(variant, sizeof variant, "push slowdown %lli", slowdowns[k]);
+        bench_report(runner, variant, sizeof(isize), (double) res.push_ops/res.time);
+        if(threads > 1)
+        {
+            snprintf(variant, sizeof variant, "steal slowdown %lli", slowdowns[k]);
+            bench_report(runner, variant, sizeof(isize), (double) res.pop_ops/res.time);
+        }
+    }
+}
+
+static void run_bench_lc_pool(Bench_Runner* runner, isize threads)
+{
+    const char* names[4] = {"ping/pong", "50/50", "1 push N pop", "N push 1 pop"};
+    void (*funcs[4])(void*) = {bench_lc_pool_ping_pong_thread_func, bench_lc_pool_50_50_thread_func, bench_lc_pool_asymetric_thread_func, bench_lc_pool_asymetric_thread_func};
+    isize a_counts[4] = {threads/2, threads/2, 1, threads - 1};
+    for(isize k = 0; k < 4; k++)
+    {
+        Bench_Pool_Result res = bench_lc_pool_single(0, false, 1024*1024*2, a_counts[k], threads - a_counts[k], runner->options.seconds, funcs[k]);
+        bench_report(runner, names[k], sizeof(isize), (double) res.ops/res.time);
+    }
+}
+
+static void run_bench_lc_pool_victims(Bench_Runner* runner, isize threads)
+{
+    const char* names[3] = {"ping/pong", "50/50", "1 push N pop"};
+    const char* policy_names[4] = {"sequential", "random", "two choices", "sticky"};
+    void (*funcs[3])(void*) = {bench_lc_pool_ping_pong_thread_func, bench_lc_pool_50_50_thread_func, bench_lc_pool_asymetric_thread_func};
+    for(isize k = 0; k < 3; k++)
+        for(isize policy = 0; policy < 4; policy++)
+        {
+            char variant[64] = {0};
+            isize a_count = k == 2 ? 1 : threads/2;
+            uint64_t user = (uint64_t) policy << BENCH_LC_POOL_POLICY_SHIFT;
+            Bench_Pool_Result res = bench_lc_pool_single(user, false, 1024*1024*2, a_count, threads - a_count, runner->options.seconds, funcs[k]);
+            snprintf(variant, sizeof variant, "%s %s", names[k], policy_names[policy]);
+            bench_report(runner, variant, sizeof(isize), (double) res.ops/res.time);
+        }
+}
+
+static void run_bench_lc_pool_idle(Bench_Runner* runner, isize threads)
+{
+    //one busy worker, the others keep failing to steal using the non empty mask or scanning all queues
+    double seconds = runner->options.seconds;
+    Bench_Pool_Result mask = bench_lc_pool_single(BENCH_LC_POOL_IDLE_MASK, false, 0, 1, threads - 1, seconds, bench_lc_pool_idle_thread_func);
+    Bench_Pool_Result scan = bench_lc_pool_single(BENCH_LC_POOL_IDLE_SCAN, false, 0, 1, threads - 1, seconds, bench_lc_pool_idle_thread_func);
+    bench_report(runner, "worker mask", sizeof(isize), (double) mask.ops/mask.time);
+    bench_report(runner, "worker scan", sizeof(isize), (double) scan.ops/scan.time);
+    if(threads > 1)
+    {
+        bench_report(runner, "idle pops mask", sizeof(isize), (double) mask.tries/mask.time);
+        bench_report(runner, "idle pops scan", sizeof(isize), (double) scan.tries/scan.time);
+    }
+}
+
+static void run_bench_lc_pool_wait(Bench_Runner* runner, isize threads)
+{
+    //threads - 1 waiters get an item every 1ms by spinning on lc_pool_pop or parking in lc_pool_pop_wait. 
+    // The latency is from push to pop, the ops are items per second of cpu time used by everyone.
+    const char* names[2] = {"spin", "park"};
+    uint64_t users[2] = {BENCH_LC_POOL_WAIT_SPIN, BENCH_LC_POOL_WAIT_PARK};
+    for(isize k = 0; k < 2; k++)
+    {
+        Bench_Hist* hist = (Bench_Hist*) calloc(1, sizeof(Bench_Hist));
+        Bench_Pool_Wait_Result res = bench_lc_pool_wait_single(users[k], threads - 1, runner->options.seconds, 0.001, hist);
+        double cpu_seconds = res.cpu_usage*runner->options.seconds;
+        bench_report_latency(runner, names[k], sizeof(isize), cpu_seconds > 0 ? (double) res.items/cpu_seconds : 0, hist, 1);
+        free(hist);
+    }
+}
+
+static void run_bench_lc_pool_register(Bench_Runner* runner, isize threads)
+{
+    //lc_pool_thread_add + lc_pool_thread_remove pairs on a pool which already had many threads
+    Bench_Pool_Result res = bench_lc_pool_single(0, false, 0, threads, 0, runner->options.seconds, bench_lc_pool_register_thread_func);
+    bench_report(runner, "add/remove", sizeof(isize), (double) res.ops/res.time);
+}
+
+static void run_bench_lc_pool_topology(Bench_Runner* runner, isize threads)
+{
+    //both pinned the same way, only the second one knows about the topology
+    double seconds = runner->options.seconds;
+    uint64_t pinned = BENCH_LC_POOL_PIN_THREADS;
+    uint64_t hierarchical = BENCH_LC_POOL_PIN_THREADS | BENCH_LC_POOL_USE_TOPOLOGY;
+    Bench_Pool_Result res = bench_lc_pool_single(pinned, false, 1024*1024*2, threads/2, (threads + 1)/2, seconds, bench_lc_pool_50_50_thread_func);
+    bench_report(runner, "50/50 round-robin", sizeof(isize), (double) res.ops/res.time);
+    res = bench_lc_pool_single(hierarchical, false, 1024*1024*2, threads/2, (threads + 1)/2, seconds, bench_lc_pool_50_50_thread_func);
+    bench_report(runner, "50/50 hierarchical", sizeof(isize), (double) res.ops/res.time);
+    res = bench_lc_pool_single(pinned, false, 1024*1024*2, 1, threads - 1, seconds, bench_lc_pool_asymetric_thread_func);
+    bench_report(runner, "1 push N pop round-robin", sizeof(isize), (double) res.ops/res.time);
+    res = bench_lc_pool_single(hierarchical, false, 1024*1024*2, 1, threads - 1, seconds, bench_lc_pool_asymetric_thread_func);
+    bench_report(runner, "1 push N pop hierarchical", sizeof(isize), (double) res.ops/res.time);
+}
+
+static void run_bench_lc_pool_atomics(Bench_Runner* runner, isize threads)
+{
+    //every thread hammers the same target with the operation
+    const char* names[7] = {"FAA", "CAS", "half FAA", "half CAS", "CAS128", "fat stack", "fat stack locked"};
+    uint64_t users[7] = {BENCH_LC_POOL_FAA, BENCH_LC_POOL_CAS, BENCH_LC_POOL_HALF_FAA, BENCH_LC_POOL_HALF_CAS, 
+        BENCH_LC_POOL_CAS128, BENCH_LC_POOL_FAT_STACK, BENCH_LC_POOL_FAT_STACK_LOCK};
+    for(isize k = 0; k < 7; k++)
+    {
+        if(users[k] == BENCH_LC_POOL_CAS128 && (FAT_STACK_CAS128 && fat_stack_has_cas128()) == false)
+            continue;
+
+        Bench_Pool_Result res = bench_lc_pool_single(users[k], false, 0, threads, 0, runner->options.seconds, bench_lc_pool_faa_thread_func);
+        bench_report(runner, names[k], sizeof(uint64_t), (double) res.ops/res.time);
+    }
+}
+
+static void run_bench_lc_pool_stale(Bench_Runner* runner, isize threads)
+{
+    //clearing stale bits of drained queues (rate limited by default) against never and always clearing them
+    const char* names[3] = {"never", "always", "limited"};
+    uint64_t users[3] = {BENCH_LC_POOL_CLEAR_NEVER, BENCH_LC_POOL_CLEAR_ALWAYS, 0};
+    double seconds = runner->options.seconds;
+    for(isize k = 0; k < 3; k++)
+    {
+        char variant[64] = {0};
+        Bench_Pool_Result res = bench_lc_pool_single(users[k], false, 1024*1024*2, 1, threads - 1, seconds, bench_lc_pool_asymetric_thread_func);
+        snprintf(variant, sizeof variant, "1 push N pop %s", names[k]);
+        bench_report(runner, variant, sizeof(isize), (double) res.ops/res.time);
+        
+        res = bench_lc_pool_single(BENCH_LC_POOL_IDLE_MASK | users[k], false, 0, 1, threads - 1, seconds, bench_lc_pool_idle_thread_func);
+        snprintf(variant, sizeof variant, "idle pops %s", names[k]);
+        bench_report(runner, variant, sizeof(isize), (double) res.tries/res.time);
+    }
+}
+
+static void run_bench_lc_pool_capacity(Bench_Runner* runner, isize threads)
+{
+    //Producers outrun slower consumers. Not time based and the values are not ops: 
+    // the most items and the most bytes of queue blocks the pool held at once, without and with max_capacity.
+    isize item_count = 1000*1000*10;
+    Test_Pool_Runaway_Result unlimited = test_lc_pool_runaway(-1, threads/2, (threads + 1)/2, item_count, 100);
+    Test_Pool_Runaway_Result limited = test_lc_pool_runaway(100000, threads/2, (threads + 1)/2, item_count, 100);
+    bench_report(runner, "unlimited max items", sizeof(isize), (double) unlimited.max_items);
+    bench_report(runner, "unlimited max block bytes", sizeof(isize), (double) unlimited.max_block_size);
+    bench_report(runner, "limited max items", sizeof(isize), (double) limited.max_items);
+    bench_report(runner, "limited max block bytes", sizeof(isize), (double) limited.max_block_size);
+}
+
+static void run_bench_link_pool(Bench_Runner* runner, isize threads)
+{
+    double seconds = runner->options.seconds;
+    bench_report(runner, "lc_pool 50/50", sizeof(isize), bench_link_pool_single(false, false, 0, threads, seconds)*1e6);
+    bench_report(runner, "link_pool 50/50", sizeof(isize), bench_link_pool_single(true, false, 0, threads, seconds)*1e6);
+    if(threads > 1)
     {
-        isize j = 1;
-        Bench_Reread_Result res = bench_reread_single(REREAD_XCHG, j, REREAD_READ, i, seconds);
+        bench_report(runner, "lc_pool 1 push N pop", sizeof(isize), bench_link_pool_single(false, true, 0, threads, seconds)*1e6);
+        bench_report(runner, "link_pool 1 push N pop", sizeof(isize), bench_link_pool_single(true, true, 0, threads, seconds)*1e6);
+        bench_report(runner, "link_pool pop_many(16)", sizeof(isize), bench_link_pool_single(true, true, 16, threads, seconds)*1e6);
+    }
+}
 
-        printf("%2lli x %2lli: ops/tries %5.2lf/%5.2lf M/s (%.2lf) | ops/tries %5.2lf/%5.2lf M/s (%.2lf)\n", j, i,
-            res.ops1/res.duration1/1e6, res.tries1/res.duration1/1e6, (double) res.ops1/res.tries1,
-            res.ops2/res.duration2/1e6, res.tries2/res.duration2/1e6, (double) res.ops2/res.tries2
-        );
+static void run_bench_object_pool(Bench_Runner* runner, isize threads)
+{
+    //the objects get written to as isize
+    isize object_size = runner->options.item_size < (isize) sizeof(isize) ? (isize) sizeof(isize) : runner->options.item_size;
+    bench_report(runner, "malloc batch 16", object_size, bench_object_pool_local_single(threads, 16, object_size, true, runner->options.seconds));
+    bench_report(runner, "pool batch 16", object_size, bench_object_pool_local_single(threads, 16, object_size, false, runner->options.seconds));
+
+    //producers allocate, their consumers free (threads/2 pairs)
+    if(threads >= 2)
+    {
+        double seconds = runner->options.seconds;
+        Object_Pool pool = {0};
+        object_pool_init(&pool, sizeof(Test_Object_Pool_Object));
+        isize with_malloc = test_object_pool_cross_thread_run(&pool, threads/2, seconds, 1000, true);
+        isize with_pool = test_object_pool_cross_thread_run(&pool, threads/2, seconds, 1000, false);
+        object_pool_deinit(&pool);
+        bench_report(runner, "malloc cross thread", sizeof(Test_Object_Pool_Object), with_malloc/seconds);
+        bench_report(runner, "pool cross thread", sizeof(Test_Object_Pool_Object), with_pool/seconds);
     }
 }
 
+static void run_bench_sync_stacks(Bench_Runner* runner, isize threads)
+{
+    for(isize kind = 0; kind < TEST_SYNC_STACK_KIND_COUNT; kind++)
+        bench_report(runner, test_sync_stack_kind_names[kind], sizeof(isize), bench_sync_stack_single(threads, (Test_Sync_Stack_Kind) kind, false, 0, runner->options.seconds));
+}
 
-int main() {
-    bench_reread_all(1, 12);
+static void run_bench_sync_stacks_elimination(Bench_Runner* runner, isize threads)
+{
+    //successful pushes and pops without/with the elimination array for 50% and 10% pushes
+    Test_Sync_Stack_Kind kinds[3] = {TEST_SYNC_STACK_FAT, TEST_SYNC_STACK_PACK, TEST_SYNC_STACK_INDEX};
+    isize push_percents[2] = {50, 10};
+    const char* mix_names[2] = {"50/50", "90/10"};
+    for(isize mix = 0; mix < 2; mix++)
+        for(isize k = 0; k < 3; k++)
+            for(isize elimination = 0; elimination < 2; elimination++)
+            {
+                char variant[64] = {0};
+                snprintf(variant, sizeof variant, "%s %s %s", mix_names[mix], test_sync_stack_kind_names[kinds[k]], elimination ? "elim" : "plain");
+                double ops = bench_sync_stack_single(threads, kinds[k], elimination != 0, push_percents[mix], runner->options.seconds);
+                bench_report(runner, variant, sizeof(isize), ops);
+            }
+}
+
+static void run_bench_sync_stacks_alloc(Bench_Runner* runner, isize threads)
+{
+    const char* names[BENCH_SYNC_ALLOC_KIND_COUNT] = {"malloc batch 16", "pack batch 16", "index batch 16"};
+    isize object_size = runner->options.item_size < (isize) sizeof(isize) ? (isize) sizeof(isize) : runner->options.item_size;
+    for(isize kind = 0; kind < BENCH_SYNC_ALLOC_KIND_COUNT; kind++)
+        bench_report(runner, names[kind], object_size, bench_sync_alloc_single(threads, 16, object_size, (Bench_Sync_Alloc_Kind) kind, runner->options.seconds));
+}
+
+static void run_bench_hazard_ptr(Bench_Runner* runner, isize threads)
+{
+    //Read side overhead: single threaded walks of lists of 16, 256, 4096 and 65536 nodes without 
+    // and with publishing every node. Reported as nodes per second (1e9/ns per node).
+    double seconds = runner->options.seconds;
+    Hazard_Domain domain = {0};
+    hazard_domain_init(&domain);
+    Hazard_Thread* hazard = hazard_thread_acquire(&domain);
+    for(isize length = 16; length <= 1 << 16; length *= 16)
+    {
+        CL_QUEUE_ATOMIC(Bench_Hazard_List*) head = NULL;
+        for(isize i = 0; i < length; i++)
+        {
+            Bench_Hazard_List* node = (Bench_Hazard_List*) malloc(sizeof(Bench_Hazard_List));
+            node->value = i;
+            atomic_store(&node->next, atomic_load(&head));
+            atomic_store(&head, node);
+        }
+
+        char variant[64] = {0};
+        snprintf(variant, sizeof variant, "walk plain %lli", length);
+        bench_report(runner, variant, sizeof(Bench_Hazard_List), 1e9/bench_hazard_walk_ns(&head, length, NULL, seconds/8));
+        snprintf(variant, sizeof variant, "walk hazard %lli", length);
+        bench_report(runner, variant, sizeof(Bench_Hazard_List), 1e9/bench_hazard_walk_ns(&head, length, hazard, seconds/8));
+
+        for(Bench_Hazard_List* node = atomic_load(&head); node; )
+        {
+            Bench_Hazard_List* next = atomic_load(&node->next);
+            free(node);
+            node = next;
+        }
+    }
+    hazard_domain_deinit(&domain);
+
+    //push+pop pairs with slots recycled vs freed through hazard pointers
+    bench_report(runner, "fat recycled", sizeof(isize), bench_hazard_stack_single(threads, TEST_SYNC_STACK_FAT, false, seconds));
+    bench_report(runner, "fat hazard", sizeof(isize), bench_hazard_stack_single(threads, TEST_SYNC_STACK_FAT, true, seconds));
+    bench_report(runner, "pack recycled", sizeof(isize), bench_hazard_stack_single(threads, TEST_SYNC_STACK_PACK, false, seconds));
+    bench_report(runner, "pack hazard", sizeof(isize), bench_hazard_stack_single(threads, TEST_SYNC_STACK_PACK, true, seconds));
+}
+
+static void run_bench_lc_executor(Bench_Runner* runner, isize threads)
+{
+    //Not time based, each kind runs to completion once. The ops are units of the result per second 
+    // (fib(n), solutions, tree nodes) so runs compare with each other and with the sequential version.
+    const char* names[3] = {"fib(40)", "nqueens(13)", "uts(19)"};
+    isize sizes[3] = {40, 13, 19};
+    isize cutoffs[3] = {15, 5, 0};
+    for(isize kind = 0; kind < 3; kind++)
+    {
+        char variant[64] = {0};
+        isize expected = 0;
+        int64_t before = _lc_pool_clock_ns();
+        if(kind == BENCH_EXECUTOR_FIB)
+            expected = bench_fib_seq(sizes[kind]);
+        if(kind == BENCH_EXECUTOR_NQUEENS)
+            expected = bench_nqueens_seq(sizes[kind], 0, 0, 0, 0);
+        if(kind == BENCH_EXECUTOR_UTS)
+            expected = bench_uts_seq((uint64_t) sizes[kind], true);
+        double sequential = (double) (_lc_pool_clock_ns() - before)*1e-9;
+        snprintf(variant, sizeof variant, "%s sequential", names[kind]);
+        bench_report(runner, variant, sizeof(isize), (double) expected/sequential);
+
+        isize result = 0;
+        double time = bench_lc_executor_single((Bench_Executor_Kind) kind, threads, sizes[kind], cutoffs[kind], &result);
+        TEST(result == expected);
+        bench_report(runner, names[kind], sizeof(isize), (double) result/time);
+    }
+
+    //iterations per second of lazy splitting against static chunks
+    const char* chunk_names[3] = {"lazy", "static", "static x8"};
+    for(isize skewed = 0; skewed < 2; skewed++)
+    {
+        LC_Executor executor = {0};
+        lc_executor_init(&executor, threads);
+        Bench_Executor_For bench = {0};
+        bench.count = 1000*1000;
+        bench.unit = 20;
+        bench.skewed = skewed != 0;
+
+        isize chunks[3] = {0, threads, 8*threads};
+        for(isize k = 0; k < 3; k++)
+        {
+            char variant[64] = {0};
+            double time = bench_lc_executor_for_single(&executor, &bench, chunks[k], 64);
+            snprintf(variant, sizeof variant, "for %s %s", skewed ? "skewed" : "uniform", chunk_names[k]);
+            bench_report(runner, variant, sizeof(isize), (double) bench.count/time);
+        }
+        lc_executor_deinit(&executor);
+    }
+}
+
+static void run_bench_index_mem(Bench_Runner* runner, isize threads)
+{
+    //single threaded lookups per second against a flat array. Same for every thread count.
+    //Sizes that would not fit into free physical memory are skipped so that we measure lookups and not swapping.
+    (void) threads;
+    double seconds = runner->options.seconds;
+    for(isize count = 1 << 10; count <= (isize) 1 << 30; count *= 4)
+    {
+        //flat array plus the same amount in index blocks
+        if(2*count > test_cl_available_memory())
+        {
+            fprintf(stderr, "index_mem: skipping %lli entries, not enough free memory\n", (long long) count);
+            break;
+        }
+
+        char count_name[16] = {0};
+        if(count >= (isize) 1 << 30)
+            snprintf(count_name, sizeof count_name, "%lliG", (long long) (count >> 30));
+        else if(count >= 1 << 20)
+            snprintf(count_name, sizeof count_name, "%lliM", (long long) (count >> 20));
+        else
+            snprintf(count_name, sizeof count_name, "%lliK", (long long) (count >> 10));
+
+        Index_Mem mem = {0};
+        uint8_t* flat = (uint8_t*) malloc((size_t) count);
+        for(isize i = 0; i < count; i++)
+            flat[i] = (uint8_t) i;
+        for(isize i = 0; i < count; i += BENCH_INDEX_MEM_BLOCK_SIZE)
+        {
+            uint8_t* block = (uint8_t*) index_mem_unsafe_grow(&mem, BENCH_INDEX_MEM_BLOCK_SIZE, 1);
+            for(isize k = 0; k < BENCH_INDEX_MEM_BLOCK_SIZE; k++)
+                block[k] = (uint8_t) (i + k);
+        }
+
+        for(isize random_access = 0; random_access < 2; random_access++)
+        {
+            char variant[64] = {0};
+            const char* access = random_access ? "random" : "sequential";
+            snprintf(variant, sizeof variant, "flat %s %s", access, count_name);
+            bench_report(runner, variant, 1, 1e9/bench_index_mem_time_ns(NULL, flat, count, random_access != 0, seconds/4));
+            snprintf(variant, sizeof variant, "index %s %s", access, count_name);
+            bench_report(runner, variant, 1, 1e9/bench_index_mem_time_ns(&mem, NULL, count, random_access != 0, seconds/4));
+        }
+
+        index_mem_unsafe_deinit(&mem);
+        free(flat);
+    }
+}
+
+static void run_bench_latency(Bench_Runner* runner, isize threads)
+{
+    static const char* kinds[] = {"cl_queue", "lc_pool", "lazy_queue"};
+    static const char* ops[] = {"push", "pop_back", "steal"};
+    double ns_per_tick = 1e9/test_cl_ticks_per_sec();
+    for(isize kind = 0; kind < 3; kind++)
+    {
+        Bench_Latency_Result* result = (Bench_Latency_Result*) calloc(1, sizeof(Bench_Latency_Result));
+        bench_latency_single(result, (Bench_Latency_Kind) kind, threads, runner->options.seconds, runner->options.sample_every);
+        for(isize op = 0; op < BENCH_LATENCY_OP_COUNT; op++)
+        {
+            //no pop_back on lazy queue and no stealing with a single thread
+            if(result->hists[op].count == 0)
+                continue;
+
+            char variant[64] = {0};
+            snprintf(variant, sizeof variant, "%s %s", kinds[kind], ops[op]);
+            bench_report_latency(runner, variant, sizeof(isize), result->ops_per_sec[op], &result->hists[op], ns_per_tick);
+        }
+        free(result);
+    }
+}
+
+static void run_bench_baselines(Bench_Runner* runner, isize threads)
+{
+    for(isize scenario = 0; scenario < BENCH_BASELINE_SCENARIO_COUNT; scenario++)
+        for(isize kind = 0; kind < BENCH_BASELINE_KIND_COUNT; kind++)
+        {
+            char variant[64] = {0};
+            snprintf(variant, sizeof variant, "%s %s", bench_baseline_scenario_names[scenario], bench_baseline_kind_names[kind]);
+            Bench_Pool_Result res = bench_baseline_single((Bench_Baseline_Kind) kind, (Bench_Baseline_Scenario) scenario, threads, runner->options.seconds);
+            bench_report(runner, variant, sizeof(isize), (double) res.ops/res.time);
+        }
+}
+
+static const Bench_Entry bench_entries[] = {
+    {"reread", run_bench_reread, 1, "one thread xchg-es a cache line the others read"},
+    {"chase_lev", run_bench_chase_lev, 1, "CL_Queue owner push with the other threads stealing with 0, 5, 10 and 15 pauses between steals"},
+    {"lc_pool", run_bench_lc_pool, 2, "LC_Pool ping/pong, 50/50, 1 push N pop, N push 1 pop"},
+    {"lc_pool_victims", run_bench_lc_pool_victims, 2, "lc_pool scenarios with the sequential, random, two choices and sticky victim policies"},
+    {"lc_pool_idle", run_bench_lc_pool_idle, 1, "one busy worker with idle thieves using the non empty mask or scanning all queues"},
+    {"lc_pool_wait", run_bench_lc_pool_wait, 2, "latency and items per cpu second of waiters spinning or parked in lc_pool_pop_wait"},
+    {"lc_pool_register", run_bench_lc_pool_register, 1, "lc_pool_thread_add/lc_pool_thread_remove pairs"},
+    {"lc_pool_topology", run_bench_lc_pool_topology, 2, "pinned 50/50 and 1 push N pop with round-robin and hierarchical stealing"},
+    {"lc_pool_atomics", run_bench_lc_pool_atomics, 1, "FAA, CAS, half FAA/CAS, CAS128 and fat stack on one shared target"},
+    {"lc_pool_capacity", run_bench_lc_pool_capacity, 2, "peak items and block bytes of runaway producers without and with max_capacity of 100000 (not ops/s)"},
+    {"lc_pool_stale", run_bench_lc_pool_stale, 2, "1 push N pop and failed pops of idle threads with stale bits never/always/rate limited cleared"},
+    {"link_pool", run_bench_link_pool, 1, "Link_Pool against LC_Pool"},
+    {"object_pool", run_bench_object_pool, 1, "Object_Pool alloc/free batches and producer to consumer frees against malloc (batches use --item-size)"},
+    {"sync_stacks", run_bench_sync_stacks, 1, "push+pop pairs on the Treiber stacks"},
+    {"sync_stacks_elim", run_bench_sync_stacks_elimination, 1, "50/50 and 90/10 push/pop mixes on the stacks without and with elimination"},
+    {"sync_stacks_alloc", run_bench_sync_stacks_alloc, 1, "the stacks as free lists against malloc (uses --item-size)"},
+    {"hazard_ptr", run_bench_hazard_ptr, 1, "list walks without/with hazard pointers and stack pops with slots recycled vs freed through them"},
+    {"lc_executor", run_bench_lc_executor, 1, "fib, nqueens, uts and parallel for on LC_Executor against sequential (runs to completion)"},
+    {"index_mem", run_bench_index_mem, 1, "single threaded Index_Mem lookups against a flat array, 1K to 1G entries as memory allows"},
+    {"latency", run_bench_latency, 1, "p50/p99/p99.9/max of owner push, pop back and steal (uses --sample-every)"},
+    {"baselines", run_bench_baselines, 2, "the lc_pool scenarios on LC_Pool, mutex and spin lock deques, Vyukov ring and Michael-Scott queue"},
+};
+
+//Tests are toggled below. Benchmarks are picked on the command line (run without arguments for the list).
+int main(int argc, char** argv) {
     //test_chase_lev_queue(2);
-    //bench_chase_lev(1, 12);
     //test_lc_pool(3, 12);
     //bench_lc_pool(1, 12);
+    //test_lc_executor(12);
+    //bench_lc_executor(12);
+    //test_object_pool(1, 12);
+    //test_link_pool(3, 12);
+    //test_sync_stacks(1, 12);
+    //test_index_mem(1, 12);
+    //bench_index_mem(1, (isize) 1 << 30);
+    //test_hazard_ptr(3, 12);
+    //test_bench_hist();
+    //test_baselines(1, 12);
+    //bench_baselines(1, 12);
 
     //test_k_queue_queue(3);
-}
\ No newline at end of file
+    return bench_runner_main(bench_entries, sizeof bench_entries / sizeof *bench_entries, argc, argv);
+}
@@ -0,0 +1,213 @@
+#pragma once
+
+//Allocator of fixed size objects. Each thread keeps two magazines (arrays of free objects)
+// in its Object_Pool_Cache and allocates/frees from them without any atomics. Only once both are
+// empty (or full) it exchanges a magazine with the depot, which is a pair of lock free stacks
+// of full and empty magazines. Objects freed by a different thread than the one which allocated them
+// thus travel back in whole magazines instead of one by one.
+//Memory is returned to the system only in object_pool_deinit.
+// (See Bonwick, Adams: Magazines and Vmem: Extending the Slab Allocator to Many CPUs and Arbitrary Resources)
+
+#include "sync_stacks.h"
+
+enum {
+    OBJECT_POOL_MAGAZINE_CAPACITY = 62, //so that a magazine is 512B
+    OBJECT_POOL_ALIGN = 16, //same as malloc
+};
+
+typedef struct Object_Pool_Magazine {
+    //first so that the magazine can be pushed onto the depot stacks as a Fat_Stack_Slot
+    CL_QUEUE_ATOMIC(Fat_Stack_Slot*) next;
+    isize count;
+    void* objects[OBJECT_POOL_MAGAZINE_CAPACITY];
+} Object_Pool_Magazine;
+
+//OBJECT_POOL_MAGAZINE_CAPACITY objects allocated at once
+typedef struct Object_Pool_Chunk {
+    struct Object_Pool_Chunk* next;
+    isize _; //keeps the objects aligned
+    //objects here...
+} Object_Pool_Chunk;
+
+typedef struct Object_Pool {
+    isize object_size; //rounded up to OBJECT_POOL_ALIGN
+
+    //The depot. Magazines are never freed while the pool lives so the stacks only have to care about ABA.
+    alignas(64)
+    CL_QUEUE_ATOMIC(Pack_Ptr) full; //also holds partially full magazines
+    alignas(64)
+    CL_QUEUE_ATOMIC(Pack_Ptr) empty;
+
+    //All chunks ever allocated. Only pushed to so a plain CAS on the pointer is enough.
+    alignas(64)
+    CL_QUEUE_ATOMIC(Object_Pool_Chunk*) chunks;
+    CL_QUEUE_ATOMIC(isize) chunks_count;
+    CL_QUEUE_ATOMIC(isize) magazines_count;
+} Object_Pool;
+
+//Per thread state. Zero initialized is valid. Must be used by one thread at a time.
+typedef struct Object_Pool_Cache {
+    Object_Pool_Magazine* loaded; //we allocate from and free to this one
+    Object_Pool_Magazine* previous; //either full or empty (or NULL)
+} Object_Pool_Cache;
+
+void object_pool_init(Object_Pool* pool, isize object_size);
+//All caches have to be flushed and no thread may use the pool anymore.
+void object_pool_deinit(Object_Pool* pool);
+//Returns the magazines of cache into the depot so that other threads can use its objects.
+// Has to be called before the thread stops using the pool.
+void object_pool_cache_flush(Object_Pool* pool, Object_Pool_Cache* cache);
+
+CL_QUEUE_API_INLINE void* object_pool_alloc(Object_Pool* pool, Object_Pool_Cache* cache);
+CL_QUEUE_API_INLINE void object_pool_free(Object_Pool* pool, Object_Pool_Cache* cache, void* object);
+
+CL_QUEUE_API void* _object_pool_alloc_slow(Object_Pool* pool, Object_Pool_Cache* cache);
+CL_QUEUE_API void _object_pool_free_slow(Object_Pool* pool, Object_Pool_Cache* cache, void* object);
+
+CL_QUEUE_API_INLINE void* object_pool_alloc(Object_Pool* pool, Object_Pool_Cache* cache)
+{
+    Object_Pool_Magazine* loaded = cache->loaded;
+    if(loaded && loaded->count > 0)
+        return loaded->objects[--loaded->count];
+
+    return _object_pool_alloc_slow(pool, cache);
+}
+
+CL_QUEUE_API_INLINE void object_pool_free(Object_Pool* pool, Object_Pool_Cache* cache, void* object)
+{
+    Object_Pool_Magazine* loaded = cache->loaded;
+    if(loaded && loaded->count < OBJECT_POOL_MAGAZINE_CAPACITY)
+        loaded->objects[loaded->count++] = object;
+    else
+        _object_pool_free_slow(pool, cache, object);
+}
+
+CL_QUEUE_API Object_Pool_Magazine* _object_pool_new_magazine(Object_Pool* pool)
+{
+    Object_Pool_Magazine* magazine = (Object_Pool_Magazine*) _pack_stack_pop(&pool->empty);
+    if(magazine == NULL)
+    {
+        magazine = (Object_Pool_Magazine*) malloc(sizeof(Object_Pool_Magazine));
+        atomic_store_explicit(&magazine->next, NULL, memory_order_relaxed);
+        magazine->count = 0;
+        atomic_fetch_add_explicit(&pool->magazines_count, 1, memory_order_relaxed);
+    }
+    return magazine;
+}
+
+//Fills the (empty) magazine with freshly allocated objects
+CL_QUEUE_API void _object_pool_fill(Object_Pool* pool, Object_Pool_Magazine* magazine)
+{
+    Object_Pool_Chunk* chunk = (Object_Pool_Chunk*) malloc(sizeof(Object_Pool_Chunk) + OBJECT_POOL_MAGAZINE_CAPACITY*pool->object_size);
+    uint8_t* objects = (uint8_t*) (void*) (chunk + 1);
+    for(isize i = 0; i < OBJECT_POOL_MAGAZINE_CAPACITY; i++)
+        magazine->objects[i] = objects + i*pool->object_size;
+    magazine->count = OBJECT_POOL_MAGAZINE_CAPACITY;
+
+    chunk->next = atomic_load_explicit(&pool->chunks, memory_order_relaxed);
+    while(atomic_compare_exchange_weak(&pool->chunks, &chunk->next, chunk) == false);
+    atomic_fetch_add_explicit(&pool->chunks_count, 1, memory_order_relaxed);
+}
+
+CL_QUEUE_INLINE_NEVER
+CL_QUEUE_API void* _object_pool_alloc_slow(Object_Pool* pool, Object_Pool_Cache* cache)
+{
+    //loaded is empty (or NULL). If previous has something swap them.
+    Object_Pool_Magazine* previous = cache->previous;
+    if(previous && previous->count > 0)
+    {
+        cache->previous = cache->loaded;
+        cache->loaded = previous;
+        return previous->objects[--previous->count];
+    }
+
+    //Otherwise both are empty. Take a full one from the depot and give back one of the empty ones.
+    Object_Pool_Magazine* full = (Object_Pool_Magazine*) _pack_stack_pop(&pool->full);
+    if(full == NULL)
+    {
+        //Nobody freed anything we could use so make new objects.
+        // Reuse our empty previous magazine if we have one.
+        full = previous ? previous : _object_pool_new_magazine(pool);
+        previous = NULL;
+        _object_pool_fill(pool, full);
+    }
+
+    if(previous)
+        _pack_stack_push(&pool->empty, (Fat_Stack_Slot*) (void*) previous);
+    cache->previous = cache->loaded;
+    cache->loaded = full;
+    return full->objects[--full->count];
+}
+
+CL_QUEUE_INLINE_NEVER
+CL_QUEUE_API void _object_pool_free_slow(Object_Pool* pool, Object_Pool_Cache* cache, void* object)
+{
+    //loaded is full (or NULL). If previous has space swap them.
+    Object_Pool_Magazine* previous = cache->previous;
+    if(previous && previous->count < OBJECT_POOL_MAGAZINE_CAPACITY)
+    {
+        cache->previous = cache->loaded;
+        cache->loaded = previous;
+        previous->objects[previous->count++] = object;
+        return;
+    }
+
+    //Both are full. Give one to the depot so that allocating threads can take it.
+    Object_Pool_Magazine* empty = _object_pool_new_magazine(pool);
+    if(previous)
+        _pack_stack_push(&pool->full, (Fat_Stack_Slot*) (void*) previous);
+    cache->previous = cache->loaded;
+    cache->loaded = empty;
+    empty->objects[empty->count++] = object;
+}
+
+void object_pool_init(Object_Pool* pool, isize object_size)
+{
+    memset(pool, 0, sizeof *pool);
+    pool->object_size = (object_size + OBJECT_POOL_ALIGN - 1)/OBJECT_POOL_ALIGN*OBJECT_POOL_ALIGN;
+    if(pool->object_size <= 0)
+        pool->object_size = OBJECT_POOL_ALIGN;
+
+    //the depot heads are Pack_Ptrs so the magazines have to lie below 2^48 same as for Pack_Stack
+    ASSERT(pack_stack_va_fits(), "pointers do not fit into Pack_Ptr");
+
+    atomic_store(&pool->full, (Pack_Ptr) NULL);
+    atomic_store(&pool->empty, (Pack_Ptr) NULL);
+    atomic_store(&pool->chunks, (Object_Pool_Chunk*) NULL);
+}
+
+void object_pool_cache_flush(Object_Pool* pool, Object_Pool_Cache* cache)
+{
+    Object_Pool_Magazine* magazines[2] = {cache->loaded, cache->previous};
+    for(isize i = 0; i < 2; i++)
+    {
+        if(magazines[i] == NULL)
+            continue;
+
+        if(magazines[i]->count > 0)
+            _pack_stack_push(&pool->full, (Fat_Stack_Slot*) (void*) magazines[i]);
+        else
+            _pack_stack_push(&pool->empty, (Fat_Stack_Slot*) (void*) magazines[i]);
+    }
+
+    cache->loaded = NULL;
+    cache->previous = NULL;
+}
+
+void object_pool_deinit(Object_Pool* pool)
+{
+    for(Fat_Stack_Slot* slot; (slot = _pack_stack_pop(&pool->full)) != NULL; )
+        free(slot);
+    for(Fat_Stack_Slot* slot; (slot = _pack_stack_pop(&pool->empty)) != NULL; )
+        free(slot);
+
+    for(Object_Pool_Chunk* chunk = atomic_load(&pool->chunks); chunk; )
+    {
+        Object_Pool_Chunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    memset(pool, 0, sizeof *pool);
+    atomic_store(&pool->chunks, (Object_Pool_Chunk*) NULL);
+}
@@ -0,0 +1,1056 @@
+#pragma once
+
+//Lock free (Treiber) stacks of intrusive slots. The ABA problem is solved by pairing
+// the pointer to the top slot with a generation which gets incremented on every pop.
+//Popped slots can be pushed again (also onto another stack) but must not be freed
+// while some other thread might still be popping.
+//Fat_Stack keeps the full pointer and 64 bit generation and needs a 16 byte CAS.
+// Pack_Stack squeezes both into 8 bytes.
+// Index_Stack uses 32 bit indices into an Index_Mem instead of pointers.
+//Fat_Stack and Pack_Stack can alternatively pop with hazard pointers (*_pop_hazard) in which case
+// popped slots get freed once no one reads them instead of being kept for reuse.
+
+#include "chase_lev_queue.h"
+#include "index_mem.h"
+#include "hazard_ptr.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+    #define _sync_pause() _mm_pause()
+#else
+    #define _sync_pause() (void) 0
+#endif
+
+typedef struct Fat_Stack_Slot {
+    CL_QUEUE_ATOMIC(struct Fat_Stack_Slot*) next;
+    uint8_t data[];
+} Fat_Stack_Slot;
+
+//PACKED PTR
+//Pointer and generation packed into a single 64 bit word so that the stack only needs 8 byte CAS.
+// Pointers have to fit into 48 bits (user space on x64 and arm64) and be aligned to PACK_STACK_ALIGN.
+// The generation gets the rest, that is 16 + log2(PACK_STACK_ALIGN) bits.
+typedef struct _Gen_Ptr_* Pack_Ptr;
+
+typedef struct Unpack_Ptr {
+    void* ptr;
+    uint64_t gen;
+} Unpack_Ptr;
+
+enum {
+    PACK_STACK_ALIGN = 16, //malloc gives us at least this on 64 bit platforms
+};
+
+CL_QUEUE_API_INLINE Pack_Ptr gen_ptr_pack(void* ptr, uint64_t gen, isize aligned)
+{
+    //Everything here gets computed at compile time given that aligned is known
+    const uint64_t mul = ((uint64_t) 1 << 48)/(uint64_t) aligned;
+    ASSERT((uintptr_t) ptr % (uint64_t) aligned == 0);
+    ASSERT((uint64_t) (uintptr_t) ptr < ((uint64_t) 1 << 48));
+
+    uint64_t ptr_part = (uint64_t) (uintptr_t) ptr / (uint64_t) aligned;
+    uint64_t gen_part = gen * mul; //the top bits of gen just overflow
+    return (Pack_Ptr) (uintptr_t) (ptr_part | gen_part);
+}
+
+CL_QUEUE_API_INLINE Unpack_Ptr gen_ptr_unpack(Pack_Ptr packed, isize aligned)
+{
+    const uint64_t mul = ((uint64_t) 1 << 48)/(uint64_t) aligned;
+    Unpack_Ptr unpacked = {0};
+    unpacked.ptr = (void*) (uintptr_t) ((uint64_t) (uintptr_t) packed % mul * (uint64_t) aligned);
+    unpacked.gen = (uint64_t) (uintptr_t) packed / mul;
+    return unpacked;
+}
+
+CL_QUEUE_API_INLINE void _pack_stack_push(CL_QUEUE_ATOMIC(Pack_Ptr)* last_ptr, Fat_Stack_Slot* slot)
+{
+    Pack_Ptr last = atomic_load_explicit(last_ptr, memory_order_relaxed);
+    for(;;) {
+        Unpack_Ptr last_unpacked = gen_ptr_unpack(last, PACK_STACK_ALIGN);
+        Pack_Ptr new_last = gen_ptr_pack(slot, last_unpacked.gen, PACK_STACK_ALIGN);
+        atomic_store_explicit(&slot->next, (Fat_Stack_Slot*) last_unpacked.ptr, memory_order_relaxed);
+        if(atomic_compare_exchange_weak_explicit(last_ptr, &last, new_last, memory_order_release, memory_order_relaxed))
+            break;
+    }
+}
+
+//Returns NULL if the stack is empty
+CL_QUEUE_API_INLINE Fat_Stack_Slot* _pack_stack_pop(CL_QUEUE_ATOMIC(Pack_Ptr)* last_ptr)
+{
+    Pack_Ptr last = atomic_load_explicit(last_ptr, memory_order_acquire);
+    for(;;) {
+        Unpack_Ptr last_unpacked = gen_ptr_unpack(last, PACK_STACK_ALIGN);
+        Fat_Stack_Slot* slot = (Fat_Stack_Slot*) last_unpacked.ptr;
+        if(slot == NULL)
+            return NULL;
+
+        //The slot might have been popped and pushed elsewhere in the meantime so next can be garbage.
+        // Then the generation changed and the CAS fails.
+        Fat_Stack_Slot* next = atomic_load_explicit(&slot->next, memory_order_relaxed);
+        Pack_Ptr new_last = gen_ptr_pack(next, last_unpacked.gen + 1, PACK_STACK_ALIGN);
+        if(atomic_compare_exchange_weak_explicit(last_ptr, &last, new_last, memory_order_acquire, memory_order_acquire))
+            return slot;
+    }
+}
+
+//The top slot is protected by hazard slot 0 and validated by reloading the head before next is read.
+// The generation is still needed since malloc can hand out a freed address again.
+CL_QUEUE_API_INLINE Fat_Stack_Slot* _pack_stack_pop_hazard(CL_QUEUE_ATOMIC(Pack_Ptr)* last_ptr, Hazard_Thread* hazard)
+{
+    Fat_Stack_Slot* slot = NULL;
+    for(;;) {
+        Pack_Ptr last = atomic_load_explicit(last_ptr, memory_order_acquire);
+        slot = (Fat_Stack_Slot*) gen_ptr_unpack(last, PACK_STACK_ALIGN).ptr;
+        if(slot == NULL)
+            break;
+
+        hazard_set(hazard, 0, slot);
+        if(atomic_load_explicit(last_ptr, memory_order_acquire) != last)
+            continue;
+
+        Fat_Stack_Slot* next = atomic_load_explicit(&slot->next, memory_order_relaxed);
+        Pack_Ptr new_last = gen_ptr_pack(next, gen_ptr_unpack(last, PACK_STACK_ALIGN).gen + 1, PACK_STACK_ALIGN);
+        if(atomic_compare_exchange_strong_explicit(last_ptr, &last, new_last, memory_order_acquire, memory_order_relaxed))
+            break;
+    }
+    hazard_clear(hazard, 0);
+    return slot;
+}
+
+//ELIMINATION
+//Optional elimination array in front of any of the stacks below 
+// (Hendler, Shavit, Yerushalmi: A Scalable Lock-free Stack Algorithm).
+//A push whose CAS on the head failed offers its item in a random slot and waits a little. 
+// A pop whose CAS failed looks into a random slot and if there is an offer copies the item straight 
+// from the pusher. Such a pair is linearized at the moment of the exchange and never touches the head, 
+// so under symmetric contention most operations cancel out off the hot word.
+//Only contended operations ever get here so the width (number of slots used) follows the CAS failure rate: 
+// it grows when offers collide with other offers and shrinks when they time out without a partner.
+enum {
+    ELIM_MAX_WIDTH = 32,
+    ELIM_OFFER_SPINS = 256, //how long a push waits for a pop
+};
+
+enum {
+    ELIM_EMPTY = 0,
+    ELIM_OFFERING, //pusher claimed the slot and is filling in item
+    ELIM_OFFERED,  //item can be taken
+    ELIM_TAKING,   //pop is copying item
+    ELIM_TAKEN,    //pusher may leave
+};
+
+//Padded instead of aligned so that it can be calloc-ed. 
+// The hot fields of each slot still end up on separate cache lines.
+typedef struct Elim_Slot {
+    CL_QUEUE_ATOMIC(uint32_t) state;
+    const void* item;
+    uint8_t _[48];
+} Elim_Slot;
+
+typedef struct Elim_Array {
+    CL_QUEUE_ATOMIC(uint32_t) width;
+    uint8_t _[60];
+    Elim_Slot slots[ELIM_MAX_WIDTH];
+} Elim_Array;
+
+static thread_local uint64_t _elim_rng_state = 0;
+
+CL_QUEUE_API_INLINE isize _elim_random_slot(Elim_Array* elim)
+{
+    uint64_t x = _elim_rng_state;
+    if(x == 0)
+        x = (uint64_t) (uintptr_t) &_elim_rng_state | 1; //distinct per thread
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    _elim_rng_state = x;
+
+    uint32_t width = atomic_load_explicit(&elim->width, memory_order_relaxed);
+    return (isize) ((x >> 32) % width);
+}
+
+//Lost updates dont matter since this is only a heuristic
+CL_QUEUE_API_INLINE void _elim_resize(Elim_Array* elim, bool grow)
+{
+    uint32_t width = atomic_load_explicit(&elim->width, memory_order_relaxed);
+    if(grow && width < ELIM_MAX_WIDTH)
+        atomic_store_explicit(&elim->width, width + 1, memory_order_relaxed);
+    if(!grow && width > 1)
+        atomic_store_explicit(&elim->width, width - 1, memory_order_relaxed);
+}
+
+Elim_Array* elim_array_new()
+{
+    Elim_Array* elim = (Elim_Array*) calloc(1, sizeof(Elim_Array));
+    atomic_store_explicit(&elim->width, 1, memory_order_relaxed);
+    return elim;
+}
+
+//true if the item was handed to a pop
+CL_QUEUE_API bool _elim_try_push(Elim_Array* elim, const void* item)
+{
+    Elim_Slot* slot = &elim->slots[_elim_random_slot(elim)];
+    uint32_t state = ELIM_EMPTY;
+    if(atomic_compare_exchange_strong_explicit(&slot->state, &state, ELIM_OFFERING, memory_order_relaxed, memory_order_relaxed) == false)
+    {
+        _elim_resize(elim, true);
+        return false;
+    }
+
+    slot->item = item;
+    atomic_store_explicit(&slot->state, ELIM_OFFERED, memory_order_release);
+    for(isize i = 0; i < ELIM_OFFER_SPINS; i++)
+    {
+        if(atomic_load_explicit(&slot->state, memory_order_relaxed) == ELIM_TAKEN)
+            break;
+        _sync_pause();
+    }
+
+    //withdraw the offer. If that fails a pop got to it and we have to wait until it finished copying.
+    state = ELIM_OFFERED;
+    if(atomic_compare_exchange_strong_explicit(&slot->state, &state, ELIM_EMPTY, memory_order_relaxed, memory_order_acquire))
+    {
+        _elim_resize(elim, false);
+        return false;
+    }
+
+    while(atomic_load_explicit(&slot->state, memory_order_acquire) != ELIM_TAKEN)
+        _sync_pause();
+    atomic_store_explicit(&slot->state, ELIM_EMPTY, memory_order_relaxed);
+    return true;
+}
+
+//true if an item from a push was copied into item
+CL_QUEUE_API bool _elim_try_pop(Elim_Array* elim, void* item, isize item_size)
+{
+    Elim_Slot* slot = &elim->slots[_elim_random_slot(elim)];
+    uint32_t state = ELIM_OFFERED;
+    if(atomic_load_explicit(&slot->state, memory_order_relaxed) != ELIM_OFFERED
+        || atomic_compare_exchange_strong_explicit(&slot->state, &state, ELIM_TAKING, memory_order_acquire, memory_order_relaxed) == false)
+        return false;
+
+    memcpy(item, slot->item, (size_t) item_size);
+    atomic_store_explicit(&slot->state, ELIM_TAKEN, memory_order_release);
+    return true;
+}
+
+//Outcome of a single attempt on the head of a stack
+typedef enum Sync_Stack_Try {
+    SYNC_STACK_OK = 0,
+    SYNC_STACK_EMPTY,
+    SYNC_STACK_CONTENDED,
+} Sync_Stack_Try;
+
+CL_QUEUE_API_INLINE bool _pack_stack_try_push(CL_QUEUE_ATOMIC(Pack_Ptr)* last_ptr, Fat_Stack_Slot* slot)
+{
+    Pack_Ptr last = atomic_load_explicit(last_ptr, memory_order_relaxed);
+    Unpack_Ptr last_unpacked = gen_ptr_unpack(last, PACK_STACK_ALIGN);
+    Pack_Ptr new_last = gen_ptr_pack(slot, last_unpacked.gen, PACK_STACK_ALIGN);
+    atomic_store_explicit(&slot->next, (Fat_Stack_Slot*) last_unpacked.ptr, memory_order_relaxed);
+    return atomic_compare_exchange_strong_explicit(last_ptr, &last, new_last, memory_order_release, memory_order_relaxed);
+}
+
+CL_QUEUE_API_INLINE Sync_Stack_Try _pack_stack_try_pop(CL_QUEUE_ATOMIC(Pack_Ptr)* last_ptr, Fat_Stack_Slot** popped)
+{
+    Pack_Ptr last = atomic_load_explicit(last_ptr, memory_order_acquire);
+    Unpack_Ptr last_unpacked = gen_ptr_unpack(last, PACK_STACK_ALIGN);
+    Fat_Stack_Slot* slot = (Fat_Stack_Slot*) last_unpacked.ptr;
+    if(slot == NULL)
+        return SYNC_STACK_EMPTY;
+
+    Fat_Stack_Slot* next = atomic_load_explicit(&slot->next, memory_order_relaxed);
+    Pack_Ptr new_last = gen_ptr_pack(next, last_unpacked.gen + 1, PACK_STACK_ALIGN);
+    if(atomic_compare_exchange_strong_explicit(last_ptr, &last, new_last, memory_order_acquire, memory_order_relaxed) == false)
+        return SYNC_STACK_CONTENDED;
+
+    *popped = slot;
+    return SYNC_STACK_OK;
+}
+
+//FAT PTR
+//Pointer and generation side by side, swapped together with cmpxchg16b. 
+// Cpus without it (some very early x64 ones) and other platforms use a spin lock instead.
+typedef struct Fat_Ptr {
+    Fat_Stack_Slot* ptr;
+    uint64_t gen;
+} Fat_Ptr;
+
+typedef struct Fat_Stack {
+    alignas(64)
+    Fat_Ptr last_used;
+    CL_QUEUE_ATOMIC(uint32_t) last_used_lock; //only used if use_lock
+    alignas(64)
+    Fat_Ptr first_free;
+    CL_QUEUE_ATOMIC(uint32_t) first_free_lock;
+    alignas(64)
+    bool use_lock; 
+    Elim_Array* elim; //NULL unless fat_stack_enable_elimination
+} Fat_Stack;
+
+void fat_stack_init(Fat_Stack* stack);
+//No other thread may use the stack anymore
+void fat_stack_deinit(Fat_Stack* stack);
+void fat_stack_push(Fat_Stack* stack, const void* item, isize item_size);
+bool fat_stack_pop(Fat_Stack* stack, void* item, isize item_size);
+//Puts an Elim_Array in front of the stack. Must be called before other threads use it.
+void fat_stack_enable_elimination(Fat_Stack* stack);
+//true if the cpu can do 16 byte CAS. Checked once.
+bool fat_stack_has_cas128();
+//Like fat_stack_pop but the slot is retired into domain (and eventually freed) instead of recycled
+// so memory goes back to malloc as the stack shrinks. All pops of a stack have to either use this or not,
+// a plain pop reads slots without protecting them. Elimination is skipped.
+bool fat_stack_pop_hazard(Fat_Stack* stack, Hazard_Domain* domain, Hazard_Thread* hazard, void* item, isize item_size);
+
+#if (defined(_MSC_VER) && defined(_M_X64))
+    #include <intrin.h>
+    #define FAT_STACK_CAS128 1
+    //On failure writes the current value into expected
+    CL_QUEUE_API_INLINE bool _fat_stack_cas128(volatile void* destination, uint64_t expected[2], uint64_t new_lo, uint64_t new_hi)
+    {
+        return _InterlockedCompareExchange128((volatile __int64*) destination, (__int64) new_hi, (__int64) new_lo, (__int64*) expected) != 0;
+    }
+    
+    static bool _fat_stack_cpu_has_cx16()
+    {
+        int info[4] = {0};
+        __cpuid(info, 1);
+        return (info[2] & (1 << 13)) != 0;
+    }
+#elif (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+    #include <cpuid.h>
+    #define FAT_STACK_CAS128 1
+    //Inline asm so that we dont depend on -mcx16 or libatomic (which might use a lock).
+    CL_QUEUE_API_INLINE bool _fat_stack_cas128(volatile void* destination, uint64_t expected[2], uint64_t new_lo, uint64_t new_hi)
+    {
+        bool success = false;
+        __asm__ __volatile__(
+            "lock cmpxchg16b %1"
+            : "=@ccz" (success), "+m" (*(volatile uint64_t (*)[2]) destination), "+a" (expected[0]), "+d" (expected[1])
+            : "b" (new_lo), "c" (new_hi)
+            : "memory");
+        return success;
+    }
+    
+    static bool _fat_stack_cpu_has_cx16()
+    {
+        unsigned a = 0, b = 0, c = 0, d = 0;
+        if(__get_cpuid(1, &a, &b, &c, &d) == 0)
+            return false;
+        return (c & bit_CMPXCHG16B) != 0;
+    }
+#else
+    #define FAT_STACK_CAS128 0
+    CL_QUEUE_API_INLINE bool _fat_stack_cas128(volatile void* destination, uint64_t expected[2], uint64_t new_lo, uint64_t new_hi)
+    {
+        (void) destination; (void) expected; (void) new_lo; (void) new_hi;
+        ASSERT(false);
+        return false;
+    }
+    
+    static bool _fat_stack_cpu_has_cx16()
+    {
+        return false;
+    }
+#endif
+
+bool fat_stack_has_cas128()
+{
+    //0 unknown, 1 no, 2 yes
+    static CL_QUEUE_ATOMIC(uint32_t) has = 0;
+    uint32_t curr = atomic_load_explicit(&has, memory_order_relaxed);
+    if(curr == 0)
+    {
+        curr = _fat_stack_cpu_has_cx16() ? 2 : 1;
+        atomic_store_explicit(&has, curr, memory_order_relaxed);
+    }
+    return curr == 2;
+}
+
+CL_QUEUE_API_INLINE void _fat_stack_lock(CL_QUEUE_ATOMIC(uint32_t)* lock)
+{
+    for(;;) {
+        if(atomic_exchange_explicit(lock, 1, memory_order_acquire) == 0)
+            break;
+        while(atomic_load_explicit(lock, memory_order_relaxed) != 0)
+            _sync_pause();
+    }
+}
+
+CL_QUEUE_API_INLINE void _fat_stack_unlock(CL_QUEUE_ATOMIC(uint32_t)* lock)
+{
+    atomic_store_explicit(lock, 0, memory_order_release);
+}
+
+//The two halves are read separately. A torn read only makes the CAS fail.
+CL_QUEUE_API_INLINE Fat_Ptr _fat_stack_load(Fat_Ptr* last_ptr)
+{
+    Fat_Ptr out = {0};
+    out.gen = *(volatile uint64_t*) &last_ptr->gen;
+    out.ptr = *(Fat_Stack_Slot* volatile*) &last_ptr->ptr;
+    return out;
+}
+
+CL_QUEUE_API_INLINE void _fat_stack_push(Fat_Ptr* last_ptr, CL_QUEUE_ATOMIC(uint32_t)* lock, bool use_lock, Fat_Stack_Slot* slot)
+{
+    if(use_lock)
+    {
+        _fat_stack_lock(lock);
+        atomic_store_explicit(&slot->next, last_ptr->ptr, memory_order_relaxed);
+        last_ptr->ptr = slot;
+        _fat_stack_unlock(lock);
+        return;
+    }
+
+    Fat_Ptr last = _fat_stack_load(last_ptr);
+    uint64_t expected[2] = {(uint64_t) last.ptr, last.gen};
+    for(;;) {
+        atomic_store_explicit(&slot->next, (Fat_Stack_Slot*) expected[0], memory_order_relaxed);
+        if(_fat_stack_cas128(last_ptr, expected, (uint64_t) slot, expected[1]))
+            break;
+    }
+}
+
+//Returns NULL if the stack is empty
+CL_QUEUE_API_INLINE Fat_Stack_Slot* _fat_stack_pop(Fat_Ptr* last_ptr, CL_QUEUE_ATOMIC(uint32_t)* lock, bool use_lock)
+{
+    if(use_lock)
+    {
+        _fat_stack_lock(lock);
+        Fat_Stack_Slot* slot = last_ptr->ptr;
+        if(slot)
+            last_ptr->ptr = atomic_load_explicit(&slot->next, memory_order_relaxed);
+        _fat_stack_unlock(lock);
+        return slot;
+    }
+
+    Fat_Ptr last = _fat_stack_load(last_ptr);
+    uint64_t expected[2] = {(uint64_t) last.ptr, last.gen};
+    for(;;) {
+        Fat_Stack_Slot* slot = (Fat_Stack_Slot*) expected[0];
+        if(slot == NULL)
+            return NULL;
+
+        //same as in _pack_stack_pop
+        Fat_Stack_Slot* next = atomic_load_explicit(&slot->next, memory_order_relaxed);
+        if(_fat_stack_cas128(last_ptr, expected, (uint64_t) next, expected[1] + 1))
+            return slot;
+    }
+}
+
+//Same as _pack_stack_pop_hazard. The lock version needs no protection at all.
+CL_QUEUE_API_INLINE Fat_Stack_Slot* _fat_stack_pop_hazard(Fat_Ptr* last_ptr, CL_QUEUE_ATOMIC(uint32_t)* lock, bool use_lock, Hazard_Thread* hazard)
+{
+    if(use_lock)
+        return _fat_stack_pop(last_ptr, lock, use_lock);
+
+    Fat_Stack_Slot* slot = NULL;
+    for(;;) {
+        Fat_Ptr last = _fat_stack_load(last_ptr);
+        slot = last.ptr;
+        if(slot == NULL)
+            break;
+
+        hazard_set(hazard, 0, slot);
+        Fat_Ptr reloaded = _fat_stack_load(last_ptr);
+        if(reloaded.ptr != last.ptr || reloaded.gen != last.gen)
+            continue;
+
+        Fat_Stack_Slot* next = atomic_load_explicit(&slot->next, memory_order_relaxed);
+        uint64_t expected[2] = {(uint64_t) last.ptr, last.gen};
+        if(_fat_stack_cas128(last_ptr, expected, (uint64_t) next, last.gen + 1))
+            break;
+    }
+    hazard_clear(hazard, 0);
+    return slot;
+}
+
+CL_QUEUE_API_INLINE bool _fat_stack_try_push(Fat_Ptr* last_ptr, CL_QUEUE_ATOMIC(uint32_t)* lock, bool use_lock, Fat_Stack_Slot* slot)
+{
+    if(use_lock)
+    {
+        //a taken lock counts as a failed CAS
+        if(atomic_exchange_explicit(lock, 1, memory_order_acquire) != 0)
+            return false;
+        atomic_store_explicit(&slot->next, last_ptr->ptr, memory_order_relaxed);
+        last_ptr->ptr = slot;
+        _fat_stack_unlock(lock);
+        return true;
+    }
+
+    Fat_Ptr last = _fat_stack_load(last_ptr);
+    uint64_t expected[2] = {(uint64_t) last.ptr, last.gen};
+    atomic_store_explicit(&slot->next, last.ptr, memory_order_relaxed);
+    return _fat_stack_cas128(last_ptr, expected, (uint64_t) slot, expected[1]);
+}
+
+CL_QUEUE_API_INLINE Sync_Stack_Try _fat_stack_try_pop(Fat_Ptr* last_ptr, CL_QUEUE_ATOMIC(uint32_t)* lock, bool use_lock, Fat_Stack_Slot** popped)
+{
+    if(use_lock)
+    {
+        if(atomic_exchange_explicit(lock, 1, memory_order_acquire) != 0)
+            return SYNC_STACK_CONTENDED;
+        Fat_Stack_Slot* slot = last_ptr->ptr;
+        if(slot)
+            last_ptr->ptr = atomic_load_explicit(&slot->next, memory_order_relaxed);
+        _fat_stack_unlock(lock);
+        *popped = slot;
+        return slot ? SYNC_STACK_OK : SYNC_STACK_EMPTY;
+    }
+
+    Fat_Ptr last = _fat_stack_load(last_ptr);
+    if(last.ptr == NULL)
+        return SYNC_STACK_EMPTY;
+
+    uint64_t expected[2] = {(uint64_t) last.ptr, last.gen};
+    Fat_Stack_Slot* next = atomic_load_explicit(&last.ptr->next, memory_order_relaxed);
+    if(_fat_stack_cas128(last_ptr, expected, (uint64_t) next, expected[1] + 1) == false)
+        return SYNC_STACK_CONTENDED;
+
+    *popped = last.ptr;
+    return SYNC_STACK_OK;
+}
+
+void fat_stack_init(Fat_Stack* stack)
+{
+    memset(stack, 0, sizeof *stack);
+    stack->use_lock = !(FAT_STACK_CAS128 && fat_stack_has_cas128());
+}
+
+void fat_stack_deinit(Fat_Stack* stack)
+{
+    for(Fat_Stack_Slot* slot; (slot = _fat_stack_pop(&stack->last_used, &stack->last_used_lock, stack->use_lock)) != NULL; )
+        free(slot);
+    for(Fat_Stack_Slot* slot; (slot = _fat_stack_pop(&stack->first_free, &stack->first_free_lock, stack->use_lock)) != NULL; )
+        free(slot);
+    free(stack->elim);
+    memset(stack, 0, sizeof *stack);
+}
+
+void fat_stack_enable_elimination(Fat_Stack* stack)
+{
+    if(stack->elim == NULL)
+        stack->elim = elim_array_new();
+}
+
+//Slots are kept on the first_free stack once popped so they are never freed while someone might be popping.
+void fat_stack_push(Fat_Stack* stack, const void* item, isize item_size)
+{
+    Fat_Stack_Slot* slot = _fat_stack_pop(&stack->first_free, &stack->first_free_lock, stack->use_lock);
+    if(slot == NULL)
+        slot = (Fat_Stack_Slot*) malloc(sizeof(Fat_Stack_Slot) + (size_t) item_size);
+
+    memcpy(slot->data, item, (size_t) item_size);
+    if(stack->elim == NULL)
+    {
+        _fat_stack_push(&stack->last_used, &stack->last_used_lock, stack->use_lock, slot);
+        return;
+    }
+
+    for(;;) {
+        if(_fat_stack_try_push(&stack->last_used, &stack->last_used_lock, stack->use_lock, slot))
+            break;
+        if(_elim_try_push(stack->elim, item))
+        {
+            _fat_stack_push(&stack->first_free, &stack->first_free_lock, stack->use_lock, slot);
+            break;
+        }
+    }
+}
+
+bool fat_stack_pop(Fat_Stack* stack, void* item, isize item_size)
+{
+    Fat_Stack_Slot* slot = NULL;
+    if(stack->elim == NULL)
+        slot = _fat_stack_pop(&stack->last_used, &stack->last_used_lock, stack->use_lock);
+    else
+    {
+        for(;;) {
+            Sync_Stack_Try state = _fat_stack_try_pop(&stack->last_used, &stack->last_used_lock, stack->use_lock, &slot);
+            if(state != SYNC_STACK_CONTENDED)
+                break;
+            if(_elim_try_pop(stack->elim, item, item_size))
+                return true;
+        }
+    }
+
+    if(slot == NULL)
+        return false;
+
+    memcpy(item, slot->data, (size_t) item_size);
+    _fat_stack_push(&stack->first_free, &stack->first_free_lock, stack->use_lock, slot);
+    return true;
+}
+
+bool fat_stack_pop_hazard(Fat_Stack* stack, Hazard_Domain* domain, Hazard_Thread* hazard, void* item, isize item_size)
+{
+    Fat_Stack_Slot* slot = _fat_stack_pop_hazard(&stack->last_used, &stack->last_used_lock, stack->use_lock, hazard);
+    if(slot == NULL)
+        return false;
+
+    memcpy(item, slot->data, (size_t) item_size);
+    hazard_retire(domain, hazard, slot, free);
+    return true;
+}
+
+//PACK STACK
+//Same as Fat_Stack but with Pack_Ptr heads so only 8 byte CAS is needed.
+// All slots have to lie below 2^48. On cpus with 57 bit virtual addresses (5 level paging)
+// both Linux and Windows still keep user space allocations below 2^47 unless a program
+// explicitly asks for more (mmap hint), which is why pack_stack_init probes instead of refusing outright.
+typedef struct Pack_Stack {
+    alignas(64)
+    CL_QUEUE_ATOMIC(Pack_Ptr) last_used;
+    alignas(64)
+    CL_QUEUE_ATOMIC(Pack_Ptr) first_free;
+    alignas(64)
+    Elim_Array* elim; //NULL unless pack_stack_enable_elimination
+} Pack_Stack;
+
+//Returns false if malloc gives us pointers which dont fit into a Pack_Ptr. 
+// The stack must not be used then.
+bool pack_stack_init(Pack_Stack* stack);
+//No other thread may use the stack anymore
+void pack_stack_deinit(Pack_Stack* stack);
+void pack_stack_push(Pack_Stack* stack, const void* item, isize item_size);
+bool pack_stack_pop(Pack_Stack* stack, void* item, isize item_size);
+//Puts an Elim_Array in front of the stack. Must be called before other threads use it.
+void pack_stack_enable_elimination(Pack_Stack* stack);
+//Same as fat_stack_pop_hazard
+bool pack_stack_pop_hazard(Pack_Stack* stack, Hazard_Domain* domain, Hazard_Thread* hazard, void* item, isize item_size);
+//Number of virtual address bits the cpu translates (48 or 57 on x64). Checked once.
+isize pack_stack_va_bits();
+//The check done by pack_stack_init. Anything keeping Pack_Ptr heads outside of a Pack_Stack
+// (like the Object_Pool depot) has to make it too.
+bool pack_stack_va_fits();
+
+CL_QUEUE_API isize _pack_stack_cpu_va_bits()
+{
+    #if defined(_MSC_VER) && defined(_M_X64)
+        int info[4] = {0};
+        __cpuid(info, 0x80000000);
+        if((unsigned) info[0] < 0x80000008)
+            return 48;
+        __cpuid(info, 0x80000008);
+        return (info[0] >> 8) & 0xFF;
+    #elif (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+        unsigned a = 0, b = 0, c = 0, d = 0;
+        if(__get_cpuid(0x80000008, &a, &b, &c, &d) == 0)
+            return 48;
+        return (a >> 8) & 0xFF;
+    #else
+        //arm64 without LVA (52 bit) which is what everyone ships
+        return 48;
+    #endif
+}
+
+isize pack_stack_va_bits()
+{
+    static CL_QUEUE_ATOMIC(isize) bits = 0;
+    isize curr = atomic_load_explicit(&bits, memory_order_relaxed);
+    if(curr == 0)
+    {
+        curr = _pack_stack_cpu_va_bits();
+        atomic_store_explicit(&bits, curr, memory_order_relaxed);
+    }
+    return curr;
+}
+
+bool pack_stack_init(Pack_Stack* stack)
+{
+    atomic_store(&stack->last_used, (Pack_Ptr) NULL);
+    atomic_store(&stack->first_free, (Pack_Ptr) NULL);
+    stack->elim = NULL;
+    return pack_stack_va_fits();
+}
+
+bool pack_stack_va_fits()
+{
+    if(pack_stack_va_bits() <= 48)
+        return true;
+
+    //57 bit cpu. See whether the OS actually hands out high addresses.
+    void* probe = malloc(sizeof(Fat_Stack_Slot));
+    bool fits = ((uint64_t) (uintptr_t) probe >> 48) == 0;
+    free(probe);
+    return fits;
+}
+
+void pack_stack_deinit(Pack_Stack* stack)
+{
+    for(Fat_Stack_Slot* slot; (slot = _pack_stack_pop(&stack->last_used)) != NULL; )
+        free(slot);
+    for(Fat_Stack_Slot* slot; (slot = _pack_stack_pop(&stack->first_free)) != NULL; )
+        free(slot);
+    free(stack->elim);
+    stack->elim = NULL;
+}
+
+void pack_stack_enable_elimination(Pack_Stack* stack)
+{
+    if(stack->elim == NULL)
+        stack->elim = elim_array_new();
+}
+
+//Slots are recycled through first_free the same way as in Fat_Stack
+void pack_stack_push(Pack_Stack* stack, const void* item, isize item_size)
+{
+    Fat_Stack_Slot* slot = _pack_stack_pop(&stack->first_free);
+    if(slot == NULL)
+    {
+        slot = (Fat_Stack_Slot*) malloc(sizeof(Fat_Stack_Slot) + (size_t) item_size);
+        ASSERT(((uint64_t) (uintptr_t) slot >> 48) == 0, "pointer does not fit into Pack_Ptr. Was pack_stack_init checked?");
+    }
+
+    memcpy(slot->data, item, (size_t) item_size);
+    if(stack->elim == NULL)
+    {
+        _pack_stack_push(&stack->last_used, slot);
+        return;
+    }
+
+    for(;;) {
+        if(_pack_stack_try_push(&stack->last_used, slot))
+            break;
+        if(_elim_try_push(stack->elim, item))
+        {
+            _pack_stack_push(&stack->first_free, slot);
+            break;
+        }
+    }
+}
+
+bool pack_stack_pop(Pack_Stack* stack, void* item, isize item_size)
+{
+    Fat_Stack_Slot* slot = NULL;
+    if(stack->elim == NULL)
+        slot = _pack_stack_pop(&stack->last_used);
+    else
+    {
+        for(;;) {
+            Sync_Stack_Try state = _pack_stack_try_pop(&stack->last_used, &slot);
+            if(state != SYNC_STACK_CONTENDED)
+                break;
+            if(_elim_try_pop(stack->elim, item, item_size))
+                return true;
+        }
+    }
+
+    if(slot == NULL)
+        return false;
+
+    memcpy(item, slot->data, (size_t) item_size);
+    _pack_stack_push(&stack->first_free, slot);
+    return true;
+}
+
+bool pack_stack_pop_hazard(Pack_Stack* stack, Hazard_Domain* domain, Hazard_Thread* hazard, void* item, isize item_size)
+{
+    Fat_Stack_Slot* slot = _pack_stack_pop_hazard(&stack->last_used, hazard);
+    if(slot == NULL)
+        return false;
+
+    memcpy(item, slot->data, (size_t) item_size);
+    hazard_retire(domain, hazard, slot, free);
+    return true;
+}
+
+//SYNC MUTEX
+//Tiny futex based mutex (Drepper: Futexes Are Tricky, mutex 2). Used where something rare like 
+// growing has to be done by a single thread and the others should sleep instead of burning the cpu 
+// for the duration of a malloc.
+//0 unlocked, 1 locked, 2 locked and someone might be sleeping
+CL_QUEUE_API void _sync_futex_wait(CL_QUEUE_ATOMIC(uint32_t)* state, uint32_t undesired);
+CL_QUEUE_API void _sync_futex_wake(CL_QUEUE_ATOMIC(uint32_t)* state);
+
+#if defined(_WIN32) || defined(_WIN64)
+    #include <Windows.h>
+    #pragma comment(lib, "Synchronization.lib")
+    CL_QUEUE_API void _sync_futex_wait(CL_QUEUE_ATOMIC(uint32_t)* state, uint32_t undesired)
+    {
+        WaitOnAddress((volatile void*) state, &undesired, sizeof undesired, INFINITE);
+    }
+
+    CL_QUEUE_API void _sync_futex_wake(CL_QUEUE_ATOMIC(uint32_t)* state)
+    {
+        WakeByAddressSingle((void*) state);
+    }
+#elif defined(__linux__)
+    #include <unistd.h>
+    #include <sys/syscall.h>
+    #include <linux/futex.h>
+    CL_QUEUE_API void _sync_futex_wait(CL_QUEUE_ATOMIC(uint32_t)* state, uint32_t undesired)
+    {
+        syscall(SYS_futex, (void*) state, FUTEX_WAIT_PRIVATE, undesired, NULL, NULL, 0);
+    }
+
+    CL_QUEUE_API void _sync_futex_wake(CL_QUEUE_ATOMIC(uint32_t)* state)
+    {
+        syscall(SYS_futex, (void*) state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+#else
+    //No sleeping. The lock just spins.
+    CL_QUEUE_API void _sync_futex_wait(CL_QUEUE_ATOMIC(uint32_t)* state, uint32_t undesired)
+    {
+        (void) state; (void) undesired;
+        _sync_pause();
+    }
+
+    CL_QUEUE_API void _sync_futex_wake(CL_QUEUE_ATOMIC(uint32_t)* state)
+    {
+        (void) state;
+    }
+#endif
+
+CL_QUEUE_API void _sync_mutex_lock(CL_QUEUE_ATOMIC(uint32_t)* mutex)
+{
+    //spin a little first since the critical sections are short
+    for(isize i = 0; i < 64; i++)
+    {
+        uint32_t expected = 0;
+        if(atomic_compare_exchange_weak_explicit(mutex, &expected, 1, memory_order_acquire, memory_order_relaxed))
+            return;
+        _sync_pause();
+    }
+
+    while(atomic_exchange_explicit(mutex, 2, memory_order_acquire) != 0)
+        _sync_futex_wait(mutex, 2);
+}
+
+CL_QUEUE_API void _sync_mutex_unlock(CL_QUEUE_ATOMIC(uint32_t)* mutex)
+{
+    if(atomic_exchange_explicit(mutex, 0, memory_order_release) == 2)
+        _sync_futex_wake(mutex);
+}
+
+//INDEX STACK
+//Treiber stack of slots inside an Index_Mem. The head is a 32 bit index and 32 bit generation 
+// in a single 64 bit word so only 8 byte CAS is needed and (unlike Pack_Stack) there are no 
+// assumptions about the address space. Slots are addressed by their index which never changes,
+// so index_stack_alloc/index_stack_free make it a lock free allocator of fixed size objects.
+//Limited to 2^32 - 1 slots.
+enum {
+    INDEX_STACK_BLOCK_SIZE = 256, //slots added at once when growing
+    INDEX_STACK_NULL = 0xFFFFFFFF,
+};
+
+typedef struct Index_Stack_Slot {
+    CL_QUEUE_ATOMIC(uint32_t) next;
+    uint32_t _; //keeps data 8 byte aligned
+    uint8_t data[];
+} Index_Stack_Slot;
+
+typedef struct Index_Stack_Allocation {
+    uint32_t index;
+    uint32_t _;
+    void* ptr; //NULL on failure
+} Index_Stack_Allocation;
+
+typedef struct Index_Stack {
+    alignas(64)
+    CL_QUEUE_ATOMIC(uint64_t) last_used; //index | generation << 32
+    alignas(64)
+    CL_QUEUE_ATOMIC(uint64_t) first_free;
+    alignas(64)
+    Index_Mem mem;
+    CL_QUEUE_ATOMIC(uint32_t) grow_lock; //sync mutex
+    uint32_t item_size;
+    uint32_t slot_size;
+    Elim_Array* elim; //NULL unless index_stack_enable_elimination
+} Index_Stack;
+
+void index_stack_init(Index_Stack* stack, isize item_size);
+//No other thread may use the stack anymore
+void index_stack_deinit(Index_Stack* stack);
+void index_stack_push(Index_Stack* stack, const void* item);
+bool index_stack_pop(Index_Stack* stack, void* item);
+//Puts an Elim_Array in front of push/pop (not alloc/free). Must be called before other threads use it.
+void index_stack_enable_elimination(Index_Stack* stack);
+
+//Allocator interface. The returned ptr points to item_size bytes which stay valid until deinit.
+// The allocation can be given back by index_stack_free (from any thread).
+Index_Stack_Allocation index_stack_alloc(Index_Stack* stack);
+void index_stack_free(Index_Stack* stack, uint32_t index);
+//Returns the data of an allocation given its index
+CL_QUEUE_API_INLINE void* index_stack_at(Index_Stack* stack, uint32_t index);
+
+CL_QUEUE_API_INLINE Index_Stack_Slot* _index_stack_slot(Index_Stack* stack, uint32_t index)
+{
+    return (Index_Stack_Slot*) index_mem_get(&stack->mem, index, INDEX_STACK_BLOCK_SIZE, stack->slot_size);
+}
+
+CL_QUEUE_API_INLINE void* index_stack_at(Index_Stack* stack, uint32_t index)
+{
+    return _index_stack_slot(stack, index)->data;
+}
+
+//Pushes the chain of slots first -> ... -> last
+CL_QUEUE_API_INLINE void _index_stack_push_chain(Index_Stack* stack, CL_QUEUE_ATOMIC(uint64_t)* last_ptr, uint32_t first, uint32_t last)
+{
+    Index_Stack_Slot* last_slot = _index_stack_slot(stack, last);
+    uint64_t head = atomic_load_explicit(last_ptr, memory_order_relaxed);
+    for(;;) {
+        atomic_store_explicit(&last_slot->next, (uint32_t) head, memory_order_relaxed);
+        uint64_t new_head = (head & 0xFFFFFFFF00000000) | first;
+        if(atomic_compare_exchange_weak_explicit(last_ptr, &head, new_head, memory_order_release, memory_order_relaxed))
+            break;
+    }
+}
+
+//Returns INDEX_STACK_NULL if empty
+CL_QUEUE_API_INLINE uint32_t _index_stack_pop(Index_Stack* stack, CL_QUEUE_ATOMIC(uint64_t)* last_ptr)
+{
+    uint64_t head = atomic_load_explicit(last_ptr, memory_order_acquire);
+    for(;;) {
+        uint32_t index = (uint32_t) head;
+        if(index == INDEX_STACK_NULL)
+            return INDEX_STACK_NULL;
+
+        //Like in _pack_stack_pop next can be garbage if the slot got reused. Then the generation changed.
+        // Reading it is always fine since slots are never freed.
+        uint32_t next = atomic_load_explicit(&_index_stack_slot(stack, index)->next, memory_order_relaxed);
+        uint64_t new_head = ((head >> 32) + 1) << 32 | next;
+        if(atomic_compare_exchange_weak_explicit(last_ptr, &head, new_head, memory_order_acquire, memory_order_acquire))
+            return index;
+    }
+}
+
+CL_QUEUE_API_INLINE bool _index_stack_try_push(Index_Stack* stack, CL_QUEUE_ATOMIC(uint64_t)* last_ptr, uint32_t index)
+{
+    uint64_t head = atomic_load_explicit(last_ptr, memory_order_relaxed);
+    atomic_store_explicit(&_index_stack_slot(stack, index)->next, (uint32_t) head, memory_order_relaxed);
+    uint64_t new_head = (head & 0xFFFFFFFF00000000) | index;
+    return atomic_compare_exchange_strong_explicit(last_ptr, &head, new_head, memory_order_release, memory_order_relaxed);
+}
+
+CL_QUEUE_API_INLINE Sync_Stack_Try _index_stack_try_pop(Index_Stack* stack, CL_QUEUE_ATOMIC(uint64_t)* last_ptr, uint32_t* popped)
+{
+    uint64_t head = atomic_load_explicit(last_ptr, memory_order_acquire);
+    uint32_t index = (uint32_t) head;
+    if(index == INDEX_STACK_NULL)
+        return SYNC_STACK_EMPTY;
+
+    uint32_t next = atomic_load_explicit(&_index_stack_slot(stack, index)->next, memory_order_relaxed);
+    uint64_t new_head = ((head >> 32) + 1) << 32 | next;
+    if(atomic_compare_exchange_strong_explicit(last_ptr, &head, new_head, memory_order_acquire, memory_order_relaxed) == false)
+        return SYNC_STACK_CONTENDED;
+
+    *popped = index;
+    return SYNC_STACK_OK;
+}
+
+void index_stack_init(Index_Stack* stack, isize item_size)
+{
+    memset(stack, 0, sizeof *stack);
+    stack->item_size = (uint32_t) item_size;
+    stack->slot_size = (uint32_t) ((sizeof(Index_Stack_Slot) + (size_t) item_size + 7)/8*8);
+    atomic_store(&stack->last_used, (uint64_t) INDEX_STACK_NULL);
+    atomic_store(&stack->first_free, (uint64_t) INDEX_STACK_NULL);
+}
+
+void index_stack_deinit(Index_Stack* stack)
+{
+    index_mem_unsafe_deinit(&stack->mem);
+    free(stack->elim);
+    memset(stack, 0, sizeof *stack);
+}
+
+void index_stack_enable_elimination(Index_Stack* stack)
+{
+    if(stack->elim == NULL)
+        stack->elim = elim_array_new();
+}
+
+CL_QUEUE_INLINE_NEVER
+CL_QUEUE_API uint32_t _index_stack_grow(Index_Stack* stack)
+{
+    _sync_mutex_lock(&stack->grow_lock);
+    
+    //someone might have grown (or freed something) while we were waiting for the lock
+    uint32_t index = _index_stack_pop(stack, &stack->first_free);
+    if(index == INDEX_STACK_NULL)
+    {
+        isize capacity = atomic_load_explicit(&stack->mem.capacity, memory_order_relaxed);
+        if(capacity + INDEX_STACK_BLOCK_SIZE < (isize) INDEX_STACK_NULL)
+        {
+            uint8_t* block = (uint8_t*) index_mem_unsafe_grow(&stack->mem, INDEX_STACK_BLOCK_SIZE, stack->slot_size);
+            for(isize i = 1; i < INDEX_STACK_BLOCK_SIZE - 1; i++)
+            {
+                Index_Stack_Slot* slot = (Index_Stack_Slot*) (void*) (block + i*stack->slot_size);
+                atomic_store_explicit(&slot->next, (uint32_t) (capacity + i + 1), memory_order_relaxed);
+            }
+
+            //keep the first for ourselves and publish the rest
+            index = (uint32_t) capacity;
+            _index_stack_push_chain(stack, &stack->first_free, (uint32_t) capacity + 1, (uint32_t) (capacity + INDEX_STACK_BLOCK_SIZE - 1));
+        }
+    }
+
+    _sync_mutex_unlock(&stack->grow_lock);
+    return index;
+}
+
+Index_Stack_Allocation index_stack_alloc(Index_Stack* stack)
+{
+    Index_Stack_Allocation out = {INDEX_STACK_NULL, 0, NULL};
+    uint32_t index = _index_stack_pop(stack, &stack->first_free);
+    if(index == INDEX_STACK_NULL)
+        index = _index_stack_grow(stack);
+
+    if(index != INDEX_STACK_NULL)
+    {
+        out.index = index;
+        out.ptr = index_stack_at(stack, index);
+    }
+    return out;
+}
+
+void index_stack_free(Index_Stack* stack, uint32_t index)
+{
+    _index_stack_push_chain(stack, &stack->first_free, index, index);
+}
+
+void index_stack_push(Index_Stack* stack, const void* item)
+{
+    Index_Stack_Allocation allocation = index_stack_alloc(stack);
+    ASSERT(allocation.ptr != NULL);
+    memcpy(allocation.ptr, item, stack->item_size);
+    if(stack->elim == NULL)
+    {
+        _index_stack_push_chain(stack, &stack->last_used, allocation.index, allocation.index);
+        return;
+    }
+
+    for(;;) {
+        if(_index_stack_try_push(stack, &stack->last_used, allocation.index))
+            break;
+        if(_elim_try_push(stack->elim, item))
+        {
+            index_stack_free(stack, allocation.index);
+            break;
+        }
+    }
+}
+
+bool index_stack_pop(Index_Stack* stack, void* item)
+{
+    uint32_t index = INDEX_STACK_NULL;
+    if(stack->elim == NULL)
+        index = _index_stack_pop(stack, &stack->last_used);
+    else
+    {
+        for(;;) {
+            Sync_Stack_Try state = _index_stack_try_pop(stack, &stack->last_used, &index);
+            if(state != SYNC_STACK_CONTENDED)
+                break;
+            if(_elim_try_pop(stack->elim, item, stack->item_size))
+                return true;
+        }
+    }
+
+    if(index == INDEX_STACK_NULL)
+        return false;
+
+    memcpy(item, index_stack_at(stack, index), stack->item_size);
+    index_stack_free(stack, index);
+    return true;
+}